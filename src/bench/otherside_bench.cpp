@@ -0,0 +1,763 @@
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include "types.h"
+
+#include "parser_definitions.h"
+#include "parser.h"
+#include "validation.h"
+#include "interpreted_vm.h"
+#include "optimizer.h"
+#include "dispatch.h"
+#include "thread_pool.h"
+#include "mipmap.h"
+#include "sampling.h"
+#include "pixel_conversion.h"
+#include "math_kernels.h"
+#include "utils.h"
+
+// Measures the stages of running the shaders in data/: parsing, validation,
+// VM setup, single threaded Run() throughput and dispatching images of
+// several sizes over several thread counts, as well as generating the mip
+// chain of the test texture, sampling large textures in each layout and
+// format, converting images between float and 8-bit pixels and the
+// GLSL.std.450 math kernels against libm, the cost of dispatching an
+// instruction in each dispatch mode of the interpreter and of calls.
+// Every measurement is printed as one CSV line, an "op" is a parse,
+// validation, setup, mip chain, sample, converted pixel, math function
+// evaluation, executed instruction, call or shader invocation.
+//
+// Has to run from the repository root (or with -d) so that the shaders,
+// the test texture and the extension libraries in ext/ are found.
+
+std::string USAGE = "[-d <data directory>] [-s <shader>] [-t <max thread count>] [-q]";
+
+// The layout benchmarks put the size of the texture into width and height.
+static const char* CSV_HEADER = "benchmark,shader,width,height,threads,lanes,layout,format,iterations,ns_per_op,ops_per_second";
+
+static const char* LAYOUT_NAMES[] = { "row", "tiled", "morton" };
+static const TextureLayout LAYOUTS[] = { TLRowMajor, TLTiled, TLMorton };
+static const char* FORMAT_NAMES[] = { "rgba32f", "rgba8", "srgb8", "rgba16f" };
+static const TextureFormat FORMATS[] = { TFRGBA32F, TFRGBA8, TFRGBA8SRGB, TFRGBA16F };
+
+struct BenchShader {
+  const char* Name;
+  const char* File;
+  // vec2 input set to the pixel position when dispatching, shaders without
+  // one are only run on a single VM.
+  const char* Coordinate;
+};
+
+// sampler.frag.spv is missing since it was compiled for an older SPIR-V
+// revision than the parser understands, complex.frag.spv because its main()
+// has no body and fails validation.
+static const BenchShader SHADERS[] = {
+  { "light", "light.frag.spv", "uv" },
+  { "Test_Loop", "Test_Loop.frag.spv", nullptr },
+};
+
+struct BenchArgs {
+  std::string DataDirectory = "data";
+  const char* Shader = nullptr;
+  uint32 MaxThreads = 0;
+  // Runs every measurement once on small images, to check that the
+  // benchmarks work rather than to get meaningful numbers.
+  bool Quick = false;
+};
+
+// Host values of every variable the shaders use. Variables are bound to a
+// pointer to the value, so each value has its pointer next to it.
+struct BenchInputs {
+  Texture Tex;
+  MipChain TexMips;
+  Sampler TexSampler;
+  Sampler* TexSamplerPtr;
+  Vec2 TexSize;
+  Vec2* TexSizePtr;
+  Light LightValue;
+  Light* LightPtr;
+  Vec2 Coordinate;
+  Vec2* CoordinatePtr;
+  int32 Iterations;
+  int32* IterationsPtr;
+  bool LoopFlag;
+  bool* LoopFlagPtr;
+  float Color3[3];
+  float* Color3Ptr;
+  Color FragColor;
+  Color* FragColorPtr;
+};
+
+struct Measurement {
+  uint64 Iterations;
+  double NsPerIteration;
+};
+
+bool ParseArgs(int argc, const char** argv, BenchArgs* args) {
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+
+    if (strcmp(arg, "-d") == 0) {
+      i++;
+      if (i == argc) {
+        return false;
+      }
+      args->DataDirectory = argv[i];
+    } else if (strcmp(arg, "-s") == 0) {
+      i++;
+      if (i == argc) {
+        return false;
+      }
+      args->Shader = argv[i];
+    } else if (strcmp(arg, "-t") == 0) {
+      i++;
+      if (i == argc) {
+        return false;
+      }
+      args->MaxThreads = atoi(argv[i]);
+    } else if (strcmp(arg, "-q") == 0) {
+      args->Quick = true;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Runs func in batches of growing size until a batch takes long enough to
+// time reliably.
+template<typename Func>
+static bool measure(const BenchArgs& args, Func func, Measurement* result) {
+  const double minNs = args.Quick ? 0 : 2e8;
+  uint64 batch = 1;
+
+  for (;;) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint64 i = 0; i < batch; i++) {
+      if (!func()) {
+        return false;
+      }
+    }
+    double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    if (ns >= minNs || args.Quick) {
+      result->Iterations = batch;
+      result->NsPerIteration = ns / batch;
+      return true;
+    }
+    batch *= ns > 0 && minNs / ns < 100 ? 2 : 10;
+  }
+}
+
+static void report(const char* benchmark, const char* shader, uint32 width, uint32 height, uint32 threads, uint32 lanes, const Measurement& m, uint64 opsPerIteration,
+                   TextureLayout layout = TLRowMajor, TextureFormat format = TFRGBA32F) {
+  double nsPerOp = m.NsPerIteration / opsPerIteration;
+  std::cout << benchmark << "," << shader << "," << width << "," << height << "," << threads << "," << lanes << ","
+            << LAYOUT_NAMES[layout] << "," << FORMAT_NAMES[format] << "," << m.Iterations << "," << std::fixed << std::setprecision(1) << nsPerOp << ","
+            << std::setprecision(0) << (nsPerOp > 0 ? 1e9 / nsPerOp : 0) << std::endl;
+}
+
+static bool readWords(const std::string& path, std::vector<uint32>* words) {
+  std::ifstream file(path, std::ifstream::in | std::ifstream::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+  file.seekg(0, std::ios::end);
+  std::streamsize size = file.tellg();
+  file.seekg(0, std::ios::beg);
+  words->resize((size_t)size / 4);
+  return size % 4 == 0 && file.read((char*)words->data(), size);
+}
+
+static bool parseWords(const std::vector<uint32>& words, Program* prog) {
+  Parser parser((int)words.size());
+  std::memcpy(parser.GetBufferPtr(), words.data(), words.size() * sizeof(uint32));
+  return parser.Parse(prog);
+}
+
+// Binds every variable the shader has, the rest are skipped.
+static bool bindInputs(InterpretedVM& vm, BenchInputs* in) {
+  vm.SetVariable("testTex", &in->TexSamplerPtr);
+  vm.SetVariable("texSize", &in->TexSizePtr);
+  vm.SetVariable("light", &in->LightPtr);
+  vm.SetVariable("uv", &in->CoordinatePtr);
+  vm.SetVariable("iterations", &in->IterationsPtr);
+  vm.SetVariable("loopFlag", &in->LoopFlagPtr);
+  vm.SetVariable("color", &in->Color3Ptr);
+  return vm.SetVariable("gl_FragColor", &in->FragColorPtr);
+}
+
+// Generates the mip chain of the test texture, which is then bound to its
+// sampler so that dispatching to images smaller than it samples the
+// matching level.
+static bool benchMipmaps(const BenchArgs& args, BenchInputs* inputs) {
+  ThreadPool pool(args.MaxThreads);
+  Measurement m;
+  if (!measure(args, [&]() { return inputs->TexMips.Generate(inputs->Tex, pool); }, &m)) {
+    std::cerr << "Could not generate mipmaps of testin.bmp" << std::endl;
+    return false;
+  }
+  report("mipmaps", "testin", inputs->Tex.width, inputs->Tex.height, pool.ThreadCount(), 0, m, 1);
+  inputs->TexMips.Bind(&inputs->TexSampler);
+  return true;
+}
+
+// A large texture stored in one of the layouts and formats, sampled
+// bilinearly without mip levels so that every sample reads the full
+// resolution texels.
+struct LayoutTexture {
+  Texture Tex;
+  std::vector<byte> Texels;
+  Sampler TexSampler;
+
+  LayoutTexture(uint32 size, TextureLayout layout, TextureFormat format = TFRGBA32F) {
+    Tex = MakeGradientTexture(size, size);
+    Texels.resize(getLayoutTexelCount(layout, 2, (uint32*)&Tex) * getTexelSize(format));
+    convertToLayout(layout, format, 2, (uint32*)&Tex, Tex.data, Texels.data());
+    TexSampler = Sampler{ 2, (uint32*)&Tex, Texels.data(), FilterMode::FMBilinear, WrapMode::WMRepeat, 0, nullptr, layout, format };
+  }
+
+  ~LayoutTexture() {
+    delete[] Tex.data;
+  }
+};
+
+// Keeps the compiler from dropping samples whose results are unused.
+static volatile float sampleSink;
+
+static std::vector<uint32> layoutTextureSizes(const BenchArgs& args) {
+  return args.Quick ? std::vector<uint32>{ 64 } : std::vector<uint32>{ 512, 2048 };
+}
+
+// Samples a texture directly, in the order the fragments of a 512x512 image
+// are dispatched (16x16 tiles), without the cost of running a shader.
+static bool benchSample(const BenchArgs& args, uint32 size, TextureLayout layout, TextureFormat format) {
+  const uint32 imageSize = args.Quick ? 16 : 512;
+  const uint32 tileSize = 16;
+
+  LayoutTexture texture(size, layout, format);
+  SamplerState state;
+  if (!prepareSampler(texture.TexSampler, &state)) {
+    std::cerr << "Could not prepare a " << LAYOUT_NAMES[layout] << " " << FORMAT_NAMES[format] << " sampler" << std::endl;
+    return false;
+  }
+
+  Color sum = { 0, 0, 0, 0 };
+  Measurement m;
+  measure(args, [&]() {
+    for (uint32 tileY = 0; tileY < imageSize; tileY += tileSize) {
+      for (uint32 tileX = 0; tileX < imageSize; tileX += tileSize) {
+        for (uint32 y = tileY; y < tileY + tileSize; y++) {
+          for (uint32 x = tileX; x < tileX + tileSize; x++) {
+            float coord[4] = { float(x) / imageSize, float(y) / imageSize, 0, 0 };
+            Color c;
+            sampleTexture(state, coord, 0, &c);
+            sum.r += c.r;
+          }
+        }
+      }
+    }
+    return true;
+  }, &m);
+  sampleSink = sum.r;
+  report("sample", "gradient", size, size, 1, 0, m, (uint64)imageSize * imageSize, layout, format);
+  return true;
+}
+
+static bool benchSampling(const BenchArgs& args) {
+  for (uint32 size : layoutTextureSizes(args)) {
+    for (TextureLayout layout : LAYOUTS) {
+      for (TextureFormat format : FORMATS) {
+        if (!benchSample(args, size, layout, format)) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// Converts a gradient between float and 8-bit pixels, the way images are
+// loaded and saved.
+static bool benchConversions(const BenchArgs& args) {
+  const uint32 size = args.Quick ? 64 : 2048;
+  ThreadPool pool(args.MaxThreads);
+  Texture tex = MakeGradientTexture(size, size, &pool);
+  std::vector<BColor> bytes(size * size);
+  Measurement m;
+
+  measure(args, [&]() { convertFloatToUnorm(tex.data, bytes.data(), size, size, &pool); return true; }, &m);
+  report("convert_float_to_unorm", "gradient", size, size, pool.ThreadCount(), 0, m, (uint64)size * size);
+  measure(args, [&]() { convertUnormToFloat(bytes.data(), tex.data, size, size, &pool); return true; }, &m);
+  report("convert_unorm_to_float", "gradient", size, size, pool.ThreadCount(), 0, m, (uint64)size * size);
+  measure(args, [&]() { convertLinearToSrgb(tex.data, bytes.data(), size, size, &pool); return true; }, &m);
+  report("convert_linear_to_srgb", "gradient", size, size, pool.ThreadCount(), 0, m, (uint64)size * size);
+  measure(args, [&]() { convertSrgbToLinear(bytes.data(), tex.data, size, size, &pool); return true; }, &m);
+  report("convert_srgb_to_linear", "gradient", size, size, pool.ThreadCount(), 0, m, (uint64)size * size);
+
+  delete[] tex.data;
+  return true;
+}
+
+// Times a loop calling libm and the kernel in both precisions, the shader
+// column holds the implementation.
+template<typename Libm, typename Kernel>
+static void benchMathFunction(const BenchArgs& args, const char* name, uint32 count, Libm libm, Kernel kernel) {
+  Measurement m;
+  measure(args, [&]() { libm(); return true; }, &m);
+  report(name, "libm", count, 1, 1, 0, m, count);
+  measure(args, [&]() { kernel(MPPrecise); return true; }, &m);
+  report(name, "precise", count, 1, 1, 0, m, count);
+  measure(args, [&]() { kernel(MPFast); return true; }, &m);
+  report(name, "fast", count, 1, 1, 0, m, count);
+}
+
+// The functions light.frag spends its time in (pow and distance) and a few
+// other common ones, over arrays of arguments. distance takes vec3s.
+static bool benchMath(const BenchArgs& args) {
+  const uint32 count = args.Quick ? 256 : 4096;
+  std::vector<float> x(count), y(count), a(3 * count), b(3 * count), out(count);
+  for (uint32 i = 0; i < count; i++) {
+    x[i] = 0.01f + 4.0f * i / count;
+    y[i] = -2.0f + 4.0f * i / count;
+  }
+  for (uint32 i = 0; i < 3 * count; i++) {
+    a[i] = (float)(i % 7) / 7;
+    b[i] = (float)(i % 5) / 5;
+  }
+
+  benchMathFunction(args, "math_pow", count,
+    [&]() { for (uint32 i = 0; i < count; i++) out[i] = std::pow(x[i], y[i]); },
+    [&](MathPrecision precision) { mathPow(precision, x.data(), y.data(), out.data(), count); });
+  benchMathFunction(args, "math_exp", count,
+    [&]() { for (uint32 i = 0; i < count; i++) out[i] = std::exp(y[i]); },
+    [&](MathPrecision precision) { mathExp(precision, y.data(), out.data(), count); });
+  benchMathFunction(args, "math_log", count,
+    [&]() { for (uint32 i = 0; i < count; i++) out[i] = std::log(x[i]); },
+    [&](MathPrecision precision) { mathLog(precision, x.data(), out.data(), count); });
+  benchMathFunction(args, "math_sin", count,
+    [&]() { for (uint32 i = 0; i < count; i++) out[i] = std::sin(y[i]); },
+    [&](MathPrecision precision) { mathSin(precision, y.data(), out.data(), count); });
+  benchMathFunction(args, "math_atan", count,
+    [&]() { for (uint32 i = 0; i < count; i++) out[i] = std::atan(y[i]); },
+    [&](MathPrecision precision) { mathAtan(precision, y.data(), out.data(), count); });
+  benchMathFunction(args, "math_distance", count,
+    [&]() {
+      for (uint32 i = 0; i < count; i++) {
+        float sum = 0;
+        for (uint32 c = 0; c < 3; c++) {
+          float d = a[3 * i + c] - b[3 * i + c];
+          sum += d * d;
+        }
+        out[i] = std::sqrt(sum);
+      }
+    },
+    [&](MathPrecision precision) { mathDistance(precision, a.data(), b.data(), 3, out.data(), count); });
+  return true;
+}
+
+static uint32 spirvOp(spv::Op code, uint32 wordCount) {
+  return (wordCount << spv::WordCountShift) | (uint32)code;
+}
+
+// Header of a fragment shader module with the entry point main, the id bound
+// is filled in once the module is complete.
+static std::vector<uint32> makeModuleHeader(uint32 mainId) {
+  const uint32 name = 0x6e69616d; // "main"
+  return {
+    spv::MagicNumber, spv::Version, 0, 0, 0,
+    spirvOp(spv::Op::OpMemoryModel, 3), (uint32)spv::AddressingModel::Logical, (uint32)spv::MemoryModel::GLSL450,
+    spirvOp(spv::Op::OpEntryPoint, 5), (uint32)spv::ExecutionModel::Fragment, mainId, name, 0,
+  };
+}
+
+// A module whose main() is a straight line of count loads of a local float,
+// each followed by an add of a constant if withAdds is set. Both pairs fuse,
+// so comparing the dispatch modes shows what dispatching an instruction costs.
+static std::vector<uint32> makeDispatchModule(uint32 count, bool withAdds) {
+  enum { Void = 1, FuncType, Float, FloatPtr, One, Main, Entry, Local, FirstResult };
+  std::vector<uint32> words = makeModuleHeader(Main);
+  words.insert(words.end(), {
+    spirvOp(spv::Op::OpTypeVoid, 2), Void,
+    spirvOp(spv::Op::OpTypeFunction, 3), FuncType, Void,
+    spirvOp(spv::Op::OpTypeFloat, 3), Float, 32,
+    spirvOp(spv::Op::OpTypePointer, 4), FloatPtr, (uint32)spv::StorageClass::Function, Float,
+    spirvOp(spv::Op::OpConstant, 4), Float, One, 0x3f800000,
+    spirvOp(spv::Op::OpFunction, 5), Void, Main, (uint32)spv::FunctionControlMask::MaskNone, FuncType,
+    spirvOp(spv::Op::OpLabel, 2), Entry,
+    spirvOp(spv::Op::OpVariable, 4), FloatPtr, Local, (uint32)spv::StorageClass::Function,
+    spirvOp(spv::Op::OpStore, 3), Local, One,
+  });
+
+  uint32 id = FirstResult;
+  for (uint32 i = 0; i < count; i++) {
+    uint32 loaded = id++;
+    words.insert(words.end(), { spirvOp(spv::Op::OpLoad, 4), Float, loaded, Local });
+    if (withAdds) {
+      words.insert(words.end(), { spirvOp(spv::Op::OpFAdd, 5), Float, id++, loaded, One });
+    }
+  }
+  words.insert(words.end(), { spirvOp(spv::Op::OpReturn, 1), spirvOp(spv::Op::OpFunctionEnd, 1) });
+  words[3] = id;
+  return words;
+}
+
+// Runs the modules above with switch and threaded dispatch, an op is one
+// executed instruction.
+static bool benchDispatchModes(const BenchArgs& args) {
+  const uint32 count = args.Quick ? 64 : 1024;
+  const char* names[] = { "loads", "load_fadd" };
+  const DispatchMode modes[] = { DMSwitch, DMThreaded };
+  const char* modeNames[] = { "dispatch_switch", "dispatch_threaded" };
+
+  for (uint32 adds = 0; adds < 2; adds++) {
+    Program prog;
+    if (!parseWords(makeDispatchModule(count, adds != 0), &prog)) {
+      std::cerr << "Could not parse the " << names[adds] << " module" << std::endl;
+      return false;
+    }
+
+    for (uint32 i = 0; i < 2; i++) {
+      Environment env;
+      InterpretedVM vm(prog, env);
+      vm.SetDispatchMode(modes[i]);
+      Measurement m;
+      if (!vm.Setup() || !measure(args, [&]() { return vm.Run(); }, &m)) {
+        std::cerr << "Could not run the " << names[adds] << " module" << std::endl;
+        return false;
+      }
+      report(modeNames[i], names[adds], 1, 1, 1, 0, m, (uint64)count * (adds + 1) + 3);
+    }
+  }
+  return true;
+}
+
+// A module whose main() makes count calls of outer(x), which returns
+// inner(inner(x)) with inner(x) = x + 1, starting at 1. The result is stored
+// to the Output variable "result".
+static std::vector<uint32> makeCallModule(uint32 count) {
+  enum {
+    Void = 1, MainType, Float, FloatFunc, ResultPtr, One, Result, Main, MainEntry,
+    Inner, InnerParam, InnerEntry, InnerSum, Outer, OuterParam, OuterEntry, OuterFirst, OuterSecond, FirstResult
+  };
+  const uint32 name[] = { 0x75736572, 0x0000746c }; // "result"
+  const uint32 output = (uint32)spv::StorageClass::Output;
+  const uint32 none = (uint32)spv::FunctionControlMask::MaskNone;
+
+  std::vector<uint32> words = makeModuleHeader(Main);
+  words.insert(words.end(), {
+    spirvOp(spv::Op::OpName, 4), Result, name[0], name[1],
+    spirvOp(spv::Op::OpTypeVoid, 2), Void,
+    spirvOp(spv::Op::OpTypeFunction, 3), MainType, Void,
+    spirvOp(spv::Op::OpTypeFloat, 3), Float, 32,
+    spirvOp(spv::Op::OpTypeFunction, 4), FloatFunc, Float, Float,
+    spirvOp(spv::Op::OpTypePointer, 4), ResultPtr, output, Float,
+    spirvOp(spv::Op::OpConstant, 4), Float, One, 0x3f800000,
+    spirvOp(spv::Op::OpVariable, 4), ResultPtr, Result, output,
+
+    spirvOp(spv::Op::OpFunction, 5), Float, Inner, none, FloatFunc,
+    spirvOp(spv::Op::OpFunctionParameter, 3), Float, InnerParam,
+    spirvOp(spv::Op::OpLabel, 2), InnerEntry,
+    spirvOp(spv::Op::OpFAdd, 5), Float, InnerSum, InnerParam, One,
+    spirvOp(spv::Op::OpReturnValue, 2), InnerSum,
+    spirvOp(spv::Op::OpFunctionEnd, 1),
+
+    spirvOp(spv::Op::OpFunction, 5), Float, Outer, none, FloatFunc,
+    spirvOp(spv::Op::OpFunctionParameter, 3), Float, OuterParam,
+    spirvOp(spv::Op::OpLabel, 2), OuterEntry,
+    spirvOp(spv::Op::OpFunctionCall, 5), Float, OuterFirst, Inner, OuterParam,
+    spirvOp(spv::Op::OpFunctionCall, 5), Float, OuterSecond, Inner, OuterFirst,
+    spirvOp(spv::Op::OpReturnValue, 2), OuterSecond,
+    spirvOp(spv::Op::OpFunctionEnd, 1),
+
+    spirvOp(spv::Op::OpFunction, 5), Void, Main, none, MainType,
+    spirvOp(spv::Op::OpLabel, 2), MainEntry,
+  });
+
+  uint32 id = FirstResult;
+  uint32 previous = One;
+  for (uint32 i = 0; i < count; i++) {
+    words.insert(words.end(), { spirvOp(spv::Op::OpFunctionCall, 5), Float, id, Outer, previous });
+    previous = id++;
+  }
+  words.insert(words.end(), {
+    spirvOp(spv::Op::OpStore, 3), Result, previous,
+    spirvOp(spv::Op::OpReturn, 1),
+    spirvOp(spv::Op::OpFunctionEnd, 1),
+  });
+  words[3] = id;
+  return words;
+}
+
+// Runs the module above with its calls made through the call stack and with
+// the functions inlined, an op is one call. Also checks the result since no
+// shader in data/ makes calls.
+static bool benchCalls(const BenchArgs& args) {
+  const uint32 count = args.Quick ? 16 : 256;
+  Program prog;
+  if (!parseWords(makeCallModule(count), &prog)) {
+    std::cerr << "Could not parse the call module" << std::endl;
+    return false;
+  }
+
+  const char* names[] = { "calls", "inlined" };
+  for (uint32 inlined = 0; inlined < 2; inlined++) {
+    std::shared_ptr<TypeLayoutTable> layouts(new TypeLayoutTable());
+    std::shared_ptr<DecodedProgram> decoded(new DecodedProgram());
+    if (!computeTypeLayouts(prog, layouts.get(), std::cerr) || !decode(prog, decoded.get(), std::cerr)) {
+      std::cerr << "Could not prepare the call module" << std::endl;
+      return false;
+    }
+    if (inlined) {
+      inlineFunctions(decoded.get());
+    }
+
+    PreparedModule prepared = { layouts, decoded };
+    Environment env;
+    InterpretedVM vm(prog, env, prepared);
+    Measurement m;
+    if (!vm.Setup() || !measure(args, [&]() { return vm.Run(); }, &m)) {
+      std::cerr << "Could not run the " << names[inlined] << " module" << std::endl;
+      return false;
+    }
+
+    float result = **(float**)vm.ReadVariable("result");
+    if (result != 1.0f + 2.0f * count) {
+      std::cerr << "The " << names[inlined] << " module returned " << result << " instead of " << 1.0f + 2.0f * count << std::endl;
+      return false;
+    }
+    report("call", names[inlined], 1, 1, 1, 0, m, (uint64)count * 3);
+  }
+  return true;
+}
+
+// Dispatches the shader with its texture replaced by large textures in
+// every layout. Shaders without a texture are skipped.
+static bool benchLayouts(const BenchArgs& args, const BenchShader& shader, InterpretedVM& vm, BenchInputs* inputs) {
+  const uint32 imageSize = args.Quick ? 16 : 512;
+  ThreadPool pool(args.MaxThreads);
+  std::vector<Color> output(imageSize * imageSize);
+
+  for (uint32 size : layoutTextureSizes(args)) {
+    for (TextureLayout layout : LAYOUTS) {
+      LayoutTexture texture(size, layout);
+      Sampler* samplerPtr = &texture.TexSampler;
+      if (!vm.SetVariable("testTex", &samplerPtr)) {
+        return true;
+      }
+
+      FragmentDispatch dispatch;
+      dispatch.Width = imageSize;
+      dispatch.Height = imageSize;
+      dispatch.CoordinateName = shader.Coordinate;
+      dispatch.OutputName = "gl_FragColor";
+      dispatch.Lanes = 8;
+
+      Measurement m;
+      if (!measure(args, [&]() { return dispatchFragments(vm, dispatch, pool, output.data()); }, &m)) {
+        std::cerr << "Could not dispatch " << shader.File << std::endl;
+        return false;
+      }
+      report("dispatch_layout", shader.Name, size, size, pool.ThreadCount(), 8, m, (uint64)imageSize * imageSize, layout);
+    }
+  }
+
+  vm.SetVariable("testTex", &inputs->TexSamplerPtr);
+  return true;
+}
+
+static bool benchShader(const BenchArgs& args, const BenchShader& shader, BenchInputs* inputs) {
+  std::vector<uint32> words;
+  if (!readWords(args.DataDirectory + "/" + shader.File, &words)) {
+    std::cerr << "Could not read " << shader.File << std::endl;
+    return false;
+  }
+
+  Measurement m;
+  if (!measure(args, [&]() { Program prog; return parseWords(words, &prog); }, &m)) {
+    std::cerr << "Could not parse " << shader.File << std::endl;
+    return false;
+  }
+  report("parse", shader.Name, 0, 0, 1, 0, m, 1);
+
+  Program prog;
+  parseWords(words, &prog);
+
+  // Validation messages are only printed if it fails.
+  std::ostream discard(nullptr);
+  if (!measure(args, [&]() { return validate(prog, discard); }, &m)) {
+    std::cerr << "Could not validate " << shader.File << std::endl;
+    validate(prog, std::cerr);
+    return false;
+  }
+  report("validate", shader.Name, 0, 0, 1, 0, m, 1);
+
+  if (!measure(args, [&]() { Environment env; InterpretedVM vm(prog, env); return vm.Setup(); }, &m)) {
+    std::cerr << "Could not set up " << shader.File << std::endl;
+    return false;
+  }
+  report("setup", shader.Name, 0, 0, 1, 0, m, 1);
+
+  Environment env;
+  InterpretedVM vm(prog, env);
+  if (!vm.Setup() || !bindInputs(vm, inputs)) {
+    std::cerr << "Could not bind the inputs of " << shader.File << std::endl;
+    return false;
+  }
+
+  if (!measure(args, [&]() { return vm.Run(); }, &m)) {
+    std::cerr << "Could not run " << shader.File << std::endl;
+    return false;
+  }
+  report("run", shader.Name, 1, 1, 1, 0, m, 1);
+
+  vm.SetDispatchMode(DMSwitch);
+  if (!measure(args, [&]() { return vm.Run(); }, &m)) {
+    std::cerr << "Could not run " << shader.File << " with switch dispatch" << std::endl;
+    return false;
+  }
+  report("run_switch", shader.Name, 1, 1, 1, 0, m, 1);
+  vm.SetDispatchMode(DMThreaded);
+
+  std::unique_ptr<InterpretedVM> profiled = vm.Fork();
+  profiled->SetProfiling(true);
+  if (!measure(args, [&]() { return profiled->Run(); }, &m)) {
+    std::cerr << "Could not run " << shader.File << " profiled" << std::endl;
+    return false;
+  }
+  report("run_profiled", shader.Name, 1, 1, 1, 0, m, 1);
+
+  // Specialized on a fork, so the dispatches below run the full program.
+  std::unique_ptr<InterpretedVM> specialized = vm.Fork();
+  if (!specialized->Specialize() || !measure(args, [&]() { return specialized->Run(); }, &m)) {
+    std::cerr << "Could not run " << shader.File << " specialized" << std::endl;
+    return false;
+  }
+  report("run_specialized", shader.Name, 1, 1, 1, 0, m, 1);
+
+  // Only the coordinate varies, so the prologue only runs in the first Run().
+  std::unique_ptr<InterpretedVM> hoisted = vm.Fork();
+  std::vector<std::string> perInvocation;
+  if (shader.Coordinate) {
+    perInvocation.push_back(shader.Coordinate);
+  }
+  if (!hoisted->Hoist(perInvocation) || !measure(args, [&]() { return hoisted->Run(); }, &m)) {
+    std::cerr << "Could not run " << shader.File << " hoisted" << std::endl;
+    return false;
+  }
+  report("run_hoisted", shader.Name, 1, 1, 1, 0, m, 1);
+
+  Program optimized;
+  parseWords(words, &optimized);
+  PassManager passes;
+  passes.AddDefaultPasses();
+  Environment optimizedEnv;
+  InterpretedVM optimizedVM(optimized, optimizedEnv);
+  if (!passes.Run(&optimized, std::cerr) || !optimizedVM.Setup() || !bindInputs(optimizedVM, inputs) ||
+      !measure(args, [&]() { return optimizedVM.Run(); }, &m)) {
+    std::cerr << "Could not run " << shader.File << " optimized" << std::endl;
+    return false;
+  }
+  report("run_optimized", shader.Name, 1, 1, 1, 0, m, 1);
+
+  if (!shader.Coordinate) {
+    return true;
+  }
+
+  std::vector<uint32> sizes = args.Quick ? std::vector<uint32>{ 16 } : std::vector<uint32>{ 64, 256, 512 };
+  std::vector<uint32> threadCounts;
+  for (uint32 t = 1; t < args.MaxThreads; t *= 2) {
+    threadCounts.push_back(t);
+  }
+  threadCounts.push_back(args.MaxThreads);
+  const uint32 lanes[] = { 0, 8 };
+
+  for (uint32 threads : threadCounts) {
+    ThreadPool pool(threads);
+    for (uint32 size : sizes) {
+      std::vector<Color> output(size * size);
+      for (uint32 l : lanes) {
+        FragmentDispatch dispatch;
+        dispatch.Width = size;
+        dispatch.Height = size;
+        dispatch.CoordinateName = shader.Coordinate;
+        dispatch.OutputName = "gl_FragColor";
+        dispatch.Lanes = l;
+
+        if (!measure(args, [&]() { return dispatchFragments(vm, dispatch, pool, output.data()); }, &m)) {
+          std::cerr << "Could not dispatch " << shader.File << std::endl;
+          return false;
+        }
+        report("dispatch", shader.Name, size, size, threads, l, m, (uint64)size * size);
+      }
+    }
+  }
+
+  return benchLayouts(args, shader, vm, inputs);
+}
+
+int main(int argc, const char** argv) {
+  BenchArgs args;
+  if (!ParseArgs(argc, argv, &args)) {
+    std::cerr << "Could not parse arguments. Usage: " << USAGE << std::endl;
+    return -1;
+  }
+
+  if (args.MaxThreads == 0) {
+    args.MaxThreads = args.Quick ? 2 : std::thread::hardware_concurrency();
+  }
+  if (args.MaxThreads == 0) {
+    args.MaxThreads = 1;
+  }
+
+  BenchInputs inputs;
+  inputs.Tex = load_tex((args.DataDirectory + "/testin.bmp").c_str());
+  inputs.TexSampler = Sampler{ 2, (uint32*)&inputs.Tex, inputs.Tex.data, FilterMode::FMPoint, WrapMode::WMRepeat };
+  inputs.TexSamplerPtr = &inputs.TexSampler;
+  inputs.TexSize = Vec2{ (float)inputs.Tex.width, (float)inputs.Tex.height };
+  inputs.TexSizePtr = &inputs.TexSize;
+  inputs.LightValue = Light{ { 1, 0, 0, 1 }, { 0.5f, 0.5f } };
+  inputs.LightPtr = &inputs.LightValue;
+  inputs.Coordinate = Vec2{ 0.5f, 0.5f };
+  inputs.CoordinatePtr = &inputs.Coordinate;
+  inputs.Iterations = 16;
+  inputs.IterationsPtr = &inputs.Iterations;
+  inputs.LoopFlag = true;
+  inputs.LoopFlagPtr = &inputs.LoopFlag;
+  inputs.Color3[0] = 0.1f;
+  inputs.Color3[1] = 0.2f;
+  inputs.Color3[2] = 0.3f;
+  inputs.Color3Ptr = inputs.Color3;
+  inputs.FragColor = Color{ 0, 0, 0, 0 };
+  inputs.FragColorPtr = &inputs.FragColor;
+
+  std::cout << CSV_HEADER << std::endl;
+
+  if (!benchMipmaps(args, &inputs) || !benchSampling(args) || !benchConversions(args) || !benchMath(args) || !benchDispatchModes(args) || !benchCalls(args)) {
+    return -1;
+  }
+
+  bool found = false;
+  for (auto& shader : SHADERS) {
+    if (args.Shader && strcmp(args.Shader, shader.Name) != 0) {
+      continue;
+    }
+    found = true;
+    if (!benchShader(args, shader, &inputs)) {
+      return -1;
+    }
+  }
+
+  if (!found) {
+    std::cerr << "Unknown shader " << args.Shader << std::endl;
+    return -1;
+  }
+  return 0;
+}
@@ -1,6 +1,241 @@
 #include "vm.h"
+#include "math_kernels.h"
+#include "pixel_conversion.h"
 #include <assert.h>
 #include <math.h>
+#include <algorithm>
+
+// Helpers for the functions below. Scalars and vectors of 32 bit components
+// are stored contiguously, so whole vectors are handed to the math kernels.
+// The batched functions get one block of lanes per component instead and
+// hand those to the kernels.
+namespace {
+
+  uint32 componentCount(VM* vm, uint32 typeId) {
+    return vm->IsVectorType(typeId) ? vm->ElementCount(typeId) : 1;
+  }
+
+  // Component i of val, a scalar stands for every component.
+  template<typename T>
+  T component(VM* vm, Value val, uint32 i) {
+    return ((T*)val.Memory)[vm->IsVectorType(val.TypeId) ? i : 0];
+  }
+
+  template<typename T, typename Func>
+  Value map(VM* vm, uint32 resultTypeId, Func func, Value a) {
+    Value result = vm->VmInit(resultTypeId, nullptr);
+    uint32 count = componentCount(vm, resultTypeId);
+    for (uint32 i = 0; i < count; i++) {
+      ((T*)result.Memory)[i] = func(component<T>(vm, a, i));
+    }
+    return result;
+  }
+
+  template<typename T, typename Func>
+  Value map(VM* vm, uint32 resultTypeId, Func func, Value a, Value b) {
+    Value result = vm->VmInit(resultTypeId, nullptr);
+    uint32 count = componentCount(vm, resultTypeId);
+    for (uint32 i = 0; i < count; i++) {
+      ((T*)result.Memory)[i] = func(component<T>(vm, a, i), component<T>(vm, b, i));
+    }
+    return result;
+  }
+
+  template<typename T, typename Func>
+  Value map(VM* vm, uint32 resultTypeId, Func func, Value a, Value b, Value c) {
+    Value result = vm->VmInit(resultTypeId, nullptr);
+    uint32 count = componentCount(vm, resultTypeId);
+    for (uint32 i = 0; i < count; i++) {
+      ((T*)result.Memory)[i] = func(component<T>(vm, a, i), component<T>(vm, b, i), component<T>(vm, c, i));
+    }
+    return result;
+  }
+
+  typedef void MathFunc(MathPrecision precision, const float* x, float* out, uint32 count);
+  typedef void MathFunc2(MathPrecision precision, const float* x, const float* y, float* out, uint32 count);
+
+  Value math(VM* vm, uint32 resultTypeId, MathFunc* func, Value x) {
+    Value result = vm->VmInit(resultTypeId, nullptr);
+    func(vm->GetMathPrecision(), (const float*)x.Memory, (float*)result.Memory, componentCount(vm, resultTypeId));
+    return result;
+  }
+
+  // A scalar y is used for every component of x.
+  Value math(VM* vm, uint32 resultTypeId, MathFunc2* func, Value x, Value y) {
+    Value result = vm->VmInit(resultTypeId, nullptr);
+    uint32 count = componentCount(vm, resultTypeId);
+    const float* ys = (const float*)y.Memory;
+    float broadcast[4];
+    if (count > 1 && !vm->IsVectorType(y.TypeId) && count <= 4) {
+      for (uint32 i = 0; i < count; i++) {
+        broadcast[i] = *ys;
+      }
+      ys = broadcast;
+    }
+    func(vm->GetMathPrecision(), (const float*)x.Memory, ys, (float*)result.Memory, count);
+    return result;
+  }
+
+  float dot(VM* vm, Value a, Value b) {
+    uint32 count = componentCount(vm, a.TypeId);
+    float sum = 0;
+    for (uint32 i = 0; i < count; i++) {
+      sum += ((float*)a.Memory)[i] * ((float*)b.Memory)[i];
+    }
+    return sum;
+  }
+
+  // Square float matrices, columns stored back to back. The size is derived
+  // from the byte size of the type.
+  uint32 matrixSize(VM* vm, uint32 typeId) {
+    uint32 elements = vm->GetTypeByteSize(typeId) / sizeof(float);
+    for (uint32 n = 2; n <= 4; n++) {
+      if (n * n == elements) {
+        return n;
+      }
+    }
+    return 0;
+  }
+
+  // Determinant of the n x n matrix in m with rows and columns given by the
+  // bit masks, expanded along the first remaining column.
+  float minorDeterminant(const float* m, uint32 n, uint32 rows, uint32 columns) {
+    uint32 column = 0;
+    while (!(columns & (1 << column))) {
+      column++;
+    }
+    columns &= ~(1 << column);
+    if (!columns) {
+      uint32 row = 0;
+      while (!(rows & (1 << row))) {
+        row++;
+      }
+      return m[column * n + row];
+    }
+
+    float det = 0;
+    float sign = 1;
+    for (uint32 row = 0; row < n; row++) {
+      if (rows & (1 << row)) {
+        det += sign * m[column * n + row] * minorDeterminant(m, n, rows & ~(1 << row), columns);
+        sign = -sign;
+      }
+    }
+    return det;
+  }
+
+  template<typename T>
+  T clampValue(T v, T min, T max) {
+    return v < min ? min : v > max ? max : v;
+  }
+
+  uint32 packComponents(VM* vm, Value v, uint32 count, uint32 bits, float scale, float min) {
+    uint32 result = 0;
+    for (uint32 i = 0; i < count; i++) {
+      int32 c = (int32)roundf(clampValue(component<float>(vm, v, i), min, 1.0f) * scale);
+      result |= ((uint32)c & ((1u << bits) - 1)) << (i * bits);
+    }
+    return result;
+  }
+
+  Value unpackComponents(VM* vm, uint32 resultTypeId, uint32 packed, uint32 count, uint32 bits, float scale, bool isSigned) {
+    Value result = vm->VmInit(resultTypeId, nullptr);
+    for (uint32 i = 0; i < count; i++) {
+      uint32 c = (packed >> (i * bits)) & ((1u << bits) - 1);
+      float f;
+      if (isSigned) {
+        // Sign extends the component.
+        int32 s = (int32)(c << (32 - bits)) >> (32 - bits);
+        f = clampValue(s / scale, -1.0f, 1.0f);
+      } else {
+        f = c / scale;
+      }
+      ((float*)result.Memory)[i] = f;
+    }
+    return result;
+  }
+
+  int32 findLsb(uint32 v) {
+    if (!v) {
+      return -1;
+    }
+    int32 bit = 0;
+    while (!(v & 1)) {
+      v >>= 1;
+      bit++;
+    }
+    return bit;
+  }
+
+  int32 findMsb(uint32 v) {
+    int32 bit = -1;
+    while (v) {
+      v >>= 1;
+      bit++;
+    }
+    return bit;
+  }
+
+
+  // Lanes of component c of a batched operand, a scalar operand stands for
+  // every component.
+  const float* lanes(const ExtLanes& v, uint32 c, uint32 count) {
+    return (const float*)v.Lanes + (v.Components > 1 ? c * count : 0);
+  }
+
+  float* resultLanes(ExtLanes* result, uint32 c, uint32 count) {
+    return (float*)result->Lanes + c * count;
+  }
+
+  template<typename Func>
+  void mapLanes(uint32 count, ExtLanes* result, Func func, const ExtLanes& a) {
+    for (uint32 c = 0; c < result->Components; c++) {
+      const float* x = lanes(a, c, count);
+      float* out = resultLanes(result, c, count);
+      for (uint32 l = 0; l < count; l++) {
+        out[l] = func(x[l]);
+      }
+    }
+  }
+
+  template<typename Func>
+  void mapLanes(uint32 count, ExtLanes* result, Func func, const ExtLanes& a, const ExtLanes& b) {
+    for (uint32 c = 0; c < result->Components; c++) {
+      const float* x = lanes(a, c, count);
+      const float* y = lanes(b, c, count);
+      float* out = resultLanes(result, c, count);
+      for (uint32 l = 0; l < count; l++) {
+        out[l] = func(x[l], y[l]);
+      }
+    }
+  }
+
+  template<typename Func>
+  void mapLanes(uint32 count, ExtLanes* result, Func func, const ExtLanes& a, const ExtLanes& b, const ExtLanes& c) {
+    for (uint32 i = 0; i < result->Components; i++) {
+      const float* x = lanes(a, i, count);
+      const float* y = lanes(b, i, count);
+      const float* z = lanes(c, i, count);
+      float* out = resultLanes(result, i, count);
+      for (uint32 l = 0; l < count; l++) {
+        out[l] = func(x[l], y[l], z[l]);
+      }
+    }
+  }
+
+  // One kernel call per component covers all invocations.
+  void mathLanes(VM* vm, uint32 count, ExtLanes* result, MathFunc* func, const ExtLanes& x) {
+    for (uint32 c = 0; c < result->Components; c++) {
+      func(vm->GetMathPrecision(), lanes(x, c, count), resultLanes(result, c, count), count);
+    }
+  }
+
+  void mathLanes(VM* vm, uint32 count, ExtLanes* result, MathFunc2* func, const ExtLanes& x, const ExtLanes& y) {
+    for (uint32 c = 0; c < result->Components; c++) {
+      func(vm->GetMathPrecision(), lanes(x, c, count), lanes(y, c, count), resultLanes(result, c, count), count);
+    }
+  }
+}
 
 #ifdef __cplusplus
 extern "C" {
@@ -21,11 +256,11 @@ extern "C" {
 
   #define ONE_ARG_OP_F(func) ONE_ARG_OP(func, float)
   #define TWO_ARG_OP_F(func) TWO_ARG_OP(func, float)
-  #define THREE_ARG_OP_F(func) TWO_ARG_OP(func, float)
+  #define THREE_ARG_OP_F(func) THREE_ARG_OP(func, float)
   
   #define ONE_ARG_OP_S(func) ONE_ARG_OP(func, int)
   #define TWO_ARG_OP_S(func) TWO_ARG_OP(func, int)
-  #define THREE_ARG_OP_S(func) TWO_ARG_OP(func, int)
+  #define THREE_ARG_OP_S(func) THREE_ARG_OP(func, int)
   
   #define THREE_ARG_OP_D(func) \
     assert(valueCount == 3); \
@@ -36,7 +271,8 @@ extern "C" {
   };
 
   EXT_INST_FUNC(roundEven_ext) {
-    return values[0];
+    assert(valueCount == 1);
+    return map<float>(vm, resultTypeId, [](float f) { return nearbyintf(f); }, values[0]);
   };
 
   EXT_INST_FUNC(trunc_ext) {
@@ -52,11 +288,11 @@ extern "C" {
   };
 
   EXT_INST_FUNC(fsign_ext) {
-    ONE_ARG_OP_F([](float f) { return signbit(f) ? 0 : 1;})
+    ONE_ARG_OP_F([](float f) { return f > 0 ? 1.0f : f < 0 ? -1.0f : 0.0f; })
   };
 
   EXT_INST_FUNC(ssign_ext) {
-    ONE_ARG_OP_S([](int s) { return s < 0 ? 0 : 1;})
+    ONE_ARG_OP_S([](int s) { return s > 0 ? 1 : s < 0 ? -1 : 0; })
   };
 
   EXT_INST_FUNC(floor_ext) {
@@ -68,181 +304,428 @@ extern "C" {
   };
 
   EXT_INST_FUNC(fract_ext) {
-    return values[0];
+    ONE_ARG_OP_F([](float f) { return f - floorf(f); })
   };
 
   EXT_INST_FUNC(radians_ext) {
-    return values[0];
+    ONE_ARG_OP_F([](float f) { return f * 0.01745329251994329577f; })
   };
 
   EXT_INST_FUNC(degrees_ext) {
-    return values[0];
+    ONE_ARG_OP_F([](float f) { return f * 57.2957795130823208768f; })
   };
 
-  EXT_INST_FUNC(sin_ext) {
-    ONE_ARG_OP_F(sinf);
-  };
+  EXT_INST_FUNC(sin_ext) { return math(vm, resultTypeId, mathSin, values[0]); }
+  EXT_INST_FUNC(cos_ext) { return math(vm, resultTypeId, mathCos, values[0]); }
+  EXT_INST_FUNC(tan_ext) { return math(vm, resultTypeId, mathTan, values[0]); }
+  EXT_INST_FUNC(asin_ext) { return math(vm, resultTypeId, mathAsin, values[0]); }
+  EXT_INST_FUNC(acos_ext) { return math(vm, resultTypeId, mathAcos, values[0]); }
+  EXT_INST_FUNC(atan_ext) { return math(vm, resultTypeId, mathAtan, values[0]); }
+  EXT_INST_FUNC(sinh_ext) { return math(vm, resultTypeId, mathSinh, values[0]); }
+  EXT_INST_FUNC(cosh_ext) { return math(vm, resultTypeId, mathCosh, values[0]); }
+  EXT_INST_FUNC(tanh_ext) { return math(vm, resultTypeId, mathTanh, values[0]); }
+  EXT_INST_FUNC(asinh_ext) { return math(vm, resultTypeId, mathAsinh, values[0]); }
+  EXT_INST_FUNC(acosh_ext) { return math(vm, resultTypeId, mathAcosh, values[0]); }
+  EXT_INST_FUNC(atanh_ext) { return math(vm, resultTypeId, mathAtanh, values[0]); }
+
+  EXT_INST_FUNC(atan2_ext) {
+    assert(valueCount == 2);
+    return math(vm, resultTypeId, mathAtan2, values[0], values[1]);
+  }
 
-  EXT_INST_FUNC(cos_ext) {
-    ONE_ARG_OP_F(cosf);
-  };
+  EXT_INST_FUNC(pow_ext) {
+    assert(valueCount == 2);
+    return math(vm, resultTypeId, mathPow, values[0], values[1]);
+  }
 
-  EXT_INST_FUNC(tan_ext) {
-    ONE_ARG_OP_F(tanf);
-  };
+  EXT_INST_FUNC(exp_ext) { return math(vm, resultTypeId, mathExp, values[0]); }
+  EXT_INST_FUNC(log_ext) { return math(vm, resultTypeId, mathLog, values[0]); }
+  EXT_INST_FUNC(exp2_ext) { return math(vm, resultTypeId, mathExp2, values[0]); }
+  EXT_INST_FUNC(log2_ext) { return math(vm, resultTypeId, mathLog2, values[0]); }
 
-  EXT_INST_FUNC(asin_ext) {
-    ONE_ARG_OP_F(asinf);
-  };
+  EXT_INST_FUNC(sqrt_ext) {
+    assert(valueCount == 1);
+    Value result = vm->VmInit(resultTypeId, nullptr);
+    mathSqrt((const float*)values[0].Memory, (float*)result.Memory, componentCount(vm, resultTypeId));
+    return result;
+  }
 
-  EXT_INST_FUNC(acos_ext) {
-    ONE_ARG_OP_F(acosf);
-  };
+  EXT_INST_FUNC(inverseSqrt_ext) { return math(vm, resultTypeId, mathInverseSqrt, values[0]); }
 
-  EXT_INST_FUNC(atan_ext) {
-    ONE_ARG_OP_F(atanf);
-  };
+  EXT_INST_FUNC(determinant_ext) {
+    assert(valueCount == 1);
+    uint32 n = matrixSize(vm, values[0].TypeId);
+    float det = n ? minorDeterminant((const float*)values[0].Memory, n, (1 << n) - 1, (1 << n) - 1) : 0;
+    return vm->VmInit(resultTypeId, &det);
+  }
+
+  EXT_INST_FUNC(matrixInverse_ext) {
+    assert(valueCount == 1);
+    Value result = vm->VmInit(resultTypeId, nullptr);
+    uint32 n = matrixSize(vm, resultTypeId);
+    if (!n) {
+      return result;
+    }
+
+    // Adjugate divided by the determinant.
+    const float* m = (const float*)values[0].Memory;
+    uint32 all = (1 << n) - 1;
+    float invDet = 1.0f / minorDeterminant(m, n, all, all);
+    for (uint32 column = 0; column < n; column++) {
+      for (uint32 row = 0; row < n; row++) {
+        float sign = (row + column) % 2 ? -1.0f : 1.0f;
+        float cofactor = sign * minorDeterminant(m, n, all & ~(1 << column), all & ~(1 << row));
+        ((float*)result.Memory)[column * n + row] = cofactor * invDet;
+      }
+    }
+    return result;
+  }
+
+  // The whole number part is written through the second operand, which
+  // refers to the variable.
+  EXT_INST_FUNC(modf_ext) {
+    assert(valueCount == 2);
+    Value whole = values[1];
+    uint32 count = componentCount(vm, resultTypeId);
+    Value result = vm->VmInit(resultTypeId, nullptr);
+    for (uint32 i = 0; i < count; i++) {
+      float x = component<float>(vm, values[0], i);
+      ((float*)whole.Memory)[i] = truncf(x);
+      ((float*)result.Memory)[i] = x - truncf(x);
+    }
+    return result;
+  }
 
-  EXT_INST_FUNC(sinh_ext) {
-    ONE_ARG_OP_F(sinhf);
+  EXT_INST_FUNC(modf_struct_ext) {
+    assert(valueCount == 1);
+    Value result = vm->VmInit(resultTypeId, nullptr);
+    Value fraction = vm->IndexMemberValue(result, 0);
+    Value whole = vm->IndexMemberValue(result, 1);
+    uint32 count = componentCount(vm, fraction.TypeId);
+    for (uint32 i = 0; i < count; i++) {
+      float x = component<float>(vm, values[0], i);
+      ((float*)whole.Memory)[i] = truncf(x);
+      ((float*)fraction.Memory)[i] = x - truncf(x);
+    }
+    return result;
   }
 
-  EXT_INST_FUNC(cosh_ext) {
-    ONE_ARG_OP_F(coshf);
+  EXT_INST_FUNC(fmin_ext) { TWO_ARG_OP_F(fminf); }
+  EXT_INST_FUNC(umin_ext) { TWO_ARG_OP(std::min<uint32>, uint32); }
+  EXT_INST_FUNC(smin_ext) { TWO_ARG_OP(std::min<int32>, int32); }
+
+  EXT_INST_FUNC(fmax_ext) { TWO_ARG_OP_F(fmaxf); }
+  EXT_INST_FUNC(umax_ext) { TWO_ARG_OP(std::max<uint32>, uint32); }
+  EXT_INST_FUNC(smax_ext) { TWO_ARG_OP(std::max<int32>, int32); }
+
+  EXT_INST_FUNC(fclamp_ext) { THREE_ARG_OP_D(Clamp<float>); }
+  EXT_INST_FUNC(uclamp_ext) { THREE_ARG_OP_D(Clamp<unsigned int>); }
+  EXT_INST_FUNC(sclamp_ext) { THREE_ARG_OP_D(Clamp<int>); }
+
+  EXT_INST_FUNC(mix_ext) {
+    assert(valueCount == 3);
+    return map<float>(vm, resultTypeId, [](float x, float y, float a) { return x * (1 - a) + y * a; }, values[0], values[1], values[2]);
   }
 
-  EXT_INST_FUNC(tanh_ext) {
-    ONE_ARG_OP_F(tanhf);
+  EXT_INST_FUNC(step_ext) {
+    assert(valueCount == 2);
+    return map<float>(vm, resultTypeId, [](float edge, float x) { return x < edge ? 0.0f : 1.0f; }, values[0], values[1]);
   }
-  
-  EXT_INST_FUNC(asinh_ext) {
-    ONE_ARG_OP_F(asinhf);
+
+  EXT_INST_FUNC(smoothStep_ext) {
+    assert(valueCount == 3);
+    return map<float>(vm, resultTypeId, [](float edge0, float edge1, float x) {
+      float t = clampValue((x - edge0) / (edge1 - edge0), 0.0f, 1.0f);
+      return t * t * (3 - 2 * t);
+    }, values[0], values[1], values[2]);
   }
-  
-  EXT_INST_FUNC(acosh_ext) {
-    ONE_ARG_OP_F(acoshf);
+
+  EXT_INST_FUNC(floatBitsToInt_ext) { return vm->VmInit(resultTypeId, values[0].Memory); }
+  EXT_INST_FUNC(floatBitsToUint_ext) { return vm->VmInit(resultTypeId, values[0].Memory); }
+  EXT_INST_FUNC(intBitsToFloat_ext) { return vm->VmInit(resultTypeId, values[0].Memory); }
+  EXT_INST_FUNC(uintBitsToFloat_ext) { return vm->VmInit(resultTypeId, values[0].Memory); }
+
+  EXT_INST_FUNC(fma_ext) {
+    assert(valueCount == 3);
+    return map<float>(vm, resultTypeId, [](float a, float b, float c) { return fmaf(a, b, c); }, values[0], values[1], values[2]);
   }
 
-  EXT_INST_FUNC(atanh_ext) {
-    ONE_ARG_OP_F(atanhf);
+  // Like modf the exponent is written through the second operand.
+  EXT_INST_FUNC(frexp_ext) {
+    assert(valueCount == 2);
+    uint32 count = componentCount(vm, resultTypeId);
+    Value result = vm->VmInit(resultTypeId, nullptr);
+    for (uint32 i = 0; i < count; i++) {
+      int exponent;
+      ((float*)result.Memory)[i] = frexpf(component<float>(vm, values[0], i), &exponent);
+      ((int32*)values[1].Memory)[i] = exponent;
+    }
+    return result;
   }
 
-  EXT_INST_FUNC(atan2_ext) { 
-    TWO_ARG_OP_F(atan2f); 
+  EXT_INST_FUNC(frexp_struct_ext) {
+    assert(valueCount == 1);
+    Value result = vm->VmInit(resultTypeId, nullptr);
+    Value significand = vm->IndexMemberValue(result, 0);
+    Value exponents = vm->IndexMemberValue(result, 1);
+    uint32 count = componentCount(vm, significand.TypeId);
+    for (uint32 i = 0; i < count; i++) {
+      int exponent;
+      ((float*)significand.Memory)[i] = frexpf(component<float>(vm, values[0], i), &exponent);
+      ((int32*)exponents.Memory)[i] = exponent;
+    }
+    return result;
   }
 
-  EXT_INST_FUNC(pow_ext) { 
+  EXT_INST_FUNC(ldexp_ext) {
     assert(valueCount == 2);
-    Value toPow = values[0];
-    Value power = values[1];
-
-    if (vm->IsVectorType(power.TypeId)) {
-      return vm->DoOp(resultTypeId,
-        [](Value op1, Value op2) { return powf(*(float*)op1.Memory, *(float*)op2.Memory); },
-        toPow, power);
-    } else {
-      return vm->DoOp(resultTypeId,
-        [power](Value op1) { return powf(*(float*)op1.Memory, *(float*)power.Memory); },
-        toPow);
+    uint32 count = componentCount(vm, resultTypeId);
+    Value result = vm->VmInit(resultTypeId, nullptr);
+    for (uint32 i = 0; i < count; i++) {
+      ((float*)result.Memory)[i] = ldexpf(component<float>(vm, values[0], i), component<int32>(vm, values[1], i));
     }
+    return result;
+  }
+
+  EXT_INST_FUNC(packSnorm4x8_ext) {
+    uint32 packed = packComponents(vm, values[0], 4, 8, 127.0f, -1.0f);
+    return vm->VmInit(resultTypeId, &packed);
   }
 
-  EXT_INST_FUNC(exp_ext) { ONE_ARG_OP_F(expf); }
-  EXT_INST_FUNC(log_ext) { ONE_ARG_OP_F(logf); }
-  EXT_INST_FUNC(exp2_ext) { ONE_ARG_OP_F(exp2f); }
-  EXT_INST_FUNC(log2_ext) { ONE_ARG_OP_F(log2f); }
-  EXT_INST_FUNC(sqrt_ext) { ONE_ARG_OP_F(sqrtf); }
-  EXT_INST_FUNC(inverseSqrt_ext) { ONE_ARG_OP_F([](float f) {return 1.0f / sqrtf(f);}) }
+  EXT_INST_FUNC(packUnorm4x8_ext) {
+    uint32 packed = packComponents(vm, values[0], 4, 8, 255.0f, 0.0f);
+    return vm->VmInit(resultTypeId, &packed);
+  }
 
-  EXT_INST_FUNC(determinant_ext) { return values [0]; }
-  EXT_INST_FUNC(matrixInverse_ext) { return values [0]; }
+  EXT_INST_FUNC(packSnorm2x16_ext) {
+    uint32 packed = packComponents(vm, values[0], 2, 16, 32767.0f, -1.0f);
+    return vm->VmInit(resultTypeId, &packed);
+  }
 
-  EXT_INST_FUNC(modf_ext) { TWO_ARG_OP_F(fmodf); }
+  EXT_INST_FUNC(packUnorm2x16_ext) {
+    uint32 packed = packComponents(vm, values[0], 2, 16, 65535.0f, 0.0f);
+    return vm->VmInit(resultTypeId, &packed);
+  }
 
-  EXT_INST_FUNC(modf_struct_ext) { TWO_ARG_OP_F(fmodf); }
+  EXT_INST_FUNC(packHalf2x16_ext) {
+    uint32 packed = floatToHalf(component<float>(vm, values[0], 0)) | ((uint32)floatToHalf(component<float>(vm, values[0], 1)) << 16);
+    return vm->VmInit(resultTypeId, &packed);
+  }
 
-  EXT_INST_FUNC(fmin_ext) { return values [0]; }
-  EXT_INST_FUNC(umin_ext) { return values [0]; }
-  EXT_INST_FUNC(smin_ext) { return values [0]; }
+  EXT_INST_FUNC(packDouble2x32_ext) { return vm->VmInit(resultTypeId, values[0].Memory); }
 
-  EXT_INST_FUNC(fmax_ext) { return values [0]; }
-  EXT_INST_FUNC(umax_ext) { return values [0]; }
-  EXT_INST_FUNC(smax_ext) { return values [0]; }
+  EXT_INST_FUNC(unpackSnorm2x16_ext) { return unpackComponents(vm, resultTypeId, *(uint32*)values[0].Memory, 2, 16, 32767.0f, true); }
+  EXT_INST_FUNC(unpackUnorm2x16_ext) { return unpackComponents(vm, resultTypeId, *(uint32*)values[0].Memory, 2, 16, 65535.0f, false); }
 
-  EXT_INST_FUNC(fclamp_ext) { THREE_ARG_OP_D(Clamp<float>); }
-  EXT_INST_FUNC(uclamp_ext) { THREE_ARG_OP_D(Clamp<unsigned int>); }
-  EXT_INST_FUNC(sclamp_ext) { THREE_ARG_OP_D(Clamp<int>); }
+  EXT_INST_FUNC(unpackHalf2x16_ext) {
+    uint32 packed = *(uint32*)values[0].Memory;
+    float unpacked[2] = { halfToFloat((uint16)packed), halfToFloat((uint16)(packed >> 16)) };
+    return vm->VmInit(resultTypeId, unpacked);
+  }
+
+  EXT_INST_FUNC(unpackSnorm4x8_ext) { return unpackComponents(vm, resultTypeId, *(uint32*)values[0].Memory, 4, 8, 127.0f, true); }
+  EXT_INST_FUNC(unpackUnorm4x8_ext) { return unpackComponents(vm, resultTypeId, *(uint32*)values[0].Memory, 4, 8, 255.0f, false); }
+  EXT_INST_FUNC(unpackDouble2x32_ext) { return vm->VmInit(resultTypeId, values[0].Memory); }
 
-  EXT_INST_FUNC(mix_ext) { return values [0]; }
-  EXT_INST_FUNC(step_ext) { return values [0]; }
-  EXT_INST_FUNC(smoothStep_ext) { return values [0]; }
-
-  EXT_INST_FUNC(floatBitsToInt_ext) { return values [0]; }
-  EXT_INST_FUNC(floatBitsToUint_ext) { return values [0]; }
-  EXT_INST_FUNC(intBitsToFloat_ext) { return values [0]; }
-  EXT_INST_FUNC(uintBitsToFloat_ext) { return values [0]; }
-
-  EXT_INST_FUNC(fma_ext) { return values [0]; }
-  EXT_INST_FUNC(frexp_ext) { return values [0]; }
-  EXT_INST_FUNC(frexp_struct_ext) { return values [0]; }
-  EXT_INST_FUNC(ldexp_ext) { return values [0]; }
-
-  EXT_INST_FUNC(packSnorm4x8_ext) { return values [0]; }
-  EXT_INST_FUNC(packUnorm4x8_ext) { return values [0]; }
-  EXT_INST_FUNC(packSnorm2x16_ext) { return values [0]; }
-  EXT_INST_FUNC(packUnorm2x16_ext) { return values [0]; }
-  EXT_INST_FUNC(packHalf2x16_ext) { return values [0]; }
-  EXT_INST_FUNC(packDouble2x32_ext) { return values [0]; }
-  EXT_INST_FUNC(unpackSnorm2x16_ext) { return values [0]; }
-  EXT_INST_FUNC(unpackUnorm2x16_ext) { return values [0]; }
-  EXT_INST_FUNC(unpackHalf2x16_ext) { return values [0]; }
-  EXT_INST_FUNC(unpackSnorm4x8_ext) { return values [0]; }
-  EXT_INST_FUNC(unpackUnorm4x8_ext) { return values [0]; }
-  EXT_INST_FUNC(unpackDouble2x32_ext) { return values [0]; }
-
-  EXT_INST_FUNC(length_ext) { 
+  EXT_INST_FUNC(length_ext) {
     assert(valueCount == 1);
-    Value a = values[0];
-    if (!vm->IsVectorType(a.TypeId)) {
-      return vm->VmInit(resultTypeId, a.Memory);
-    }
+    float res;
+    mathLength(vm->GetMathPrecision(), (const float*)values[0].Memory, componentCount(vm, values[0].TypeId), &res, 1);
+    return vm->VmInit(resultTypeId, &res);
+  }
 
-    uint32 elCount = vm->ElementCount(a.TypeId);
-    float sum = 0;
-    for (int i = 0; i < elCount; i++) {
-      float val = *(float*)vm->IndexMemberValue(a, i).Memory;
-      sum += val * val;
-    }
-    float res = sqrtf(sum);
+  EXT_INST_FUNC(distance_ext) {
+    assert(valueCount == 2);
+    float res;
+    mathDistance(vm->GetMathPrecision(), (const float*)values[0].Memory, (const float*)values[1].Memory,
+      componentCount(vm, values[0].TypeId), &res, 1);
     return vm->VmInit(resultTypeId, &res);
   }
 
-  EXT_INST_FUNC(distance_ext) { 
+  EXT_INST_FUNC(cross_ext) {
     assert(valueCount == 2);
-    Value start = values[0];
-    Value end = values[1];
-    Value diff = vm->DoOp(start.TypeId, Sub<float>, start, end);
-    return length_ext(vm, resultTypeId, 1, &diff);
+    const float* a = (const float*)values[0].Memory;
+    const float* b = (const float*)values[1].Memory;
+    float res[3] = { a[1] * b[2] - b[1] * a[2], a[2] * b[0] - b[2] * a[0], a[0] * b[1] - b[0] * a[1] };
+    return vm->VmInit(resultTypeId, res);
   }
 
-  EXT_INST_FUNC(cross_ext) { return values [0]; }
-  EXT_INST_FUNC(normalize_ext) { return values [0]; }
-  EXT_INST_FUNC(faceForward_ext) { return values [0]; }
-  EXT_INST_FUNC(reflect_ext) { return values [0]; }
-  EXT_INST_FUNC(refract_ext) { return values [0]; }
+  EXT_INST_FUNC(normalize_ext) {
+    assert(valueCount == 1);
+    float scale = dot(vm, values[0], values[0]);
+    mathInverseSqrt(vm->GetMathPrecision(), &scale, &scale, 1);
+    return map<float>(vm, resultTypeId, [scale](float f) { return f * scale; }, values[0]);
+  }
 
-  EXT_INST_FUNC(findILSB_ext) { return values [0]; }
-  EXT_INST_FUNC(findSMSB_ext) { return values [0]; }
-  EXT_INST_FUNC(findUMSB_ext) { return values [0]; }
+  EXT_INST_FUNC(faceForward_ext) {
+    assert(valueCount == 3);
+    bool facing = dot(vm, values[2], values[1]) < 0;
+    return map<float>(vm, resultTypeId, [facing](float n) { return facing ? n : -n; }, values[0]);
+  }
 
-  EXT_INST_FUNC(interpolateAtCentroid_ext) { return values [0]; }
-  EXT_INST_FUNC(interpolateAtSample_ext) { return values [0]; }
-  EXT_INST_FUNC(interpolateAtOffset_ext) { return values [0]; }
+  EXT_INST_FUNC(reflect_ext) {
+    assert(valueCount == 2);
+    float d = 2 * dot(vm, values[1], values[0]);
+    return map<float>(vm, resultTypeId, [d](float i, float n) { return i - d * n; }, values[0], values[1]);
+  }
 
-  EXT_INST_FUNC(addCarry_ext) { return values [0]; }
-  EXT_INST_FUNC(subBorrow_ext) { return values [0]; }
-  EXT_INST_FUNC(mulExtended_ext) { return values [0]; }
+  EXT_INST_FUNC(refract_ext) {
+    assert(valueCount == 3);
+    float eta = *(float*)values[2].Memory;
+    float d = dot(vm, values[1], values[0]);
+    float k = 1 - eta * eta * (1 - d * d);
+    if (k < 0) {
+      return vm->VmInit(resultTypeId, nullptr);
+    }
+    float s = eta * d + sqrtf(k);
+    return map<float>(vm, resultTypeId, [eta, s](float i, float n) { return eta * i - s * n; }, values[0], values[1]);
+  }
 
+  EXT_INST_FUNC(findILSB_ext) { ONE_ARG_OP(findLsb, uint32); }
+  EXT_INST_FUNC(findSMSB_ext) { ONE_ARG_OP_S([](int s) { return findMsb(s < 0 ? ~(uint32)s : (uint32)s); }); }
+  EXT_INST_FUNC(findUMSB_ext) { ONE_ARG_OP(findMsb, uint32); }
+
+  // Invocations run on their own, so the interpolant already holds its value
+  // at the only sample there is.
+  EXT_INST_FUNC(interpolateAtCentroid_ext) { return vm->VmInit(resultTypeId, values[0].Memory); }
+  EXT_INST_FUNC(interpolateAtSample_ext) { return vm->VmInit(resultTypeId, values[0].Memory); }
+  EXT_INST_FUNC(interpolateAtOffset_ext) { return vm->VmInit(resultTypeId, values[0].Memory); }
+
+  // Carry, borrow and the high and low halves of the product are written
+  // through the trailing operands.
+  EXT_INST_FUNC(addCarry_ext) {
+    assert(valueCount == 3);
+    uint32 count = componentCount(vm, resultTypeId);
+    Value result = vm->VmInit(resultTypeId, nullptr);
+    for (uint32 i = 0; i < count; i++) {
+      uint32 a = component<uint32>(vm, values[0], i);
+      uint32 sum = a + component<uint32>(vm, values[1], i);
+      ((uint32*)result.Memory)[i] = sum;
+      ((uint32*)values[2].Memory)[i] = sum < a ? 1 : 0;
+    }
+    return result;
+  }
+
+  EXT_INST_FUNC(subBorrow_ext) {
+    assert(valueCount == 3);
+    uint32 count = componentCount(vm, resultTypeId);
+    Value result = vm->VmInit(resultTypeId, nullptr);
+    for (uint32 i = 0; i < count; i++) {
+      uint32 a = component<uint32>(vm, values[0], i);
+      uint32 b = component<uint32>(vm, values[1], i);
+      ((uint32*)result.Memory)[i] = a - b;
+      ((uint32*)values[2].Memory)[i] = a < b ? 1 : 0;
+    }
+    return result;
+  }
+
+  EXT_INST_FUNC(mulExtended_ext) {
+    assert(valueCount == 4);
+    uint32 count = componentCount(vm, values[0].TypeId);
+    for (uint32 i = 0; i < count; i++) {
+      uint64 product = (uint64)component<uint32>(vm, values[0], i) * component<uint32>(vm, values[1], i);
+      ((uint32*)values[2].Memory)[i] = (uint32)(product >> 32);
+      ((uint32*)values[3].Memory)[i] = (uint32)product;
+    }
+    return vm->VmInit(resultTypeId, nullptr);
+  }
+
+
+  // Batched versions of the float functions that only read their operands.
+  // They compute every lane, the VM ignores the inactive ones.
+
+  EXT_BATCH_INST_FUNC(fabs_batch) {
+    mapLanes(count, result, [](float f) { return fabsf(f); }, values[0]);
+    return true;
+  }
+
+  EXT_BATCH_INST_FUNC(floor_batch) {
+    mapLanes(count, result, [](float f) { return floorf(f); }, values[0]);
+    return true;
+  }
+
+  EXT_BATCH_INST_FUNC(ceil_batch) {
+    mapLanes(count, result, [](float f) { return ceilf(f); }, values[0]);
+    return true;
+  }
+
+  EXT_BATCH_INST_FUNC(fract_batch) {
+    mapLanes(count, result, [](float f) { return f - floorf(f); }, values[0]);
+    return true;
+  }
+
+  EXT_BATCH_INST_FUNC(sin_batch) { mathLanes(vm, count, result, mathSin, values[0]); return true; }
+  EXT_BATCH_INST_FUNC(cos_batch) { mathLanes(vm, count, result, mathCos, values[0]); return true; }
+  EXT_BATCH_INST_FUNC(tan_batch) { mathLanes(vm, count, result, mathTan, values[0]); return true; }
+  EXT_BATCH_INST_FUNC(asin_batch) { mathLanes(vm, count, result, mathAsin, values[0]); return true; }
+  EXT_BATCH_INST_FUNC(acos_batch) { mathLanes(vm, count, result, mathAcos, values[0]); return true; }
+  EXT_BATCH_INST_FUNC(atan_batch) { mathLanes(vm, count, result, mathAtan, values[0]); return true; }
+  EXT_BATCH_INST_FUNC(sinh_batch) { mathLanes(vm, count, result, mathSinh, values[0]); return true; }
+  EXT_BATCH_INST_FUNC(cosh_batch) { mathLanes(vm, count, result, mathCosh, values[0]); return true; }
+  EXT_BATCH_INST_FUNC(tanh_batch) { mathLanes(vm, count, result, mathTanh, values[0]); return true; }
+  EXT_BATCH_INST_FUNC(asinh_batch) { mathLanes(vm, count, result, mathAsinh, values[0]); return true; }
+  EXT_BATCH_INST_FUNC(acosh_batch) { mathLanes(vm, count, result, mathAcosh, values[0]); return true; }
+  EXT_BATCH_INST_FUNC(atanh_batch) { mathLanes(vm, count, result, mathAtanh, values[0]); return true; }
+  EXT_BATCH_INST_FUNC(atan2_batch) { mathLanes(vm, count, result, mathAtan2, values[0], values[1]); return true; }
+
+  EXT_BATCH_INST_FUNC(pow_batch) { mathLanes(vm, count, result, mathPow, values[0], values[1]); return true; }
+  EXT_BATCH_INST_FUNC(exp_batch) { mathLanes(vm, count, result, mathExp, values[0]); return true; }
+  EXT_BATCH_INST_FUNC(log_batch) { mathLanes(vm, count, result, mathLog, values[0]); return true; }
+  EXT_BATCH_INST_FUNC(exp2_batch) { mathLanes(vm, count, result, mathExp2, values[0]); return true; }
+  EXT_BATCH_INST_FUNC(log2_batch) { mathLanes(vm, count, result, mathLog2, values[0]); return true; }
+
+  EXT_BATCH_INST_FUNC(sqrt_batch) {
+    for (uint32 c = 0; c < result->Components; c++) {
+      mathSqrt(lanes(values[0], c, count), resultLanes(result, c, count), count);
+    }
+    return true;
+  }
+
+  EXT_BATCH_INST_FUNC(inverseSqrt_batch) { mathLanes(vm, count, result, mathInverseSqrt, values[0]); return true; }
+
+  EXT_BATCH_INST_FUNC(fmin_batch) {
+    mapLanes(count, result, [](float x, float y) { return fminf(x, y); }, values[0], values[1]);
+    return true;
+  }
+
+  EXT_BATCH_INST_FUNC(fmax_batch) {
+    mapLanes(count, result, [](float x, float y) { return fmaxf(x, y); }, values[0], values[1]);
+    return true;
+  }
+
+  EXT_BATCH_INST_FUNC(fclamp_batch) {
+    mapLanes(count, result, [](float x, float min, float max) { return clampValue(x, min, max); }, values[0], values[1], values[2]);
+    return true;
+  }
+
+  EXT_BATCH_INST_FUNC(mix_batch) {
+    mapLanes(count, result, [](float x, float y, float a) { return x * (1 - a) + y * a; }, values[0], values[1], values[2]);
+    return true;
+  }
+
+  EXT_BATCH_INST_FUNC(step_batch) {
+    mapLanes(count, result, [](float edge, float x) { return x < edge ? 0.0f : 1.0f; }, values[0], values[1]);
+    return true;
+  }
+
+  EXT_BATCH_INST_FUNC(smoothStep_batch) {
+    mapLanes(count, result, [](float edge0, float edge1, float x) {
+      float t = clampValue((x - edge0) / (edge1 - edge0), 0.0f, 1.0f);
+      return t * t * (3 - 2 * t);
+    }, values[0], values[1], values[2]);
+    return true;
+  }
+
+  EXT_BATCH_INST_FUNC(length_batch) {
+    mathLengthLanes(vm->GetMathPrecision(), lanes(values[0], 0, count), values[0].Components, resultLanes(result, 0, count), count);
+    return true;
+  }
+
+  EXT_BATCH_INST_FUNC(distance_batch) {
+    mathDistanceLanes(vm->GetMathPrecision(), lanes(values[0], 0, count), lanes(values[1], 0, count),
+      values[0].Components, resultLanes(result, 0, count), count);
+    return true;
+  }
 
   ExtInstFunc* exports[]{
     nullptr,
@@ -339,7 +822,116 @@ extern "C" {
     mulExtended_ext,
   };
 
+  // Indexed like exports.
+  ExtBatchInstFunc* batchExports[]{
+    nullptr,
+
+    nullptr, // round
+    nullptr, // roundEven
+    nullptr, // trunc
+    fabs_batch,
+    nullptr, // sabs
+    nullptr, // fsign
+    nullptr, // ssign
+    floor_batch,
+    ceil_batch,
+    fract_batch,
+
+    nullptr, // radians
+    nullptr, // degrees
+    sin_batch,
+    cos_batch,
+    tan_batch,
+    asin_batch,
+    acos_batch,
+    atan_batch,
+    sinh_batch,
+    cosh_batch,
+    tanh_batch,
+    asinh_batch,
+    acosh_batch,
+    atanh_batch,
+    atan2_batch,
+
+    pow_batch,
+    exp_batch,
+    log_batch,
+    exp2_batch,
+    log2_batch,
+    sqrt_batch,
+    inverseSqrt_batch,
+
+    nullptr, // determinant
+    nullptr, // matrixInverse
+
+    nullptr, // modf
+    nullptr, // modf_struct
+    fmin_batch,
+    nullptr, // umin
+    nullptr, // smin
+    fmax_batch,
+    nullptr, // umax
+    nullptr, // smax
+    fclamp_batch,
+    nullptr, // uclamp
+    nullptr, // sclamp
+    mix_batch,
+    step_batch,
+    smoothStep_batch,
+
+    nullptr, // fma
+    nullptr, // frexp
+    nullptr, // frexp_struct
+    nullptr, // ldexp
+
+    nullptr, // packSnorm4x8
+    nullptr, // packUnorm4x8
+    nullptr, // packSnorm2x16
+    nullptr, // packUnorm2x16
+    nullptr, // packHalf2x16
+    nullptr, // packDouble2x32
+    nullptr, // unpackSnorm2x16
+    nullptr, // unpackUnorm2x16
+    nullptr, // unpackHalf2x16
+    nullptr, // unpackSnorm4x8
+    nullptr, // unpackUnorm4x8
+    nullptr, // unpackDouble2x32
+
+    length_batch,
+    distance_batch,
+    nullptr, // cross
+    nullptr, // normalize
+    nullptr, // faceForward
+    nullptr, // reflect
+    nullptr, // refract
+
+    nullptr, // findILSB
+    nullptr, // findSMSB
+    nullptr, // findUMSB
+
+    nullptr, // interpolateAtCentroid
+    nullptr, // interpolateAtSample
+    nullptr, // interpolateAtOffset
+
+    nullptr, // addCarry
+    nullptr, // subBorrow
+    nullptr, // mulExtended
+  };
+
+#ifdef OTHERSIDE_STATIC_EXTENSION
+  ExtInstFunc** GetGlslStd450Table(uint32* outCount) {
+    *outCount = sizeof(exports) / sizeof(exports[0]);
+    return exports;
+  }
+
+  ExtBatchInstFunc** GetGlslStd450BatchTable(uint32* outCount) {
+    *outCount = sizeof(batchExports) / sizeof(batchExports[0]);
+    return batchExports;
+  }
+#else
   EXT_EXPORT_TABLE_FUNC(exports)
+  EXT_EXPORT_BATCH_TABLE_FUNC(batchExports)
+#endif
 
 #ifdef __cplusplus
 }
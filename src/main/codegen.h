@@ -5,4 +5,10 @@ struct Program;
 
 bool genCode(std::stringstream* ss, const Program& prog);
 
-bool genCode(const char* outFileName, const Program& prog);
\ No newline at end of file
+bool genCode(const char* outFileName, const Program& prog);
+
+// Emits self-contained C++ for the module which NativeVM compiles into a
+// shared library. Fails if the module uses anything InterpretedVM can't run.
+bool genNativeCode(std::stringstream* ss, const Program& prog);
+
+bool genNativeCode(std::string* source, const Program& prog);
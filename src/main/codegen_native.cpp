@@ -0,0 +1,624 @@
+#include "codegen.h"
+#include <string>
+#include <vector>
+#include <iomanip>
+#include <limits>
+#include <iostream>
+#include "parser_definitions.h"
+#include "lookups_gen.h"
+#include "parser.h"
+#include "decoder.h"
+
+// Generates a self-contained C++ translation unit for a module. Every id gets
+// a fixed name derived from its number: t_ for types, c_ for constants, g->v_
+// for module variables, r_ for everything inside functions and f_ for
+// functions. Values have the same memory layout as in InterpretedVM, so host
+// bindings and extension instructions see the same bytes.
+class NativeGenerator {
+private:
+  const Program& prog;
+  DecodedProgram decoded;
+  std::stringstream* ss;
+  std::vector<uint32> idTypes;
+
+  SOp Type(uint32 typeId) const {
+    return prog.DefinedTypes.at(typeId);
+  }
+
+  bool IsOpaque(uint32 typeId) const {
+    auto op = Type(typeId).Op;
+    return op == Op::OpTypeImage || op == Op::OpTypeSampler || op == Op::OpTypeSampledImage;
+  }
+
+  bool IsPointer(uint32 typeId) const {
+    return Type(typeId).Op == Op::OpTypePointer;
+  }
+
+  uint32 Pointee(uint32 typeId) const {
+    return ((STypePointer*)Type(typeId).Memory)->TypeId;
+  }
+
+  uint32 ComponentCount(uint32 typeId) const {
+    SOp type = Type(typeId);
+    return type.Op == Op::OpTypeVector ? ((STypeVector*)type.Memory)->ComponentCount : 1;
+  }
+
+  bool IsConstant(uint32 id) const {
+    return prog.Constants.find(id) != prog.Constants.end();
+  }
+
+  uint32 ConstantLiteral(uint32 id) const {
+    return *((SConstant*)prog.Constants.at(id).Memory)->Values;
+  }
+
+  std::string Name(uint32 id) const {
+    if (IsConstant(id)) {
+      return "c_" + std::to_string(id);
+    }
+    if (prog.Variables.find(id) != prog.Variables.end()) {
+      return "g->v_" + std::to_string(id);
+    }
+    return "r_" + std::to_string(id);
+  }
+
+  std::string TypeName(uint32 typeId) const {
+    return "t_" + std::to_string(typeId);
+  }
+
+  // Component i of a value, or the value itself for scalars.
+  std::string Component(uint32 id, uint32 i) const {
+    if (ComponentCount(idTypes[id]) == 1) {
+      return Name(id);
+    }
+    return Name(id) + ".v[" + std::to_string(i) + "]";
+  }
+
+  bool Fail(const std::string& message, SOp op) {
+    std::cout << message << ": " << writeOp(op);
+    return false;
+  }
+
+  void Header();
+  bool Types();
+  bool Constants();
+  void Globals();
+  bool CollectTypes();
+  bool FunctionSignature(const DecodedFunction& func, bool declarationOnly);
+  bool FunctionBody(const DecodedFunction& func);
+  bool Instruction(const DecodedFunction& func, const DecodedOp& op);
+  std::string CompositePath(uint32 typeId, uint32 count, const uint32* indices, bool indicesAreIds) const;
+  void Exports();
+
+public:
+  NativeGenerator(std::stringstream* ss, const Program& prog) : prog(prog), ss(ss) { }
+  bool Generate();
+};
+
+void NativeGenerator::Header() {
+  *ss << "// Generated by otherside from a SPIR-V module. Do not edit." << std::endl;
+  *ss << "#include <stdint.h>" << std::endl;
+  *ss << std::endl;
+  *ss << "typedef double float64;" << std::endl;
+  *ss << "typedef float float32;" << std::endl;
+  *ss << "typedef uint8_t uint8;" << std::endl;
+  *ss << "typedef uint16_t uint16;" << std::endl;
+  *ss << "typedef uint32_t uint32;" << std::endl;
+  *ss << "typedef uint64_t uint64;" << std::endl;
+  *ss << "typedef int8_t int8;" << std::endl;
+  *ss << "typedef int16_t int16;" << std::endl;
+  *ss << "typedef int32_t int32;" << std::endl;
+  *ss << "typedef int64_t int64;" << std::endl;
+  *ss << std::endl;
+  // Has to match NativeHost in native_vm.h.
+  *ss << "struct NativeHost {" << std::endl;
+  *ss << "  void* Context;" << std::endl;
+  *ss << "  void (*ExtInst)(void* context, uint32 setId, uint32 instruction, uint32 resultTypeId, uint32 operandCount, const uint32* operandTypeIds, void** operands, void* result);" << std::endl;
+  *ss << "  void (*Sample)(void* context, uint32 sampledImageTypeId, const void* sampledImage, uint32 coordinateTypeId, const void* coordinate, uint32 resultTypeId, void* result);" << std::endl;
+  *ss << "};" << std::endl;
+  *ss << std::endl;
+}
+
+bool NativeGenerator::Types() {
+  // InterpretedVM packs composites without padding.
+  *ss << "#pragma pack(push, 1)" << std::endl;
+  for (auto& type : prog.DefinedTypes) {
+    std::string name = TypeName(type.first);
+    switch (type.second.Op) {
+    case Op::OpTypeVoid:
+      *ss << "typedef void " << name << ";" << std::endl;
+      break;
+    case Op::OpTypeBool:
+      *ss << "typedef bool " << name << ";" << std::endl;
+      break;
+    case Op::OpTypeInt: {
+      auto i = (STypeInt*)type.second.Memory;
+      *ss << "typedef " << (i->Signedness ? "" : "u") << "int" << i->Width << " " << name << ";" << std::endl;
+      break;
+    }
+    case Op::OpTypeFloat:
+      *ss << "typedef float" << ((STypeFloat*)type.second.Memory)->Width << " " << name << ";" << std::endl;
+      break;
+    case Op::OpTypeVector: {
+      auto v = (STypeVector*)type.second.Memory;
+      *ss << "struct " << name << " { " << TypeName(v->ComponentTypeId) << " v[" << v->ComponentCount << "]; };" << std::endl;
+      break;
+    }
+    case Op::OpTypeArray: {
+      auto a = (STypeArray*)type.second.Memory;
+      *ss << "struct " << name << " { " << TypeName(a->ElementTypeId) << " v[" << ConstantLiteral(a->LengthId) << "]; };" << std::endl;
+      break;
+    }
+    case Op::OpTypeStruct: {
+      auto s = (STypeStruct*)type.second.Memory;
+      *ss << "struct " << name << " {";
+      for (uint32 i = 0; i < s->MembertypeIdsCount; i++) {
+        *ss << " " << TypeName(s->MembertypeIds[i]) << " m_" << i << ";";
+      }
+      *ss << " };" << std::endl;
+      break;
+    }
+    case Op::OpTypePointer: {
+      auto p = (STypePointer*)type.second.Memory;
+      if (IsOpaque(p->TypeId)) {
+        *ss << "typedef const void* " << name << ";" << std::endl;
+      } else {
+        *ss << "typedef " << TypeName(p->TypeId) << "* " << name << ";" << std::endl;
+      }
+      break;
+    }
+    // Opaque objects are only ever handled through a pointer to the host's
+    // representation, loading one just passes that pointer on.
+    case Op::OpTypeImage:
+    case Op::OpTypeSampler:
+    case Op::OpTypeSampledImage:
+      *ss << "typedef const void* " << name << ";" << std::endl;
+      break;
+    case Op::OpTypeFunction:
+      break;
+    default:
+      *ss << "#pragma pack(pop)" << std::endl;
+      return Fail("Type not supported by the native backend", type.second);
+    }
+  }
+  *ss << "#pragma pack(pop)" << std::endl << std::endl;
+  return true;
+}
+
+bool NativeGenerator::Constants() {
+  for (auto& constant : prog.Constants) {
+    std::string name = Name(constant.first);
+    switch (constant.second.Op) {
+    case Op::OpConstant: {
+      auto c = (SConstant*)constant.second.Memory;
+      SOp type = Type(c->ResultTypeId);
+      *ss << "static const " << TypeName(c->ResultTypeId) << " " << name << " = ";
+      if (type.Op == Op::OpTypeFloat && c->ValuesCount == 1) {
+        *ss << std::scientific << std::setprecision(std::numeric_limits<float>::max_digits10 - 1) << *(float*)c->Values << "f";
+      } else if (type.Op == Op::OpTypeFloat && c->ValuesCount == 2) {
+        *ss << std::scientific << std::setprecision(std::numeric_limits<double>::max_digits10 - 1) << *(double*)c->Values;
+      } else if (c->ValuesCount == 2) {
+        *ss << "(" << TypeName(c->ResultTypeId) << ")" << *(uint64*)c->Values << "ull";
+      } else {
+        *ss << "(" << TypeName(c->ResultTypeId) << ")" << *c->Values << "u";
+      }
+      *ss << std::defaultfloat << ";" << std::endl;
+      break;
+    }
+    case Op::OpConstantTrue:
+    case Op::OpConstantFalse: {
+      uint32 typeId = *(uint32*)constant.second.Memory;
+      *ss << "static const " << TypeName(typeId) << " " << name << " = " << (constant.second.Op == Op::OpConstantTrue ? "true" : "false") << ";" << std::endl;
+      break;
+    }
+    case Op::OpConstantComposite: {
+      auto c = (SConstantComposite*)constant.second.Memory;
+      bool wrapped = Type(c->ResultTypeId).Op != Op::OpTypeStruct;
+      *ss << "static const " << TypeName(c->ResultTypeId) << " " << name << " = { " << (wrapped ? "{ " : "");
+      for (uint32 i = 0; i < c->ConstituentsIdsCount; i++) {
+        *ss << (i > 0 ? ", " : "") << Name(c->ConstituentsIds[i]);
+      }
+      *ss << (wrapped ? " }" : "") << " };" << std::endl;
+      break;
+    }
+    default:
+      return Fail("Constant not supported by the native backend", constant.second);
+    }
+  }
+  *ss << std::endl;
+  return true;
+}
+
+void NativeGenerator::Globals() {
+  // Module variables are pointers like in InterpretedVM so the host can
+  // rebind them, by default they point at storage inside Globals.
+  *ss << "struct Globals {" << std::endl;
+  for (auto& var : prog.Variables) {
+    *ss << "  " << TypeName(var.second.ResultTypeId) << " v_" << var.first << ";" << std::endl;
+    uint32 pointee = Pointee(var.second.ResultTypeId);
+    if (!IsOpaque(pointee)) {
+      *ss << "  " << TypeName(pointee) << " s_" << var.first << ";" << std::endl;
+    }
+  }
+  *ss << "};" << std::endl << std::endl;
+}
+
+bool NativeGenerator::CollectTypes() {
+  idTypes.assign(prog.IDBound, 0);
+  for (auto& constant : prog.Constants) {
+    idTypes[constant.first] = *(uint32*)constant.second.Memory;
+  }
+  for (auto& var : prog.Variables) {
+    idTypes[var.first] = var.second.ResultTypeId;
+  }
+  for (auto& func : decoded.Functions) {
+    for (auto& param : func.Source->Parameters) {
+      idTypes[param.ResultId] = param.ResultTypeId;
+    }
+    for (auto& op : func.Ops) {
+      switch (op.Op) {
+      case Op::OpBranch:
+      case Op::OpBranchConditional:
+      case Op::OpReturn:
+      case Op::OpReturnValue:
+      case Op::OpStore:
+        break;
+      default: {
+        uint32* words = (uint32*)op.Memory;
+        if (words[1] >= idTypes.size()) {
+          return Fail("Result id out of bounds", SOp{ op.Op, op.Memory });
+        }
+        idTypes[words[1]] = words[0];
+        break;
+      }
+      }
+    }
+  }
+  return true;
+}
+
+bool NativeGenerator::FunctionSignature(const DecodedFunction& func, bool declarationOnly) {
+  *ss << "static " << TypeName(func.Source->Info.ResultTypeId) << " f_" << func.Id << "(Globals* g, const NativeHost* host";
+  for (auto& param : func.Source->Parameters) {
+    *ss << ", " << TypeName(param.ResultTypeId) << " r_" << param.ResultId;
+  }
+  *ss << ")" << (declarationOnly ? ";" : " {") << std::endl;
+  return true;
+}
+
+std::string NativeGenerator::CompositePath(uint32 typeId, uint32 count, const uint32* indices, bool indicesAreIds) const {
+  std::string path;
+  for (uint32 i = 0; i < count; i++) {
+    SOp type = Type(typeId);
+    std::string index = indicesAreIds ? (IsConstant(indices[i]) ? std::to_string(ConstantLiteral(indices[i])) : Name(indices[i])) : std::to_string(indices[i]);
+    switch (type.Op) {
+    case Op::OpTypeStruct: {
+      uint32 member = indicesAreIds ? ConstantLiteral(indices[i]) : indices[i];
+      path += ".m_" + std::to_string(member);
+      typeId = ((STypeStruct*)type.Memory)->MembertypeIds[member];
+      break;
+    }
+    case Op::OpTypeVector:
+      path += ".v[" + index + "]";
+      typeId = ((STypeVector*)type.Memory)->ComponentTypeId;
+      break;
+    case Op::OpTypeArray:
+      path += ".v[" + index + "]";
+      typeId = ((STypeArray*)type.Memory)->ElementTypeId;
+      break;
+    default:
+      return path;
+    }
+  }
+  return path;
+}
+
+bool NativeGenerator::FunctionBody(const DecodedFunction& func) {
+  FunctionSignature(func, false);
+
+  // Results are declared up front since gotos may not jump over initializations.
+  std::vector<bool> isTarget(func.Ops.size(), false);
+  for (auto& op : func.Ops) {
+    if (op.Op == Op::OpBranch || op.Op == Op::OpBranchConditional) {
+      isTarget[op.Targets[0]] = true;
+      if (op.Op == Op::OpBranchConditional) {
+        isTarget[op.Targets[1]] = true;
+      }
+    }
+    switch (op.Op) {
+    case Op::OpBranch:
+    case Op::OpBranchConditional:
+    case Op::OpReturn:
+    case Op::OpReturnValue:
+    case Op::OpStore:
+      break;
+    case Op::OpFunctionCall:
+      if (Type(((SFunctionCall*)op.Memory)->ResultTypeId).Op == Op::OpTypeVoid) {
+        break;
+      }
+      // fall through
+    default: {
+      uint32* words = (uint32*)op.Memory;
+      *ss << "  " << TypeName(words[0]) << " r_" << words[1] << ";" << std::endl;
+      if (op.Op == Op::OpVariable) {
+        *ss << "  " << TypeName(Pointee(words[0])) << " s_" << words[1] << ";" << std::endl;
+      }
+      break;
+    }
+    }
+  }
+
+  for (uint32 pc = 0; pc < func.Ops.size(); pc++) {
+    if (isTarget[pc]) {
+      *ss << "op_" << pc << ":" << std::endl;
+    }
+    if (!Instruction(func, func.Ops[pc])) {
+      return false;
+    }
+  }
+
+  *ss << "}" << std::endl << std::endl;
+  return true;
+}
+
+bool NativeGenerator::Instruction(const DecodedFunction& func, const DecodedOp& op) {
+  SOp sop = { op.Op, op.Memory };
+  uint32* words = (uint32*)op.Memory;
+  *ss << "  ";
+
+  switch (op.Op) {
+  case Op::OpBranch:
+    *ss << "goto op_" << op.Targets[0] << ";" << std::endl;
+    break;
+  case Op::OpBranchConditional: {
+    auto branch = (SBranchConditional*)op.Memory;
+    *ss << "if (" << Name(branch->ConditionId) << ") goto op_" << op.Targets[0] << "; else goto op_" << op.Targets[1] << ";" << std::endl;
+    break;
+  }
+  case Op::OpReturn:
+    *ss << "return;" << std::endl;
+    break;
+  case Op::OpReturnValue:
+    *ss << "return " << Name(((SReturnValue*)op.Memory)->ValueId) << ";" << std::endl;
+    break;
+  case Op::OpFunctionCall: {
+    auto call = (SFunctionCall*)op.Memory;
+    if (Type(call->ResultTypeId).Op != Op::OpTypeVoid) {
+      *ss << Name(call->ResultId) << " = ";
+    }
+    *ss << "f_" << call->FunctionId << "(g, host";
+    for (uint32 i = 0; i < call->ArgumentIdsCount; i++) {
+      *ss << ", " << Name(call->ArgumentIds[i]);
+    }
+    *ss << ");" << std::endl;
+    break;
+  }
+  case Op::OpExtInst: {
+    // Extension instructions see the pointee of pointer operands, like in
+    // InterpretedVM.
+    auto extInst = (SExtInst*)op.Memory;
+    std::stringstream typeIds;
+    std::stringstream operands;
+    for (uint32 i = 0; i < extInst->OperandIdsCount; i++) {
+      uint32 id = extInst->OperandIds[i];
+      uint32 typeId = idTypes[id];
+      bool pointer = IsPointer(typeId);
+      typeIds << (i > 0 ? ", " : "") << (pointer ? Pointee(typeId) : typeId);
+      operands << (i > 0 ? ", " : "") << "(void*)" << (pointer ? "" : "&") << Name(id);
+    }
+    uint32 count = extInst->OperandIdsCount;
+    *ss << "{ const uint32 types[] = { " << (count ? typeIds.str() : "0") << " }; void* operands[] = { " << (count ? operands.str() : "0") << " }; ";
+    *ss << "host->ExtInst(host->Context, " << extInst->SetId << ", " << extInst->Instruction << ", " << extInst->ResultTypeId << ", " << count << ", types, operands, &" << Name(extInst->ResultId) << "); }" << std::endl;
+    break;
+  }
+  case Op::OpImageSampleImplicitLod: {
+    auto sample = (SImageSampleImplicitLod*)op.Memory;
+    uint32 coordType = idTypes[sample->CoordinateId];
+    *ss << "host->Sample(host->Context, " << idTypes[sample->SampledImageId] << ", " << Name(sample->SampledImageId) << ", "
+        << coordType << ", &" << Name(sample->CoordinateId) << ", " << sample->ResultTypeId << ", &" << Name(sample->ResultId) << ");" << std::endl;
+    break;
+  }
+  case Op::OpConvertSToF: {
+    auto convert = (SConvertSToF*)op.Memory;
+    uint32 count = ComponentCount(convert->ResultTypeId);
+    for (uint32 i = 0; i < count; i++) {
+      *ss << (i > 0 ? " " : "") << Component(convert->ResultId, i) << " = (float32)" << Component(convert->SignedValueId, i) << ";";
+    }
+    *ss << std::endl;
+    break;
+  }
+  case Op::OpFAdd:
+  case Op::OpFSub:
+  case Op::OpFMul:
+  case Op::OpFDiv:
+  case Op::OpSLessThan:
+  case Op::OpSGreaterThan: {
+    const char* symbol = op.Op == Op::OpFAdd ? "+" : op.Op == Op::OpFSub ? "-" : op.Op == Op::OpFMul ? "*" :
+                         op.Op == Op::OpFDiv ? "/" : op.Op == Op::OpSLessThan ? "<" : ">";
+    uint32 count = ComponentCount(words[0]);
+    for (uint32 i = 0; i < count; i++) {
+      *ss << (i > 0 ? " " : "") << Component(words[1], i) << " = " << Component(words[2], i) << " " << symbol << " " << Component(words[3], i) << ";";
+    }
+    *ss << std::endl;
+    break;
+  }
+  case Op::OpIAdd:
+  case Op::OpISub:
+  case Op::OpIMul: {
+    // Wrap around instead of relying on signed overflow.
+    const char* symbol = op.Op == Op::OpIAdd ? "+" : op.Op == Op::OpISub ? "-" : "*";
+    uint32 count = ComponentCount(words[0]);
+    SOp resultType = Type(words[0]);
+    uint32 componentType = resultType.Op == Op::OpTypeVector ? ((STypeVector*)resultType.Memory)->ComponentTypeId : words[0];
+    for (uint32 i = 0; i < count; i++) {
+      *ss << (i > 0 ? " " : "") << Component(words[1], i) << " = (" << TypeName(componentType) << ")((uint32)" << Component(words[2], i) << " " << symbol << " (uint32)" << Component(words[3], i) << ");";
+    }
+    *ss << std::endl;
+    break;
+  }
+  case Op::OpVectorTimesScalar: {
+    auto vts = (SVectorTimesScalar*)op.Memory;
+    uint32 count = ComponentCount(vts->ResultTypeId);
+    for (uint32 i = 0; i < count; i++) {
+      *ss << (i > 0 ? " " : "") << Component(vts->ResultId, i) << " = " << Component(vts->VectorId, i) << " * " << Name(vts->ScalarId) << ";";
+    }
+    *ss << std::endl;
+    break;
+  }
+  case Op::OpLoad: {
+    auto load = (SLoad*)op.Memory;
+    *ss << Name(load->ResultId) << " = " << (IsOpaque(load->ResultTypeId) ? "" : "*") << Name(load->PointerId) << ";" << std::endl;
+    break;
+  }
+  case Op::OpStore: {
+    auto store = (SStore*)op.Memory;
+    *ss << "*" << Name(store->PointerId) << " = " << Name(store->ObjectId) << ";" << std::endl;
+    break;
+  }
+  case Op::OpAccessChain: {
+    auto access = (SAccessChain*)op.Memory;
+    uint32 baseType = Pointee(idTypes[access->BaseId]);
+    *ss << Name(access->ResultId) << " = &(*" << Name(access->BaseId) << ")" << CompositePath(baseType, access->IndexesIdsCount, access->IndexesIds, true) << ";" << std::endl;
+    break;
+  }
+  case Op::OpVectorShuffle: {
+    auto shuffle = (SVectorShuffle*)op.Memory;
+    uint32 v1Count = ComponentCount(idTypes[shuffle->Vector1Id]);
+    for (uint32 i = 0; i < shuffle->ComponentsCount; i++) {
+      uint32 index = shuffle->Components[i];
+      *ss << (i > 0 ? " " : "") << Component(shuffle->ResultId, i) << " = "
+          << (index < v1Count ? Component(shuffle->Vector1Id, index) : Component(shuffle->Vector2Id, index - v1Count)) << ";";
+    }
+    *ss << std::endl;
+    break;
+  }
+  case Op::OpCompositeExtract: {
+    auto extract = (SCompositeExtract*)op.Memory;
+    *ss << Name(extract->ResultId) << " = " << Name(extract->CompositeId) << CompositePath(idTypes[extract->CompositeId], extract->IndexesCount, extract->Indexes, false) << ";" << std::endl;
+    break;
+  }
+  case Op::OpCompositeInsert: {
+    auto insert = (SCompositeInsert*)op.Memory;
+    *ss << Name(insert->ResultId) << " = " << Name(insert->CompositeId) << "; "
+        << Name(insert->ResultId) << CompositePath(insert->ResultTypeId, insert->IndexesCount, insert->Indexes, false) << " = " << Name(insert->ObjectId) << ";" << std::endl;
+    break;
+  }
+  case Op::OpCompositeConstruct: {
+    auto construct = (SCompositeConstruct*)op.Memory;
+    SOp resultType = Type(construct->ResultTypeId);
+    if (resultType.Op == Op::OpTypeVector) {
+      // Vectors can be constructed from a mix of scalars and smaller vectors.
+      uint32 component = 0;
+      for (uint32 i = 0; i < construct->ConstituentsIdsCount; i++) {
+        uint32 id = construct->ConstituentsIds[i];
+        for (uint32 c = 0; c < ComponentCount(idTypes[id]); c++) {
+          *ss << Component(construct->ResultId, component++) << " = " << Component(id, c) << "; ";
+        }
+      }
+    } else {
+      bool isStruct = resultType.Op == Op::OpTypeStruct;
+      for (uint32 i = 0; i < construct->ConstituentsIdsCount; i++) {
+        *ss << Name(construct->ResultId) << (isStruct ? ".m_" : ".v[") << i << (isStruct ? "" : "]") << " = " << Name(construct->ConstituentsIds[i]) << "; ";
+      }
+    }
+    *ss << std::endl;
+    break;
+  }
+  case Op::OpVariable: {
+    auto var = (SVariable*)op.Memory;
+    std::string storage = "s_" + std::to_string(var->ResultId);
+    *ss << storage << " = " << (var->InitializerId ? Name(var->InitializerId) : TypeName(Pointee(var->ResultTypeId)) + "()") << "; "
+        << Name(var->ResultId) << " = &" << storage << ";" << std::endl;
+    break;
+  }
+  default:
+    return Fail("Operation not supported by the native backend", sop);
+  }
+
+  return true;
+}
+
+void NativeGenerator::Exports() {
+  *ss << "#if defined(_WIN32) || defined(__CYGWIN__)" << std::endl;
+  *ss << "  #define NATIVE_EXPORT extern \"C\" __declspec(dllexport)" << std::endl;
+  *ss << "#else" << std::endl;
+  *ss << "  #define NATIVE_EXPORT extern \"C\" __attribute__ ((visibility (\"default\")))" << std::endl;
+  *ss << "#endif" << std::endl << std::endl;
+
+  *ss << "NATIVE_EXPORT uint32 otherside_globals_size() {" << std::endl;
+  *ss << "  return sizeof(Globals);" << std::endl;
+  *ss << "}" << std::endl << std::endl;
+
+  *ss << "NATIVE_EXPORT void otherside_init(void* globals) {" << std::endl;
+  *ss << "  Globals* g = (Globals*)globals;" << std::endl;
+  for (auto& var : prog.Variables) {
+    if (IsOpaque(Pointee(var.second.ResultTypeId))) {
+      *ss << "  g->v_" << var.first << " = 0;" << std::endl;
+      continue;
+    }
+    if (var.second.InitializerId) {
+      *ss << "  g->s_" << var.first << " = " << Name(var.second.InitializerId) << ";" << std::endl;
+    }
+    *ss << "  g->v_" << var.first << " = &g->s_" << var.first << ";" << std::endl;
+  }
+  *ss << "}" << std::endl << std::endl;
+
+  *ss << "NATIVE_EXPORT void** otherside_variable(void* globals, uint32 id) {" << std::endl;
+  *ss << "  Globals* g = (Globals*)globals;" << std::endl;
+  *ss << "  switch (id) {" << std::endl;
+  for (auto& var : prog.Variables) {
+    *ss << "  case " << var.first << ": return (void**)&g->v_" << var.first << ";" << std::endl;
+  }
+  *ss << "  default: return 0;" << std::endl;
+  *ss << "  }" << std::endl;
+  *ss << "}" << std::endl << std::endl;
+
+  *ss << "NATIVE_EXPORT void otherside_run(void* globals, const NativeHost* host) {" << std::endl;
+  *ss << "  Globals* g = (Globals*)globals;" << std::endl;
+  for (uint32 ep : decoded.EntryPoints) {
+    *ss << "  f_" << decoded.Functions[ep].Id << "(g, host);" << std::endl;
+  }
+  *ss << "}" << std::endl;
+}
+
+bool NativeGenerator::Generate() {
+  if (!decode(prog, &decoded, std::cout)) {
+    return false;
+  }
+
+  if (!CollectTypes()) {
+    return false;
+  }
+  Header();
+  if (!Types() || !Constants()) {
+    return false;
+  }
+  Globals();
+
+  for (auto& func : decoded.Functions) {
+    FunctionSignature(func, true);
+  }
+  *ss << std::endl;
+
+  for (auto& func : decoded.Functions) {
+    if (!FunctionBody(func)) {
+      return false;
+    }
+  }
+
+  Exports();
+  return true;
+}
+
+bool genNativeCode(std::stringstream* ss, const Program& prog) {
+  NativeGenerator generator(ss, prog);
+  return generator.Generate();
+}
+
+bool genNativeCode(std::string* source, const Program& prog) {
+  std::stringstream ss;
+  if (!genNativeCode(&ss, prog)) {
+    return false;
+  }
+  *source = ss.str();
+  return true;
+}
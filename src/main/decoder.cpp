@@ -0,0 +1,450 @@
+#include "decoder.h"
+#include "parser.h"
+#include "static_extensions.h"
+#include <algorithm>
+
+bool isNoOp(spv::Op op) {
+  return op == Op::OpLabel ||
+         op == Op::OpSelectionMerge ||
+         op == Op::OpLoopMerge ||
+         op == Op::OpNop ||
+         op == Op::OpLine;
+}
+
+bool isTerminator(spv::Op op) {
+  return op == Op::OpBranch ||
+         op == Op::OpBranchConditional ||
+         op == Op::OpSwitch ||
+         op == Op::OpKill ||
+         op == Op::OpReturn ||
+         op == Op::OpReturnValue ||
+         op == Op::OpUnreachable;
+}
+
+static bool resolveLabel(const std::map<uint32, uint32>& labels, uint32 labelId, uint32* target, std::ostream& errorOut) {
+  auto label = labels.find(labelId);
+  if (label == labels.end()) {
+    errorOut << "Branch to unknown label " << labelId << std::endl;
+    return false;
+  }
+  *target = label->second;
+  return true;
+}
+
+static bool decodeFunction(const Program& prog, const DecodedProgram& decoded, const Function& func, DecodedFunction* out, std::ostream& errorOut) {
+  out->Id = func.Info.ResultId;
+  out->Source = &func;
+  out->Ops.clear();
+
+  if (func.Ops.empty() || !isTerminator(func.Ops.back().Op)) {
+    errorOut << "Function " << func.Info.ResultId << " does not end in a terminator." << std::endl;
+    return false;
+  }
+
+  // Labels and merge annotations are not executed, so a label resolves to the
+  // first instruction that follows it in the decoded stream.
+  std::map<uint32, uint32> labels;
+  uint32 decodedCount = 0;
+  for (auto& op : func.Ops) {
+    if (op.Op == Op::OpLabel) {
+      labels[((SLabel*)op.Memory)->ResultId] = decodedCount;
+    } else if (!isNoOp(op.Op)) {
+      decodedCount++;
+    }
+  }
+
+  out->Ops.reserve(decodedCount);
+  for (auto& op : func.Ops) {
+    if (isNoOp(op.Op)) {
+      continue;
+    }
+
+    DecodedOp decodedOp = { op.Op, op.Memory, { 0, 0 }, nullptr, nullptr, IHUnimplemented, IBNone };
+    switch (op.Op) {
+    case Op::OpBranch: {
+      auto branch = (SBranch*)op.Memory;
+      if (!resolveLabel(labels, branch->TargetLabelId, &decodedOp.Targets[0], errorOut)) {
+        return false;
+      }
+      break;
+    }
+    case Op::OpBranchConditional: {
+      auto branch = (SBranchConditional*)op.Memory;
+      if (!resolveLabel(labels, branch->TrueLabelId, &decodedOp.Targets[0], errorOut) ||
+          !resolveLabel(labels, branch->FalseLabelId, &decodedOp.Targets[1], errorOut)) {
+        return false;
+      }
+      break;
+    }
+    case Op::OpFunctionCall: {
+      auto call = (SFunctionCall*)op.Memory;
+      if (call->FunctionId >= decoded.FunctionIndices.size() || decoded.FunctionIndices[call->FunctionId] < 0) {
+        errorOut << "Call to undefined function " << call->FunctionId << std::endl;
+        return false;
+      }
+      decodedOp.Targets[0] = decoded.FunctionIndices[call->FunctionId];
+      break;
+    }
+    case Op::OpCopyObject: {
+      auto copy = (SCopyObject*)op.Memory;
+      decodedOp.Targets[0] = copy->ResultId;
+      decodedOp.Targets[1] = copy->OperandId;
+      break;
+    }
+    case Op::OpExtInst:
+      decodedOp.Ext = resolveStaticExtInst(prog, *(SExtInst*)op.Memory);
+      decodedOp.ExtBatch = resolveStaticExtBatchInst(prog, *(SExtInst*)op.Memory);
+      break;
+    default:
+      break;
+    }
+    out->Ops.push_back(decodedOp);
+  }
+
+  selectHandlers(out);
+  return true;
+}
+
+static InstructionHandler handlerOf(spv::Op op) {
+  switch (op) {
+  case Op::OpBranch: return IHBranch;
+  case Op::OpBranchConditional: return IHBranchConditional;
+  case Op::OpFunctionCall: return IHFunctionCall;
+  case Op::OpExtInst: return IHExtInst;
+  case Op::OpConvertSToF: return IHConvertSToF;
+  case Op::OpFAdd: return IHFAdd;
+  case Op::OpIAdd: return IHIAdd;
+  case Op::OpFSub: return IHFSub;
+  case Op::OpISub: return IHISub;
+  case Op::OpFDiv: return IHFDiv;
+  case Op::OpFMul: return IHFMul;
+  case Op::OpIMul: return IHIMul;
+  case Op::OpVectorTimesScalar: return IHVectorTimesScalar;
+  case Op::OpSLessThan: return IHSLessThan;
+  case Op::OpSGreaterThan: return IHSGreaterThan;
+  case Op::OpLoad: return IHLoad;
+  case Op::OpStore: return IHStore;
+  case Op::OpImageSampleImplicitLod: return IHImageSampleImplicitLod;
+  case Op::OpAccessChain: return IHAccessChain;
+  case Op::OpVectorShuffle: return IHVectorShuffle;
+  case Op::OpCompositeExtract: return IHCompositeExtract;
+  case Op::OpCompositeInsert: return IHCompositeInsert;
+  case Op::OpCompositeConstruct: return IHCompositeConstruct;
+  case Op::OpVariable: return IHVariable;
+  case Op::OpReturnValue: return IHReturnValue;
+  case Op::OpReturn: return IHReturn;
+  case Op::OpCopyObject: return IHCopyObject;
+  default: return IHUnimplemented;
+  }
+}
+
+// Superinstruction for an instruction followed by next, IHUnimplemented if
+// there is none. Sequences are taken from glslang output, which loads every
+// operand right before its use and extracts vector components one by one.
+static InstructionHandler fusedHandlerOf(const DecodedOp& op, const DecodedOp& next) {
+  uint32* words = (uint32*)op.Memory;
+  uint32* nextWords = (uint32*)next.Memory;
+  switch (op.Op) {
+  case Op::OpAccessChain:
+    return next.Op == Op::OpLoad && nextWords[2] == words[1] ? IHAccessChainLoad : IHUnimplemented;
+  case Op::OpLoad: {
+    bool arithmetic = next.Op == Op::OpFAdd || next.Op == Op::OpFSub || next.Op == Op::OpFMul || next.Op == Op::OpFDiv;
+    if (!arithmetic || (nextWords[2] != words[1] && nextWords[3] != words[1])) {
+      return IHUnimplemented;
+    }
+    return next.Op == Op::OpFAdd ? IHLoadFAdd :
+           next.Op == Op::OpFSub ? IHLoadFSub :
+           next.Op == Op::OpFMul ? IHLoadFMul : IHLoadFDiv;
+  }
+  case Op::OpCompositeExtract:
+    return next.Op == Op::OpCompositeExtract ? IHCompositeExtractChain : IHUnimplemented;
+  case Op::OpVectorShuffle:
+    return next.Op == Op::OpStore && nextWords[1] == words[1] ? IHVectorShuffleStore : IHUnimplemented;
+  default:
+    return IHUnimplemented;
+  }
+}
+
+void selectHandlers(DecodedFunction* func) {
+  std::vector<DecodedOp>& ops = func->Ops;
+  for (auto& op : ops) {
+    op.Handler = handlerOf(op.Op);
+  }
+
+  // Instructions other than terminators are always followed by one of the
+  // same block, so pairs never span a branch target.
+  for (size_t i = 0; i + 1 < ops.size(); i++) {
+    InstructionHandler fused = fusedHandlerOf(ops[i], ops[i + 1]);
+    if (fused != IHUnimplemented) {
+      ops[i].Handler = fused;
+    }
+  }
+}
+
+bool decode(const Program& prog, DecodedProgram* outProg, std::ostream& errorOut) {
+  outProg->IDBound = prog.IDBound;
+  outProg->Functions.clear();
+  outProg->FunctionIndices.assign(prog.IDBound, -1);
+  outProg->EntryPoints.clear();
+
+  // Indices are assigned up front so calls can be resolved regardless of the
+  // order in which functions are defined.
+  for (auto& func : prog.FunctionDefinitions) {
+    if (func.first >= prog.IDBound) {
+      errorOut << "Function id " << func.first << " is out of bounds." << std::endl;
+      return false;
+    }
+    outProg->FunctionIndices[func.first] = (int)outProg->Functions.size();
+    outProg->Functions.push_back(DecodedFunction());
+  }
+
+  for (auto& func : prog.FunctionDefinitions) {
+    DecodedFunction* decodedFunc = &outProg->Functions[outProg->FunctionIndices[func.first]];
+    if (!decodeFunction(prog, *outProg, func.second, decodedFunc, errorOut)) {
+      return false;
+    }
+  }
+
+  for (auto& ep : prog.EntryPoints) {
+    if (!outProg->GetFunction(ep.second.EntryPointId)) {
+      errorOut << "Entry point " << ep.second.EntryPointId << " has no definition." << std::endl;
+      return false;
+    }
+    outProg->EntryPoints.push_back(outProg->FunctionIndices[ep.second.EntryPointId]);
+  }
+
+  return true;
+}
+
+// Appends callee to out in place of call. Returns leave through an OpBranch
+// to the instruction after the inlined ones, unless they are the last one.
+static void inlineCall(const DecodedOp& call, const DecodedFunction& callee, std::vector<DecodedOp>* out) {
+  auto callOp = (SFunctionCall*)call.Memory;
+  for (uint32 i = 0; i < callOp->ArgumentIdsCount; i++) {
+    uint32 param = callee.Source->Parameters[i].ResultId;
+    out->push_back(DecodedOp{ Op::OpCopyObject, call.Memory, { param, callOp->ArgumentIds[i] }, nullptr, nullptr, IHUnimplemented, IBParameter });
+  }
+
+  // Where each instruction of the callee ends up, the last entry is the
+  // instruction after the inlined ones.
+  std::vector<uint32> newIndex(callee.Ops.size() + 1);
+  uint32 next = (uint32)out->size();
+  for (size_t i = 0; i < callee.Ops.size(); i++) {
+    newIndex[i] = next;
+    const DecodedOp& op = callee.Ops[i];
+    bool last = i + 1 == callee.Ops.size();
+    next += op.Op == Op::OpReturnValue ? (last ? 1 : 2) :
+            op.Op == Op::OpReturn ? (last ? 0 : 1) : 1;
+  }
+  newIndex[callee.Ops.size()] = next;
+
+  for (size_t i = 0; i < callee.Ops.size(); i++) {
+    DecodedOp op = callee.Ops[i];
+    bool last = i + 1 == callee.Ops.size();
+    if (op.Op == Op::OpReturnValue) {
+      uint32 valueId = ((SReturnValue*)op.Memory)->ValueId;
+      out->push_back(DecodedOp{ Op::OpCopyObject, call.Memory, { callOp->ResultId, valueId }, nullptr, nullptr, IHUnimplemented, IBResult });
+    }
+    if (op.Op == Op::OpReturnValue || op.Op == Op::OpReturn) {
+      if (!last) {
+        out->push_back(DecodedOp{ Op::OpBranch, op.Memory, { next, 0 }, nullptr, nullptr, IHUnimplemented, IBNone });
+      }
+      continue;
+    }
+    if (op.Op == Op::OpBranch || op.Op == Op::OpBranchConditional) {
+      op.Targets[0] = newIndex[op.Targets[0]];
+    }
+    if (op.Op == Op::OpBranchConditional) {
+      op.Targets[1] = newIndex[op.Targets[1]];
+    }
+    out->push_back(op);
+  }
+}
+
+static void inlineCalls(DecodedProgram* program, uint32 index, std::vector<bool>* visited) {
+  if ((*visited)[index]) {
+    return;
+  }
+  (*visited)[index] = true;
+
+  DecodedFunction& func = program->Functions[index];
+  bool inlinable = false;
+  for (auto& op : func.Ops) {
+    if (op.Op == Op::OpFunctionCall) {
+      inlineCalls(program, op.Targets[0], visited);
+      inlinable = inlinable || program->Functions[op.Targets[0]].Ops.size() <= INLINE_MAX_OPS;
+    }
+  }
+  if (!inlinable) {
+    return;
+  }
+
+  std::vector<DecodedOp> ops;
+  std::vector<uint32> newIndex(func.Ops.size());
+  std::vector<bool> inlined;
+  for (size_t i = 0; i < func.Ops.size(); i++) {
+    const DecodedOp& op = func.Ops[i];
+    newIndex[i] = (uint32)ops.size();
+    bool inlineCallee = op.Op == Op::OpFunctionCall && program->Functions[op.Targets[0]].Ops.size() <= INLINE_MAX_OPS;
+    if (inlineCallee) {
+      inlineCall(op, program->Functions[op.Targets[0]], &ops);
+    } else {
+      ops.push_back(op);
+    }
+    // Instructions of the callee already point to their new index.
+    inlined.resize(ops.size(), inlineCallee);
+  }
+
+  for (size_t i = 0; i < ops.size(); i++) {
+    DecodedOp& op = ops[i];
+    if (inlined[i]) {
+      continue;
+    }
+    if (op.Op == Op::OpBranch || op.Op == Op::OpBranchConditional) {
+      op.Targets[0] = newIndex[op.Targets[0]];
+    }
+    if (op.Op == Op::OpBranchConditional) {
+      op.Targets[1] = newIndex[op.Targets[1]];
+    }
+  }
+
+  func.Ops = std::move(ops);
+  selectHandlers(&func);
+}
+
+void inlineFunctions(DecodedProgram* program) {
+  // SPIR-V has no recursion, so the calls form a DAG.
+  std::vector<bool> visited(program->Functions.size(), false);
+  for (uint32 i = 0; i < program->Functions.size(); i++) {
+    inlineCalls(program, i, &visited);
+  }
+}
+
+static uint32 getCallDepth(const DecodedProgram& program, uint32 index, std::vector<int>* depths) {
+  int& depth = (*depths)[index];
+  if (depth < 0) {
+    uint32 deepest = 0;
+    for (auto& op : program.Functions[index].Ops) {
+      if (op.Op == Op::OpFunctionCall) {
+        deepest = std::max(deepest, getCallDepth(program, op.Targets[0], depths) + 1);
+      }
+    }
+    depth = (int)deepest;
+  }
+  return (uint32)depth;
+}
+
+uint32 getMaxCallDepth(const DecodedProgram& program) {
+  std::vector<int> depths(program.Functions.size(), -1);
+  uint32 deepest = 0;
+  for (uint32 ep : program.EntryPoints) {
+    deepest = std::max(deepest, getCallDepth(program, ep, &depths));
+  }
+  return deepest;
+}
+
+uint32 getOperandIds(const DecodedOp& op, std::vector<uint32>* operands) {
+  operands->clear();
+  uint32* words = (uint32*)op.Memory;
+  switch (op.Op) {
+  case Op::OpFAdd:
+  case Op::OpIAdd:
+  case Op::OpFSub:
+  case Op::OpISub:
+  case Op::OpFDiv:
+  case Op::OpFMul:
+  case Op::OpIMul:
+  case Op::OpSLessThan:
+  case Op::OpSGreaterThan:
+  case Op::OpVectorTimesScalar:
+  case Op::OpVectorShuffle:
+    operands->push_back(words[2]);
+    operands->push_back(words[3]);
+    return words[1];
+  case Op::OpConvertSToF:
+  case Op::OpLoad:
+  case Op::OpCompositeExtract:
+    operands->push_back(words[2]);
+    return words[1];
+  case Op::OpCompositeInsert: {
+    auto insert = (SCompositeInsert*)op.Memory;
+    operands->push_back(insert->ObjectId);
+    operands->push_back(insert->CompositeId);
+    return insert->ResultId;
+  }
+  case Op::OpAccessChain: {
+    auto access = (SAccessChain*)op.Memory;
+    operands->push_back(access->BaseId);
+    operands->insert(operands->end(), access->IndexesIds, access->IndexesIds + access->IndexesIdsCount);
+    return access->ResultId;
+  }
+  case Op::OpCompositeConstruct: {
+    auto construct = (SCompositeConstruct*)op.Memory;
+    operands->insert(operands->end(), construct->ConstituentsIds, construct->ConstituentsIds + construct->ConstituentsIdsCount);
+    return construct->ResultId;
+  }
+  case Op::OpExtInst: {
+    auto extInst = (SExtInst*)op.Memory;
+    operands->insert(operands->end(), extInst->OperandIds, extInst->OperandIds + extInst->OperandIdsCount);
+    return extInst->ResultId;
+  }
+  case Op::OpImageSampleImplicitLod: {
+    auto sample = (SImageSampleImplicitLod*)op.Memory;
+    operands->push_back(sample->SampledImageId);
+    operands->push_back(sample->CoordinateId);
+    // The first image operand is the mask, the rest are ids.
+    for (uint32 i = 1; i < sample->ImageOperandsIdsCount; i++) {
+      operands->push_back(sample->ImageOperandsIds[i]);
+    }
+    return sample->ResultId;
+  }
+  case Op::OpFunctionCall: {
+    auto call = (SFunctionCall*)op.Memory;
+    operands->insert(operands->end(), call->ArgumentIds, call->ArgumentIds + call->ArgumentIdsCount);
+    return call->ResultId;
+  }
+  case Op::OpVariable: {
+    auto var = (SVariable*)op.Memory;
+    if (var->InitializerId) {
+      operands->push_back(var->InitializerId);
+    }
+    return var->ResultId;
+  }
+  case Op::OpStore: {
+    auto store = (SStore*)op.Memory;
+    operands->push_back(store->PointerId);
+    operands->push_back(store->ObjectId);
+    return 0;
+  }
+  case Op::OpBranchConditional:
+    operands->push_back(((SBranchConditional*)op.Memory)->ConditionId);
+    return 0;
+  case Op::OpReturnValue:
+    operands->push_back(((SReturnValue*)op.Memory)->ValueId);
+    return 0;
+  case Op::OpCopyObject:
+    operands->push_back(op.Targets[1]);
+    return op.Targets[0];
+  default:
+    return 0;
+  }
+}
+
+bool prepareModule(const Program& prog, PreparedModule* outModule, std::ostream& errorOut) {
+  std::shared_ptr<TypeLayoutTable> layouts(new TypeLayoutTable());
+  if (!computeTypeLayouts(prog, layouts.get(), errorOut)) {
+    errorOut << "Could not compute type layouts!" << std::endl;
+    return false;
+  }
+
+  std::shared_ptr<DecodedProgram> decoded(new DecodedProgram());
+  if (!decode(prog, decoded.get(), errorOut)) {
+    errorOut << "Could not decode program!" << std::endl;
+    return false;
+  }
+  inlineFunctions(decoded.get());
+
+  outModule->Layouts = layouts;
+  outModule->Decoded = decoded;
+  return true;
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <ostream>
+#include "types.h"
+#include "ext_inst.h"
+#include "parser_definitions.h"
+#include "type_layout.h"
+
+// Code the interpreter runs for a decoded instruction. The fused ones are
+// superinstructions that also run the instructions after theirs: those keep
+// their own handler and opcode, so the stream stays valid for every other
+// consumer and for branches into it. IHCompositeExtractChain continues with
+// the next extract as long as it has that handler.
+enum InstructionHandler {
+  IHUnimplemented,
+  IHBranch,
+  IHBranchConditional,
+  IHFunctionCall,
+  IHExtInst,
+  IHConvertSToF,
+  IHFAdd,
+  IHIAdd,
+  IHFSub,
+  IHISub,
+  IHFDiv,
+  IHFMul,
+  IHIMul,
+  IHVectorTimesScalar,
+  IHSLessThan,
+  IHSGreaterThan,
+  IHLoad,
+  IHStore,
+  IHImageSampleImplicitLod,
+  IHAccessChain,
+  IHVectorShuffle,
+  IHCompositeExtract,
+  IHCompositeInsert,
+  IHCompositeConstruct,
+  IHVariable,
+  IHReturnValue,
+  IHReturn,
+  IHCopyObject,
+  IHAccessChainLoad,
+  IHLoadFAdd,
+  IHLoadFSub,
+  IHLoadFMul,
+  IHLoadFDiv,
+  IHCompositeExtractChain,
+  IHVectorShuffleStore,
+  IHCount
+};
+
+// A single instruction of a decoded function. Operand ids inside Memory index
+// the VM register file directly, branch targets are instruction indices.
+// OpExtInst of a statically linked set carries its functions in Ext and
+// ExtBatch, the latter is nullptr if the set has no batched version.
+// OpCopyObject copies the value of id Targets[1] to id Targets[0]. Inlined
+// calls bind parameters and results with copies that keep the Memory of the
+// call and are marked in Bind, and leave early returns with an OpBranch that
+// keeps the Memory of the return.
+enum InlineBind {
+  IBNone,
+  // A parameter of the callee aliases its argument.
+  IBParameter,
+  // The result of the call receives the returned value.
+  IBResult
+};
+
+struct DecodedOp {
+  spv::Op Op;
+  void* Memory;
+  uint32 Targets[2];
+  ExtInstFunc* Ext;
+  ExtBatchInstFunc* ExtBatch;
+  InstructionHandler Handler;
+  InlineBind Bind;
+};
+
+struct DecodedFunction {
+  uint32 Id;
+  const Function* Source;
+  std::vector<DecodedOp> Ops;
+};
+
+struct DecodedProgram {
+  uint32 IDBound;
+  std::vector<DecodedFunction> Functions;
+  std::vector<int> FunctionIndices;
+  std::vector<uint32> EntryPoints;
+
+  const DecodedFunction* GetFunction(uint32 id) const {
+    if (id >= FunctionIndices.size() || FunctionIndices[id] < 0) {
+      return nullptr;
+    }
+    return &Functions[FunctionIndices[id]];
+  }
+};
+
+// Everything the VMs derive from a program independently of their
+// environment. Computed by InterpretedVM::Setup() unless it is handed in,
+// e.g. after loading it from a module cache.
+struct PreparedModule {
+  std::shared_ptr<const TypeLayoutTable> Layouts;
+  std::shared_ptr<const DecodedProgram> Decoded;
+};
+
+bool decode(const Program& prog, DecodedProgram* outProg, std::ostream& errorOut);
+
+// Functions with at most this many instructions are inlined.
+const uint32 INLINE_MAX_OPS = 32;
+
+// Replaces calls to small functions with their instructions, callees are
+// inlined into each other first. prepareModule() does this after decoding.
+void inlineFunctions(DecodedProgram* program);
+
+// Deepest nesting of calls starting at an entry point, 0 if they make none.
+uint32 getMaxCallDepth(const DecodedProgram& program);
+
+// Assigns the interpreter handler of every instruction of func and fuses
+// superinstructions. Has to run again whenever the instructions change.
+void selectHandlers(DecodedFunction* func);
+
+// Instructions in function bodies the VMs skip.
+bool isNoOp(spv::Op op);
+bool isTerminator(spv::Op op);
+
+// Ids an instruction reads, returns the id of its result or 0 if it has none.
+// Covers the instructions the VMs execute, others read nothing.
+uint32 getOperandIds(const DecodedOp& op, std::vector<uint32>* operands);
+bool prepareModule(const Program& prog, PreparedModule* outModule, std::ostream& errorOut);
@@ -0,0 +1,188 @@
+#include "dispatch.h"
+#include "interpreted_vm.h"
+#include "native_vm.h"
+#include "thread_pool.h"
+#include "wide_vm.h"
+#include <atomic>
+#include <algorithm>
+#include <iostream>
+
+template<typename VMType>
+struct DispatchWorker {
+  std::unique_ptr<VMType> VM;
+  Vec2 Coordinate;
+  Vec2* CoordinatePtr;
+  Color Output;
+  Color* OutputPtr;
+  Color** OutputSlot;
+};
+
+template<typename VMType>
+static bool dispatchScalar(const VMType& vm, const FragmentDispatch& dispatch, ThreadPool& pool, Color* output) {
+  uint32 tileSize = dispatch.TileSize > 0 ? dispatch.TileSize : 16;
+
+  std::vector<DispatchWorker<VMType>> workers(pool.ThreadCount());
+  for (auto& worker : workers) {
+    worker.VM = vm.Fork();
+    worker.VM->SetSampleFootprint(1.0f / dispatch.Width, 1.0f / dispatch.Height);
+    worker.CoordinatePtr = &worker.Coordinate;
+    worker.Output = Color{ 0, 0, 0, 0 };
+    worker.OutputPtr = &worker.Output;
+    if (!worker.VM->SetVariable(dispatch.CoordinateName, &worker.CoordinatePtr)) {
+      std::cout << "Could not bind " << dispatch.CoordinateName << "." << std::endl;
+      return false;
+    }
+    // Stores rebind the output variable to VM memory, so the result is read
+    // through the variable after every invocation rather than from Output.
+    if (!worker.VM->SetVariable(dispatch.OutputName, &worker.OutputPtr)) {
+      std::cout << "Could not bind " << dispatch.OutputName << "." << std::endl;
+      return false;
+    }
+    worker.OutputSlot = (Color**)worker.VM->ReadVariable(dispatch.OutputName);
+  }
+
+  uint32 tilesX = (dispatch.Width + tileSize - 1) / tileSize;
+  uint32 tilesY = (dispatch.Height + tileSize - 1) / tileSize;
+  std::atomic<bool> failed(false);
+
+  pool.ParallelFor(tilesX * tilesY, [&](uint32 tile, uint32 workerIndex) {
+    if (failed) {
+      return;
+    }
+
+    DispatchWorker<VMType>& worker = workers[workerIndex];
+    uint32 startX = (tile % tilesX) * tileSize;
+    uint32 startY = (tile / tilesX) * tileSize;
+    uint32 endX = std::min(startX + tileSize, dispatch.Width);
+    uint32 endY = std::min(startY + tileSize, dispatch.Height);
+
+    for (uint32 y = startY; y < endY; y++) {
+      for (uint32 x = startX; x < endX; x++) {
+        worker.Coordinate.x = float(x) / dispatch.Width;
+        worker.Coordinate.y = float(y) / dispatch.Height;
+
+        if (!worker.VM->Run()) {
+          failed = true;
+          return;
+        }
+
+        output[x + y * dispatch.Width] = **worker.OutputSlot;
+      }
+    }
+  });
+
+  return !failed;
+}
+
+template<uint32 Lanes>
+struct WideDispatchWorker {
+  std::unique_ptr<WideVM<Lanes>> VM;
+  float* Coordinate;
+  float* Output;
+};
+
+// Returns false without touching output if the program can't run in lockstep.
+template<uint32 Lanes>
+static bool dispatchWide(const InterpretedVM& vm, const FragmentDispatch& dispatch, ThreadPool& pool, Color* output, bool* failed) {
+  uint32 tileSize = dispatch.TileSize > 0 ? dispatch.TileSize : 16;
+
+  std::vector<WideDispatchWorker<Lanes>> workers(pool.ThreadCount());
+  for (auto& worker : workers) {
+    worker.VM.reset(new WideVM<Lanes>(vm));
+    if (!worker.VM->Setup()) {
+      return false;
+    }
+    worker.VM->SetSampleFootprint(1.0f / dispatch.Width, 1.0f / dispatch.Height);
+    worker.Coordinate = worker.VM->GetLanes(dispatch.CoordinateName);
+    worker.Output = worker.VM->GetLanes(dispatch.OutputName);
+    if (!worker.Coordinate || !worker.Output) {
+      return false;
+    }
+  }
+
+  uint32 tilesX = (dispatch.Width + tileSize - 1) / tileSize;
+  uint32 tilesY = (dispatch.Height + tileSize - 1) / tileSize;
+  std::atomic<bool> runFailed(false);
+
+  pool.ParallelFor(tilesX * tilesY, [&](uint32 tile, uint32 workerIndex) {
+    if (runFailed) {
+      return;
+    }
+
+    WideDispatchWorker<Lanes>& worker = workers[workerIndex];
+    uint32 startX = (tile % tilesX) * tileSize;
+    uint32 startY = (tile / tilesX) * tileSize;
+    uint32 endX = std::min(startX + tileSize, dispatch.Width);
+    uint32 endY = std::min(startY + tileSize, dispatch.Height);
+
+    for (uint32 y = startY; y < endY; y++) {
+      for (uint32 x = startX; x < endX; x += Lanes) {
+        uint32 count = std::min(Lanes, endX - x);
+        for (uint32 l = 0; l < count; l++) {
+          worker.Coordinate[l] = float(x + l) / dispatch.Width;
+          worker.Coordinate[Lanes + l] = float(y) / dispatch.Height;
+        }
+
+        if (!worker.VM->Run((uint32)((1ull << count) - 1))) {
+          runFailed = true;
+          return;
+        }
+
+        Color* row = output + x + y * dispatch.Width;
+        for (uint32 l = 0; l < count; l++) {
+          row[l] = Color{ worker.Output[l], worker.Output[Lanes + l], worker.Output[2 * Lanes + l], worker.Output[3 * Lanes + l] };
+        }
+      }
+    }
+  });
+
+  *failed = runFailed;
+  return true;
+}
+
+bool dispatchFragments(InterpretedVM& vm, const FragmentDispatch& dispatch, ThreadPool& pool, Color* output) {
+  if (dispatch.Width == 0 || dispatch.Height == 0) {
+    return true;
+  }
+
+  if (!vm.UpdatePrologue()) {
+    std::cout << "Could not run the prologue." << std::endl;
+    return false;
+  }
+
+  bool failed = false;
+  bool dispatched = false;
+  switch (dispatch.Lanes) {
+  case 0:
+  case 1:
+    break;
+  case 4:
+    dispatched = dispatchWide<4>(vm, dispatch, pool, output, &failed);
+    break;
+  case 8:
+    dispatched = dispatchWide<8>(vm, dispatch, pool, output, &failed);
+    break;
+  case 16:
+    dispatched = dispatchWide<16>(vm, dispatch, pool, output, &failed);
+    break;
+  default:
+    std::cout << "Unsupported lane count " << dispatch.Lanes << ", use 4, 8 or 16." << std::endl;
+    return false;
+  }
+
+  if (dispatched) {
+    return !failed;
+  }
+
+  if (dispatch.Lanes > 1) {
+    std::cout << "Falling back to scalar execution." << std::endl;
+  }
+  return dispatchScalar(vm, dispatch, pool, output);
+}
+
+bool dispatchFragments(const NativeVM& vm, const FragmentDispatch& dispatch, ThreadPool& pool, Color* output) {
+  if (dispatch.Width == 0 || dispatch.Height == 0) {
+    return true;
+  }
+  return dispatchScalar(vm, dispatch, pool, output);
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <string>
+#include "types.h"
+#include "utils.h"
+
+class InterpretedVM;
+class NativeVM;
+class ThreadPool;
+
+struct FragmentDispatch {
+  uint32 Width;
+  uint32 Height;
+  // vec2 input that is set to the normalized pixel position of each invocation.
+  std::string CoordinateName;
+  // vec4 output that is written to the image after each invocation.
+  std::string OutputName;
+  uint32 TileSize = 16;
+  // Number of invocations executed in lockstep by a WideVM (4, 8 or 16).
+  // 0 runs every invocation on its own InterpretedVM. Programs the WideVM
+  // can't execute fall back to that as well.
+  uint32 Lanes = 0;
+};
+
+// Runs one invocation per pixel of a Width x Height image, writing the output
+// variable into output (row-major). The image is split into tiles which are
+// processed by the threads of pool, each running its own fork of vm.
+// vm has to be set up and have all non per-invocation variables bound. The
+// prologue of a hoisted vm runs once before it is forked.
+// Mip levels are selected with the footprint of a pixel in coordinate space,
+// which matches shaders that sample textures at the coordinate.
+bool dispatchFragments(InterpretedVM& vm, const FragmentDispatch& dispatch, ThreadPool& pool, Color* output);
+
+// Same as above for a program compiled to native code, Lanes is ignored.
+bool dispatchFragments(const NativeVM& vm, const FragmentDispatch& dispatch, ThreadPool& pool, Color* output);
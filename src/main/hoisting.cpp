@@ -0,0 +1,140 @@
+#include "hoisting.h"
+
+// Module scope variables the program stores to, through an access chain or
+// by passing them to a function, which may store to its parameters.
+static std::vector<bool> findWrittenVariables(const Program& prog, const DecodedProgram& program) {
+  // The variable an id points into, 0 if it is not a module scope variable
+  // or an access chain into one. Access chains follow their base, copies and
+  // the parameters of inlined calls what they are bound to.
+  std::vector<uint32> roots(program.IDBound, 0);
+  for (auto& var : prog.Variables) {
+    roots[var.first] = var.first;
+  }
+
+  std::vector<bool> written(program.IDBound, false);
+  for (auto& func : program.Functions) {
+    for (auto& op : func.Ops) {
+      switch (op.Op) {
+      case Op::OpAccessChain: {
+        auto access = (SAccessChain*)op.Memory;
+        roots[access->ResultId] = roots[access->BaseId];
+        break;
+      }
+      case Op::OpCopyObject:
+        roots[op.Targets[0]] = roots[op.Targets[1]];
+        break;
+      case Op::OpStore:
+        written[roots[((SStore*)op.Memory)->PointerId]] = true;
+        break;
+      case Op::OpFunctionCall: {
+        auto call = (SFunctionCall*)op.Memory;
+        for (uint32 i = 0; i < call->ArgumentIdsCount; i++) {
+          written[roots[call->ArgumentIds[i]]] = true;
+        }
+        break;
+      }
+      default:
+        break;
+      }
+    }
+  }
+  return written;
+}
+
+bool partitionInvocation(const Program& prog, const DecodedProgram& program, const std::vector<uint32>& perInvocation,
+                         InvocationPartition* out, HoistingStats* stats) {
+  std::vector<bool> written = findWrittenVariables(prog, program);
+  std::vector<bool> invariant(program.IDBound, false);
+  for (auto& constant : prog.Constants) {
+    invariant[constant.first] = true;
+  }
+  for (auto& var : prog.Variables) {
+    invariant[var.first] = !written[var.first];
+  }
+  for (uint32 id : perInvocation) {
+    if (id < invariant.size()) {
+      invariant[id] = false;
+    }
+  }
+
+  HoistingStats counts = { 0, 0 };
+  std::shared_ptr<DecodedProgram> prologue(new DecodedProgram(program));
+  std::shared_ptr<DecodedProgram> body(new DecodedProgram(program));
+  out->Hoisted.clear();
+  out->PerInvocation = perInvocation;
+  out->InvariantVariables.clear();
+  for (auto& var : prog.Variables) {
+    if (invariant[var.first]) {
+      out->InvariantVariables.push_back(var.first);
+    }
+  }
+
+  std::vector<uint32> operands;
+  for (uint32 ep : program.EntryPoints) {
+    // Program order visits definitions before their uses, values carried
+    // around loops go through Function variables which are never invariant.
+    const std::vector<DecodedOp>& ops = program.Functions[ep].Ops;
+    std::vector<bool> hoisted(ops.size(), false);
+    for (size_t i = 0; i < ops.size(); i++) {
+      const DecodedOp& op = ops[i];
+      uint32 resultId = getOperandIds(op, &operands);
+      if (!resultId || !isFoldable(op.Op)) {
+        continue;
+      }
+
+      bool allInvariant = true;
+      for (uint32 id : operands) {
+        allInvariant = allInvariant && invariant[id];
+      }
+      if (allInvariant) {
+        invariant[resultId] = true;
+        hoisted[i] = true;
+        out->Hoisted.push_back(FoldedResult{ resultId, ((uint32*)op.Memory)[0] });
+      }
+    }
+
+    // Branch targets move to the first remaining instruction of their block,
+    // terminators are never hoisted so there always is one.
+    std::vector<uint32> newIndex(ops.size());
+    uint32 kept = 0;
+    for (size_t i = 0; i < ops.size(); i++) {
+      newIndex[i] = kept;
+      if (!hoisted[i]) {
+        kept++;
+      }
+    }
+
+    DecodedFunction& first = prologue->Functions[ep];
+    DecodedFunction& rest = body->Functions[ep];
+    first.Ops.clear();
+    rest.Ops.clear();
+    rest.Ops.reserve(kept);
+    for (size_t i = 0; i < ops.size(); i++) {
+      if (hoisted[i]) {
+        first.Ops.push_back(ops[i]);
+        continue;
+      }
+      DecodedOp op = ops[i];
+      if (op.Op == Op::OpBranch || op.Op == Op::OpBranchConditional) {
+        op.Targets[0] = newIndex[op.Targets[0]];
+      }
+      if (op.Op == Op::OpBranchConditional) {
+        op.Targets[1] = newIndex[op.Targets[1]];
+      }
+      rest.Ops.push_back(op);
+    }
+    first.Ops.push_back(DecodedOp{ Op::OpReturn, nullptr, { 0, 0 }, nullptr, nullptr, IHReturn, IBNone });
+
+    counts.HoistedOps += (uint32)first.Ops.size() - 1;
+    counts.BodyOps += kept;
+    selectHandlers(&first);
+    selectHandlers(&rest);
+  }
+
+  out->Prologue = prologue;
+  out->Body = body;
+  if (stats) {
+    *stats = counts;
+  }
+  return true;
+}
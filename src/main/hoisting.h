@@ -0,0 +1,37 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "types.h"
+#include "parser_definitions.h"
+#include "decoder.h"
+#include "specializer.h"
+
+// The entry points of a program split into a prologue, which computes
+// everything that stays the same for all invocations of a frame, and the body
+// that is left for every invocation. The prologue runs the hoisted
+// instructions in their original order and returns, the body is the entry
+// point without them. Other functions are the same in both.
+struct InvocationPartition {
+  std::shared_ptr<const DecodedProgram> Prologue;
+  std::shared_ptr<const DecodedProgram> Body;
+  // Results the body reads from the prologue.
+  std::vector<FoldedResult> Hoisted;
+  // Variables the host changes between invocations.
+  std::vector<uint32> PerInvocation;
+  // Module scope variables the prologue may read, rebinding one of them
+  // invalidates its results.
+  std::vector<uint32> InvariantVariables;
+};
+
+struct HoistingStats {
+  uint32 HoistedOps;
+  uint32 BodyOps;
+};
+
+// Partitions the entry points of program. An instruction of an entry point is
+// invocation-invariant if it has no side effects and only reads constants,
+// invariant results and module scope variables that are neither in
+// perInvocation nor written by the program. Those are hoisted, even out of
+// loops and conditional blocks: their operands are defined either way.
+bool partitionInvocation(const Program& prog, const DecodedProgram& program, const std::vector<uint32>& perInvocation,
+                         InvocationPartition* out, HoistingStats* stats);
@@ -3,38 +3,11 @@
 #include <cstring>
 #include <iostream>
 #include <algorithm>
-
-#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)  // note the underscore: without it, it's not msdn official!
-  #include <Windows.h>
-  #define LOAD_LIBRARY(path) LoadLibrary(path)
-  #define LOAD_SYMBOL GetProcAddress
-  #define LIBRARY_EXT ".dll"
-
-  #ifdef __CYGWIN__
-    #define LIB_NAME(name) ("cyg" + name)
-  #else
-    #define LIB_NAME(name) name
-  #endif
-
-  #define LIB_ERROR ""
-  #define HANDLE_TYPE HINSTANCE
-#elif defined(__unix__) || defined(__linux__) || defined(__APPLE__) // all unices, not all compilers
-  #include <dlfcn.h>
-  #define LOAD_LIBRARY(path) dlopen(path, RTLD_LAZY)
-  #define LOAD_SYMBOL dlsym
-  #define LIBRARY_EXT ".so"
-  #define LIB_NAME(name) ("lib" + name)
-  #define LIB_ERROR dlerror()
-  #define HANDLE_TYPE void*
-  #define TEXT(txt) txt
-#endif
-
+#include "dynamic_library.h"
+#include "static_extensions.h"
 
 byte* InterpretedVM::VmAlloc(uint32 typeId) {
-  uint32 compositeSize = GetTypeByteSize(typeId);
-  byte* mem = (byte*)malloc(compositeSize);
-  VmMemory.push_back(std::unique_ptr<byte>(mem));
-  return (byte*)mem;
+  return currentMemory->Alloc(GetTypeByteSize(typeId));
 }
 
 Value InterpretedVM::IndexMemberValue(Value val, uint32 index) const {
@@ -44,33 +17,22 @@ Value InterpretedVM::IndexMemberValue(Value val, uint32 index) const {
 Value InterpretedVM::IndexMemberValue(uint32 typeId, byte* val, uint32 index) const {
   Value result;
 
-  SOp compDef = prog.DefinedTypes.at(typeId);
-  switch (compDef.Op) {
-  case Op::OpTypeVector: {
-    auto vec = (STypeVector*)compDef.Memory;
-    uint32 offset = GetTypeByteSize(vec->ComponentTypeId) * index;
-    result.TypeId = vec->ComponentTypeId;
-    result.Memory = val + offset;
+  const TypeLayout& layout = (*layouts)[typeId];
+  switch (layout.Definition.Op) {
+  case Op::OpTypeVector:
+  case Op::OpTypeArray:
+  case Op::OpTypeStruct:
+    result.Memory = val + layouts->ElementOffset(typeId, index, &result.TypeId);
     break;
-  }
-  case Op::OpTypeStruct: {
-    auto s = (STypeStruct*)compDef.Memory;
-    result.TypeId = s->MembertypeIds[index];
-    result.Memory = val;
-    for (uint32 i = 0; i < index; i++) {
-      result.Memory += GetTypeByteSize(s->MembertypeIds[i]);
-    }
-    break;
-  }
   case Op::OpTypePointer: {
-    auto p = (STypePointer*)compDef.Memory;
+    auto p = (STypePointer*)layout.Definition.Memory;
     result = IndexMemberValue(p->TypeId, (byte*)*(void**)val, index);
     break;
   }
   default:
     result.Memory = nullptr;
     result.TypeId = 0;
-    std::cout << "Not a composite type def: " << writeOp(compDef);
+    std::cout << "Not a composite type def: " << writeOp(layout.Definition);
   }
 
   return result;
@@ -87,7 +49,7 @@ byte* InterpretedVM::GetPointerInComposite(uint32 typeId, byte* composite, uint3
 }
 
 SOp InterpretedVM::GetType(uint32 typeId) const {
-  return prog.DefinedTypes.at(typeId);
+  return (*layouts)[typeId].Definition;
 }
 
 bool InterpretedVM::IsVectorType(uint32 typeId) const {
@@ -95,20 +57,11 @@ bool InterpretedVM::IsVectorType(uint32 typeId) const {
 }
 
 uint32 InterpretedVM::ElementCount(uint32 typeId) const {
-  auto def = GetType(typeId);
-  switch (def.Op)
-  {
-  case Op::OpTypeArray: {
-    uint32 lengthId = ((STypeArray*)def.Memory)->LengthId;
-    return *(uint32*)env.Values.at(lengthId).Memory;
-  }
-  case Op::OpTypeVector: {
-    auto vec = (STypeVector*)def.Memory;
-    return vec->ComponentCount;
-  }
-  default:
-    return 0;
-  }
+  return (*layouts)[typeId].ElementCount;
+}
+
+MathPrecision InterpretedVM::GetMathPrecision() const {
+  return mathPrecision;
 }
 
 Value InterpretedVM::VmInit(uint32 typeId, void* value) {
@@ -136,274 +89,397 @@ Value InterpretedVM::TextureSample(Value sampler, Value coord, Value bias, uint3
   STypeImage* imageType = (STypeImage*)GetType(samplerType->ImageTypeId).Memory;
   assert(imageType->Sampled == 1);
   assert(ElementCount(coord.TypeId) >= (int)imageType->Dim + imageType->Arrayed);
-  Sampler* s = ((Sampler*)sampler.Memory);
-  
-  uint32 index = 0;
-  uint32 acc = 1;
-  for (uint32 d = 0; d < s->DimCount; d++) {
-    uint32 dd = s->Dims[d];
-    uint32 add = (uint32)(*(float*)IndexMemberValue(coord, d).Memory * (dd - 1) + 0.5f);
-    switch (s->Wrap) {
-    case WrapMode::WMClamp: add = add < 0 ? 0 : add > dd - 1 ? dd - 1 : add; break;
-    case WrapMode::WMRepeat: add = add % dd; break;
+  const Sampler* s = ((Sampler*)sampler.Memory);
+
+  if (s != preparedSampler || (const byte*)s->Data != samplerState.Levels[0].Texels || s->Filter != samplerState.Filter ||
+      s->Wrap != samplerState.Wrap || s->Layout != samplerState.Layout || s->Format != samplerState.Format ||
+      (s->Mips ? s->MipCount : 0) + 1 != samplerState.LevelCount) {
+    preparedSampler = prepareSampler(*s, &samplerState) ? s : nullptr;
+    if (!preparedSampler) {
+      std::cout << "Invalid sampler." << std::endl;
+      return VmInit(resultTypeId, nullptr);
+    }
+  }
+
+  float coords[4] = { 0, 0, 0, 0 };
+  const float* c = (const float*)IndexMemberValue(coord, 0).Memory;
+  for (uint32 d = 0; d < samplerState.DimCount; d++) {
+    coords[d] = c[d];
+  }
+
+  float lod = computeLod(samplerState, sampleFootprint);
+  if (bias.Memory) {
+    lod += *(float*)bias.Memory;
+  }
+
+  Value result = { resultTypeId, VmAlloc(resultTypeId) };
+  sampleTexture(samplerState, coords, lod, (Color*)result.Memory);
+  return result;
+}
+
+// Binds the parameters and returns the function to continue with.
+const DecodedFunction* InterpretedVM::EnterFunction(const DecodedOp& op, const DecodedFunction* caller, uint32 pc) {
+  auto call = (SFunctionCall*)op.Memory;
+  const DecodedFunction* toCall = &ActiveProgram().Functions[op.Targets[0]];
+  for (uint32 i = 0; i < call->ArgumentIdsCount; i++) {
+    uint32 param = toCall->Source->Parameters[i].ResultId;
+    const Value& arg = env.Values[call->ArgumentIds[i]];
+    env.Values[param] = pointerBinds[param] ? arg : Dereference(arg);
+  }
+  callStack.push_back(CallFrame{ caller, pc + 1, call->ResultId });
+  return toCall;
+}
+
+void InterpretedVM::LeaveFunction(uint32 valueId, const DecodedFunction** func, uint32* pc) {
+  const CallFrame& frame = callStack.back();
+  env.Values[frame.ResultId] = env.Values[valueId];
+  *func = frame.Function;
+  *pc = frame.ReturnPc;
+  callStack.pop_back();
+}
+
+void InterpretedVM::ExecuteCopyObject(const DecodedOp& op) {
+  const Value& operand = env.Values[op.Targets[1]];
+  env.Values[op.Targets[0]] = pointerBinds[op.Targets[0]] ? operand : Dereference(operand);
+}
+
+void InterpretedVM::ExecuteExtInst(const DecodedOp& op) {
+  auto extInst = (SExtInst*)op.Memory;
+  if (extOperands.size() < extInst->OperandIdsCount) {
+    extOperands.resize(extInst->OperandIdsCount);
+  }
+  for (uint32 i = 0; i < extInst->OperandIdsCount; i++) {
+    extOperands[i] = Dereference(env.Values.at(extInst->OperandIds[i]));
+  }
+
+  ExtInstFunc* extFunc = op.Ext ? op.Ext : env.Extensions[extInst->SetId][extInst->Instruction];
+  env.Values[extInst->ResultId] = extFunc(this, extInst->ResultTypeId, extInst->OperandIdsCount, extOperands.data());
+}
+
+void InterpretedVM::ExecuteConvertSToF(const DecodedOp& op) {
+  auto convert = (SConvertSToF*)op.Memory;
+  Value op1 = Dereference(env.Values[convert->SignedValueId]);
+  env.Values[convert->ResultId] = DoOp(convert->ResultTypeId, Convert<int32, float>, op1);
+}
+
+// All binary instructions share the operand layout of OpFAdd.
+template<typename Func>
+void InterpretedVM::ExecuteBinary(const DecodedOp& op, Func func) {
+  auto binary = (SFAdd*)op.Memory;
+  Value op1 = Dereference(env.Values[binary->Operand1Id]);
+  Value op2 = Dereference(env.Values[binary->Operand2Id]);
+  env.Values[binary->ResultId] = DoOp(binary->ResultTypeId, func, op1, op2);
+}
+
+static bool lessThan(Value a, Value b) {
+  return Cmp<int32>(a, b) == -1;
+}
+
+static bool greaterThan(Value a, Value b) {
+  return Cmp<int32>(a, b) == 1;
+}
+
+void InterpretedVM::ExecuteVectorTimesScalar(const DecodedOp& op) {
+  auto vts = (SVectorTimesScalar*)op.Memory;
+  Value scalar = Dereference(env.Values[vts->ScalarId]);
+  Value vector = Dereference(env.Values[vts->VectorId]);
+  env.Values[vts->ResultId] = DoOp(vts->ResultTypeId, [scalar](Value comp) {return Mul<float>(scalar, comp);}, vector);
+}
+
+void InterpretedVM::ExecuteLoad(const DecodedOp& op) {
+  auto load = (SLoad*)op.Memory;
+  auto valueToLoad = env.Values.at(load->PointerId);
+  env.Values[load->ResultId] = valueToLoad;
+}
+
+void InterpretedVM::ExecuteStore(const DecodedOp& op) {
+  auto store = (SStore*)op.Memory;
+  auto val = env.Values[store->ObjectId];
+  auto var = GetType(val.TypeId);
+  if (var.Op == Op::OpTypePointer) {
+    SetVariable(store->PointerId, val.Memory);
+  } else {
+    SetVariable(store->PointerId, &val.Memory);
+  }
+}
+
+void InterpretedVM::ExecuteImageSample(const DecodedOp& op) {
+  auto sample = (SImageSampleImplicitLod*)op.Memory;
+  auto sampledImage = Dereference(env.Values.at(sample->SampledImageId));
+  auto coord = Dereference(env.Values.at(sample->CoordinateId));
+  Value bias = { 0, 0 };
+
+  // The operands start with the mask, Bias is the lowest bit so its id
+  // comes first.
+  if (sample->ImageOperandsIdsCount > 1 && (sample->ImageOperandsIds[0] & (uint32)spv::ImageOperandsMask::Bias)) {
+    bias = Dereference(env.Values.at(sample->ImageOperandsIds[1]));
+  }
+  env.Values[sample->ResultId] = TextureSample(sampledImage, coord, bias, sample->ResultTypeId);
+}
+
+void InterpretedVM::ExecuteAccessChain(const DecodedOp& op) {
+  auto access = (SAccessChain*)op.Memory;
+  auto val = Dereference(env.Values.at(access->BaseId));
+
+  uint32* indices = (uint32*)currentMemory->Alloc(sizeof(uint32) * access->IndexesIdsCount);
+  for (int i = 0; i < access->IndexesIdsCount; i++) {
+    indices[i] = *(uint32*)Dereference(env.Values[access->IndexesIds[i]]).Memory;
+  }
+
+  byte* mem = GetPointerInComposite(val.TypeId, val.Memory, access->IndexesIdsCount, indices);
+
+  Value res = VmInit(access->ResultTypeId, &mem);
+  env.Values[access->ResultId] = res;
+}
+
+void InterpretedVM::ExecuteVectorShuffle(const DecodedOp& op) {
+  auto vecShuffle = (SVectorShuffle*)op.Memory;
+  auto vec1 = Dereference(env.Values.at(vecShuffle->Vector1Id));
+  auto vec2 = Dereference(env.Values.at(vecShuffle->Vector2Id));
+
+  auto result = VmInit(vecShuffle->ResultTypeId, nullptr);
+  int v1ElCount = ElementCount(vec1.TypeId);
+  for (uint32 i = 0; i < vecShuffle->ComponentsCount; i++) {
+    int index = vecShuffle->Components[i];
+    Value toCopy;
+    if (index < v1ElCount) {
+      toCopy = vec1;
+    } else {
+      index -= v1ElCount;
+      toCopy = vec2;
     }
-    index += add * acc;
-    acc *= dd;
+
+    Value elToCopy = IndexMemberValue(toCopy, index);
+    std::memcpy(IndexMemberValue(result, i).Memory, elToCopy.Memory, GetTypeByteSize(elToCopy.TypeId));
   }
-  return VmInit(resultTypeId, ((float*)s->Data) + index * 4);
+
+  env.Values[vecShuffle->ResultId] = result;
 }
 
-uint32 InterpretedVM::Execute(Function* func) {
-  currentFunction = func;
+//TODO: FIX INDICES (NOT HIERARCHY!)
+void InterpretedVM::ExecuteCompositeExtract(const DecodedOp& op) {
+  auto extract = (SCompositeExtract*)op.Memory;
+  auto composite = env.Values[extract->CompositeId];
+  byte* mem = GetPointerInComposite(composite.TypeId, composite.Memory, extract->IndexesCount, extract->Indexes);
+  Value val = { extract->ResultTypeId, VmAlloc(extract->ResultTypeId) };
+  std::memcpy(val.Memory, mem, GetTypeByteSize(val.TypeId));
+  env.Values[extract->ResultId] = val;
+}
 
-  int pc = 0;
+void InterpretedVM::ExecuteCompositeInsert(const DecodedOp& op) {
+  auto insert = (SCompositeInsert*)op.Memory;
+  auto composite = Dereference(env.Values[insert->CompositeId]);
+  Value val = Dereference(env.Values.at(insert->ObjectId));
+  // The composite may be a constant in read-only module memory.
+  Value result = VmInit(composite.TypeId, composite.Memory);
+  byte* mem = GetPointerInComposite(result.TypeId, result.Memory, insert->IndexesCount, insert->Indexes);
+  std::memcpy(mem, val.Memory, GetTypeByteSize(val.TypeId));
+  env.Values[insert->ResultId] = result;
+}
+
+void InterpretedVM::ExecuteCompositeConstruct(const DecodedOp& op) {
+  auto construct = (SCompositeConstruct*)op.Memory;
+  Value val = { construct->ResultTypeId, VmAlloc(construct->ResultTypeId) };
+  env.Values[construct->ResultId] = val;
+  byte* memPtr = val.Memory;
+  for (int i = 0; i < construct->ConstituentsIdsCount; i++) {
+    auto memVal = env.Values[construct->ConstituentsIds[i]];
+    uint32 memSize = GetTypeByteSize(memVal.TypeId);
+    std::memcpy(memPtr, memVal.Memory, memSize);
+    memPtr += memSize;
+  }
+  assert(memPtr - val.Memory == GetTypeByteSize(construct->ResultTypeId));
+}
+
+void InterpretedVM::ExecuteVariable(const DecodedOp& op) {
+  auto var = (SVariable*)op.Memory;
+  Value val = { var->ResultTypeId, VmAlloc(var->ResultTypeId) };
+  if (var->InitializerId) {
+    std::memcpy(val.Memory, env.Values[var->InitializerId].Memory, GetTypeByteSize(val.TypeId));
+  }
+  else {
+    memset(val.Memory, 0, GetTypeByteSize(val.TypeId));
+  }
+  env.Values[var->ResultId] = val;
+}
+
+// Probes see every instruction before it runs as well as every call and
+// return. NoProfiling has nothing to do.
+struct NoProfiling {
+  static const bool Enabled = false;
+  explicit NoProfiling(Profile* profile) { }
+  void Enter(const DecodedFunction* func) { }
+  void Return() { }
+  void Step(uint32 pc) { }
+  void Finish() { }
+};
+
+// Charges the cycles since the previous instruction started to it, in the
+// context of the calls that are active.
+struct Profiling {
+  static const bool Enabled = true;
+  Profile* profile;
+  uint32 call = Profile::NoCaller;
+  ProfileCounter* counters = nullptr;
+  ProfileCounter* running = nullptr;
+  uint64 started = 0;
+
+  explicit Profiling(Profile* profile) : profile(profile) { }
+
+  void Enter(const DecodedFunction* func) {
+    call = profile->Enter(call, func);
+    counters = profile->Counters(call);
+  }
+
+  void Return() {
+    call = profile->Leave(call);
+    counters = profile->Counters(call);
+  }
+
+  void Step(uint32 pc) {
+    uint64 now = readCycleCounter();
+    if (running) {
+      running->Cycles += now - started;
+    }
+    running = &counters[pc];
+    running->Count++;
+    started = now;
+  }
+
+  // Also ends the calls a failed execution left.
+  void Finish() {
+    if (running) {
+      running->Cycles += readCycleCounter() - started;
+      running = nullptr;
+    }
+    while (call != Profile::NoCaller) {
+      call = profile->Leave(call);
+    }
+  }
+};
+
+uint32 InterpretedVM::Execute(const DecodedFunction* func) {
+#ifdef OTHERSIDE_COMPUTED_GOTO
+  if (dispatchMode == DMThreaded) {
+    return profiling ? ExecuteThreaded<Profiling>(func) : ExecuteThreaded<NoProfiling>(func);
+  }
+#endif
+  return profiling ? ExecuteSwitch<Profiling>(func) : ExecuteSwitch<NoProfiling>(func);
+}
+
+// Both loops return from the function they were started with, (uint32)-1 if
+// it failed, which is never a valid id.
+template<typename Probe>
+uint32 InterpretedVM::ExecuteSwitch(const DecodedFunction* func) {
+  const size_t outermost = callStack.size();
+  uint32 pc = 0;
+  Probe probe(profile.get());
+  probe.Enter(func);
 
   for (;;) {
-    auto op = func->Ops[pc];
+    probe.Step(pc);
+    const DecodedOp& op = func->Ops[pc];
     switch (op.Op) {
     case Op::OpBranch: {
-      auto branch = (SBranch*)op.Memory;
-      pc = func->Labels.at(branch->TargetLabelId);
-      break;
+      pc = op.Targets[0];
+      continue;
     }
     case Op::OpBranchConditional: {
       auto branch = (SBranchConditional*)op.Memory;
-      uint32 labelID;
       Value val = Dereference(env.Values[branch->ConditionId]);
-      if (*(bool*)val.Memory) {
-        labelID = branch->TrueLabelId;
-      } else {
-        labelID = branch->FalseLabelId;
-      }
-      pc = func->Labels.at(labelID);
-      break;
+      pc = *(bool*)val.Memory ? op.Targets[0] : op.Targets[1];
+      continue;
     }
-    case Op::OpFunctionCall: {
-      auto call = (SFunctionCall*)op.Memory;
-      Function toCall = prog.FunctionDefinitions.at(call->FunctionId);
-      for (uint32 i = 0; i < call->ArgumentIdsCount; i++) {
-        env.Values[toCall.Parameters[i].ResultId] = Dereference(env.Values.at(call->ArgumentIds[i]));
-      }
-      uint32 resultId = Execute(&toCall);
-      // This works since (uint32)-1 is never a valid ID.
-      if (resultId == -1) {
-        return -1;
-      }
-      currentFunction = func;
-      env.Values[call->ResultId] = env.Values[resultId];
+    case Op::OpFunctionCall:
+      func = EnterFunction(op, func, pc);
+      probe.Enter(func);
+      pc = 0;
+      continue;
+    case Op::OpCopyObject:
+      ExecuteCopyObject(op);
       break;
-    }
-    case Op::OpExtInst: {
-      auto extInst = (SExtInst*)op.Memory;
-      Value* ops = new Value[extInst->OperandIdsCount];
-      for (uint32 i = 0; i < extInst->OperandIdsCount; i++) {
-        ops[i] = Dereference(env.Values.at(extInst->OperandIds[i]));
-      }
-
-      ExtInstFunc* extFunc = env.Extensions[extInst->SetId][extInst->Instruction];
-      env.Values[extInst->ResultId] = extFunc(this, extInst->ResultTypeId, extInst->OperandIdsCount, ops);
+    case Op::OpExtInst:
+      ExecuteExtInst(op);
       break;
-    }
-    case Op::OpConvertSToF: {
-      auto convert = (SConvertSToF*)op.Memory;
-      Value op1 = Dereference(env.Values[convert->SignedValueId]);
-      env.Values[convert->ResultId] = DoOp(convert->ResultTypeId, Convert<int32, float>, op1);
+    case Op::OpConvertSToF:
+      ExecuteConvertSToF(op);
       break;
-    }
-    case Op::OpFAdd: {
-      auto add = (SFAdd*)op.Memory;
-      Value op1 = Dereference(env.Values[add->Operand1Id]);
-      Value op2 = Dereference(env.Values[add->Operand2Id]);
-      env.Values[add->ResultId] = DoOp(add->ResultTypeId, Add<float>, op1, op2);
+    case Op::OpFAdd:
+      ExecuteBinary(op, Add<float>);
       break;
-    }
-    case Op::OpIAdd: {
-      auto add = (SIAdd*)op.Memory;
-      Value op1 = Dereference(env.Values[add->Operand1Id]);
-      Value op2 = Dereference(env.Values[add->Operand2Id]);
-      env.Values[add->ResultId] = DoOp(add->ResultTypeId, Add<int>, op1, op2);
+    case Op::OpIAdd:
+      ExecuteBinary(op, Add<int>);
       break;
-    }
-    case Op::OpFSub: {
-      auto sub = (SFSub*)op.Memory;
-      Value op1 = Dereference(env.Values[sub->Operand1Id]);
-      Value op2 = Dereference(env.Values[sub->Operand2Id]);
-      env.Values[sub->ResultId] = DoOp(sub->ResultTypeId, Sub<float>, op1, op2);
+    case Op::OpFSub:
+      ExecuteBinary(op, Sub<float>);
       break;
-    }
-    case Op::OpISub: {
-      auto sub = (SISub*)op.Memory;
-      Value op1 = Dereference(env.Values[sub->Operand1Id]);
-      Value op2 = Dereference(env.Values[sub->Operand2Id]);
-      env.Values[sub->ResultId] = DoOp(sub->ResultTypeId, Sub<int>, op1, op2);
+    case Op::OpISub:
+      ExecuteBinary(op, Sub<int>);
       break;
-    }
-    case Op::OpFDiv: {
-      auto div = (SFDiv*)op.Memory;
-      Value op1 = Dereference(env.Values[div->Operand1Id]);
-      Value op2 = Dereference(env.Values[div->Operand2Id]);
-      env.Values[div->ResultId] = DoOp(div->ResultTypeId, Div<float>, op1, op2);
+    case Op::OpFDiv:
+      ExecuteBinary(op, Div<float>);
       break;
-    }
-    case Op::OpFMul: {
-      auto mul = (SFMul*)op.Memory;
-      Value op1 = Dereference(env.Values[mul->Operand1Id]);
-      Value op2 = Dereference(env.Values[mul->Operand2Id]);
-      env.Values[mul->ResultId] = DoOp(mul->ResultTypeId, Mul<float>, op1, op2);
+    case Op::OpFMul:
+      ExecuteBinary(op, Mul<float>);
       break;
-    }
-    case Op::OpIMul: {
-      auto mul = (SFMul*)op.Memory;
-      Value op1 = Dereference(env.Values[mul->Operand1Id]);
-      Value op2 = Dereference(env.Values[mul->Operand2Id]);
-      env.Values[mul->ResultId] = DoOp(mul->ResultTypeId, Mul<int>, op1, op2);
+    case Op::OpIMul:
+      ExecuteBinary(op, Mul<int>);
       break;
-    }
-    case Op::OpVectorTimesScalar: {
-      auto vts = (SVectorTimesScalar*)op.Memory;
-      Value scalar = Dereference(env.Values[vts->ScalarId]);
-      Value vector = Dereference(env.Values[vts->VectorId]);
-      env.Values[vts->ResultId] = DoOp(vts->ResultTypeId, [scalar](Value comp) {return Mul<float>(scalar, comp);}, vector);
+    case Op::OpVectorTimesScalar:
+      ExecuteVectorTimesScalar(op);
       break;
-    }
-    case Op::OpSLessThan: {
-      auto lessThan = (SSLessThan*)op.Memory;
-      Value op1 = Dereference(env.Values[lessThan->Operand1Id]);
-      Value op2 = Dereference(env.Values[lessThan->Operand2Id]);
-      env.Values[lessThan->ResultId] = DoOp(lessThan->ResultTypeId, [](Value a, Value b) { return Cmp<int32>(a, b) == -1; }, op1, op2);
+    case Op::OpSLessThan:
+      ExecuteBinary(op, lessThan);
       break;
-    }
-    case Op::OpSGreaterThan: {
-      auto greaterThan = (SSLessThan*)op.Memory;
-      Value op1 = Dereference(env.Values[greaterThan->Operand1Id]);
-      Value op2 = Dereference(env.Values[greaterThan->Operand2Id]);
-      env.Values[greaterThan->ResultId] = DoOp(greaterThan->ResultTypeId, [](Value a, Value b) { return Cmp<int32>(a, b) == 1; }, op1, op2);
+    case Op::OpSGreaterThan:
+      ExecuteBinary(op, greaterThan);
       break;
-    }
-    case Op::OpLoad: {
-      auto load = (SLoad*)op.Memory;
-      auto valueToLoad = env.Values.at(load->PointerId);
-      env.Values[load->ResultId] = valueToLoad;
+    case Op::OpLoad:
+      ExecuteLoad(op);
       break;
-    }
-    case Op::OpStore: {
-      auto store = (SStore*)op.Memory;
-      auto val = env.Values[store->ObjectId];
-      auto var = GetType(val.TypeId);
-      if (var.Op == Op::OpTypePointer) {
-        SetVariable(store->PointerId, val.Memory);
-      } else {
-        SetVariable(store->PointerId, &val.Memory);
-      }
+    case Op::OpStore:
+      ExecuteStore(op);
       break;
-    }
-    case Op::OpImageSampleImplicitLod: {
-      auto sample = (SImageSampleImplicitLod*)op.Memory;
-      auto sampledImage = Dereference(env.Values.at(sample->SampledImageId));
-      auto coord = Dereference(env.Values.at(sample->CoordinateId));
-      Value bias = { 0, 0 };
-
-      //TODO (Dario): Use sample->ImageOperandsIds
-      env.Values[sample->ResultId] = TextureSample(sampledImage, coord, bias, sample->ResultTypeId);
+    case Op::OpImageSampleImplicitLod:
+      ExecuteImageSample(op);
       break;
-    }
     case Op::OpLabel:
     case Op::OpSelectionMerge:
     case Op::OpLoopMerge:
       break;
-    case Op::OpAccessChain: {
-      auto access = (SAccessChain*)op.Memory;
-      auto val = Dereference(env.Values.at(access->BaseId));
-
-      uint32* indices = new uint32[access->IndexesIdsCount];
-      for (int i = 0; i < access->IndexesIdsCount; i++) {
-        indices[i] = *(uint32*)Dereference(env.Values[access->IndexesIds[i]]).Memory;
-      }
-
-      byte* mem = GetPointerInComposite(val.TypeId, val.Memory, access->IndexesIdsCount, indices);
-      delete indices;
-
-      Value res = VmInit(access->ResultTypeId, &mem);
-      env.Values[access->ResultId] = res;
+    case Op::OpAccessChain:
+      ExecuteAccessChain(op);
       break;
-    }
-    case Op::OpVectorShuffle: {
-      auto vecShuffle = (SVectorShuffle*)op.Memory;
-      auto vec1 = Dereference(env.Values.at(vecShuffle->Vector1Id));
-      auto vec2 = Dereference(env.Values.at(vecShuffle->Vector2Id));
-
-      auto result = VmInit(vecShuffle->ResultTypeId, nullptr);
-      int v1ElCount = ElementCount(vec1.TypeId);
-      for (uint32 i = 0; i < vecShuffle->ComponentsCount; i++) {
-        int index = vecShuffle->Components[i];
-        Value toCopy;
-        if (index < v1ElCount) {
-          toCopy = vec1;
-        } else {
-          index -= v1ElCount;
-          toCopy = vec2;
-        }
-
-        Value elToCopy = IndexMemberValue(toCopy, index);
-        std::memcpy(IndexMemberValue(result, i).Memory, elToCopy.Memory, GetTypeByteSize(elToCopy.TypeId));
-      }
-
-      env.Values[vecShuffle->ResultId] = result;
+    case Op::OpVectorShuffle:
+      ExecuteVectorShuffle(op);
       break;
-    }
-    //TODO: FIX INDICES (NOT HIERARCHY!)
-    case Op::OpCompositeExtract: {
-      auto extract = (SCompositeExtract*)op.Memory;
-      auto composite = env.Values[extract->CompositeId];
-      byte* mem = GetPointerInComposite(composite.TypeId, composite.Memory, extract->IndexesCount, extract->Indexes);
-      Value val = { extract->ResultTypeId, VmAlloc(extract->ResultTypeId) };
-      std::memcpy(val.Memory, mem, GetTypeByteSize(val.TypeId));
-      env.Values[extract->ResultId] = val;
+    case Op::OpCompositeExtract:
+      ExecuteCompositeExtract(op);
       break;
-    }
-    case Op::OpCompositeInsert: {
-      auto insert = (SCompositeInsert*)op.Memory;
-      auto composite = Dereference(env.Values[insert->CompositeId]);
-      Value val = Dereference(env.Values.at(insert->ObjectId));
-      byte* mem = GetPointerInComposite(composite.TypeId, composite.Memory, insert->IndexesCount, insert->Indexes);
-      std::memcpy(mem, val.Memory, GetTypeByteSize(val.TypeId));
-      env.Values[insert->ResultId] = VmInit(composite.TypeId, composite.Memory);
+    case Op::OpCompositeInsert:
+      ExecuteCompositeInsert(op);
       break;
-    }
-    case Op::OpCompositeConstruct: {
-      auto construct = (SCompositeConstruct*)op.Memory;
-      Value val = { construct->ResultTypeId, VmAlloc(construct->ResultTypeId) };
-      env.Values[construct->ResultId] = val;
-      byte* memPtr = val.Memory;
-      for (int i = 0; i < construct->ConstituentsIdsCount; i++) {
-        auto memVal = env.Values[construct->ConstituentsIds[i]];
-        uint32 memSize = GetTypeByteSize(memVal.TypeId);
-        std::memcpy(memPtr, memVal.Memory, memSize);
-        memPtr += memSize;
-      }
-      assert(memPtr - val.Memory == GetTypeByteSize(construct->ResultTypeId));
+    case Op::OpCompositeConstruct:
+      ExecuteCompositeConstruct(op);
       break;
-    }
-    case Op::OpVariable: {
-      auto var = (SVariable*)op.Memory;
-      Value val = { var->ResultTypeId, VmAlloc(var->ResultTypeId) };
-      if (var->InitializerId) {
-        std::memcpy(val.Memory, env.Values[var->InitializerId].Memory, GetTypeByteSize(val.TypeId));
-      }
-      else {
-        memset(val.Memory, 0, GetTypeByteSize(val.TypeId));
-      }
-      env.Values[var->ResultId] = val;
+    case Op::OpVariable:
+      ExecuteVariable(op);
       break;
+    case Op::OpReturnValue:
+    case Op::OpReturn: {
+      uint32 valueId = op.Op == Op::OpReturnValue ? ((SReturnValue*)op.Memory)->ValueId : 0;
+      if (callStack.size() == outermost) {
+        probe.Finish();
+        return valueId;
+      }
+      LeaveFunction(valueId, &func, &pc);
+      probe.Return();
+      continue;
     }
-    case Op::OpReturnValue: {
-      auto ret = (SReturnValue*)op.Memory;
-      return ret->ValueId;
-    }
-    case Op::OpReturn:
-      return 0;
     default:
-      std::cout << "Unimplemented operation: " << writeOp(op);
+      probe.Finish();
+      std::cout << "Unimplemented operation: " << writeOp(SOp{ op.Op, op.Memory });
+      callStack.resize(outermost);
       return -1;
     }
 
@@ -411,12 +487,184 @@ uint32 InterpretedVM::Execute(Function* func) {
   }
 }
 
+#ifdef OTHERSIDE_COMPUTED_GOTO
+// Labels as values are a GNU extension.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+// Every handler ends in its own indirect jump to the next one, which gives the
+// branch predictor a history per handler instead of the single jump of a
+// switch. Superinstructions run their first instruction and jump straight to
+// the code of the second. Profiled loops run the instructions of
+// superinstructions on their own so that each of them is counted.
+template<typename Probe>
+uint32 InterpretedVM::ExecuteThreaded(const DecodedFunction* func) {
+  static const void* const fused[IHCount] = {
+    &&unimplemented, &&branch, &&branchConditional, &&functionCall, &&extInst, &&convertSToF,
+    &&fAdd, &&iAdd, &&fSub, &&iSub, &&fDiv, &&fMul, &&iMul, &&vectorTimesScalar, &&sLessThan, &&sGreaterThan,
+    &&load, &&store, &&imageSample, &&accessChain, &&vectorShuffle, &&compositeExtract, &&compositeInsert,
+    &&compositeConstruct, &&variable, &&returnValue, &&returnVoid, &&copyObject,
+    &&accessChainLoad, &&loadFAdd, &&loadFSub, &&loadFMul, &&loadFDiv, &&compositeExtractChain, &&vectorShuffleStore
+  };
+  static const void* const unfused[IHCount] = {
+    &&unimplemented, &&branch, &&branchConditional, &&functionCall, &&extInst, &&convertSToF,
+    &&fAdd, &&iAdd, &&fSub, &&iSub, &&fDiv, &&fMul, &&iMul, &&vectorTimesScalar, &&sLessThan, &&sGreaterThan,
+    &&load, &&store, &&imageSample, &&accessChain, &&vectorShuffle, &&compositeExtract, &&compositeInsert,
+    &&compositeConstruct, &&variable, &&returnValue, &&returnVoid, &&copyObject,
+    &&accessChain, &&load, &&load, &&load, &&load, &&compositeExtract, &&vectorShuffle
+  };
+  const void* const* handlers = Probe::Enabled ? unfused : fused;
+
+  const size_t outermost = callStack.size();
+  const DecodedOp* ops = func->Ops.data();
+  uint32 pc = 0;
+  uint32 valueId = 0;
+  Probe probe(profile.get());
+  probe.Enter(func);
+
+#define DISPATCH() probe.Step(pc); goto *handlers[ops[pc].Handler]
+#define NEXT() pc++; DISPATCH()
+
+  DISPATCH();
+
+branch:
+  pc = ops[pc].Targets[0];
+  DISPATCH();
+branchConditional: {
+    auto branch = (SBranchConditional*)ops[pc].Memory;
+    Value val = Dereference(env.Values[branch->ConditionId]);
+    pc = *(bool*)val.Memory ? ops[pc].Targets[0] : ops[pc].Targets[1];
+    DISPATCH();
+  }
+functionCall:
+  func = EnterFunction(ops[pc], func, pc);
+  probe.Enter(func);
+  ops = func->Ops.data();
+  pc = 0;
+  DISPATCH();
+extInst:
+  ExecuteExtInst(ops[pc]);
+  NEXT();
+convertSToF:
+  ExecuteConvertSToF(ops[pc]);
+  NEXT();
+fAdd:
+  ExecuteBinary(ops[pc], Add<float>);
+  NEXT();
+iAdd:
+  ExecuteBinary(ops[pc], Add<int>);
+  NEXT();
+fSub:
+  ExecuteBinary(ops[pc], Sub<float>);
+  NEXT();
+iSub:
+  ExecuteBinary(ops[pc], Sub<int>);
+  NEXT();
+fDiv:
+  ExecuteBinary(ops[pc], Div<float>);
+  NEXT();
+fMul:
+  ExecuteBinary(ops[pc], Mul<float>);
+  NEXT();
+iMul:
+  ExecuteBinary(ops[pc], Mul<int>);
+  NEXT();
+vectorTimesScalar:
+  ExecuteVectorTimesScalar(ops[pc]);
+  NEXT();
+sLessThan:
+  ExecuteBinary(ops[pc], lessThan);
+  NEXT();
+sGreaterThan:
+  ExecuteBinary(ops[pc], greaterThan);
+  NEXT();
+load:
+  ExecuteLoad(ops[pc]);
+  NEXT();
+store:
+  ExecuteStore(ops[pc]);
+  NEXT();
+imageSample:
+  ExecuteImageSample(ops[pc]);
+  NEXT();
+accessChain:
+  ExecuteAccessChain(ops[pc]);
+  NEXT();
+vectorShuffle:
+  ExecuteVectorShuffle(ops[pc]);
+  NEXT();
+compositeExtract:
+  ExecuteCompositeExtract(ops[pc]);
+  NEXT();
+compositeInsert:
+  ExecuteCompositeInsert(ops[pc]);
+  NEXT();
+compositeConstruct:
+  ExecuteCompositeConstruct(ops[pc]);
+  NEXT();
+variable:
+  ExecuteVariable(ops[pc]);
+  NEXT();
+returnValue:
+  valueId = ((SReturnValue*)ops[pc].Memory)->ValueId;
+  goto leave;
+returnVoid:
+  valueId = 0;
+leave:
+  if (callStack.size() == outermost) {
+    probe.Finish();
+    return valueId;
+  }
+  LeaveFunction(valueId, &func, &pc);
+  probe.Return();
+  ops = func->Ops.data();
+  DISPATCH();
+copyObject:
+  ExecuteCopyObject(ops[pc]);
+  NEXT();
+
+accessChainLoad:
+  ExecuteAccessChain(ops[pc++]);
+  goto load;
+loadFAdd:
+  ExecuteLoad(ops[pc++]);
+  goto fAdd;
+loadFSub:
+  ExecuteLoad(ops[pc++]);
+  goto fSub;
+loadFMul:
+  ExecuteLoad(ops[pc++]);
+  goto fMul;
+loadFDiv:
+  ExecuteLoad(ops[pc++]);
+  goto fDiv;
+compositeExtractChain:
+  while (ops[pc].Handler == IHCompositeExtractChain) {
+    ExecuteCompositeExtract(ops[pc++]);
+  }
+  goto compositeExtract;
+vectorShuffleStore:
+  ExecuteVectorShuffle(ops[pc++]);
+  goto store;
+
+unimplemented:
+  probe.Finish();
+  std::cout << "Unimplemented operation: " << writeOp(SOp{ ops[pc].Op, ops[pc].Memory });
+  callStack.resize(outermost);
+  return -1;
+
+#undef NEXT
+#undef DISPATCH
+}
+
+#pragma GCC diagnostic pop
+#endif
+
 void* InterpretedVM::ReadVariable(uint32 id) const {
-  auto var = prog.Variables.at(id);
-  if (env.Values.find(var.ResultId) == env.Values.end()) {
+  if (id >= env.Values.size()) {
     return nullptr;
   }
-  return env.Values[var.ResultId].Memory;
+  return env.Values[id].Memory;
 }
 
 void* InterpretedVM::ReadVariable(std::string name) const {
@@ -429,24 +677,27 @@ void* InterpretedVM::ReadVariable(std::string name) const {
 }
 
 bool InterpretedVM::SetVariable(uint32 id, void* value) {
-  SVariable var;
-  
-  if (currentFunction && currentFunction->Variables.find(id) != currentFunction->Variables.end()) {
-    var = currentFunction->Variables.at(id);
-  } else {
-    var = prog.Variables.at(id);
+  if (id >= env.Values.size()) {
+    return false;
   }
 
-  if (env.Values.find(var.ResultId) == env.Values.end()) {
+  // Function variables are always allocated by their OpVariable before they
+  // are stored to, so only module scope variables can be unset here.
+  if (!env.Values[id].Memory) {
+    auto varIt = prog.Variables.find(id);
+    if (varIt == prog.Variables.end()) {
+      return false;
+    }
+    auto& var = varIt->second;
     Value val = { var.ResultTypeId, VmAlloc(var.ResultTypeId) };
     if (value) {
       std::memcpy(val.Memory, value, GetTypeByteSize(val.TypeId));
     } else {
       memset(val.Memory, 0, GetTypeByteSize(val.TypeId));
     }
-    env.Values[var.ResultId] = val;
+    env.Values[id] = val;
   } else {
-    Value val = env.Values[var.ResultId];
+    Value val = env.Values[id];
     std::memcpy(val.Memory, value, GetTypeByteSize(val.TypeId));
   }
   return true;
@@ -455,6 +706,14 @@ bool InterpretedVM::SetVariable(uint32 id, void* value) {
 bool InterpretedVM::SetVariable(std::string name, void* value) {
   for (auto& nameOp : prog.Names) {
     if (nameOp.second.Name == name) {
+      auto varIt = prog.Variables.find(nameOp.second.TargetId);
+      if (varIt != prog.Variables.end() && isUniformStorage(varIt->second.StorageClass)) {
+        ResetSpecialization();
+      }
+      // Outputs and the per-invocation inputs are rebound by every fork.
+      if (partition && std::find(partition->InvariantVariables.begin(), partition->InvariantVariables.end(), nameOp.second.TargetId) != partition->InvariantVariables.end()) {
+        prologueCurrent = false;
+      }
       return SetVariable(nameOp.second.TargetId, value);
     }
   }
@@ -462,60 +721,7 @@ bool InterpretedVM::SetVariable(std::string name, void* value) {
 }
 
 uint32 InterpretedVM::GetTypeByteSize(uint32 typeId) const {
-  if (TypeByteSizes.find(typeId) != TypeByteSizes.end()) {
-    return TypeByteSizes.at(typeId);
-  }
-
-  auto definedType = prog.DefinedTypes.at(typeId);
-  uint32 size = 0;
-
-  switch (definedType.Op)
-  {
-  case Op::OpTypeArray: {
-    auto arr = (STypeArray*)definedType.Memory;
-    size = GetTypeByteSize(size) * *(uint32*)env.Values[arr->LengthId].Memory;
-    break;
-  }
-  case Op::OpTypeInt: {
-    auto i = (STypeInt*)definedType.Memory;
-    assert(i->Width % 8 == 0);
-    size = i->Width / 8;
-    break;
-  }
-  case Op::OpTypeFloat: {
-    auto f = (STypeFloat*)definedType.Memory;
-    assert(f->Width % 8 == 0);
-    size = f->Width / 8;
-    break;
-  }
-  case Op::OpTypeBool: {
-    size = sizeof(bool);
-    break;
-  }
-  case Op::OpTypePointer: {
-    size = sizeof(void*);
-    break;
-  }
-  case Op::OpTypeStruct: {
-    auto s = (STypeStruct*)definedType.Memory;
-    for (uint32 i = 0; i < s->MembertypeIdsCount; i++) {
-      uint32 id = s->MembertypeIds[i];
-      size += GetTypeByteSize(id);
-    }
-    break;
-  }
-  case Op::OpTypeVector: {
-    auto v = (STypeVector*)definedType.Memory;
-    size = GetTypeByteSize(v->ComponentTypeId) * v->ComponentCount;
-    break;
-  }
-  default:
-    std::cout << "Not a type definition: " << writeOp(definedType);
-  }
-
-  //TODO: Precalc type sizes
-  //TypeByteSizes[typeId] = size;
-  return size;
+  return (*layouts)[typeId].Size;
 }
 
 bool InterpretedVM::InitializeConstants() {
@@ -546,12 +752,14 @@ bool InterpretedVM::InitializeConstants() {
       auto constant = (SConstantFalse*)op.Memory;
       Value val = { constant->ResultTypeId, VmAlloc(constant->ResultTypeId) };
       *(bool*)val.Memory = false;
+      env.Values[constant->ResultId] = val;
       break;
     }
     case Op::OpConstantTrue: {
       auto constant = (SConstantTrue*)op.Memory;
       Value val = { constant->ResultTypeId, VmAlloc(constant->ResultTypeId) };
       *(bool*)val.Memory = true;
+      env.Values[constant->ResultId] = val;
       break;
     }
     default:
@@ -563,7 +771,25 @@ bool InterpretedVM::InitializeConstants() {
   return true;
 }
 
+bool InterpretedVM::InitializeVariables() {
+  // Module scope variables get their storage up front so that stores during
+  // an invocation never have to allocate memory that outlives it.
+  for (auto& var : prog.Variables) {
+    if (!env.Values[var.first].Memory) {
+      env.Values[var.first] = VmInit(var.second.ResultTypeId, nullptr);
+    }
+  }
+  return true;
+}
+
 bool InterpretedVM::ImportExt(SExtInstImport import) {
+  const StaticExtension* linked = findStaticExtension(import.Name);
+  if (linked) {
+    env.Extensions[import.ResultId] = linked->Table;
+    env.BatchExtensions[import.ResultId] = ExtBatchTable{ linked->BatchTable, linked->BatchInstructionCount };
+    return true;
+  }
+
   std::string name(import.Name);
   std::transform(name.begin(), name.end(), name.begin(), ::tolower);
   auto filename = ("ext/" + LIB_NAME(name) + LIBRARY_EXT);
@@ -576,6 +802,13 @@ bool InterpretedVM::ImportExt(SExtInstImport import) {
     if (func) {
       auto res = func();
       env.Extensions[import.ResultId] = res;
+      const char* batchFuncName = xstr(EXT_EXPORT_BATCH_TABLE_FUNC_NAME);
+      GetExtBatchTableFunc* batchFunc = (GetExtBatchTableFunc*)LOAD_SYMBOL(extInst, TEXT(batchFuncName));
+      ExtBatchTable batchTable = { nullptr, 0 };
+      if (batchFunc) {
+        batchTable.Functions = batchFunc(&batchTable.Count);
+      }
+      env.BatchExtensions[import.ResultId] = batchTable;
       return true;
     }
   }
@@ -585,6 +818,36 @@ bool InterpretedVM::ImportExt(SExtInstImport import) {
 }
 
 bool InterpretedVM::Setup() {
+    CollectProfile();
+    env.Values.assign(prog.IDBound, Value{ 0, nullptr });
+    specialization.reset();
+    partition.reset();
+    prologueCurrent = false;
+
+    if (!layouts || !decoded) {
+        PreparedModule prepared;
+        if (!prepareModule(prog, &prepared, std::cout)) {
+            return false;
+        }
+        layouts = prepared.Layouts;
+        decoded = prepared.Decoded;
+    }
+    callStack.reserve(getMaxCallDepth(*decoded));
+
+    pointerBinds.assign(prog.IDBound, false);
+    for (auto& func : prog.FunctionDefinitions) {
+        for (auto& param : func.second.Parameters) {
+            pointerBinds[param.ResultId] = GetType(param.ResultTypeId).Op == Op::OpTypePointer;
+        }
+    }
+    for (auto& func : decoded->Functions) {
+        for (auto& op : func.Ops) {
+            if (op.Op == Op::OpCopyObject && op.Bind == IBNone) {
+                pointerBinds[op.Targets[0]] = GetType(((SCopyObject*)op.Memory)->ResultTypeId).Op == Op::OpTypePointer;
+            }
+        }
+    }
+
     for (auto& ext : prog.ExtensionImports) {
         if(!ImportExt(ext.second)) {
             std::cout << "Loading externsion " << ext.second.Name << " failed!" << std::endl;
@@ -597,15 +860,214 @@ bool InterpretedVM::Setup() {
         return false;
     }
 
+    if (!InitializeVariables()) {
+        std::cout << "Could not allocate variables!" << std::endl;
+        return false;
+    }
+
     return true;
 }
 
-bool InterpretedVM::Run() {
-  for (auto& ep : prog.EntryPoints) {
-    auto func = prog.FunctionDefinitions.at(ep.second.EntryPointId);
-    if (Execute(&func) != 0) {
+InterpretedVM::InterpretedVM(const InterpretedVM& parent) :
+  prog(parent.prog),
+  ownedEnv(new Environment(parent.env)),
+  env(*ownedEnv),
+  decoded(parent.decoded),
+  layouts(parent.layouts),
+  specialization(parent.specialization),
+  partition(parent.partition),
+  parentProfile(parent.profiling ? parent.profile : nullptr),
+  profiling(parent.profiling),
+  currentMemory(&ConstantMemory),
+  frameMemory(parent.frameMemory),
+  prologueCurrent(parent.prologueCurrent) {
+  std::copy(parent.sampleFootprint, parent.sampleFootprint + SAMPLER_MAX_DIMS, sampleFootprint);
+  mathPrecision = parent.mathPrecision;
+  dispatchMode = parent.dispatchMode;
+  callStack.reserve(parent.callStack.capacity());
+  pointerBinds = parent.pointerBinds;
+  if (profiling) {
+    profile.reset(new Profile());
+  }
+
+  // Constants keep pointing into the parent's memory, variables are copied so
+  // that binding or storing to them does not affect any other VM.
+  for (auto& var : prog.Variables) {
+    Value& val = env.Values[var.first];
+    if (val.Memory) {
+      val = VmInit(val.TypeId, val.Memory);
+    }
+  }
+}
+
+InterpretedVM::~InterpretedVM() {
+  if (parentProfile) {
+    CollectProfile();
+    parentProfile->Merge(*profile);
+  }
+}
+
+void InterpretedVM::SetSampleFootprint(float x, float y, float z) {
+  sampleFootprint[0] = x;
+  sampleFootprint[1] = y;
+  sampleFootprint[2] = z;
+}
+
+void InterpretedVM::SetMathPrecision(MathPrecision precision) {
+  mathPrecision = precision;
+  ResetSpecialization();
+  prologueCurrent = false;
+}
+
+void InterpretedVM::SetDispatchMode(DispatchMode mode) {
+  dispatchMode = mode;
+}
+
+bool InterpretedVM::Specialize(SpecializationStats* stats) {
+  CollectProfile();
+  // Folding runs single instructions that are not part of the program.
+  bool wasProfiling = profiling;
+  profiling = false;
+  std::shared_ptr<Specialization> result(new Specialization());
+  bool success = specialize(*this, result.get(), stats);
+  profiling = wasProfiling;
+  if (!success) {
+    return false;
+  }
+  specialization = result;
+  partition.reset();
+  return true;
+}
+
+bool InterpretedVM::IsSpecialized() const {
+  return specialization != nullptr;
+}
+
+// A partition of the specialized program goes with it.
+void InterpretedVM::ResetSpecialization() {
+  if (specialization) {
+    CollectProfile();
+    specialization.reset();
+    partition.reset();
+  }
+}
+
+bool InterpretedVM::Hoist(const std::vector<std::string>& perInvocation, HoistingStats* stats) {
+  if (!decoded) {
+    std::cout << "The VM has to be set up before it is hoisted." << std::endl;
+    return false;
+  }
+
+  std::vector<uint32> ids;
+  for (auto& name : perInvocation) {
+    uint32 id = 0;
+    for (auto& nameOp : prog.Names) {
+      if (nameOp.second.Name == name && prog.Variables.find(nameOp.second.TargetId) != prog.Variables.end()) {
+        id = nameOp.second.TargetId;
+      }
+    }
+    if (!id) {
+      std::cout << "There is no variable " << name << "." << std::endl;
       return false;
     }
+    ids.push_back(id);
+  }
+
+  CollectProfile();
+  std::shared_ptr<InvocationPartition> result(new InvocationPartition());
+  const DecodedProgram& program = specialization ? *specialization->Program : *decoded;
+  if (!partitionInvocation(prog, program, ids, result.get(), stats)) {
+    return false;
   }
+  partition = result;
+  prologueCurrent = false;
   return true;
 }
+
+bool InterpretedVM::IsHoisted() const {
+  return partition != nullptr;
+}
+
+void InterpretedVM::InvalidatePrologue() {
+  prologueCurrent = false;
+}
+
+bool InterpretedVM::UpdatePrologue() {
+  return !partition || prologueCurrent || RunPrologue();
+}
+
+void InterpretedVM::SetProfiling(bool enabled) {
+  profiling = enabled;
+  if (enabled && !profile) {
+    profile.reset(new Profile());
+  }
+}
+
+const Profile* InterpretedVM::GetProfile() {
+  CollectProfile();
+  return profile.get();
+}
+
+void InterpretedVM::CollectProfile() {
+  if (profile) {
+    profile->Collect(prog);
+  }
+}
+
+bool InterpretedVM::RunPrologue() {
+  frameMemory.reset(new Arena());
+  currentMemory = frameMemory.get();
+
+  bool success = true;
+  for (uint32 ep : partition->Prologue->EntryPoints) {
+    const DecodedFunction& func = partition->Prologue->Functions[ep];
+    if (Execute(&func) != 0) {
+      success = false;
+      break;
+    }
+    // Loads alias the variable, which a fork replaces with its own copy.
+    for (auto& op : func.Ops) {
+      if (op.Op == Op::OpLoad) {
+        uint32 resultId = ((SLoad*)op.Memory)->ResultId;
+        env.Values[resultId] = Dereference(env.Values[resultId]);
+      }
+    }
+  }
+
+  currentMemory = &ConstantMemory;
+  prologueCurrent = success;
+  return success;
+}
+
+const DecodedProgram& InterpretedVM::ActiveProgram() const {
+  if (partition) {
+    return *partition->Body;
+  }
+  return specialization ? *specialization->Program : *decoded;
+}
+
+std::unique_ptr<InterpretedVM> InterpretedVM::Fork() const {
+  return std::unique_ptr<InterpretedVM>(new InterpretedVM(*this));
+}
+
+bool InterpretedVM::Run() {
+  if (partition && !prologueCurrent && !RunPrologue()) {
+    return false;
+  }
+
+  // Results of the previous invocation stay readable until the next one starts.
+  InvocationMemory.Reset();
+  currentMemory = &InvocationMemory;
+
+  bool success = true;
+  const DecodedProgram& program = ActiveProgram();
+  for (uint32 ep : program.EntryPoints) {
+    if (Execute(&program.Functions[ep]) != 0) {
+      success = false;
+      break;
+    }
+  }
+
+  currentMemory = &ConstantMemory;
+  return success;
+}
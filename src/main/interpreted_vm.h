@@ -3,33 +3,199 @@
 #include <memory>
 #include <vector>
 #include "parser_definitions.h"
+#include "decoder.h"
+#include "type_layout.h"
+#include "arena.h"
+#include "sampling.h"
+#include "specializer.h"
+#include "hoisting.h"
+#include "profiler.h"
 
-struct Function;
+template<uint32 Lanes> class WideVM;
+
+// Threaded dispatch jumps through a table of label addresses, an extension
+// GCC and Clang support.
+#if defined(__GNUC__)
+#define OTHERSIDE_COMPUTED_GOTO
+#endif
+
+// How the interpreter gets from one instruction to the next. DMSwitch switches
+// on the opcode of every instruction, DMThreaded jumps from handler to handler
+// and runs the superinstructions selectHandlers() fused. Without computed
+// gotos DMThreaded falls back to DMSwitch.
+enum DispatchMode {
+  DMSwitch,
+  DMThreaded
+};
+
+// Where a call returns to. Parameters and results are registers like every
+// other id: SPIR-V has no recursion, so a function never has two activations
+// that could overwrite each other's.
+struct CallFrame {
+  const DecodedFunction* Function;
+  uint32 ReturnPc;
+  uint32 ResultId;
+};
 
 class InterpretedVM : public VM {
 private:
+  template<uint32 Lanes> friend class WideVM;
+  friend class NativeVM;
+  friend class Specializer;
+
+
   Program& prog;
+  std::unique_ptr<Environment> ownedEnv;
   Environment& env;
-  Function* currentFunction;
-  std::map<uint32, uint32> TypeByteSizes;
-  std::vector<std::unique_ptr<byte>> VmMemory;
+  std::shared_ptr<const DecodedProgram> decoded;
+  std::shared_ptr<const TypeLayoutTable> layouts;
+  std::shared_ptr<const Specialization> specialization;
+  std::shared_ptr<const InvocationPartition> partition;
+  // Forks count into their own profile and merge it into their parent's when
+  // they are destroyed.
+  std::shared_ptr<Profile> profile;
+  std::shared_ptr<Profile> parentProfile;
+  bool profiling = false;
+
+  // Constants and module scope variables live as long as the VM, everything
+  // else is allocated per invocation and released when the next Run() starts.
+  Arena ConstantMemory;
+  Arena InvocationMemory;
+  Arena* currentMemory;
+  // Results of the prologue, replaced when it runs again since forks may still
+  // read the previous ones.
+  std::shared_ptr<Arena> frameMemory;
+  bool prologueCurrent = false;
+  // Operands of the extended instruction being executed, grown to the largest
+  // operand count seen and reused afterwards.
+  std::vector<Value> extOperands;
+  // Calls run in the dispatch loop of their caller instead of recursing.
+  // Setup() reserves the deepest nesting, so calls don't allocate.
+  std::vector<CallFrame> callStack;
+  // Parameters and copies declared as pointers, by id. They alias what they
+  // are bound to, other binds dereference it so that they hold the value it
+  // had when they were bound.
+  std::vector<bool> pointerBinds;
+
+  // Addressing of the sampler used last. Samplers are expected to keep their
+  // dimensions while they are bound, a different texture or filter mode is
+  // picked up on the next sample.
+  const Sampler* preparedSampler = nullptr;
+  SamplerState samplerState;
+  float sampleFootprint[SAMPLER_MAX_DIMS] = { 0, 0, 0 };
+  MathPrecision mathPrecision = MPPrecise;
+  DispatchMode dispatchMode = DMThreaded;
 
   byte* VmAlloc(uint32 typeId) override;
   
   Value TextureSample(Value sampler, Value coord, Value bias, uint32 resultTypeId);
   
-  uint32 Execute(Function* func);
+  // The dispatch loops are instantiated once with a probe that counts and
+  // times every instruction and once with one that compiles to nothing.
+  uint32 Execute(const DecodedFunction* func);
+  template<typename Probe>
+  uint32 ExecuteSwitch(const DecodedFunction* func);
+#ifdef OTHERSIDE_COMPUTED_GOTO
+  template<typename Probe>
+  uint32 ExecuteThreaded(const DecodedFunction* func);
+#endif
+
+  // Instruction bodies shared by the dispatch loops.
+  const DecodedFunction* EnterFunction(const DecodedOp& op, const DecodedFunction* caller, uint32 pc);
+  void LeaveFunction(uint32 valueId, const DecodedFunction** func, uint32* pc);
+  void ExecuteCopyObject(const DecodedOp& op);
+  void ExecuteExtInst(const DecodedOp& op);
+  void ExecuteConvertSToF(const DecodedOp& op);
+  template<typename Func>
+  void ExecuteBinary(const DecodedOp& op, Func func);
+  void ExecuteVectorTimesScalar(const DecodedOp& op);
+  void ExecuteLoad(const DecodedOp& op);
+  void ExecuteStore(const DecodedOp& op);
+  void ExecuteImageSample(const DecodedOp& op);
+  void ExecuteAccessChain(const DecodedOp& op);
+  void ExecuteVectorShuffle(const DecodedOp& op);
+  void ExecuteCompositeExtract(const DecodedOp& op);
+  void ExecuteCompositeInsert(const DecodedOp& op);
+  void ExecuteCompositeConstruct(const DecodedOp& op);
+  void ExecuteVariable(const DecodedOp& op);
+  // The body of the partition if there is one, otherwise the specialized
+  // program if there is one and the decoded one if not.
+  const DecodedProgram& ActiveProgram() const;
+  void ResetSpecialization();
+  bool RunPrologue();
+  // Counters refer to the decoded functions, they are collected before the
+  // VM lets go of a program.
+  void CollectProfile();
   
   void * ReadVariable(uint32 id) const;
   bool SetVariable(uint32 id, void * value);
   
 
   bool InitializeConstants();
+  bool InitializeVariables();
 
   bool ImportExt(SExtInstImport import);
 
+  InterpretedVM(const InterpretedVM& parent);
+
 public:
-  InterpretedVM(Program& prog, Environment& env) : prog(prog), env(env), currentFunction(nullptr) { }
+  InterpretedVM(Program& prog, Environment& env) : prog(prog), env(env), currentMemory(&ConstantMemory) { }
+  // Uses type layouts and decoded functions that were prepared in advance
+  // instead of computing them in Setup().
+  InterpretedVM(Program& prog, Environment& env, const PreparedModule& prepared) :
+    prog(prog), env(env), decoded(prepared.Decoded), layouts(prepared.Layouts), currentMemory(&ConstantMemory) { }
+
+  // Creates a VM that shares the program, the decoded functions and the
+  // constants of this one but has its own registers, variable bindings and
+  // invocation memory. Forks of the same VM can run concurrently.
+  std::unique_ptr<InterpretedVM> Fork() const;
+  ~InterpretedVM();
+
+  // Extent of an invocation in normalized texture coordinates, which selects
+  // the mip level of implicitly sampled textures. Invocations run on their own,
+  // so there are no neighbours to take derivatives from. The default of zero
+  // samples the full resolution unless a bias is given. Forks inherit it.
+  void SetSampleFootprint(float x, float y, float z = 0);
+
+  // Accuracy of the extended math instructions, MPPrecise by default. Forks
+  // inherit it.
+  void SetMathPrecision(MathPrecision precision);
+
+  // DMThreaded by default. Forks inherit it.
+  void SetDispatchMode(DispatchMode mode);
+
+  // Folds everything that only depends on constants and the uniforms bound
+  // now, see specializer.h. Run() executes the specialized program until a
+  // uniform is bound again with SetVariable() or the math precision changes.
+  // Writing through a bound uniform pointer requires another Specialize().
+  // Forks and wide VMs created afterwards share the specialization.
+  bool Specialize(SpecializationStats* stats = nullptr);
+  bool IsSpecialized() const;
+
+  // Splits the entry points into a prologue that runs once per frame and a
+  // body that runs per invocation, see hoisting.h. perInvocation names the
+  // variables that change between invocations. Run() runs the prologue first
+  // whenever it is out of date: after binding a variable the prologue reads
+  // with SetVariable(), changing the math precision or InvalidatePrologue(), which
+  // has to be called when the memory the bound variables point to changes.
+  // Applies to the specialized program if there is one, losing that or
+  // specializing again drops the partition. Forks share it as well as the
+  // prologue results computed so far.
+  bool Hoist(const std::vector<std::string>& perInvocation, HoistingStats* stats = nullptr);
+  bool IsHoisted() const;
+  void InvalidatePrologue();
+  // Runs the prologue now if it is out of date, so that forks and wide VMs
+  // created afterwards share its results instead of each running it.
+  bool UpdatePrologue();
+
+  // Counts executions and cycles of every instruction Run() executes per
+  // call stack and records every call for a trace, see profiler.h. Off by
+  // default, which costs nothing per instruction. Forks inherit it and add
+  // their counts to the profile of this VM when they are destroyed, which has
+  // to happen before it is read. Wide VMs are not profiled.
+  void SetProfiling(bool enabled);
+  // nullptr if profiling was never enabled.
+  const Profile* GetProfile();
 
   virtual bool Setup() override;
   virtual bool Run() override;
@@ -46,4 +212,5 @@ public:
   SOp GetType(uint32 typeId) const override;
   bool IsVectorType(uint32 typeId) const override;
   uint32 ElementCount(uint32 typeId) const override;
+  MathPrecision GetMathPrecision() const override;
 };
\ No newline at end of file
@@ -0,0 +1,407 @@
+#include "module_cache.h"
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+#include "parser.h"
+#include "mapped_file.h"
+#include "static_extensions.h"
+
+static const uint32 CacheMagic = 0x4353544f; // "OTSC"
+static const uint32 CacheFormatVersion = 2;
+static const uint32 NoIndex = (uint32)-1;
+static const uintptr_t NullOffset = (uintptr_t)-1;
+
+struct CacheHeader {
+  uint32 Magic;
+  uint32 FormatVersion;
+  uint32 PointerSize;
+  uint32 Reserved;
+  uint64 ModuleHash;
+  // Hash of everything following the header.
+  uint64 Checksum;
+
+  uint32 Version;
+  uint32 GeneratorMagic;
+  uint32 IDBound;
+  uint32 InstructionSchema;
+
+  uint32 WordCount;
+  uint32 OpCount;
+  uint32 OpMemorySize;
+  uint32 RelocationCount;
+  uint32 TypeCount;
+  uint32 MemberOffsetCount;
+  uint32 FunctionCount;
+  uint32 DecodedOpCount;
+  uint32 EntryPointCount;
+  uint32 Padding;
+};
+
+struct CachedOp {
+  uint32 Op;
+  // Byte offset of the operand struct in the operand memory.
+  uint32 Offset;
+};
+
+struct CachedType {
+  // Instruction defining the type, NoIndex for ids that aren't types.
+  uint32 DefinitionIndex;
+  uint32 Size;
+  uint32 Alignment;
+  uint32 ElementTypeId;
+  uint32 ElementCount;
+  uint32 FirstMember;
+};
+
+struct CachedFunction {
+  uint32 Id;
+  uint32 OpCount;
+};
+
+struct CachedDecodedOp {
+  uint32 Op;
+  uint32 OpIndex;
+  uint32 Targets[2];
+  uint32 Bind;
+};
+
+// Sections follow the header in this order:
+//   uint32 words[WordCount]
+//   CachedOp ops[OpCount]
+//   byte opMemory[OpMemorySize]
+//   uint32 relocations[RelocationCount]  (offsets of pointers in opMemory)
+//   CachedType types[TypeCount]
+//   uint32 memberOffsets[MemberOffsetCount]
+//   CachedFunction functions[FunctionCount]
+//   CachedDecodedOp decodedOps[DecodedOpCount]  (function bodies back to back)
+//   uint32 entryPoints[EntryPointCount]
+// Pointers in opMemory hold byte offsets into words, NullOffset for null.
+
+template<typename T>
+static void append(std::vector<byte>* out, const T* data, size_t count) {
+  out->insert(out->end(), (const byte*)data, (const byte*)(data + count));
+}
+
+struct CacheReader {
+  const byte* Data;
+  size_t Size;
+  size_t Offset;
+
+  template<typename T>
+  const T* Take(size_t count) {
+    if ((Size - Offset) / sizeof(T) < count) {
+      return nullptr;
+    }
+    const T* result = (const T*)(Data + Offset);
+    Offset += sizeof(T) * count;
+    return result;
+  }
+};
+
+uint64 hashModuleData(const void* data, size_t size) {
+  uint64 hash = 0xcbf29ce484222325ull;
+  const byte* bytes = (const byte*)data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+bool getModuleCachePath(const char* directory, const char* modulePath, std::string* outPath, uint64* outModuleHash) {
+  MappedFile module;
+  if (!module.Open(modulePath)) {
+    return false;
+  }
+
+  *outModuleHash = hashModuleData(module.Data(), module.Size());
+
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.otsc", (unsigned long long)*outModuleHash);
+  *outPath = std::string(directory) + "/" + name;
+  return true;
+}
+
+bool writeModuleCache(const char* path, uint64 moduleHash, const Program& prog, const PreparedModule& prepared, std::ostream& errorOut) {
+  if (!prog.Words || !prepared.Layouts || !prepared.Decoded) {
+    errorOut << "Only parsed and prepared programs can be cached." << std::endl;
+    return false;
+  }
+
+  const byte* wordsBegin = (const byte*)prog.Words.get();
+  const byte* wordsEnd = wordsBegin + sizeof(uint32) * prog.WordCount;
+
+  std::vector<CachedOp> ops;
+  std::vector<byte> opMemory;
+  std::vector<uint32> relocations;
+  std::unordered_map<const void*, uint32> opIndices;
+  ops.reserve(prog.Ops.size());
+
+  for (size_t i = 0; i < prog.Ops.size(); i++) {
+    SOp op = prog.Ops[i];
+    uint32 size;
+    int pointerOffset;
+    if (!getOpLayout(op.Op, &size, &pointerOffset)) {
+      errorOut << "Instruction " << i << " can not be cached." << std::endl;
+      return false;
+    }
+
+    opIndices.insert({ op.Memory, (uint32)i });
+    CachedOp cached = { (uint32)op.Op, (uint32)opMemory.size() };
+    append(&opMemory, (const byte*)op.Memory, size);
+
+    if (pointerOffset >= 0) {
+      const byte* target;
+      std::memcpy(&target, (const byte*)op.Memory + pointerOffset, sizeof(target));
+      uintptr_t offset = NullOffset;
+      if (target) {
+        if (target < wordsBegin || target > wordsEnd) {
+          errorOut << "Operands of instruction " << i << " point outside of the module." << std::endl;
+          return false;
+        }
+        offset = target - wordsBegin;
+      }
+      std::memcpy(&opMemory[cached.Offset + pointerOffset], &offset, sizeof(offset));
+      relocations.push_back(cached.Offset + pointerOffset);
+    }
+    ops.push_back(cached);
+  }
+
+  const TypeLayoutTable& layouts = *prepared.Layouts;
+  std::vector<CachedType> types;
+  types.reserve(layouts.Types.size());
+  for (auto& type : layouts.Types) {
+    CachedType cached = { NoIndex, type.Size, type.Alignment, type.ElementTypeId, type.ElementCount, type.FirstMember };
+    if (type.Definition.Memory) {
+      auto index = opIndices.find(type.Definition.Memory);
+      if (index == opIndices.end()) {
+        errorOut << "Type layout refers to an unknown instruction." << std::endl;
+        return false;
+      }
+      cached.DefinitionIndex = index->second;
+    }
+    types.push_back(cached);
+  }
+
+  const DecodedProgram& decoded = *prepared.Decoded;
+  std::vector<CachedFunction> functions;
+  std::vector<CachedDecodedOp> decodedOps;
+  for (auto& func : decoded.Functions) {
+    functions.push_back(CachedFunction{ func.Id, (uint32)func.Ops.size() });
+    for (auto& op : func.Ops) {
+      auto index = opIndices.find(op.Memory);
+      if (index == opIndices.end()) {
+        errorOut << "Function " << func.Id << " refers to an unknown instruction." << std::endl;
+        return false;
+      }
+      decodedOps.push_back(CachedDecodedOp{ (uint32)op.Op, index->second, { op.Targets[0], op.Targets[1] }, (uint32)op.Bind });
+    }
+  }
+
+  std::vector<byte> payload;
+  append(&payload, prog.Words.get(), prog.WordCount);
+  append(&payload, ops.data(), ops.size());
+  append(&payload, opMemory.data(), opMemory.size());
+  append(&payload, relocations.data(), relocations.size());
+  append(&payload, types.data(), types.size());
+  append(&payload, layouts.MemberOffsets.data(), layouts.MemberOffsets.size());
+  append(&payload, functions.data(), functions.size());
+  append(&payload, decodedOps.data(), decodedOps.size());
+  append(&payload, decoded.EntryPoints.data(), decoded.EntryPoints.size());
+
+  CacheHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.Magic = CacheMagic;
+  header.FormatVersion = CacheFormatVersion;
+  header.PointerSize = sizeof(void*);
+  header.ModuleHash = moduleHash;
+  header.Checksum = hashModuleData(payload.data(), payload.size());
+  header.Version = prog.Version;
+  header.GeneratorMagic = prog.GeneratorMagic;
+  header.IDBound = prog.IDBound;
+  header.InstructionSchema = prog.InstructionSchema;
+  header.WordCount = prog.WordCount;
+  header.OpCount = (uint32)ops.size();
+  header.OpMemorySize = (uint32)opMemory.size();
+  header.RelocationCount = (uint32)relocations.size();
+  header.TypeCount = (uint32)types.size();
+  header.MemberOffsetCount = (uint32)layouts.MemberOffsets.size();
+  header.FunctionCount = (uint32)functions.size();
+  header.DecodedOpCount = (uint32)decodedOps.size();
+  header.EntryPointCount = (uint32)decoded.EntryPoints.size();
+
+  // Written next to the entry and renamed so that readers never see a
+  // partially written file.
+  std::string tempPath = std::string(path) + ".tmp";
+  std::ofstream out(tempPath, std::ofstream::out | std::ofstream::binary);
+  out.write((const char*)&header, sizeof(header));
+  out.write((const char*)payload.data(), payload.size());
+  out.close();
+  if (!out) {
+    errorOut << "Could not write module cache " << tempPath << std::endl;
+    std::remove(tempPath.c_str());
+    return false;
+  }
+
+  if (std::rename(tempPath.c_str(), path) != 0) {
+    std::remove(path);
+    if (std::rename(tempPath.c_str(), path) != 0) {
+      errorOut << "Could not write module cache " << path << std::endl;
+      std::remove(tempPath.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+bool readModuleCache(const char* path, uint64 moduleHash, Program* outProg, PreparedModule* outPrepared, std::ostream& errorOut) {
+  std::shared_ptr<MappedFile> file(new MappedFile());
+  if (!file->Open(path)) {
+    return false;
+  }
+
+  CacheHeader header;
+  if (file->Size() < sizeof(header)) {
+    errorOut << "Module cache " << path << " is truncated." << std::endl;
+    return false;
+  }
+  std::memcpy(&header, file->Data(), sizeof(header));
+
+  if (header.Magic != CacheMagic || header.FormatVersion != CacheFormatVersion || header.PointerSize != sizeof(void*)) {
+    errorOut << "Module cache " << path << " has an incompatible format." << std::endl;
+    return false;
+  }
+  if (header.ModuleHash != moduleHash) {
+    errorOut << "Module cache " << path << " belongs to a different module." << std::endl;
+    return false;
+  }
+
+  CacheReader reader = { file->Data() + sizeof(header), file->Size() - sizeof(header), 0 };
+  if (hashModuleData(reader.Data, reader.Size) != header.Checksum) {
+    errorOut << "Module cache " << path << " is corrupt." << std::endl;
+    return false;
+  }
+
+  const uint32* words = reader.Take<uint32>(header.WordCount);
+  const CachedOp* ops = reader.Take<CachedOp>(header.OpCount);
+  const byte* cachedOpMemory = reader.Take<byte>(header.OpMemorySize);
+  const uint32* relocations = reader.Take<uint32>(header.RelocationCount);
+  const CachedType* types = reader.Take<CachedType>(header.TypeCount);
+  const uint32* memberOffsets = reader.Take<uint32>(header.MemberOffsetCount);
+  const CachedFunction* functions = reader.Take<CachedFunction>(header.FunctionCount);
+  const CachedDecodedOp* decodedOps = reader.Take<CachedDecodedOp>(header.DecodedOpCount);
+  const uint32* entryPoints = reader.Take<uint32>(header.EntryPointCount);
+  if (!words || !ops || !cachedOpMemory || !relocations || !types || !memberOffsets ||
+      !functions || !decodedOps || !entryPoints || reader.Offset != reader.Size) {
+    errorOut << "Module cache " << path << " is corrupt." << std::endl;
+    return false;
+  }
+
+  Program prog;
+  prog.Version = header.Version;
+  prog.GeneratorMagic = header.GeneratorMagic;
+  prog.IDBound = header.IDBound;
+  prog.InstructionSchema = header.InstructionSchema;
+  prog.Words = std::shared_ptr<const uint32>(file, words);
+  prog.WordCount = header.WordCount;
+
+  byte* opMemory = prog.Memory.Alloc(header.OpMemorySize);
+  std::memcpy(opMemory, cachedOpMemory, header.OpMemorySize);
+  for (uint32 i = 0; i < header.RelocationCount; i++) {
+    uintptr_t offset;
+    if (relocations[i] + sizeof(offset) > header.OpMemorySize) {
+      errorOut << "Module cache " << path << " is corrupt." << std::endl;
+      return false;
+    }
+    std::memcpy(&offset, opMemory + relocations[i], sizeof(offset));
+    if (offset != NullOffset && offset > sizeof(uint32) * header.WordCount) {
+      errorOut << "Module cache " << path << " is corrupt." << std::endl;
+      return false;
+    }
+    const byte* target = offset == NullOffset ? nullptr : (const byte*)words + offset;
+    std::memcpy(opMemory + relocations[i], &target, sizeof(target));
+  }
+
+  prog.Ops.reserve(header.OpCount);
+  for (uint32 i = 0; i < header.OpCount; i++) {
+    if (ops[i].Offset > header.OpMemorySize) {
+      errorOut << "Module cache " << path << " is corrupt." << std::endl;
+      return false;
+    }
+    prog.Ops.push_back(SOp{ (spv::Op)ops[i].Op, opMemory + ops[i].Offset });
+  }
+
+  indexProgram(&prog);
+
+  std::shared_ptr<TypeLayoutTable> layouts(new TypeLayoutTable());
+  layouts->Types.resize(header.TypeCount);
+  for (uint32 i = 0; i < header.TypeCount; i++) {
+    const CachedType& cached = types[i];
+    TypeLayout& type = layouts->Types[i];
+    if (cached.DefinitionIndex == NoIndex) {
+      type.Definition = SOp{ Op::OpNop, nullptr };
+    } else if (cached.DefinitionIndex < header.OpCount) {
+      type.Definition = prog.Ops[cached.DefinitionIndex];
+    } else {
+      errorOut << "Module cache " << path << " is corrupt." << std::endl;
+      return false;
+    }
+    type.Size = cached.Size;
+    type.Alignment = cached.Alignment;
+    type.ElementTypeId = cached.ElementTypeId;
+    type.ElementCount = cached.ElementCount;
+    type.FirstMember = cached.FirstMember;
+  }
+  layouts->MemberOffsets.assign(memberOffsets, memberOffsets + header.MemberOffsetCount);
+
+  std::shared_ptr<DecodedProgram> decoded(new DecodedProgram());
+  decoded->IDBound = header.IDBound;
+  decoded->FunctionIndices.assign(header.IDBound, -1);
+  decoded->Functions.resize(header.FunctionCount);
+  uint32 nextOp = 0;
+  for (uint32 i = 0; i < header.FunctionCount; i++) {
+    const CachedFunction& cached = functions[i];
+    auto source = prog.FunctionDefinitions.find(cached.Id);
+    if (cached.Id >= header.IDBound || source == prog.FunctionDefinitions.end() ||
+        cached.OpCount > header.DecodedOpCount - nextOp) {
+      errorOut << "Module cache " << path << " is corrupt." << std::endl;
+      return false;
+    }
+
+    DecodedFunction& func = decoded->Functions[i];
+    func.Id = cached.Id;
+    func.Source = &source->second;
+    func.Ops.reserve(cached.OpCount);
+    for (uint32 j = 0; j < cached.OpCount; j++, nextOp++) {
+      const CachedDecodedOp& op = decodedOps[nextOp];
+      if (op.OpIndex >= header.OpCount || op.Bind > IBResult) {
+        errorOut << "Module cache " << path << " is corrupt." << std::endl;
+        return false;
+      }
+      DecodedOp decodedOp = { (spv::Op)op.Op, prog.Ops[op.OpIndex].Memory, { op.Targets[0], op.Targets[1] }, nullptr, nullptr, IHUnimplemented, (InlineBind)op.Bind };
+      // Function addresses change between runs, so they are resolved again.
+      if (decodedOp.Op == Op::OpExtInst) {
+        decodedOp.Ext = resolveStaticExtInst(prog, *(SExtInst*)decodedOp.Memory);
+        decodedOp.ExtBatch = resolveStaticExtBatchInst(prog, *(SExtInst*)decodedOp.Memory);
+      }
+      func.Ops.push_back(decodedOp);
+    }
+    selectHandlers(&func);
+    decoded->FunctionIndices[cached.Id] = (int)i;
+  }
+
+  for (uint32 i = 0; i < header.EntryPointCount; i++) {
+    if (entryPoints[i] >= header.FunctionCount) {
+      errorOut << "Module cache " << path << " is corrupt." << std::endl;
+      return false;
+    }
+  }
+  decoded->EntryPoints.assign(entryPoints, entryPoints + header.EntryPointCount);
+
+  *outProg = std::move(prog);
+  outPrepared->Layouts = layouts;
+  outPrepared->Decoded = decoded;
+  return true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <ostream>
+#include "types.h"
+#include "parser_definitions.h"
+#include "decoder.h"
+
+// On-disk cache of parsed, validated and decoded modules. An entry holds the
+// module words, the operand structs of every instruction with their pointers
+// stored as offsets, the type layouts and the decoded functions. It is keyed
+// by a hash of the SPIR-V words and protected by a checksum of its contents.
+//
+// Loading maps the entry, copies the operand structs into the program's arena
+// and relocates their pointers into the mapping, then rebuilds the lookup
+// tables. Parsing and validation are skipped entirely, so only modules that
+// passed validation should be written.
+
+// 64 bit FNV-1a hash of size bytes.
+uint64 hashModuleData(const void* data, size_t size);
+
+// Hashes the module at modulePath and returns the path of its cache entry
+// inside directory.
+bool getModuleCachePath(const char* directory, const char* modulePath, std::string* outPath, uint64* outModuleHash);
+
+bool writeModuleCache(const char* path, uint64 moduleHash, const Program& prog, const PreparedModule& prepared, std::ostream& errorOut);
+
+// Fails without a message if there is no entry at path. Entries written for a
+// different module, by a different format version or that fail the checksum
+// are rejected.
+bool readModuleCache(const char* path, uint64 moduleHash, Program* outProg, PreparedModule* outPrepared, std::ostream& errorOut);
@@ -0,0 +1,282 @@
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include "codegen.h"
+#include "native_vm.h"
+#include "module_cache.h"
+#include "dynamic_library.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+  #include <process.h>
+  #define GET_PID _getpid
+#else
+  #include <sys/stat.h>
+  #include <unistd.h>
+  #define GET_PID getpid
+#endif
+
+typedef uint32 GlobalsSizeFunc();
+typedef void InitFunc(void* globals);
+typedef void** VariableFunc(void* globals, uint32 id);
+typedef void RunFunc(void* globals, const NativeHost* host);
+
+struct NativeModule {
+  HANDLE_TYPE Handle;
+  uint32 GlobalsSize;
+  InitFunc* Init;
+  VariableFunc* Variable;
+  RunFunc* Run;
+
+  NativeModule() : Handle(0), GlobalsSize(0), Init(nullptr), Variable(nullptr), Run(nullptr) { }
+
+  ~NativeModule() {
+    if (Handle) {
+      UNLOAD_LIBRARY(Handle);
+    }
+  }
+};
+
+// Libraries in the build directory are loaded as they are, so the default
+// one must not be writable by other users. The temporary directory is shared
+// on POSIX systems, a directory of the user's own is made inside it. On
+// Windows the temporary directory already belongs to the user.
+static bool getDefaultBuildDirectory(std::string* out) {
+  const char* dir = std::getenv("TMPDIR");
+  if (!dir) {
+    dir = std::getenv("TEMP");
+  }
+  std::string temp = dir ? dir : "/tmp";
+#if defined(_WIN32) || defined(_WIN64)
+  *out = temp;
+  return true;
+#else
+  std::string path = temp + "/otherside-" + std::to_string(getuid());
+  if (mkdir(path.c_str(), 0700) != 0 && errno != EEXIST) {
+    std::cout << "Could not create " << path << std::endl;
+    return false;
+  }
+
+  // Another user may have created it first.
+  struct stat info;
+  if (lstat(path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) || info.st_uid != getuid() || (info.st_mode & 077) != 0) {
+    std::cout << path << " is not a private directory of the current user." << std::endl;
+    return false;
+  }
+  *out = path;
+  return true;
+#endif
+}
+
+// Whether path is a library the current user built: it belongs to them and
+// nobody else can write it.
+static bool isOwnLibrary(const std::string& path) {
+#if defined(_WIN32) || defined(_WIN64)
+  return (bool)std::ifstream(path);
+#else
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode) && info.st_uid == getuid() &&
+         (info.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+#endif
+}
+
+NativeVM::NativeVM(Program& prog, Environment& env, const std::string& buildDirectory) :
+  NativeVM(prog, env, PreparedModule(), buildDirectory) {
+}
+
+NativeVM::NativeVM(Program& prog, Environment& env, const PreparedModule& prepared, const std::string& buildDirectory) :
+  prog(prog),
+  hostVM(new InterpretedVM(prog, env, prepared)),
+  buildDirectory(buildDirectory) {
+  host = NativeHost{ this, HostExtInst, HostSample };
+}
+
+NativeVM::NativeVM(const NativeVM& parent) :
+  prog(parent.prog),
+  hostVM(parent.hostVM->Fork()),
+  module(parent.module),
+  buildDirectory(parent.buildDirectory) {
+  host = NativeHost{ this, HostExtInst, HostSample };
+
+  uint32 words = (module->GlobalsSize + sizeof(uint64) - 1) / sizeof(uint64);
+  globals.reset(new uint64[words]);
+  std::memcpy(globals.get(), parent.globals.get(), module->GlobalsSize);
+
+  // Variables that aren't bound by the host point at storage inside the
+  // parent's globals, move them over to our own copy.
+  byte* parentBase = (byte*)parent.globals.get();
+  byte* base = (byte*)globals.get();
+  for (auto& var : prog.Variables) {
+    byte** slot = (byte**)module->Variable(base, var.first);
+    if (*slot >= parentBase && *slot < parentBase + module->GlobalsSize) {
+      *slot = base + (*slot - parentBase);
+    }
+  }
+}
+
+std::unique_ptr<NativeVM> NativeVM::Fork() const {
+  return std::unique_ptr<NativeVM>(new NativeVM(*this));
+}
+
+void NativeVM::SetSampleFootprint(float x, float y, float z) {
+  hostVM->SetSampleFootprint(x, y, z);
+}
+
+void NativeVM::SetMathPrecision(MathPrecision precision) {
+  hostVM->SetMathPrecision(precision);
+}
+
+void NativeVM::HostExtInst(void* context, uint32 setId, uint32 instruction, uint32 resultTypeId, uint32 operandCount, const uint32* operandTypeIds, void** operands, void* result) {
+  InterpretedVM& vm = *((NativeVM*)context)->hostVM;
+  if (vm.extOperands.size() < operandCount) {
+    vm.extOperands.resize(operandCount);
+  }
+  for (uint32 i = 0; i < operandCount; i++) {
+    vm.extOperands[i] = Value{ operandTypeIds[i], (byte*)operands[i] };
+  }
+
+  ExtInstFunc* extFunc = vm.env.Extensions[setId][instruction];
+  Value res = extFunc(&vm, resultTypeId, operandCount, vm.extOperands.data());
+  std::memcpy(result, res.Memory, vm.GetTypeByteSize(resultTypeId));
+}
+
+void NativeVM::HostSample(void* context, uint32 sampledImageTypeId, const void* sampledImage, uint32 coordinateTypeId, const void* coordinate, uint32 resultTypeId, void* result) {
+  InterpretedVM& vm = *((NativeVM*)context)->hostVM;
+  Value sampler = { sampledImageTypeId, (byte*)sampledImage };
+  Value coord = { coordinateTypeId, (byte*)coordinate };
+  Value res = vm.TextureSample(sampler, coord, Value{ 0, 0 }, resultTypeId);
+  std::memcpy(result, res.Memory, vm.GetTypeByteSize(resultTypeId));
+}
+
+// Compiles under a name unique to this process and renames the result into
+// place, so other processes never load a partially written library.
+bool NativeVM::Compile(const std::string& source, const std::string& compileCommand, const std::string& libraryPath) {
+  std::string basePath = libraryPath.substr(0, libraryPath.size() - std::strlen(LIBRARY_EXT)) + "." + std::to_string(GET_PID());
+  std::string sourcePath = basePath + ".cpp";
+  std::string tempPath = basePath + LIBRARY_EXT;
+  std::ofstream out(sourcePath);
+  if (!out) {
+    std::cout << "Could not write " << sourcePath << std::endl;
+    return false;
+  }
+  out << source;
+  out.close();
+
+  std::string command = compileCommand + " -o \"" + tempPath + "\" \"" + sourcePath + "\"";
+
+  // The source is kept around when compilation fails to make it easy to see why.
+  if (std::system(command.c_str()) != 0) {
+    std::cout << "Compiling the native module failed: " << command << std::endl;
+    std::remove(tempPath.c_str());
+    return false;
+  }
+  std::remove(sourcePath.c_str());
+
+  // Renaming over an existing file fails on Windows, another process built
+  // the same library in that case.
+  if (std::rename(tempPath.c_str(), libraryPath.c_str()) != 0) {
+    std::remove(tempPath.c_str());
+    if (!isOwnLibrary(libraryPath)) {
+      std::cout << "Could not write " << libraryPath << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool NativeVM::Setup() {
+  if (!hostVM->Setup()) {
+    return false;
+  }
+
+  std::string code;
+  if (!genNativeCode(&code, prog)) {
+    std::cout << "Could not generate native code!" << std::endl;
+    return false;
+  }
+
+  // Libraries built by another compiler or with other flags aren't reused.
+  const char* compiler = std::getenv("CXX");
+  std::string compileCommand = std::string(compiler ? compiler : "c++") + " -std=c++11 -O2 -shared -fPIC";
+
+  std::string directory = buildDirectory;
+  if (directory.empty() && !getDefaultBuildDirectory(&directory)) {
+    return false;
+  }
+
+  // Keyed like module cache entries, so names don't depend on the standard
+  // library's string hash.
+  std::string key = compileCommand + "\n" + code;
+  char hash[17];
+  std::snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)hashModuleData(key.data(), key.size()));
+  std::string libraryPath = directory + "/otherside_native_" + hash + LIBRARY_EXT;
+
+  // Libraries another user could have planted or modified are rebuilt.
+  if (!isOwnLibrary(libraryPath) && !Compile(code, compileCommand, libraryPath)) {
+    return false;
+  }
+
+  std::shared_ptr<NativeModule> loaded(new NativeModule());
+  loaded->Handle = LOAD_LIBRARY(libraryPath.c_str());
+  if (!loaded->Handle) {
+    std::cout << LIB_ERROR << std::endl;
+    return false;
+  }
+
+  auto globalsSize = (GlobalsSizeFunc*)LOAD_SYMBOL(loaded->Handle, TEXT("otherside_globals_size"));
+  loaded->Init = (InitFunc*)LOAD_SYMBOL(loaded->Handle, TEXT("otherside_init"));
+  loaded->Variable = (VariableFunc*)LOAD_SYMBOL(loaded->Handle, TEXT("otherside_variable"));
+  loaded->Run = (RunFunc*)LOAD_SYMBOL(loaded->Handle, TEXT("otherside_run"));
+  if (!globalsSize || !loaded->Init || !loaded->Variable || !loaded->Run) {
+    std::cout << "Native module " << libraryPath << " is missing exports." << std::endl;
+    return false;
+  }
+
+  loaded->GlobalsSize = globalsSize();
+  module = loaded;
+
+  uint32 words = (module->GlobalsSize + sizeof(uint64) - 1) / sizeof(uint64);
+  globals.reset(new uint64[words]());
+  module->Init(globals.get());
+  return true;
+}
+
+bool NativeVM::Run() {
+  hostVM->InvocationMemory.Reset();
+  hostVM->currentMemory = &hostVM->InvocationMemory;
+  module->Run(globals.get(), &host);
+  hostVM->currentMemory = &hostVM->ConstantMemory;
+  return true;
+}
+
+void* NativeVM::VariableSlot(uint32 id) const {
+  if (!module) {
+    return nullptr;
+  }
+  return module->Variable(globals.get(), id);
+}
+
+bool NativeVM::SetVariable(std::string name, void* value) {
+  for (auto& nameOp : prog.Names) {
+    if (nameOp.second.Name == name) {
+      void* slot = VariableSlot(nameOp.second.TargetId);
+      if (!slot) {
+        return false;
+      }
+      std::memcpy(slot, value, sizeof(void*));
+      return true;
+    }
+  }
+  return false;
+}
+
+void* NativeVM::ReadVariable(std::string name) const {
+  for (auto& nameOp : prog.Names) {
+    if (nameOp.second.Name == name) {
+      return VariableSlot(nameOp.second.TargetId);
+    }
+  }
+  return nullptr;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <memory>
+#include <string>
+#include "interpreted_vm.h"
+
+// Callbacks the compiled module uses for everything it can't do on its own.
+// The layout is repeated in the generated code (see codegen_native.cpp).
+extern "C" {
+struct NativeHost {
+  void* Context;
+  void (*ExtInst)(void* context, uint32 setId, uint32 instruction, uint32 resultTypeId, uint32 operandCount, const uint32* operandTypeIds, void** operands, void* result);
+  void (*Sample)(void* context, uint32 sampledImageTypeId, const void* sampledImage, uint32 coordinateTypeId, const void* coordinate, uint32 resultTypeId, void* result);
+};
+}
+
+struct NativeModule;
+
+// Runs a program compiled ahead of time to native code. Setup() generates C++
+// from the module, compiles it into a shared library with the system compiler
+// (the CXX environment variable, "c++" by default) and loads it. Libraries are
+// named after a hash of the generated code and the compiler command and reused
+// if they already exist in the build directory, so a shader is only compiled
+// once. Only libraries that belong to the current user and that no one else
+// can write are reused. The build directory defaults to otherside-<uid> in the
+// system's temporary directory, which is created private to the user.
+//
+// Variables are bound exactly like with InterpretedVM: SetVariable() takes a
+// pointer to a pointer to the host data and ReadVariable() returns the
+// address of that pointer. Extension instructions and texture sampling are
+// delegated to an InterpretedVM set up on the same program.
+class NativeVM {
+private:
+  Program& prog;
+  std::unique_ptr<InterpretedVM> hostVM;
+  std::shared_ptr<const NativeModule> module;
+  std::unique_ptr<uint64[]> globals;
+  NativeHost host;
+  std::string buildDirectory;
+
+  NativeVM(const NativeVM& parent);
+
+  bool Compile(const std::string& source, const std::string& compileCommand, const std::string& libraryPath);
+  void* VariableSlot(uint32 id) const;
+
+  static void HostExtInst(void* context, uint32 setId, uint32 instruction, uint32 resultTypeId, uint32 operandCount, const uint32* operandTypeIds, void** operands, void* result);
+  static void HostSample(void* context, uint32 sampledImageTypeId, const void* sampledImage, uint32 coordinateTypeId, const void* coordinate, uint32 resultTypeId, void* result);
+
+public:
+  NativeVM(Program& prog, Environment& env, const std::string& buildDirectory = "");
+  NativeVM(Program& prog, Environment& env, const PreparedModule& prepared, const std::string& buildDirectory = "");
+
+  // Creates a VM that shares the loaded library and the variable bindings
+  // of this one. Forks of the same VM can run concurrently.
+  std::unique_ptr<NativeVM> Fork() const;
+
+  // See InterpretedVM::SetSampleFootprint().
+  void SetSampleFootprint(float x, float y, float z = 0);
+
+  // See InterpretedVM::SetMathPrecision().
+  void SetMathPrecision(MathPrecision precision);
+
+  bool Setup();
+  bool Run();
+  bool SetVariable(std::string name, void * value);
+  void * ReadVariable(std::string name) const;
+};
@@ -0,0 +1,441 @@
+#include "optimizer.h"
+#include "parser.h"
+#include "decoder.h"
+#include "specializer.h"
+#include "Khronos/GLSL450Lib.h"
+#include <chrono>
+#include <cstring>
+#include <unordered_map>
+
+// Calls f with the word index and a pointer to every id operand of op, result
+// and result type ids included. Elements of an id list share the index of the
+// list.
+template<typename F>
+static void forEachId(SOp op, F f) {
+  if (sizeof(LUTOpWordTypes) / sizeof(void*) <= (uint32)op.Op) {
+    return;
+  }
+
+  const WordType* wordTypes = (const WordType*)LUTOpWordTypes[(int)op.Op];
+  uint32 wordCount = LUTOpWordTypesCount[(int)op.Op];
+  uint32* words = (uint32*)op.Memory;
+  for (uint32 i = 1; i < wordCount; i++) {
+    if (wordTypes[i] == WordType::TId) {
+      f(i, &words[i - 1]);
+    } else if (wordTypes[i] == WordType::TIdList) {
+      uint32* list = *(uint32**)(words + i);
+      for (uint32 j = 0; j < words[i - 1]; j++) {
+        f(i, &list[j]);
+      }
+      return;
+    } else if (wordTypes[i] == WordType::TLiteralNumberList || wordTypes[i] == WordType::TLiteralString) {
+      return;
+    }
+  }
+}
+
+static void replaceIds(SOp op, const std::vector<uint32>& replacements) {
+  forEachId(op, [&](uint32 index, uint32* id) {
+    if (*id < replacements.size() && replacements[*id]) {
+      *id = replacements[*id];
+    }
+  });
+}
+
+// Instructions are rewritten as the passes reach them, this catches uses that
+// come before their definition in block order, like phi operands.
+static void replaceRemainingIds(const Function& func, const std::vector<uint32>& replacements) {
+  for (auto& op : func.Ops) {
+    replaceIds(op, replacements);
+  }
+}
+
+static bool isPureExtInst(const Program& prog, const SExtInst* inst) {
+  auto import = prog.ExtensionImports.find(inst->SetId);
+  if (import == prog.ExtensionImports.end() || std::strcmp(import->second.Name, "GLSL.std.450") != 0) {
+    return false;
+  }
+  // These write through a pointer operand or read per invocation state.
+  return inst->Instruction != (uint32)GLSLstd450::Modf &&
+         inst->Instruction != (uint32)GLSLstd450::Frexp &&
+         inst->Instruction < (uint32)GLSLstd450::InterpolateAtCentroid;
+}
+
+// Instructions laid out as result type, result id and operands that only
+// depend on their operands.
+static bool isPure(const Program& prog, SOp op) {
+  switch (op.Op) {
+  case Op::OpAccessChain:
+  case Op::OpInBoundsAccessChain:
+  case Op::OpVectorExtractDynamic:
+  case Op::OpVectorInsertDynamic:
+  case Op::OpVectorShuffle:
+  case Op::OpCompositeConstruct:
+  case Op::OpCompositeExtract:
+  case Op::OpCompositeInsert:
+  case Op::OpCopyObject:
+  case Op::OpTranspose:
+  case Op::OpConvertFToU:
+  case Op::OpConvertFToS:
+  case Op::OpConvertSToF:
+  case Op::OpConvertUToF:
+  case Op::OpUConvert:
+  case Op::OpSConvert:
+  case Op::OpFConvert:
+  case Op::OpBitcast:
+    return true;
+  case Op::OpExtInst:
+    return isPureExtInst(prog, (SExtInst*)op.Memory);
+  default:
+    // Arithmetic, relational, logical and bit instructions.
+    return (op.Op >= Op::OpSNegate && op.Op <= Op::OpDot) ||
+           (op.Op >= Op::OpAny && op.Op <= Op::OpBitCount);
+  }
+}
+
+// Result of an instruction the passes may remove, 0 for everything else.
+static uint32 removableResult(const Program& prog, SOp op) {
+  if (op.Op == Op::OpLoad || op.Op == Op::OpVariable || isPure(prog, op)) {
+    return ((uint32*)op.Memory)[1];
+  }
+  return 0;
+}
+
+// Function variables whose pointer is only used by loads from and stores to
+// it, which makes every access to them visible in the function.
+static std::vector<bool> findLocalVariables(const Program& prog, const Function& func) {
+  std::vector<bool> local(prog.IDBound, false);
+  for (auto& var : func.Variables) {
+    local[var.first] = var.second.StorageClass == StorageClass::Function;
+  }
+
+  for (auto& op : func.Ops) {
+    forEachId(op, [&](uint32 index, uint32* id) {
+      bool access = (op.Op == Op::OpLoad && index == 3) || (op.Op == Op::OpStore && index == 1);
+      bool definition = op.Op == Op::OpVariable && index == 2;
+      if (*id < local.size() && !access && !definition) {
+        local[*id] = false;
+      }
+    });
+  }
+  return local;
+}
+
+void forwardStores(const Program& prog, const Function& func, RemovedOps* removed) {
+  std::vector<bool> local = findLocalVariables(prog, func);
+  std::vector<uint32> replacements(prog.IDBound, 0);
+  // Value of every local variable at the current instruction, 0 if unknown.
+  std::vector<uint32> values(prog.IDBound, 0);
+  std::vector<uint32> known;
+
+  for (auto& op : func.Ops) {
+    replaceIds(op, replacements);
+    switch (op.Op) {
+    case Op::OpLabel:
+      for (uint32 var : known) {
+        values[var] = 0;
+      }
+      known.clear();
+      break;
+    case Op::OpVariable: {
+      auto var = (SVariable*)op.Memory;
+      if (local[var->ResultId] && var->InitializerId) {
+        values[var->ResultId] = var->InitializerId;
+        known.push_back(var->ResultId);
+      }
+      break;
+    }
+    case Op::OpStore: {
+      auto store = (SStore*)op.Memory;
+      if (local[store->PointerId]) {
+        values[store->PointerId] = store->ObjectId;
+        known.push_back(store->PointerId);
+      }
+      break;
+    }
+    case Op::OpLoad: {
+      auto load = (SLoad*)op.Memory;
+      if (!local[load->PointerId]) {
+        break;
+      }
+      if (values[load->PointerId]) {
+        replacements[load->ResultId] = values[load->PointerId];
+        removed->insert(op.Memory);
+      } else {
+        values[load->PointerId] = load->ResultId;
+        known.push_back(load->PointerId);
+      }
+      break;
+    }
+    default:
+      break;
+    }
+  }
+
+  replaceRemainingIds(func, replacements);
+}
+
+void propagateCopies(const Program& prog, const Function& func, RemovedOps* removed) {
+  std::vector<uint32> replacements(prog.IDBound, 0);
+  std::vector<uint32> resultTypes(prog.IDBound, 0);
+  for (auto& constant : prog.Constants) {
+    resultTypes[constant.first] = *(uint32*)constant.second.Memory;
+  }
+  for (auto& param : func.Parameters) {
+    resultTypes[param.ResultId] = param.ResultTypeId;
+  }
+
+  for (auto& op : func.Ops) {
+    replaceIds(op, replacements);
+    uint32 result = removableResult(prog, op);
+    if (result) {
+      resultTypes[result] = ((uint32*)op.Memory)[0];
+    }
+
+    if (op.Op == Op::OpCopyObject) {
+      auto copy = (SCopyObject*)op.Memory;
+      replacements[copy->ResultId] = copy->OperandId;
+      removed->insert(op.Memory);
+    } else if (op.Op == Op::OpVectorShuffle) {
+      auto shuffle = (SVectorShuffle*)op.Memory;
+      bool identity = shuffle->ResultTypeId == resultTypes[shuffle->Vector1Id];
+      auto type = prog.DefinedTypes.find(shuffle->ResultTypeId);
+      identity = identity && type != prog.DefinedTypes.end() && type->second.Op == Op::OpTypeVector &&
+                 ((STypeVector*)type->second.Memory)->ComponentCount == shuffle->ComponentsCount;
+      for (uint32 i = 0; identity && i < shuffle->ComponentsCount; i++) {
+        identity = shuffle->Components[i] == i;
+      }
+      if (identity) {
+        replacements[shuffle->ResultId] = shuffle->Vector1Id;
+        removed->insert(op.Memory);
+      }
+    }
+  }
+
+  replaceRemainingIds(func, replacements);
+}
+
+// Pointers into memory that doesn't change while an invocation runs.
+static bool isReadOnlyStorage(spv::StorageClass storageClass) {
+  return isUniformStorage(storageClass) || storageClass == StorageClass::Input;
+}
+
+void eliminateCommonSubexpressions(const Program& prog, const Function& func, RemovedOps* removed) {
+  std::vector<uint32> replacements(prog.IDBound, 0);
+  std::vector<bool> readOnly(prog.IDBound, false);
+  for (auto& var : prog.Variables) {
+    readOnly[var.first] = isReadOnlyStorage(var.second.StorageClass);
+  }
+
+  // Instructions are keyed by their opcode and every operand word except the
+  // result id.
+  std::unordered_map<std::string, uint32> available;
+  std::string key;
+  for (auto& op : func.Ops) {
+    replaceIds(op, replacements);
+    if (op.Op == Op::OpLabel) {
+      available.clear();
+      continue;
+    }
+
+    uint32* words = (uint32*)op.Memory;
+    bool readOnlyAccess = (op.Op == Op::OpAccessChain || op.Op == Op::OpInBoundsAccessChain || op.Op == Op::OpLoad) &&
+                          readOnly[words[2]];
+    if (readOnlyAccess && op.Op != Op::OpLoad) {
+      readOnly[words[1]] = true;
+    }
+    if (!readOnlyAccess && (op.Op == Op::OpLoad || !isPure(prog, op))) {
+      continue;
+    }
+
+    uint32 size;
+    int pointerOffset;
+    if (!getOpLayout(op.Op, &size, &pointerOffset)) {
+      continue;
+    }
+    key.assign((const char*)&op.Op, sizeof(op.Op));
+    key.append((const char*)words, sizeof(uint32));
+    if (pointerOffset < 0) {
+      key.append((const char*)(words + 2), size - 2 * sizeof(uint32));
+    } else {
+      // The count of the list is its last word before the pointer.
+      key.append((const char*)(words + 2), pointerOffset - 2 * sizeof(uint32));
+      const uint32* list = *(const uint32**)((byte*)op.Memory + pointerOffset);
+      uint32 count = *(const uint32*)((byte*)op.Memory + pointerOffset - sizeof(uint32));
+      key.append((const char*)list, count * sizeof(uint32));
+    }
+
+    auto inserted = available.insert({ key, words[1] });
+    if (!inserted.second) {
+      replacements[words[1]] = inserted.first->second;
+      removed->insert(op.Memory);
+    }
+  }
+
+  replaceRemainingIds(func, replacements);
+}
+
+void eliminateDeadCode(const Program& prog, const Function& func, RemovedOps* removed) {
+  std::vector<bool> local = findLocalVariables(prog, func);
+  std::vector<uint32> uses(prog.IDBound, 0);
+  std::vector<uint32> loads(prog.IDBound, 0);
+
+  auto countUses = [&](SOp op, int delta) {
+    uint32 result = removableResult(prog, op);
+    forEachId(op, [&](uint32 index, uint32* id) {
+      if (*id != result || index != 2) {
+        uses[*id] += delta;
+      }
+    });
+    if (op.Op == Op::OpLoad) {
+      loads[((SLoad*)op.Memory)->PointerId] += delta;
+    }
+  };
+
+  for (auto& op : func.Ops) {
+    countUses(op, 1);
+  }
+
+  // Removing an instruction can make the definitions of its operands dead,
+  // which come earlier, so the function is walked backwards until nothing
+  // changes.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = func.Ops.size(); i-- > 0;) {
+      SOp op = func.Ops[i];
+      if (removed->count(op.Memory)) {
+        continue;
+      }
+
+      bool dead;
+      if (op.Op == Op::OpStore) {
+        uint32 pointer = ((SStore*)op.Memory)->PointerId;
+        dead = local[pointer] && loads[pointer] == 0;
+      } else if (op.Op == Op::OpVariable) {
+        uint32 var = ((SVariable*)op.Memory)->ResultId;
+        dead = local[var] && uses[var] == 0;
+      } else {
+        uint32 result = removableResult(prog, op);
+        dead = result && uses[result] == 0;
+      }
+
+      if (dead) {
+        countUses(op, -1);
+        removed->insert(op.Memory);
+        changed = true;
+      }
+    }
+  }
+}
+
+void PassManager::AddPass(const std::string& name, FunctionPass pass) {
+  passes.push_back(Pass{ name, pass });
+}
+
+void PassManager::AddDefaultPasses() {
+  AddPass("forward-stores", forwardStores);
+  AddPass("copy-propagation", propagateCopies);
+  AddPass("cse", eliminateCommonSubexpressions);
+  AddPass("dce", eliminateDeadCode);
+}
+
+static uint32 countInstructions(const Program& prog) {
+  uint32 count = 0;
+  for (auto& func : prog.FunctionDefinitions) {
+    for (auto& op : func.second.Ops) {
+      count += isNoOp(op.Op) ? 0 : 1;
+    }
+  }
+  return count;
+}
+
+// Rebuilds the lookup tables and functions from prog->Ops.
+static void reindex(Program* prog) {
+  Program indexed;
+  indexed.Version = prog->Version;
+  indexed.GeneratorMagic = prog->GeneratorMagic;
+  indexed.IDBound = prog->IDBound;
+  indexed.InstructionSchema = prog->InstructionSchema;
+  indexed.Ops = std::move(prog->Ops);
+  indexed.Memory = std::move(prog->Memory);
+  indexed.Words = prog->Words;
+  indexed.WordCount = prog->WordCount;
+  indexProgram(&indexed);
+  *prog = std::move(indexed);
+}
+
+// Moves the module words into a copy owned by the program, instructions that
+// point into the old ones are relocated.
+static bool copyWords(Program* prog, std::ostream& errorOut) {
+  const byte* begin = (const byte*)prog->Words.get();
+  const byte* end = begin + sizeof(uint32) * prog->WordCount;
+  uint32* words = new uint32[prog->WordCount];
+  std::shared_ptr<const uint32> owned(words, std::default_delete<uint32[]>());
+  std::memcpy(words, begin, end - begin);
+
+  auto relocate = [&](const void* target) {
+    return (const byte*)target >= begin && (const byte*)target < end ? (byte*)words + ((const byte*)target - begin) : (byte*)target;
+  };
+
+  for (size_t i = 0; i < prog->Ops.size(); i++) {
+    SOp& op = prog->Ops[i];
+    uint32 size;
+    int pointerOffset;
+    if (!getOpLayout(op.Op, &size, &pointerOffset)) {
+      errorOut << "Instruction " << i << " has no known layout." << std::endl;
+      return false;
+    }
+
+    op.Memory = relocate(op.Memory);
+    if (pointerOffset >= 0) {
+      byte* target;
+      std::memcpy(&target, (byte*)op.Memory + pointerOffset, sizeof(target));
+      target = relocate(target);
+      std::memcpy((byte*)op.Memory + pointerOffset, &target, sizeof(target));
+    }
+  }
+
+  prog->Words = owned;
+  return true;
+}
+
+bool PassManager::Run(Program* prog, std::ostream& errorOut) {
+  stats.clear();
+  if (!prog->Words) {
+    errorOut << "Only parsed programs can be optimized." << std::endl;
+    return false;
+  }
+  if (!copyWords(prog, errorOut)) {
+    return false;
+  }
+  reindex(prog);
+
+  for (auto& pass : passes) {
+    PassStats passStats = { pass.Name, 0, countInstructions(*prog), 0 };
+    auto start = std::chrono::steady_clock::now();
+
+    RemovedOps removed;
+    for (auto& func : prog->FunctionDefinitions) {
+      pass.Run(*prog, func.second, &removed);
+    }
+
+    if (!removed.empty()) {
+      std::vector<SOp> kept;
+      kept.reserve(prog->Ops.size() - removed.size());
+      for (auto& op : prog->Ops) {
+        if (!removed.count(op.Memory)) {
+          kept.push_back(op);
+        }
+      }
+      prog->Ops = std::move(kept);
+      reindex(prog);
+    }
+
+    passStats.Milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    passStats.InstructionsAfter = countInstructions(*prog);
+    stats.push_back(passStats);
+  }
+
+  return true;
+}
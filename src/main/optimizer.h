@@ -0,0 +1,64 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <ostream>
+#include <unordered_set>
+#include "types.h"
+#include "parser_definitions.h"
+
+// Instructions a pass removes, identified by their operand memory.
+typedef std::unordered_set<const void*> RemovedOps;
+
+// Rewrites the operands of the instructions of func in place and adds the ones
+// that became redundant to removed. The pass manager drops them from the
+// program once the pass ran on every function.
+typedef void (*FunctionPass)(const Program& prog, const Function& func, RemovedOps* removed);
+
+struct PassStats {
+  std::string Name;
+  double Milliseconds;
+  // Instructions in function bodies, labels and merge annotations excluded.
+  uint32 InstructionsBefore;
+  uint32 InstructionsAfter;
+};
+
+// Runs passes over every function of a program in the order they were added.
+// The program is changed in place, so anything prepared from it before has to
+// be prepared again. Every run copies its module words since operand lists
+// point into them and mapped modules are read-only.
+class PassManager {
+private:
+  struct Pass {
+    std::string Name;
+    FunctionPass Run;
+  };
+
+  std::vector<Pass> passes;
+  std::vector<PassStats> stats;
+
+public:
+  void AddPass(const std::string& name, FunctionPass pass);
+  // forward-stores, copy-propagation, cse and dce, in that order.
+  void AddDefaultPasses();
+
+  bool Run(Program* prog, std::ostream& errorOut);
+  // One entry per pass of the last Run().
+  const std::vector<PassStats>& Stats() const { return stats; }
+};
+
+// Replaces loads of Function variables with the value stored or loaded last
+// in the same block. Variables whose pointer is used by anything but loads
+// and stores are left alone.
+void forwardStores(const Program& prog, const Function& func, RemovedOps* removed);
+
+// Replaces the results of OpCopyObject and of shuffles that return their first
+// vector unchanged with their operand.
+void propagateCopies(const Program& prog, const Function& func, RemovedOps* removed);
+
+// Replaces pure instructions that repeat one earlier in the same block with
+// its result. Loads count as pure if they read uniform or input memory.
+void eliminateCommonSubexpressions(const Program& prog, const Function& func, RemovedOps* removed);
+
+// Removes pure instructions and loads whose results are never used, as well
+// as Function variables that are only stored to together with their stores.
+void eliminateDeadCode(const Program& prog, const Function& func, RemovedOps* removed);
@@ -9,10 +9,17 @@
 #include "parser.h"
 #include "codegen.h"
 #include "validation.h"
+#include "module_cache.h"
+#include "optimizer.h"
 #include "interpreted_vm.h"
+#include "native_vm.h"
+#include "dispatch.h"
+#include "thread_pool.h"
+#include "mipmap.h"
+#include "sampling.h"
 #include "utils.h"
 
-std::string USAGE = "-i <input file> -o <outputFile>";
+std::string USAGE = "-i <input file> -o <outputFile> [-b <output image>] [-r <reference image>] [-e <max channel error>] [-t <thread count>] [-w <lanes: 4, 8 or 16>] [-n] [-N <native build directory>] [-m] [-c <cache directory>] [-l <texture layout: row, tiled or morton>] [-f <texture format: rgba32f, rgba8, srgb8 or rgba16f>] [-p <math precision: precise or fast>] [-s] [-H] [-O] [-d <dispatch: threaded or switch>] [-P <profile file prefix>]";
 
 struct TestArgs {
   const char* ShaderFile;
@@ -23,6 +30,23 @@ struct TestArgs {
 struct CmdArgs {
   const char* InputFile;
   const char* OutputFile;
+  const char* ImageFile = "data/testout.bmp";
+  const char* ReferenceFile = nullptr;
+  int Tolerance = 0;
+  uint32 ThreadCount = 0;
+  uint32 Lanes = 0;
+  bool Native = false;
+  const char* NativeDirectory = "";
+  bool Mapped = false;
+  const char* CacheDirectory = nullptr;
+  TextureLayout Layout = TLRowMajor;
+  TextureFormat Format = TFRGBA32F;
+  MathPrecision Precision = MPPrecise;
+  bool Specialize = false;
+  bool Hoist = false;
+  bool Optimize = false;
+  DispatchMode Dispatch = DMThreaded;
+  const char* ProfilePrefix = nullptr;
 };
 
 bool ParseArgs(int argc, const char** argv, CmdArgs* args) {
@@ -41,54 +65,203 @@ bool ParseArgs(int argc, const char** argv, CmdArgs* args) {
         return false;
       }
       args->OutputFile = argv[i];
+    } else if (strcmp(arg, "-b") == 0) {
+      i++;
+      if (i == argc) {
+        return false;
+      }
+      args->ImageFile = argv[i];
+    } else if (strcmp(arg, "-r") == 0) {
+      i++;
+      if (i == argc) {
+        return false;
+      }
+      args->ReferenceFile = argv[i];
+    } else if (strcmp(arg, "-e") == 0) {
+      i++;
+      if (i == argc) {
+        return false;
+      }
+      args->Tolerance = atoi(argv[i]);
+    } else if (strcmp(arg, "-t") == 0) {
+      i++;
+      if (i == argc) {
+        return false;
+      }
+      args->ThreadCount = atoi(argv[i]);
+    } else if (strcmp(arg, "-w") == 0) {
+      i++;
+      if (i == argc) {
+        return false;
+      }
+      args->Lanes = atoi(argv[i]);
+    } else if (strcmp(arg, "-n") == 0) {
+      args->Native = true;
+    } else if (strcmp(arg, "-N") == 0) {
+      i++;
+      if (i == argc) {
+        return false;
+      }
+      args->NativeDirectory = argv[i];
+    } else if (strcmp(arg, "-m") == 0) {
+      args->Mapped = true;
+    } else if (strcmp(arg, "-c") == 0) {
+      i++;
+      if (i == argc) {
+        return false;
+      }
+      args->CacheDirectory = argv[i];
+    } else if (strcmp(arg, "-l") == 0) {
+      i++;
+      if (i == argc) {
+        return false;
+      }
+      if (strcmp(argv[i], "row") == 0) {
+        args->Layout = TLRowMajor;
+      } else if (strcmp(argv[i], "tiled") == 0) {
+        args->Layout = TLTiled;
+      } else if (strcmp(argv[i], "morton") == 0) {
+        args->Layout = TLMorton;
+      } else {
+        return false;
+      }
+    } else if (strcmp(arg, "-f") == 0) {
+      i++;
+      if (i == argc) {
+        return false;
+      }
+      if (strcmp(argv[i], "rgba32f") == 0) {
+        args->Format = TFRGBA32F;
+      } else if (strcmp(argv[i], "rgba8") == 0) {
+        args->Format = TFRGBA8;
+      } else if (strcmp(argv[i], "srgb8") == 0) {
+        args->Format = TFRGBA8SRGB;
+      } else if (strcmp(argv[i], "rgba16f") == 0) {
+        args->Format = TFRGBA16F;
+      } else {
+        return false;
+      }
+    } else if (strcmp(arg, "-d") == 0) {
+      i++;
+      if (i == argc) {
+        return false;
+      }
+      if (strcmp(argv[i], "threaded") == 0) {
+        args->Dispatch = DMThreaded;
+      } else if (strcmp(argv[i], "switch") == 0) {
+        args->Dispatch = DMSwitch;
+      } else {
+        return false;
+      }
+    } else if (strcmp(arg, "-P") == 0) {
+      i++;
+      if (i == argc) {
+        return false;
+      }
+      args->ProfilePrefix = argv[i];
+    } else if (strcmp(arg, "-O") == 0) {
+      args->Optimize = true;
+    } else if (strcmp(arg, "-s") == 0) {
+      args->Specialize = true;
+    } else if (strcmp(arg, "-H") == 0) {
+      args->Hoist = true;
+    } else if (strcmp(arg, "-p") == 0) {
+      i++;
+      if (i == argc) {
+        return false;
+      }
+      if (strcmp(argv[i], "precise") == 0) {
+        args->Precision = MPPrecise;
+      } else if (strcmp(argv[i], "fast") == 0) {
+        args->Precision = MPFast;
+      } else {
+        return false;
+      }
     }
   }
+
+  // Native code is compiled from the unspecialized, unhoisted module.
+  if (args->Native && args->Specialize) {
+    std::cout << "-s can not be combined with -n." << std::endl;
+    return false;
+  }
+  if (args->Native && args->Hoist) {
+    std::cout << "-H can not be combined with -n." << std::endl;
+    return false;
+  }
+  // Only interpreted code is profiled.
+  if (args->Native && args->ProfilePrefix) {
+    std::cout << "-P can not be combined with -n." << std::endl;
+    return false;
+  }
   return true;
 }
 
-int main(int argc, const char** argv) {
-  CmdArgs args;
-  if (!ParseArgs(argc, argv, &args)) {
-    std::cout << "Could not parse arguments. Usage: " << USAGE << std::endl;
-    return -1;
+bool specializeProgram(InterpretedVM& vm) {
+  SpecializationStats stats;
+  if (!vm.Specialize(&stats)) {
+    return false;
   }
+  std::cout << "Specialized program: " << stats.FoldedOps << " instructions and " << stats.FoldedBranches
+            << " branches folded, " << stats.PrunedOps << " instructions pruned" << std::endl;
+  return true;
+}
 
-  Parser parser(args.InputFile);
-  Program prog;
-
-  if (!parser.Parse(&prog)) {
-    std::cout << "Could not parse program." << std::endl;
-    return -1;
-  }
+// Native code is compiled ahead of time and can't be specialized, ParseArgs()
+// rejects -s with -n.
+bool specializeProgram(NativeVM& vm) {
+  return false;
+}
 
-  std::cout << "Validating program:...";
-  if(!validate(prog, std::cout)) {
-    std::cout << "Validation failed." << std::endl;
-    return -1;
+// Only the coordinate changes from one pixel to the next.
+bool hoistProgram(InterpretedVM& vm) {
+  HoistingStats stats;
+  if (!vm.Hoist({ "uv" }, &stats)) {
+    return false;
   }
-  std::cout << "done" << std::endl;
+  std::cout << "Hoisted program: " << stats.HoistedOps << " instructions run once per frame, "
+            << stats.BodyOps << " per invocation" << std::endl;
+  return true;
+}
 
-  std::cout << writeProgram(prog);
+// ParseArgs() rejects -H with -n.
+bool hoistProgram(NativeVM& vm) {
+  return false;
+}
 
-  std::cout << "Generationg code:...";
-  if (!genCode(args.OutputFile, prog)) {
-    std::cout << "Could not generate code for program." << std::endl;
-    return -1;
-  }
-  std::cout << "done" << std::endl;
+// Writes <prefix>.json, <prefix>.folded and <prefix>.trace.json. Wide VMs only
+// profile the prologue of a hoisted program.
+bool reportProfile(InterpretedVM& vm, const Program& prog, const std::string& prefix) {
+  const Profile* profile = vm.GetProfile();
+  profile->Report(prog, std::cout);
+  return profile->WriteJson(prog, (prefix + ".json").c_str(), std::cout) &&
+         profile->WriteFoldedStacks((prefix + ".folded").c_str(), std::cout) &&
+         profile->WriteTrace(prog, (prefix + ".trace.json").c_str(), std::cout);
+}
 
-  Environment env;
-  InterpretedVM vm(prog, env);
+template<typename VMType>
+bool runProgram(VMType& vm, const CmdArgs& args, ThreadPool& pool, Texture* outTex) {
   if(!vm.Setup()) {
       std::cout << "Could not setup the VM." << std::endl;
-      return -1;
+      return false;
   }
 
   std::cout << "Running program:...";
 
-  Texture inTex = load_tex("data/testin.bmp");
+  Texture inTex = load_tex("data/testin.bmp", &pool);
+  MipChain inMips;
+  inMips.Generate(inTex, pool, args.Layout, args.Format);
+
+  // Only the converted texels are kept.
+  std::vector<byte> texels(getLayoutTexelCount(args.Layout, 2, (uint32*)&inTex) * getTexelSize(args.Format));
+  convertToLayout(args.Layout, args.Format, 2, (uint32*)&inTex, inTex.data, texels.data());
+  delete[] inTex.data;
+  inTex.data = nullptr;
 
-  Sampler* sampler = new Sampler{ 2, (uint32*)&inTex, inTex.data, FilterMode::FMPoint, WrapMode::WMRepeat };
+  Sampler* sampler = new Sampler{ 2, (uint32*)&inTex, texels.data(), FilterMode::FMPoint, WrapMode::WMRepeat };
+  inMips.Bind(sampler);
+  sampler->Layout = args.Layout;
+  sampler->Format = args.Format;
   Vec2* texSize = new Vec2{ (float)inTex.width, (float)inTex.height};
   Light* light = new Light{ {1, 0, 0, 1}, {0.5f, 0.5f} };
   Color* fragColor = new Color{ 0, 0, 0, 0 };
@@ -103,27 +276,146 @@ int main(int argc, const char** argv) {
 
   if(!allVariablesSet) {
     std::cout << "Could not set all variables." << std::endl;
+    return false;
+  }
+
+  if (args.Specialize && !specializeProgram(vm)) {
+    std::cout << "Could not specialize the program." << std::endl;
+    return false;
+  }
+
+  if (args.Hoist && !hoistProgram(vm)) {
+    std::cout << "Could not hoist the program." << std::endl;
+    return false;
+  }
+
+  *outTex = MakeFlatTexture(inTex.width, inTex.height, { 0, 0, 0, 1 }, &pool);
+
+  FragmentDispatch dispatch;
+  dispatch.Width = outTex->width;
+  dispatch.Height = outTex->height;
+  dispatch.CoordinateName = "uv";
+  dispatch.OutputName = "gl_FragColor";
+  dispatch.Lanes = args.Lanes;
+
+  if (!dispatchFragments(vm, dispatch, pool, outTex->data)) {
+    std::cout << "Program failed to run.";
+    return false;
+  }
+
+  return true;
+}
+
+int main(int argc, const char** argv) {
+  CmdArgs args;
+  if (!ParseArgs(argc, argv, &args)) {
+    std::cout << "Could not parse arguments. Usage: " << USAGE << std::endl;
     return -1;
   }
 
-  Texture outTex = MakeFlatTexture(inTex.width, inTex.height, { 0, 0, 0, 1 });
+  Program prog;
+  PreparedModule prepared;
+  std::string cachePath;
+  uint64 moduleHash = 0;
+  bool cached = false;
+
+  if (args.CacheDirectory) {
+    if (!getModuleCachePath(args.CacheDirectory, args.InputFile, &cachePath, &moduleHash)) {
+      std::cout << "Could not read " << args.InputFile << std::endl;
+      return -1;
+    }
+    cached = readModuleCache(cachePath.c_str(), moduleHash, &prog, &prepared, std::cout);
+    if (cached) {
+      std::cout << "Loaded program from " << cachePath << std::endl;
+    }
+  }
+
+  if (!cached) {
+    Parser parser(args.InputFile, args.Mapped ? LMMap : LMRead);
+    if (!parser.Parse(&prog)) {
+      std::cout << "Could not parse program." << std::endl;
+      return -1;
+    }
 
-  for (int x = 0; x < outTex.width; x++) {
-    for (int y = 0; y < outTex.height; y++) {
-      uv->x = float(x) / outTex.width;
-      uv->y = float(y) / outTex.height;
+    std::cout << "Validating program:...";
+    if(!validate(prog, std::cout)) {
+      std::cout << "Validation failed." << std::endl;
+      return -1;
+    }
+    std::cout << "done" << std::endl;
 
-      if (!vm.Run()) {
-        std::cout << "Program failed to run.";
-        return -1;
+    if (args.CacheDirectory) {
+      if (!prepareModule(prog, &prepared, std::cout) ||
+          !writeModuleCache(cachePath.c_str(), moduleHash, prog, prepared, std::cout)) {
+        std::cout << "Could not cache program." << std::endl;
       }
+    }
+  }
+
+  // Cache entries hold the module as parsed, so it is optimized and prepared
+  // again after loading one.
+  if (args.Optimize) {
+    PassManager passes;
+    passes.AddDefaultPasses();
+    if (!passes.Run(&prog, std::cout)) {
+      std::cout << "Could not optimize program." << std::endl;
+      return -1;
+    }
+    for (auto& pass : passes.Stats()) {
+      std::cout << "Pass " << pass.Name << ": " << pass.InstructionsBefore << " -> " << pass.InstructionsAfter
+                << " instructions in " << pass.Milliseconds << " ms" << std::endl;
+    }
+    prepared = PreparedModule();
+  }
+
+  std::cout << writeProgram(prog);
+
+  std::cout << "Generationg code:...";
+  if (!genCode(args.OutputFile, prog)) {
+    std::cout << "Could not generate code for program." << std::endl;
+    return -1;
+  }
+  std::cout << "done" << std::endl;
 
-      outTex.data[x + y * outTex.width] = **(Color**)vm.ReadVariable("gl_FragColor");
+  Environment env;
+  ThreadPool pool(args.ThreadCount);
+  Texture outTex;
+  if (args.Native) {
+    NativeVM vm(prog, env, prepared, args.NativeDirectory);
+    vm.SetMathPrecision(args.Precision);
+    if (!runProgram(vm, args, pool, &outTex)) {
+      return -1;
+    }
+  } else {
+    InterpretedVM vm(prog, env, prepared);
+    vm.SetMathPrecision(args.Precision);
+    vm.SetDispatchMode(args.Dispatch);
+    vm.SetProfiling(args.ProfilePrefix != nullptr);
+    if (!runProgram(vm, args, pool, &outTex)) {
+      return -1;
+    }
+    if (args.ProfilePrefix && !reportProfile(vm, prog, args.ProfilePrefix)) {
+      return -1;
     }
   }
 
-  save_bmp("data/testout.bmp", outTex);
+  save_bmp(args.ImageFile, outTex, &pool);
 
   std::cout << " done";
+
+  if (args.ReferenceFile) {
+    uint32 mismatches;
+    int maxError;
+    if (!compare_tex(args.ReferenceFile, outTex, args.Tolerance, &mismatches, &maxError, &pool)) {
+      std::cout << std::endl << "Could not compare the output with " << args.ReferenceFile << std::endl;
+      return -1;
+    }
+    if (mismatches > 0) {
+      std::cout << std::endl << mismatches << " pixels differ from " << args.ReferenceFile
+                << " by up to " << maxError << std::endl;
+      return -1;
+    }
+    std::cout << std::endl << "Output matches " << args.ReferenceFile << std::endl;
+  }
   return 0;
 }
@@ -40,7 +40,7 @@ bool Parser::expect(uint32 e) const {
 }
 
 
-SOp Parser::readInstruction() {
+SOp Parser::readInstruction(Arena& opMemory) {
   uint32* opData = buffer;
   uint32 word = getAndEat();
   spv::Op op = (spv::Op)(word & spv::OpCodeMask);
@@ -65,7 +65,22 @@ SOp Parser::readInstruction() {
     }
   }
 
-  uint32* opMem = new uint32[opWordCount + 1];
+  // If every operand is present and none of them is a list or string, the
+  // instruction words have the same layout as the op struct.
+  bool inPlace = mapped && wordCount == opWordCount;
+  for (uint32 i = 1; inPlace && i < wordCount; i++) {
+    inPlace = wordTypes[i] != WordType::TIdList &&
+              wordTypes[i] != WordType::TLiteralNumberList &&
+              wordTypes[i] != WordType::TLiteralString;
+  }
+
+  if (inPlace) {
+    buffer = opData + wordCount;
+    index += wordCount - 1;
+    return SOp{ op, opData + 1 };
+  }
+
+  uint32* opMem = (uint32*)opMemory.Alloc(sizeof(uint32) * (opWordCount + 1));
   memset(opMem, 0, sizeof(uint32) * (opWordCount + 1));
   SOp Result = { op, opMem };
   auto bufferBegin = buffer;
@@ -97,37 +112,78 @@ SOp Parser::readInstruction() {
 }
 
 bool Parser::Parse(Program *outProg) {
+  if (length < 5) {
+    std::cout << "Module is too short to be SPIR-V." << std::endl;
+    return false;
+  }
+
   if (!expectAndEat(spv::MagicNumber)) {
     return false;
   }
 
-  ParseProgram prog;
+  Program prog;
+  prog.Words = words;
+  prog.WordCount = length;
   prog.Version = getAndEat();
   prog.GeneratorMagic = getAndEat();
   prog.IDBound = getAndEat();
   prog.InstructionSchema = getAndEat();
 
-  int instructionIndex = 0;
-  prog.NextOp = readInstruction();
-
-  do {
-    SOp op = prog.NextOp;
-    instructionIndex++;
-    if (!end()) {
-      prog.NextOp = readInstruction();
-    } else {
-      prog.NextOp = SOp{ Op::OpNop, nullptr };
+  // A Nop ends the module, same as running out of words.
+  while (!end()) {
+    SOp op = readInstruction(prog.Memory);
+    if (op.Op == Op::OpNop) {
+      break;
     }
+    prog.Ops.push_back(op);
+  }
+
+  indexProgram(&prog);
+  *outProg = std::move(prog);
+  return true;
+}
+
+void indexProgram(Program* outProg) {
+  ParseProgram prog;
+  (Program&)prog = std::move(*outProg);
+  reserveIds(&prog, prog.IDBound);
+
+  for (size_t i = 0; i < prog.Ops.size(); i++) {
+    SOp op = prog.Ops[i];
+    prog.NextOp = i + 1 < prog.Ops.size() ? prog.Ops[i + 1] : SOp{ Op::OpNop, nullptr };
 
     LUTHandlerMethods[(int)op.Op]((void*)op.Memory, &prog);
-    prog.Ops.push_back(op);
 
     if (prog.InFunction && prog.CurrentFunction->InBlock) {
       addOp(&prog, op);
     }
-  } while (prog.NextOp.Op != Op::OpNop);
+  }
+
+  *outProg = std::move((Program&)prog);
+}
 
-  *outProg = (Program)prog;
+bool getOpLayout(spv::Op op, uint32* size, int* pointerOffset) {
+  if (sizeof(LUTOpWordTypes) / sizeof(void*) <= (int)op) {
+    return false;
+  }
+
+  const WordType* opWordTypes = (const WordType*)LUTOpWordTypes[(int)op];
+  uint32 opWordCount = LUTOpWordTypesCount[(int)op];
+  *size = sizeof(uint32) * (opWordCount > 0 ? opWordCount - 1 : 0);
+  *pointerOffset = -1;
+  if (opWordCount < 2) {
+    return true;
+  }
+
+  // Lists are stored as their length followed by a pointer, strings as a pointer.
+  WordType last = opWordTypes[opWordCount - 1];
+  if (last == WordType::TIdList || last == WordType::TLiteralNumberList) {
+    *pointerOffset = sizeof(uint32) * (opWordCount - 1);
+    *size = *pointerOffset + sizeof(uint32*);
+  } else if (last == WordType::TLiteralString) {
+    *pointerOffset = sizeof(uint32) * (opWordCount - 2);
+    *size = *pointerOffset + sizeof(char*);
+  }
   return true;
 }
 
@@ -200,6 +256,7 @@ bool writeOpArg(std::stringstream& opline, SOp op, int i, const Program* prog, c
     opline << " " << name;
   }
 
+  return true;
 }
 
 std::string writeOp(SOp op, const Program* prog) {
@@ -1,17 +1,32 @@
 #pragma once
 #include "types.h"
+#include "Khronos/spirv.h"
 #include <string>
 #include <assert.h>
 #include <memory>
 #include <fstream>
 #include <iostream>
+#include "arena.h"
+#include "mapped_file.h"
 
 struct Program;
 struct SOp;
 
+enum LoadMode {
+  // Reads the module into memory.
+  LMRead,
+  // Maps the module read-only. Instructions whose operands are laid out like
+  // their S* struct point straight into the mapping instead of being copied.
+  LMMap
+};
+
+// Parsed programs share ownership of the module words and keep their decoded
+// instructions in their own arena, so they can outlive the parser.
 class Parser {
 private:
-  std::unique_ptr<uint32> bufferStart;
+  std::shared_ptr<const uint32> words;
+  bool mapped;
+  uint32* bufferStart;
   uint32* buffer;
   int length;
   int index;
@@ -22,20 +37,39 @@ private:
   uint32 getAndEat();
   bool expectAndEat(uint32 e);
   bool expect(uint32 e) const;
-  SOp readInstruction();
+  SOp readInstruction(Arena& opMemory);
 
 public:
   Parser(int length) {
     this->index = 0;
     this->length = length;
-    this->bufferStart = std::unique_ptr<uint32>(new uint32[length]);
-    this->buffer = bufferStart.get();
+    this->mapped = false;
+    this->bufferStart = new uint32[length];
+    this->words = std::shared_ptr<const uint32>(bufferStart, std::default_delete<uint32[]>());
+    this->buffer = bufferStart;
   }
 
-  Parser(const char* inputFileName) {
+  Parser(const char* inputFileName, LoadMode mode = LMRead) {
     assert(inputFileName);
 
     this->index = 0;
+    this->mapped = mode == LMMap;
+
+    if (mapped) {
+      std::shared_ptr<MappedFile> mappedFile(new MappedFile());
+      if (!mappedFile->Open(inputFileName) || mappedFile->Size() % 4 != 0) {
+        std::cout << "Could not map file." << std::endl;
+        this->length = 0;
+        this->bufferStart = nullptr;
+        this->buffer = nullptr;
+        return;
+      }
+      this->length = (int)(mappedFile->Size() / 4);
+      this->bufferStart = (uint32*)mappedFile->Data();
+      this->buffer = bufferStart;
+      this->words = std::shared_ptr<const uint32>(mappedFile, (const uint32*)mappedFile->Data());
+      return;
+    }
 
     std::ifstream inputFile;
 
@@ -47,8 +81,9 @@ public:
     assert(size % 4 == 0);
 
     this->length = size / 4;
-    this->bufferStart = std::unique_ptr<uint32>(new uint32[length]);
-    this->buffer = bufferStart.get();
+    this->bufferStart = new uint32[length];
+    this->words = std::shared_ptr<const uint32>(bufferStart, std::default_delete<uint32[]>());
+    this->buffer = bufferStart;
 
     if (!inputFile.read((char*)GetBufferPtr(), size)) {
       std::cout << "Could not read file." << std::endl;
@@ -59,11 +94,20 @@ public:
 
   bool Parse(Program *prog);
   uint32* GetBufferPtr() const {
-    return bufferStart.get();
+    return bufferStart;
   }
 
 };
 
+// Runs the instruction handlers over prog->Ops to fill in the lookup tables
+// and functions of a program whose instructions have already been decoded.
+void indexProgram(Program* prog);
+
+// Size in bytes of the operand struct the parser builds for op and the byte
+// offset of its list or string pointer within it, -1 if it has none. Fails for
+// instructions the parser has no layout for.
+bool getOpLayout(spv::Op op, uint32* size, int* pointerOffset);
+
 std::string writeProgram(const Program& prog);
 std::string writeOp(SOp op);
 std::string writeOp(SOp op, const Program* prog);
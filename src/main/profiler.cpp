@@ -0,0 +1,397 @@
+#include "profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+struct SourceLocation {
+  spv::Op Op;
+  uint32 FunctionId;
+  uint32 BlockId;
+  // File 0 if the instruction has no line.
+  SourceLine Line;
+};
+
+struct ProfileRow {
+  std::string Name;
+  // Opcode, label, function or line number.
+  uint32 Id;
+  ProfileCounter Counter;
+};
+
+static std::atomic<uint32> nextThread(0);
+
+static void add(ProfileCounter* to, const ProfileCounter& counter) {
+  to->Count += counter.Count;
+  to->Cycles += counter.Cycles;
+}
+
+static std::string functionName(const Program& prog, uint32 id) {
+  auto name = prog.Names.find(id);
+  if (name != prog.Names.end() && name->second.Name[0]) {
+    return name->second.Name;
+  }
+  std::stringstream result;
+  result << "%" << id;
+  return result.str();
+}
+
+static std::string lineName(const Program& prog, const SourceLine& line) {
+  std::stringstream result;
+  auto file = prog.Strings.find(line.first);
+  if (file != prog.Strings.end()) {
+    result << file->second.String;
+  } else {
+    result << "%" << line.first;
+  }
+  result << ":" << line.second;
+  return result.str();
+}
+
+// Folded stacks separate frames with semicolons, which mangled GLSL names
+// contain.
+static std::string frameName(std::string name) {
+  std::replace(name.begin(), name.end(), ';', ',');
+  std::replace(name.begin(), name.end(), ' ', '_');
+  return name;
+}
+
+Profile::Profile() : thread(nextThread++) {
+}
+
+uint32 Profile::Enter(uint32 caller, const DecodedFunction* func) {
+  std::vector<uint32>& candidates = caller == NoCaller ? roots : calls[caller].Callees;
+  uint32 node = NoCaller;
+  for (uint32 candidate : candidates) {
+    if (calls[candidate].Function == func) {
+      node = candidate;
+      break;
+    }
+  }
+  if (node == NoCaller) {
+    node = (uint32)calls.size();
+    calls.push_back(CallNode{ func, caller, 0, std::vector<ProfileCounter>(func->Ops.size(), ProfileCounter{ 0, 0 }), {} });
+    candidates.push_back(node);
+  }
+  calls[node].Started = readTraceClock();
+  return node;
+}
+
+uint32 Profile::Leave(uint32 node) {
+  const CallNode& call = calls[node];
+  if (events.size() < TRACE_MAX_EVENTS) {
+    events.push_back(TraceEvent{ call.Function->Id, thread, call.Started, readTraceClock() - call.Started });
+  } else {
+    droppedEvents++;
+  }
+  return call.Caller;
+}
+
+void Profile::Collect(const Program& prog) {
+  if (calls.empty()) {
+    return;
+  }
+
+  std::unordered_map<const void*, SourceLocation> locations;
+  std::map<uint32, uint32> entryBlocks;
+  std::vector<uint32> operands;
+  for (auto& func : prog.FunctionDefinitions) {
+    for (auto& block : func.second.Blocks) {
+      SourceLine line(0, 0);
+      for (auto& op : block.second.Ops) {
+        uint32 resultId = getOperandIds(DecodedOp{ op.Op, op.Memory, { 0, 0 }, nullptr, nullptr, IHUnimplemented, IBNone }, &operands);
+        auto opLine = resultId ? prog.Lines.find(resultId) : prog.Lines.end();
+        if (opLine != prog.Lines.end()) {
+          line = SourceLine(opLine->second.FileId, opLine->second.Line);
+        }
+        locations[op.Memory] = SourceLocation{ op.Op, func.first, block.first, line };
+      }
+    }
+    auto root = func.second.Blocks.find(0);
+    if (root != func.second.Blocks.end() && !root->second.Children.empty()) {
+      entryBlocks[func.first] = root->second.Children.front();
+    }
+  }
+
+  // Callers are entered before their callees, so their frames are known.
+  std::vector<std::string> frames(calls.size());
+  for (size_t i = 0; i < calls.size(); i++) {
+    const CallNode& call = calls[i];
+    std::string name = frameName(functionName(prog, call.Function->Id));
+    frames[i] = call.Caller == NoCaller ? name : frames[call.Caller] + ";" + name;
+  }
+
+  // Inlining copies instructions and adds ones that bind parameters and
+  // results with the operands of the call or return. Only the copies of an
+  // instruction that kept its opcode count towards its executions.
+  std::unordered_map<const void*, uint64> executions;
+  for (size_t i = 0; i < calls.size(); i++) {
+    const CallNode& call = calls[i];
+    const std::vector<DecodedOp>& ops = call.Function->Ops;
+    for (size_t j = 0; j < ops.size(); j++) {
+      const ProfileCounter& counter = call.Counters[j];
+      if (!counter.Count) {
+        continue;
+      }
+      add(&opcodes[(uint32)ops[j].Op], counter);
+
+      auto location = locations.find(ops[j].Memory);
+      if (location == locations.end()) {
+        stacks[frames[i]] += counter.Cycles;
+        continue;
+      }
+      const SourceLocation& source = location->second;
+      blocks[BlockLocation(source.FunctionId, source.BlockId)].Cycles += counter.Cycles;
+      functions[source.FunctionId].Cycles += counter.Cycles;
+      if (source.Op == ops[j].Op) {
+        executions[ops[j].Memory] += counter.Count;
+      }
+
+      std::string stack = frames[i];
+      if (source.FunctionId != call.Function->Id) {
+        stack += ";" + frameName(functionName(prog, source.FunctionId));
+      }
+      if (source.Line.first) {
+        lines[source.Line].Cycles += counter.Cycles;
+        stack += ";" + frameName(lineName(prog, source.Line));
+      }
+      stacks[stack] += counter.Cycles;
+    }
+  }
+
+  std::map<BlockLocation, uint64> blockExecutions;
+  std::map<SourceLine, uint64> lineExecutions;
+  for (auto& executed : executions) {
+    const SourceLocation& source = locations[executed.first];
+    uint64& blockCount = blockExecutions[BlockLocation(source.FunctionId, source.BlockId)];
+    blockCount = std::max(blockCount, executed.second);
+    if (source.Line.first) {
+      uint64& lineCount = lineExecutions[source.Line];
+      lineCount = std::max(lineCount, executed.second);
+    }
+  }
+  for (auto& executed : blockExecutions) {
+    blocks[executed.first].Count += executed.second;
+    auto entry = entryBlocks.find(executed.first.first);
+    if (entry != entryBlocks.end() && entry->second == executed.first.second) {
+      functions[executed.first.first].Count += executed.second;
+    }
+  }
+  for (auto& executed : lineExecutions) {
+    lines[executed.first].Count += executed.second;
+  }
+
+  calls.clear();
+  roots.clear();
+}
+
+void Profile::Merge(const Profile& other) {
+  std::lock_guard<std::mutex> lock(mergeMutex);
+  for (auto& opcode : other.opcodes) {
+    add(&opcodes[opcode.first], opcode.second);
+  }
+  for (auto& block : other.blocks) {
+    add(&blocks[block.first], block.second);
+  }
+  for (auto& func : other.functions) {
+    add(&functions[func.first], func.second);
+  }
+  for (auto& line : other.lines) {
+    add(&lines[line.first], line.second);
+  }
+  for (auto& stack : other.stacks) {
+    stacks[stack.first] += stack.second;
+  }
+  size_t kept = std::min(other.events.size(), (size_t)TRACE_MAX_EVENTS - std::min(events.size(), (size_t)TRACE_MAX_EVENTS));
+  events.insert(events.end(), other.events.begin(), other.events.begin() + kept);
+  droppedEvents += other.droppedEvents + (other.events.size() - kept);
+}
+
+uint64 Profile::TotalCycles() const {
+  uint64 total = 0;
+  for (auto& opcode : opcodes) {
+    total += opcode.second.Cycles;
+  }
+  return total;
+}
+
+static std::string blockName(const Program& prog, const BlockLocation& block) {
+  std::stringstream result;
+  result << functionName(prog, block.first) << " %" << block.second;
+  return result.str();
+}
+
+static std::vector<ProfileRow> opcodeRows(const Profile& profile) {
+  std::vector<ProfileRow> rows;
+  for (auto& opcode : profile.Opcodes()) {
+    rows.push_back(ProfileRow{ OpStrings[opcode.first], opcode.first, opcode.second });
+  }
+  return rows;
+}
+
+static std::vector<ProfileRow> blockRows(const Profile& profile, const Program& prog) {
+  std::vector<ProfileRow> rows;
+  for (auto& block : profile.Blocks()) {
+    rows.push_back(ProfileRow{ blockName(prog, block.first), block.first.second, block.second });
+  }
+  return rows;
+}
+
+static std::vector<ProfileRow> functionRows(const Profile& profile, const Program& prog) {
+  std::vector<ProfileRow> rows;
+  for (auto& func : profile.Functions()) {
+    rows.push_back(ProfileRow{ functionName(prog, func.first), func.first, func.second });
+  }
+  return rows;
+}
+
+static std::vector<ProfileRow> lineRows(const Profile& profile, const Program& prog) {
+  std::vector<ProfileRow> rows;
+  for (auto& line : profile.Lines()) {
+    rows.push_back(ProfileRow{ lineName(prog, line.first), line.first.second, line.second });
+  }
+  return rows;
+}
+
+static void writeTable(const char* title, std::vector<ProfileRow> rows, uint64 total, uint32 maxRows,
+                       std::ostream& out) {
+  std::stable_sort(rows.begin(), rows.end(), [](const ProfileRow& a, const ProfileRow& b) {
+    return a.Counter.Cycles > b.Counter.Cycles;
+  });
+
+  out << title << ":" << std::endl;
+  out << std::setw(16) << "cycles" << std::setw(8) << "%" << std::setw(14) << "count"
+      << std::setw(12) << "per exec" << "  name" << std::endl;
+  for (size_t i = 0; i < rows.size() && i < maxRows; i++) {
+    const ProfileCounter& counter = rows[i].Counter;
+    double share = total ? 100.0 * counter.Cycles / total : 0;
+    double perExecution = counter.Count ? (double)counter.Cycles / counter.Count : 0;
+    out << std::setw(16) << counter.Cycles << std::setw(8) << std::fixed << std::setprecision(2) << share
+        << std::setw(14) << counter.Count << std::setw(12) << std::setprecision(1) << perExecution
+        << "  " << rows[i].Name << std::endl;
+  }
+  out.unsetf(std::ios_base::floatfield);
+}
+
+void Profile::Report(const Program& prog, std::ostream& out, uint32 maxRows) const {
+  uint64 total = TotalCycles();
+  out << "Profile: " << total << " cycles" << std::endl;
+  writeTable("Opcodes", opcodeRows(*this), total, maxRows, out);
+  writeTable("Blocks", blockRows(*this, prog), total, maxRows, out);
+  writeTable("Functions", functionRows(*this, prog), total, maxRows, out);
+  if (!lines.empty()) {
+    writeTable("Lines", lineRows(*this, prog), total, maxRows, out);
+  }
+}
+
+static void writeJsonString(const std::string& str, std::ostream& out) {
+  out << '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if ((unsigned char)c < 0x20) {
+      out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec << std::setfill(' ');
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+}
+
+static void writeJsonRows(const char* key, const std::vector<ProfileRow>& rows, std::ostream& out) {
+  out << "  \"" << key << "\": [";
+  for (size_t i = 0; i < rows.size(); i++) {
+    out << (i ? ",\n" : "\n") << "    { \"name\": ";
+    writeJsonString(rows[i].Name, out);
+    out << ", \"id\": " << rows[i].Id << ", \"count\": " << rows[i].Counter.Count << ", \"cycles\": " << rows[i].Counter.Cycles << " }";
+  }
+  out << "\n  ]";
+}
+
+bool Profile::WriteJson(const Program& prog, const char* path, std::ostream& errorOut) const {
+  std::ofstream out(path);
+  if (!out) {
+    errorOut << "Could not write profile " << path << std::endl;
+    return false;
+  }
+
+#ifdef OTHERSIDE_RDTSC
+  const char* unit = "tsc";
+#else
+  const char* unit = "ns";
+#endif
+  out << "{\n  \"unit\": \"" << unit << "\",\n  \"cycles\": " << TotalCycles() << ",\n";
+  writeJsonRows("opcodes", opcodeRows(*this), out);
+  out << ",\n";
+  writeJsonRows("blocks", blockRows(*this, prog), out);
+  out << ",\n";
+  writeJsonRows("functions", functionRows(*this, prog), out);
+  out << ",\n";
+  writeJsonRows("lines", lineRows(*this, prog), out);
+  out << "\n}\n";
+
+  if (!out) {
+    errorOut << "Could not write profile " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool Profile::WriteFoldedStacks(const char* path, std::ostream& errorOut) const {
+  std::ofstream out(path);
+  if (!out) {
+    errorOut << "Could not write profile " << path << std::endl;
+    return false;
+  }
+
+  for (auto& stack : stacks) {
+    if (stack.second) {
+      out << stack.first << " " << stack.second << "\n";
+    }
+  }
+
+  if (!out) {
+    errorOut << "Could not write profile " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool Profile::WriteTrace(const Program& prog, const char* path, std::ostream& errorOut) const {
+  std::ofstream out(path);
+  if (!out) {
+    errorOut << "Could not write trace " << path << std::endl;
+    return false;
+  }
+
+  // Timestamps are in microseconds from the first call.
+  uint64 first = (uint64)-1;
+  for (auto& event : events) {
+    first = std::min(first, event.Start);
+  }
+
+  std::map<uint32, std::string> names;
+  out << "{\n  \"displayTimeUnit\": \"ns\",\n  \"droppedEvents\": " << droppedEvents << ",\n  \"traceEvents\": [";
+  out << std::fixed << std::setprecision(3);
+  for (size_t i = 0; i < events.size(); i++) {
+    const TraceEvent& event = events[i];
+    auto name = names.find(event.FunctionId);
+    if (name == names.end()) {
+      name = names.insert(std::make_pair(event.FunctionId, functionName(prog, event.FunctionId))).first;
+    }
+    out << (i ? ",\n" : "\n") << "    { \"name\": ";
+    writeJsonString(name->second, out);
+    out << ", \"cat\": \"function\", \"ph\": \"X\", \"ts\": " << (event.Start - first) / 1000.0
+        << ", \"dur\": " << event.Duration / 1000.0 << ", \"pid\": 0, \"tid\": " << event.Thread << " }";
+  }
+  out << "\n  ]\n}\n";
+
+  if (!out) {
+    errorOut << "Could not write trace " << path << std::endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,135 @@
+#pragma once
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "types.h"
+#include "parser_definitions.h"
+#include "decoder.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+  #define OTHERSIDE_RDTSC 1
+  #include <x86intrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+  #define OTHERSIDE_RDTSC 1
+  #include <intrin.h>
+#endif
+
+// Time stamp counter on x86, nanoseconds of the steady clock elsewhere.
+inline uint64 readCycleCounter() {
+#ifdef OTHERSIDE_RDTSC
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Nanoseconds of the steady clock, which trace events are placed on.
+inline uint64 readTraceClock() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// A profile keeps at most this many trace events, later calls are dropped.
+const uint32 TRACE_MAX_EVENTS = 100000;
+
+struct ProfileCounter {
+  uint64 Count;
+  uint64 Cycles;
+};
+
+// Function id and label of a block.
+typedef std::pair<uint32, uint32> BlockLocation;
+
+// OpString id of the file and line number an OpLine gave.
+typedef std::pair<uint32, uint32> SourceLine;
+
+// A call of a function, on the steady clock.
+struct TraceEvent {
+  uint32 FunctionId;
+  uint32 Thread;
+  uint64 Start;
+  uint64 Duration;
+};
+
+// Executions and cycles of a program per opcode, block, function and source
+// line. Every instruction is charged the cycles until the next one starts, so
+// a call is charged for binding the parameters and a function only for its
+// own instructions. Inlined instructions count for the function they came
+// from. Blocks, functions and lines count how often their most executed
+// instruction ran. Instructions without a line of their own take the one of
+// the instruction before them in their block.
+class Profile {
+private:
+  // A function in the context of the calls that led to it.
+  struct CallNode {
+    const DecodedFunction* Function;
+    uint32 Caller;
+    uint64 Started;
+    // Indexed like the instructions of Function.
+    std::vector<ProfileCounter> Counters;
+    std::vector<uint32> Callees;
+  };
+
+  // Nodes of the calls since the last Collect(), nodes never move.
+  std::deque<CallNode> calls;
+  std::vector<uint32> roots;
+  uint32 thread;
+
+  std::map<uint32, ProfileCounter> opcodes;
+  std::map<BlockLocation, ProfileCounter> blocks;
+  std::map<uint32, ProfileCounter> functions;
+  std::map<SourceLine, ProfileCounter> lines;
+  // Cycles per call stack in the folded format of flamegraph.pl, the frames
+  // are functions with the source line on top.
+  std::map<std::string, uint64> stacks;
+  std::vector<TraceEvent> events;
+  uint64 droppedEvents = 0;
+  std::mutex mergeMutex;
+
+public:
+  static const uint32 NoCaller = (uint32)-1;
+
+  // Every profile is a thread of the trace.
+  Profile();
+
+  // Starts a call of func from the node caller, NoCaller for the function an
+  // execution starts with, and returns its node.
+  uint32 Enter(uint32 caller, const DecodedFunction* func);
+  // Ends the call of node and returns the node of its caller.
+  uint32 Leave(uint32 node);
+  // Counters for the instructions of node, valid until the next Collect().
+  ProfileCounter* Counters(uint32 node) { return calls[node].Counters.data(); }
+
+  // Attributes the instruction counters to opcodes, blocks, functions, lines
+  // and call stacks. The functions counted have to be alive, so the VM
+  // collects before it drops a program.
+  void Collect(const Program& prog);
+  // Adds the collected counters and trace events of other. Forks merge into
+  // their parent's profile concurrently.
+  void Merge(const Profile& other);
+
+  const std::map<uint32, ProfileCounter>& Opcodes() const { return opcodes; }
+  const std::map<BlockLocation, ProfileCounter>& Blocks() const { return blocks; }
+  const std::map<uint32, ProfileCounter>& Functions() const { return functions; }
+  const std::map<SourceLine, ProfileCounter>& Lines() const { return lines; }
+  const std::map<std::string, uint64>& Stacks() const { return stacks; }
+  const std::vector<TraceEvent>& Events() const { return events; }
+  uint64 TotalCycles() const;
+
+  // Tables sorted by cycles, each cut off after maxRows rows. Lines are left
+  // out if the module has no OpLine.
+  void Report(const Program& prog, std::ostream& out, uint32 maxRows = 16) const;
+  bool WriteJson(const Program& prog, const char* path, std::ostream& errorOut) const;
+  // One line per call stack with its cycles, which flamegraph.pl and
+  // speedscope read.
+  bool WriteFoldedStacks(const char* path, std::ostream& errorOut) const;
+  // Calls as complete events of the Chrome trace event format, which
+  // chrome://tracing and Perfetto open.
+  bool WriteTrace(const Program& prog, const char* path, std::ostream& errorOut) const;
+};
@@ -0,0 +1,225 @@
+#include "specializer.h"
+#include "interpreted_vm.h"
+#include "parser.h"
+#include <iostream>
+
+bool isUniformStorage(spv::StorageClass storageClass) {
+  return storageClass == StorageClass::UniformConstant || storageClass == StorageClass::Uniform;
+}
+
+bool isFoldable(spv::Op op) {
+  switch (op) {
+  case Op::OpFAdd:
+  case Op::OpIAdd:
+  case Op::OpFSub:
+  case Op::OpISub:
+  case Op::OpFDiv:
+  case Op::OpFMul:
+  case Op::OpIMul:
+  case Op::OpSLessThan:
+  case Op::OpSGreaterThan:
+  case Op::OpVectorTimesScalar:
+  case Op::OpConvertSToF:
+  case Op::OpLoad:
+  case Op::OpAccessChain:
+  case Op::OpVectorShuffle:
+  case Op::OpCompositeExtract:
+  case Op::OpCompositeInsert:
+  case Op::OpCompositeConstruct:
+  case Op::OpExtInst:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// The entry, branch targets and every instruction after a terminator.
+static std::vector<bool> findBlockStarts(const DecodedFunction& func) {
+  std::vector<bool> starts(func.Ops.size(), false);
+  starts[0] = true;
+  for (size_t i = 0; i < func.Ops.size(); i++) {
+    const DecodedOp& op = func.Ops[i];
+    if (op.Op == Op::OpBranch || op.Op == Op::OpBranchConditional) {
+      starts[op.Targets[0]] = true;
+    }
+    if (op.Op == Op::OpBranchConditional) {
+      starts[op.Targets[1]] = true;
+    }
+    if (isTerminator(op.Op) && i + 1 < func.Ops.size()) {
+      starts[i + 1] = true;
+    }
+  }
+  return starts;
+}
+
+// Instructions of the blocks reachable from the entry.
+static std::vector<bool> findReachable(const std::vector<DecodedOp>& ops) {
+  std::vector<bool> reachable(ops.size(), false);
+  std::vector<uint32> pending(1, 0);
+  while (!pending.empty()) {
+    uint32 pc = pending.back();
+    pending.pop_back();
+    for (; pc < ops.size() && !reachable[pc]; pc++) {
+      reachable[pc] = true;
+      const DecodedOp& op = ops[pc];
+      if (op.Op == Op::OpBranch || op.Op == Op::OpBranchConditional) {
+        pending.push_back(op.Targets[0]);
+      }
+      if (op.Op == Op::OpBranchConditional) {
+        pending.push_back(op.Targets[1]);
+      }
+      if (isTerminator(op.Op)) {
+        break;
+      }
+    }
+  }
+  return reachable;
+}
+
+class Specializer {
+public:
+  static bool Specialize(InterpretedVM& vm, Specialization* out, SpecializationStats* stats);
+
+private:
+  static void SpecializeFunction(InterpretedVM& vm, const DecodedFunction& func, std::vector<bool>& known,
+                                 DecodedFunction* out, Specialization* spec, SpecializationStats* stats);
+};
+
+void Specializer::SpecializeFunction(InterpretedVM& vm, const DecodedFunction& func, std::vector<bool>& known,
+                                     DecodedFunction* out, Specialization* spec, SpecializationStats* stats) {
+  const std::vector<DecodedOp>& ops = func.Ops;
+  std::vector<DecodedOp> rewritten(ops);
+  std::vector<bool> folded(ops.size(), false);
+  std::vector<bool> starts = findBlockStarts(func);
+
+  // Folding runs in program order, which visits the definition of an id
+  // before its uses. Blocks are only evaluated once a branch that survived
+  // folding leads to them, so nothing is computed for code that's never run.
+  std::vector<bool> reached(ops.size(), false);
+  reached[0] = true;
+  bool inReachedBlock = false;
+
+  DecodedFunction single;
+  single.Id = func.Id;
+  single.Source = func.Source;
+  single.Ops.resize(2);
+  single.Ops[1] = DecodedOp{ Op::OpReturn, nullptr, { 0, 0 }, nullptr, nullptr, IHReturn, IBNone };
+
+  std::vector<uint32> operands;
+  for (size_t i = 0; i < ops.size(); i++) {
+    if (starts[i]) {
+      inReachedBlock = reached[i];
+    }
+    if (!inReachedBlock) {
+      continue;
+    }
+
+    const DecodedOp& op = ops[i];
+    uint32 resultId = getOperandIds(op, &operands);
+    bool allKnown = true;
+    for (uint32 id : operands) {
+      allKnown = allKnown && known[id];
+    }
+
+    if (resultId && allKnown && isFoldable(op.Op)) {
+      single.Ops[0] = op;
+      selectHandlers(&single);
+      if (vm.Execute(&single) == 0) {
+        // Loads alias the variable, which a fork replaces with its own copy.
+        if (op.Op == Op::OpLoad) {
+          vm.env.Values[resultId] = vm.Dereference(vm.env.Values[resultId]);
+        }
+        known[resultId] = true;
+        folded[i] = true;
+        spec->Folded.push_back(FoldedResult{ resultId, ((uint32*)op.Memory)[0] });
+        stats->FoldedOps++;
+        continue;
+      }
+    }
+
+    DecodedOp& result = rewritten[i];
+    if (op.Op == Op::OpBranchConditional && allKnown) {
+      Value cond = vm.Dereference(vm.env.Values[operands[0]]);
+      result.Op = Op::OpBranch;
+      result.Targets[0] = *(bool*)cond.Memory ? op.Targets[0] : op.Targets[1];
+      stats->FoldedBranches++;
+    }
+    if (result.Op == Op::OpBranch || result.Op == Op::OpBranchConditional) {
+      reached[result.Targets[0]] = true;
+    }
+    if (result.Op == Op::OpBranchConditional) {
+      reached[result.Targets[1]] = true;
+    }
+  }
+
+  // Branch targets move to the first remaining instruction of their block,
+  // terminators are never removed so there always is one.
+  std::vector<bool> reachable = findReachable(rewritten);
+  std::vector<uint32> newIndex(ops.size());
+  uint32 kept = 0;
+  for (size_t i = 0; i < ops.size(); i++) {
+    newIndex[i] = kept;
+    if (reachable[i] && !folded[i]) {
+      kept++;
+    } else if (!reachable[i]) {
+      stats->PrunedOps++;
+    }
+  }
+
+  out->Ops.clear();
+  out->Ops.reserve(kept);
+  for (size_t i = 0; i < ops.size(); i++) {
+    if (!reachable[i] || folded[i]) {
+      continue;
+    }
+    DecodedOp op = rewritten[i];
+    if (op.Op == Op::OpBranch || op.Op == Op::OpBranchConditional) {
+      op.Targets[0] = newIndex[op.Targets[0]];
+    }
+    if (op.Op == Op::OpBranchConditional) {
+      op.Targets[1] = newIndex[op.Targets[1]];
+    }
+    out->Ops.push_back(op);
+  }
+  selectHandlers(out);
+}
+
+bool Specializer::Specialize(InterpretedVM& vm, Specialization* out, SpecializationStats* stats) {
+  if (!vm.decoded) {
+    std::cout << "The VM has to be set up before it is specialized." << std::endl;
+    return false;
+  }
+
+  std::vector<bool> known(vm.prog.IDBound, false);
+  for (auto& constant : vm.prog.Constants) {
+    known[constant.first] = vm.env.Values[constant.first].Memory != nullptr;
+  }
+  for (auto& var : vm.prog.Variables) {
+    Value val = vm.env.Values[var.first];
+    known[var.first] = isUniformStorage(var.second.StorageClass) && val.Memory && *(byte**)val.Memory;
+  }
+
+  SpecializationStats counts = { 0, 0, 0 };
+  std::shared_ptr<DecodedProgram> program(new DecodedProgram(*vm.decoded));
+  out->Memory.reset(new Arena());
+  out->Folded.clear();
+
+  // Folded results are allocated from the specialization, which forks share,
+  // instead of the memory of the VM.
+  Arena* previousMemory = vm.currentMemory;
+  vm.currentMemory = out->Memory.get();
+  for (size_t f = 0; f < program->Functions.size(); f++) {
+    SpecializeFunction(vm, vm.decoded->Functions[f], known, &program->Functions[f], out, &counts);
+  }
+  vm.currentMemory = previousMemory;
+
+  out->Program = program;
+  if (stats) {
+    *stats = counts;
+  }
+  return true;
+}
+
+bool specialize(InterpretedVM& vm, Specialization* out, SpecializationStats* stats) {
+  return Specializer::Specialize(vm, out, stats);
+}
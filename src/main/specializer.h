@@ -0,0 +1,43 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "types.h"
+#include "decoder.h"
+#include "arena.h"
+
+class InterpretedVM;
+
+struct FoldedResult {
+  uint32 Id;
+  uint32 TypeId;
+};
+
+// A program specialized for the uniform bindings of a VM. Instructions that
+// only depend on constants and uniforms were executed once, their results are
+// kept in Memory and listed in Folded. Conditional branches on such values
+// became unconditional and blocks that can't be reached any more are removed.
+// Functions keep their indices.
+struct Specialization {
+  std::shared_ptr<const DecodedProgram> Program;
+  std::shared_ptr<Arena> Memory;
+  std::vector<FoldedResult> Folded;
+};
+
+struct SpecializationStats {
+  uint32 FoldedOps;
+  uint32 FoldedBranches;
+  uint32 PrunedOps;
+};
+
+// Variables whose bindings a specialization depends on.
+bool isUniformStorage(spv::StorageClass storageClass);
+
+// Instructions without side effects whose result only depends on their
+// operands. Loads qualify as long as the memory they read is known not to
+// change, the callers make sure of that.
+bool isFoldable(spv::Op op);
+
+// Specializes the program of vm, which has to be set up, for the values its
+// uniform variables point to now. The folded results are stored in the
+// environment of vm. Unbound uniforms are treated as unknown.
+bool specialize(InterpretedVM& vm, Specialization* out, SpecializationStats* stats);
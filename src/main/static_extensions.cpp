@@ -0,0 +1,71 @@
+#include "static_extensions.h"
+#include <cctype>
+
+#ifdef OTHERSIDE_STATIC_GLSL_STD_450
+extern "C" ExtInstFunc** GetGlslStd450Table(uint32* outCount);
+extern "C" ExtBatchInstFunc** GetGlslStd450BatchTable(uint32* outCount);
+#endif
+
+namespace {
+
+bool equalsIgnoreCase(const char* a, const char* b) {
+  for (; *a && *b; a++, b++) {
+    if (std::tolower((unsigned char)*a) != std::tolower((unsigned char)*b)) {
+      return false;
+    }
+  }
+  return *a == *b;
+}
+
+struct StaticExtensionList {
+  StaticExtension Extensions[1];
+  uint32 Count;
+
+  StaticExtensionList() : Count(0) {
+#ifdef OTHERSIDE_STATIC_GLSL_STD_450
+    StaticExtension& std450 = Extensions[Count++];
+    std450.Name = "GLSL.std.450";
+    std450.Table = GetGlslStd450Table(&std450.InstructionCount);
+    std450.BatchTable = GetGlslStd450BatchTable(&std450.BatchInstructionCount);
+#endif
+  }
+};
+
+const StaticExtensionList& getStaticExtensions() {
+  static const StaticExtensionList list;
+  return list;
+}
+
+}
+
+const StaticExtension* findStaticExtension(const char* name) {
+  const StaticExtensionList& list = getStaticExtensions();
+  for (uint32 i = 0; i < list.Count; i++) {
+    if (equalsIgnoreCase(list.Extensions[i].Name, name)) {
+      return &list.Extensions[i];
+    }
+  }
+  return nullptr;
+}
+
+static const StaticExtension* staticExtensionOf(const Program& prog, const SExtInst& inst) {
+  auto import = prog.ExtensionImports.find(inst.SetId);
+  if (import == prog.ExtensionImports.end()) {
+    return nullptr;
+  }
+  const StaticExtension* ext = findStaticExtension(import->second.Name);
+  if (!ext || inst.Instruction >= ext->InstructionCount) {
+    return nullptr;
+  }
+  return ext;
+}
+
+ExtInstFunc* resolveStaticExtInst(const Program& prog, const SExtInst& inst) {
+  const StaticExtension* ext = staticExtensionOf(prog, inst);
+  return ext ? ext->Table[inst.Instruction] : nullptr;
+}
+
+ExtBatchInstFunc* resolveStaticExtBatchInst(const Program& prog, const SExtInst& inst) {
+  const StaticExtension* ext = staticExtensionOf(prog, inst);
+  return ext && ext->BatchTable && inst.Instruction < ext->BatchInstructionCount ? ext->BatchTable[inst.Instruction] : nullptr;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "types.h"
+#include "ext_inst.h"
+#include "parser_definitions.h"
+
+// An extended instruction set compiled into the interpreter. Importing it
+// never loads a library from ext/.
+struct StaticExtension {
+  const char* Name;
+  ExtInstFunc** Table;
+  uint32 InstructionCount;
+  // Indexed like Table, nullptr if the set has no batched functions.
+  ExtBatchInstFunc** BatchTable;
+  uint32 BatchInstructionCount;
+};
+
+// Looks up an import name, ignoring case. nullptr if the set isn't linked in.
+const StaticExtension* findStaticExtension(const char* name);
+
+// Function of an OpExtInst whose set is linked in, nullptr if its set has to
+// be loaded at runtime or the instruction is out of range.
+ExtInstFunc* resolveStaticExtInst(const Program& prog, const SExtInst& inst);
+
+// Same for the batched function, nullptr if there is none.
+ExtBatchInstFunc* resolveStaticExtBatchInst(const Program& prog, const SExtInst& inst);
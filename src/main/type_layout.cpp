@@ -0,0 +1,132 @@
+#include "type_layout.h"
+#include "parser.h"
+#include <algorithm>
+
+uint32 TypeLayoutTable::ElementOffset(uint32 typeId, uint32 index, uint32* elementTypeId) const {
+  const TypeLayout& type = Types[typeId];
+  if (type.Definition.Op == Op::OpTypeStruct) {
+    *elementTypeId = ((STypeStruct*)type.Definition.Memory)->MembertypeIds[index];
+    return MemberOffsets[type.FirstMember + index];
+  }
+
+  *elementTypeId = type.ElementTypeId;
+  return Types[type.ElementTypeId].Size * index;
+}
+
+static bool computeLayout(const Program& prog, uint32 typeId, TypeLayoutTable* table, std::vector<bool>* done, std::ostream& errorOut);
+
+// Ids don't have to be ascending in declaration order, so dependencies are
+// computed on demand.
+static const TypeLayout* dependency(const Program& prog, uint32 typeId, TypeLayoutTable* table, std::vector<bool>* done, std::ostream& errorOut) {
+  if (typeId >= done->size()) {
+    errorOut << "Type id " << typeId << " is out of bounds." << std::endl;
+    return nullptr;
+  }
+  if (!(*done)[typeId] && !computeLayout(prog, typeId, table, done, errorOut)) {
+    return nullptr;
+  }
+  return &table->Types[typeId];
+}
+
+static bool computeLayout(const Program& prog, uint32 typeId, TypeLayoutTable* table, std::vector<bool>* done, std::ostream& errorOut) {
+  auto defIt = prog.DefinedTypes.find(typeId);
+  if (defIt == prog.DefinedTypes.end()) {
+    errorOut << "Id " << typeId << " is not a type." << std::endl;
+    return false;
+  }
+  (*done)[typeId] = true;
+
+  SOp def = defIt->second;
+  TypeLayout layout;
+  layout.Definition = def;
+  layout.Size = 0;
+  layout.Alignment = 1;
+  layout.ElementTypeId = 0;
+  layout.ElementCount = 0;
+  layout.FirstMember = 0;
+
+  switch (def.Op) {
+  case Op::OpTypeInt: {
+    auto i = (STypeInt*)def.Memory;
+    layout.Size = layout.Alignment = i->Width / 8;
+    break;
+  }
+  case Op::OpTypeFloat: {
+    auto f = (STypeFloat*)def.Memory;
+    layout.Size = layout.Alignment = f->Width / 8;
+    break;
+  }
+  case Op::OpTypeBool:
+    layout.Size = layout.Alignment = sizeof(bool);
+    break;
+  case Op::OpTypePointer:
+    layout.Size = layout.Alignment = sizeof(void*);
+    break;
+  case Op::OpTypeVector: {
+    auto v = (STypeVector*)def.Memory;
+    const TypeLayout* comp = dependency(prog, v->ComponentTypeId, table, done, errorOut);
+    if (!comp) {
+      return false;
+    }
+    layout.ElementTypeId = v->ComponentTypeId;
+    layout.ElementCount = v->ComponentCount;
+    layout.Size = comp->Size * v->ComponentCount;
+    layout.Alignment = comp->Alignment;
+    break;
+  }
+  case Op::OpTypeArray: {
+    auto arr = (STypeArray*)def.Memory;
+    auto length = prog.Constants.find(arr->LengthId);
+    if (length == prog.Constants.end() || length->second.Op != Op::OpConstant) {
+      errorOut << "Array length " << arr->LengthId << " is not a constant." << std::endl;
+      return false;
+    }
+    const TypeLayout* element = dependency(prog, arr->ElementTypeId, table, done, errorOut);
+    if (!element) {
+      return false;
+    }
+    layout.ElementTypeId = arr->ElementTypeId;
+    layout.ElementCount = *((SConstant*)length->second.Memory)->Values;
+    layout.Size = element->Size * layout.ElementCount;
+    layout.Alignment = element->Alignment;
+    break;
+  }
+  case Op::OpTypeStruct: {
+    auto s = (STypeStruct*)def.Memory;
+    std::vector<uint32> offsets;
+    for (uint32 i = 0; i < s->MembertypeIdsCount; i++) {
+      const TypeLayout* member = dependency(prog, s->MembertypeIds[i], table, done, errorOut);
+      if (!member) {
+        return false;
+      }
+      offsets.push_back(layout.Size);
+      layout.Size += member->Size;
+      layout.Alignment = std::max(layout.Alignment, member->Alignment);
+    }
+    layout.ElementCount = s->MembertypeIdsCount;
+    layout.FirstMember = (uint32)table->MemberOffsets.size();
+    table->MemberOffsets.insert(table->MemberOffsets.end(), offsets.begin(), offsets.end());
+    break;
+  }
+  default:
+    // Void, functions and opaque types have no size of their own.
+    break;
+  }
+
+  table->Types[typeId] = layout;
+  return true;
+}
+
+bool computeTypeLayouts(const Program& prog, TypeLayoutTable* outTable, std::ostream& errorOut) {
+  outTable->Types.assign(prog.IDBound, TypeLayout{ SOp{ Op::OpNop, nullptr }, 0, 1, 0, 0, 0 });
+  outTable->MemberOffsets.clear();
+
+  std::vector<bool> done(prog.IDBound, false);
+  for (auto& type : prog.DefinedTypes) {
+    if (!dependency(prog, type.first, outTable, &done, errorOut)) {
+      return false;
+    }
+  }
+
+  return true;
+}
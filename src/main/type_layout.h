@@ -0,0 +1,34 @@
+#pragma once
+#include <vector>
+#include <ostream>
+#include "types.h"
+#include "parser_definitions.h"
+
+// Memory layout of a type as used by the VMs. Composites are packed, members
+// follow each other without padding. Alignment is the largest scalar
+// alignment inside the type and only informational.
+struct TypeLayout {
+  SOp Definition;
+  uint32 Size;
+  uint32 Alignment;
+  // Component type and count for vectors and arrays, member count for structs.
+  uint32 ElementTypeId;
+  uint32 ElementCount;
+  // Index of the first member offset of a struct in TypeLayoutTable::MemberOffsets.
+  uint32 FirstMember;
+};
+
+struct TypeLayoutTable {
+  // Indexed by type id, entries of ids that aren't types have a Nop definition.
+  std::vector<TypeLayout> Types;
+  std::vector<uint32> MemberOffsets;
+
+  const TypeLayout& operator[](uint32 typeId) const {
+    return Types[typeId];
+  }
+
+  // Byte offset and type of element index of a vector, array or struct.
+  uint32 ElementOffset(uint32 typeId, uint32 index, uint32* elementTypeId) const;
+};
+
+bool computeTypeLayouts(const Program& prog, TypeLayoutTable* outTable, std::ostream& errorOut);
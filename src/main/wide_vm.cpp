@@ -0,0 +1,902 @@
+#include "wide_vm.h"
+#include "parser.h"
+#include "simd.h"
+#include <iostream>
+#include <cstring>
+
+static const uint32 DONE = (uint32)-1;
+
+struct FAddOp {
+  static float Scalar(float a, float b) { return a + b; }
+#ifdef OTHERSIDE_SSE2
+  static __m128 Sse(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+#endif
+#ifdef OTHERSIDE_AVX
+  static __m256 Avx(__m256 a, __m256 b) { return _mm256_add_ps(a, b); }
+#endif
+};
+
+struct FSubOp {
+  static float Scalar(float a, float b) { return a - b; }
+#ifdef OTHERSIDE_SSE2
+  static __m128 Sse(__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+#endif
+#ifdef OTHERSIDE_AVX
+  static __m256 Avx(__m256 a, __m256 b) { return _mm256_sub_ps(a, b); }
+#endif
+};
+
+struct FMulOp {
+  static float Scalar(float a, float b) { return a * b; }
+#ifdef OTHERSIDE_SSE2
+  static __m128 Sse(__m128 a, __m128 b) { return _mm_mul_ps(a, b); }
+#endif
+#ifdef OTHERSIDE_AVX
+  static __m256 Avx(__m256 a, __m256 b) { return _mm256_mul_ps(a, b); }
+#endif
+};
+
+struct FDivOp {
+  static float Scalar(float a, float b) { return a / b; }
+#ifdef OTHERSIDE_SSE2
+  static __m128 Sse(__m128 a, __m128 b) { return _mm_div_ps(a, b); }
+#endif
+#ifdef OTHERSIDE_AVX
+  static __m256 Avx(__m256 a, __m256 b) { return _mm256_div_ps(a, b); }
+#endif
+};
+
+struct IAddOp {
+  static int32 Scalar(int32 a, int32 b) { return (int32)((uint32)a + (uint32)b); }
+#ifdef OTHERSIDE_SSE2
+  static __m128i Sse(__m128i a, __m128i b) { return _mm_add_epi32(a, b); }
+#endif
+};
+
+struct ISubOp {
+  static int32 Scalar(int32 a, int32 b) { return (int32)((uint32)a - (uint32)b); }
+#ifdef OTHERSIDE_SSE2
+  static __m128i Sse(__m128i a, __m128i b) { return _mm_sub_epi32(a, b); }
+#endif
+};
+
+struct IMulOp {
+  static int32 Scalar(int32 a, int32 b) { return (int32)((uint32)a * (uint32)b); }
+#ifdef OTHERSIDE_SSE41
+  static __m128i Sse(__m128i a, __m128i b) { return _mm_mullo_epi32(a, b); }
+#elif defined(OTHERSIDE_SSE2)
+  static __m128i Sse(__m128i a, __m128i b) {
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+  }
+#endif
+};
+
+struct SLessThanOp {
+  static int32 Scalar(int32 a, int32 b) { return a < b ? -1 : 0; }
+#ifdef OTHERSIDE_SSE2
+  static __m128i Sse(__m128i a, __m128i b) { return _mm_cmplt_epi32(a, b); }
+#endif
+};
+
+struct SGreaterThanOp {
+  static int32 Scalar(int32 a, int32 b) { return a > b ? -1 : 0; }
+#ifdef OTHERSIDE_SSE2
+  static __m128i Sse(__m128i a, __m128i b) { return _mm_cmpgt_epi32(a, b); }
+#endif
+};
+
+template<typename Op>
+static void binaryF(uint32* dst, const uint32* a, const uint32* b, uint32 count) {
+  float* fd = (float*)dst;
+  const float* fa = (const float*)a;
+  const float* fb = (const float*)b;
+  uint32 i = 0;
+#ifdef OTHERSIDE_AVX
+  for (; i + 8 <= count; i += 8) {
+    _mm256_storeu_ps(fd + i, Op::Avx(_mm256_loadu_ps(fa + i), _mm256_loadu_ps(fb + i)));
+  }
+#endif
+#ifdef OTHERSIDE_SSE2
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_ps(fd + i, Op::Sse(_mm_loadu_ps(fa + i), _mm_loadu_ps(fb + i)));
+  }
+#endif
+  for (; i < count; i++) {
+    fd[i] = Op::Scalar(fa[i], fb[i]);
+  }
+}
+
+template<typename Op>
+static void binaryI(uint32* dst, const uint32* a, const uint32* b, uint32 count) {
+  int32* id = (int32*)dst;
+  const int32* ia = (const int32*)a;
+  const int32* ib = (const int32*)b;
+  uint32 i = 0;
+#ifdef OTHERSIDE_SSE2
+  for (; i + 4 <= count; i += 4) {
+    __m128i r = Op::Sse(_mm_loadu_si128((const __m128i*)(ia + i)), _mm_loadu_si128((const __m128i*)(ib + i)));
+    _mm_storeu_si128((__m128i*)(id + i), r);
+  }
+#endif
+  for (; i < count; i++) {
+    id[i] = Op::Scalar(ia[i], ib[i]);
+  }
+}
+
+static void convertSToF(uint32* dst, const uint32* a, uint32 count) {
+  uint32 i = 0;
+#ifdef OTHERSIDE_SSE2
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_ps((float*)dst + i, _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(a + i))));
+  }
+#endif
+  for (; i < count; i++) {
+    ((float*)dst)[i] = (float)(int32)a[i];
+  }
+}
+
+// dst = mask ? src : dst for every component block of lanes words.
+static void blend(uint32* dst, const uint32* src, const uint32* mask, uint32 lanes, uint32 components) {
+  for (uint32 c = 0; c < components; c++) {
+    uint32* d = dst + c * lanes;
+    const uint32* s = src + c * lanes;
+    uint32 i = 0;
+#ifdef OTHERSIDE_SSE2
+    for (; i + 4 <= lanes; i += 4) {
+      __m128i m = _mm_loadu_si128((const __m128i*)(mask + i));
+      __m128i r = _mm_or_si128(_mm_and_si128(m, _mm_loadu_si128((const __m128i*)(s + i))),
+                               _mm_andnot_si128(m, _mm_loadu_si128((const __m128i*)(d + i))));
+      _mm_storeu_si128((__m128i*)(d + i), r);
+    }
+#endif
+    for (; i < lanes; i++) {
+      d[i] = (s[i] & mask[i]) | (d[i] & ~mask[i]);
+    }
+  }
+}
+
+static uint32 componentByteSize(WideComponentKind kind) {
+  return kind == WCBool ? sizeof(bool) : sizeof(uint32);
+}
+
+template<uint32 Lanes>
+WideVM<Lanes>::WideVM(const InterpretedVM& vm) :
+  prog(vm.prog),
+  laneVM(vm.Fork()),
+  decoded(vm.partition ? vm.partition->Body : vm.specialization ? vm.specialization->Program : vm.decoded),
+  specialization(vm.specialization),
+  partition(vm.partition),
+  scratch(nullptr),
+  scratchComponents(0) {
+}
+
+template<uint32 Lanes>
+const WideType& WideVM<Lanes>::GetWideType(uint32 typeId) const {
+  SOp def = laneVM->GetType(typeId);
+  if (def.Op == Op::OpTypePointer) {
+    return types[((STypePointer*)def.Memory)->TypeId];
+  }
+  return types[typeId];
+}
+
+template<uint32 Lanes>
+uint32* WideVM<Lanes>::AllocLanes(uint32 components) {
+  uint32* lanes = (uint32*)memory.Alloc(sizeof(uint32) * components * Lanes, SIMD_ALIGNMENT);
+  std::memset(lanes, 0, sizeof(uint32) * components * Lanes);
+  return lanes;
+}
+
+template<uint32 Lanes>
+bool WideVM<Lanes>::InitializeTypes() {
+  types.assign(prog.IDBound, WideType{ false, 0, WCFloat });
+
+  // Types are defined before they are used, so component types are always
+  // classified by the time a vector refers to them.
+  for (auto& type : prog.DefinedTypes) {
+    WideType& wide = types[type.first];
+    switch (type.second.Op) {
+    case Op::OpTypeFloat:
+      wide = WideType{ ((STypeFloat*)type.second.Memory)->Width == 32, 1, WCFloat };
+      break;
+    case Op::OpTypeInt:
+      wide = WideType{ ((STypeInt*)type.second.Memory)->Width == 32, 1, WCInt };
+      break;
+    case Op::OpTypeBool:
+      wide = WideType{ true, 1, WCBool };
+      break;
+    case Op::OpTypeVector: {
+      auto vec = (STypeVector*)type.second.Memory;
+      const WideType& comp = types[vec->ComponentTypeId];
+      wide = WideType{ comp.Vectorizable && comp.Components == 1, vec->ComponentCount, comp.Kind };
+      break;
+    }
+    default:
+      break;
+    }
+
+    if (wide.Vectorizable && wide.Components > scratchComponents) {
+      scratchComponents = wide.Components;
+    }
+  }
+
+  return true;
+}
+
+template<uint32 Lanes>
+bool WideVM<Lanes>::InitializeResult(uint32 typeId, uint32 resultId, bool isReference) {
+  const WideType& wide = GetWideType(typeId);
+  if (!wide.Vectorizable) {
+    if (isReference) {
+      return true;
+    }
+    std::cout << "Result " << resultId << " can not be executed in lockstep." << std::endl;
+    return false;
+  }
+
+  WideSlot& slot = slots[resultId];
+  slot.Kind = WSVarying;
+  slot.TypeId = typeId;
+  slot.Components = wide.Components;
+  slot.Lanes = AllocLanes(wide.Components);
+  return true;
+}
+
+template<uint32 Lanes>
+void WideVM<Lanes>::InitializeUniformSlot(uint32 id, Value val) {
+  const WideType& wide = GetWideType(val.TypeId);
+  WideSlot& slot = slots[id];
+  slot.TypeId = val.TypeId;
+  uniformIds[id] = true;
+  if (!wide.Vectorizable) {
+    slot.Kind = WSUniformRef;
+    slot.Memory = val.Memory;
+    return;
+  }
+
+  slot.Kind = WSVarying;
+  slot.Components = wide.Components;
+  slot.Lanes = AllocLanes(wide.Components);
+  for (uint32 l = 0; l < Lanes; l++) {
+    ScatterLane(slot, val, l);
+  }
+}
+
+// Access chains into uniforms were folded to pointers, everything else to
+// values.
+template<uint32 Lanes>
+void WideVM<Lanes>::InitializeSharedResults(const std::vector<FoldedResult>& results) {
+  for (auto& result : results) {
+    Value val = laneVM->Dereference(laneVM->env.Values[result.Id]);
+    if (laneVM->GetType(result.TypeId).Op == Op::OpTypePointer) {
+      slots[result.Id] = WideSlot{ WSUniformRef, val.TypeId, 0, nullptr, val.Memory };
+      uniformIds[result.Id] = true;
+    } else {
+      InitializeUniformSlot(result.Id, val);
+    }
+  }
+}
+
+template<uint32 Lanes>
+bool WideVM<Lanes>::InitializeSlots() {
+  slots.assign(prog.IDBound, WideSlot{ WSEmpty, 0, 0, nullptr, nullptr });
+  uniformIds.assign(prog.IDBound, false);
+  const Environment& env = laneVM->env;
+
+  for (auto& constant : prog.Constants) {
+    Value val = env.Values[constant.first];
+    if (val.Memory) {
+      InitializeUniformSlot(constant.first, val);
+    }
+  }
+
+  for (auto& var : prog.Variables) {
+    Value val = env.Values[var.first];
+    auto pointer = (STypePointer*)laneVM->GetType(var.second.ResultTypeId).Memory;
+    const WideType& wide = GetWideType(var.second.ResultTypeId);
+    byte* bound = val.Memory ? *(byte**)val.Memory : nullptr;
+    WideSlot& slot = slots[var.first];
+    slot.TypeId = pointer->TypeId;
+
+    bool perLane = var.second.StorageClass == StorageClass::Input ||
+                   var.second.StorageClass == StorageClass::Output ||
+                   var.second.StorageClass == StorageClass::PrivateGlobal;
+
+    if (!perLane || !wide.Vectorizable) {
+      slot.Kind = WSUniformRef;
+      slot.Memory = bound;
+      continue;
+    }
+
+    slot.Kind = WSVaryingRef;
+    slot.Components = wide.Components;
+    slot.Lanes = AllocLanes(wide.Components);
+    if (bound) {
+      for (uint32 l = 0; l < Lanes; l++) {
+        ScatterLane(slot, Value{ pointer->TypeId, bound }, l);
+      }
+    }
+  }
+
+  if (specialization) {
+    InitializeSharedResults(specialization->Folded);
+  }
+  if (partition) {
+    if (!laneVM->prologueCurrent && !laneVM->RunPrologue()) {
+      std::cout << "Could not run the prologue." << std::endl;
+      return false;
+    }
+    InitializeSharedResults(partition->Hoisted);
+  }
+
+  for (auto& func : decoded->Functions) {
+    for (auto& op : func.Ops) {
+      uint32* words = (uint32*)op.Memory;
+      switch (op.Op) {
+      case Op::OpBranch:
+      case Op::OpBranchConditional:
+      case Op::OpReturn:
+      case Op::OpReturnValue:
+      case Op::OpStore:
+        break;
+      case Op::OpVariable: {
+        auto var = (SVariable*)op.Memory;
+        const WideType& wide = GetWideType(var->ResultTypeId);
+        if (!wide.Vectorizable) {
+          std::cout << "Variable " << var->ResultId << " can not be executed in lockstep." << std::endl;
+          return false;
+        }
+        WideSlot& slot = slots[var->ResultId];
+        slot.Kind = WSVaryingRef;
+        slot.TypeId = ((STypePointer*)laneVM->GetType(var->ResultTypeId).Memory)->TypeId;
+        slot.Components = wide.Components;
+        slot.Lanes = AllocLanes(wide.Components);
+        break;
+      }
+      case Op::OpAccessChain: {
+        // Lanes share the pointer an access chain yields, so its indices
+        // must be the same for all of them.
+        auto access = (SAccessChain*)op.Memory;
+        for (uint32 i = 0; i < access->IndexesIdsCount; i++) {
+          if (!uniformIds[access->IndexesIds[i]]) {
+            std::cout << "Access chain " << access->ResultId << " has a per-lane index and can not be executed in lockstep." << std::endl;
+            return false;
+          }
+        }
+        if (access->IndexesIdsCount > 16 || !InitializeResult(words[0], words[1], true)) {
+          return false;
+        }
+        break;
+      }
+      case Op::OpLoad:
+        if (!InitializeResult(words[0], words[1], true)) {
+          return false;
+        }
+        break;
+      case Op::OpFunctionCall: {
+        auto call = (SFunctionCall*)op.Memory;
+        const DecodedFunction* toCall = &decoded->Functions[op.Targets[0]];
+        for (uint32 i = 0; i < call->ArgumentIdsCount; i++) {
+          slots[toCall->Source->Parameters[i].ResultId] = slots[call->ArgumentIds[i]];
+        }
+        if (laneVM->GetType(call->ResultTypeId).Op != Op::OpTypeVoid &&
+            !InitializeResult(call->ResultTypeId, call->ResultId, false)) {
+          return false;
+        }
+        break;
+      }
+      // Parameters of inlined calls alias their argument like they do for
+      // calls, and so do copies of pointers. Copies of values get lanes of
+      // their own, others alias.
+      case Op::OpCopyObject:
+        if (op.Bind == IBParameter) {
+          slots[op.Targets[0]] = slots[op.Targets[1]];
+        } else if (op.Bind == IBResult) {
+          if (!InitializeResult(((SFunctionCall*)op.Memory)->ResultTypeId, op.Targets[0], false)) {
+            return false;
+          }
+        } else if (op.Bind == IBNone) {
+          uint32 typeId = ((SCopyObject*)op.Memory)->ResultTypeId;
+          if (laneVM->GetType(typeId).Op != Op::OpTypePointer && !InitializeResult(typeId, op.Targets[0], true)) {
+            return false;
+          }
+        }
+        break;
+      case Op::OpExtInst:
+        if (((SExtInst*)op.Memory)->OperandIdsCount > 8) {
+          std::cout << "Too many extension instruction operands for lockstep execution." << std::endl;
+          return false;
+        }
+        // fall through
+      case Op::OpConvertSToF:
+      case Op::OpFAdd:
+      case Op::OpIAdd:
+      case Op::OpFSub:
+      case Op::OpISub:
+      case Op::OpFDiv:
+      case Op::OpFMul:
+      case Op::OpIMul:
+      case Op::OpVectorTimesScalar:
+      case Op::OpSLessThan:
+      case Op::OpSGreaterThan:
+      case Op::OpImageSampleImplicitLod:
+      case Op::OpVectorShuffle:
+      case Op::OpCompositeConstruct:
+        if (!InitializeResult(words[0], words[1], false)) {
+          return false;
+        }
+        break;
+      case Op::OpCompositeExtract:
+      case Op::OpCompositeInsert: {
+        uint32 indexCount = op.Op == Op::OpCompositeExtract ? ((SCompositeExtract*)op.Memory)->IndexesCount : ((SCompositeInsert*)op.Memory)->IndexesCount;
+        if (indexCount != 1) {
+          std::cout << "Only single level composite access can be executed in lockstep." << std::endl;
+          return false;
+        }
+        if (!InitializeResult(words[0], words[1], false)) {
+          return false;
+        }
+        break;
+      }
+      default:
+        std::cout << "Operation can not be executed in lockstep: " << writeOp(SOp{ op.Op, op.Memory });
+        return false;
+      }
+    }
+  }
+
+  // Arithmetic and composite instructions read their operands as lanes.
+  // Operands of other types are only bound to memory, so programs that pass
+  // them are left to the scalar VM. Calls bound their parameters above,
+  // which is why this runs once all results have their slots.
+  std::vector<uint32> operands;
+  for (auto& func : decoded->Functions) {
+    for (auto& op : func.Ops) {
+      switch (op.Op) {
+      case Op::OpConvertSToF:
+      case Op::OpFAdd:
+      case Op::OpIAdd:
+      case Op::OpFSub:
+      case Op::OpISub:
+      case Op::OpFDiv:
+      case Op::OpFMul:
+      case Op::OpIMul:
+      case Op::OpVectorTimesScalar:
+      case Op::OpSLessThan:
+      case Op::OpSGreaterThan:
+      case Op::OpVectorShuffle:
+      case Op::OpCompositeConstruct:
+      case Op::OpCompositeExtract:
+      case Op::OpCompositeInsert: {
+        uint32 resultId = getOperandIds(op, &operands);
+        for (uint32 id : operands) {
+          if (slots[id].Kind != WSVarying) {
+            std::cout << "Operand " << id << " of result " << resultId << " can not be executed in lockstep." << std::endl;
+            return false;
+          }
+        }
+        break;
+      }
+      default:
+        break;
+      }
+    }
+  }
+
+  scratch = AllocLanes(scratchComponents > 0 ? scratchComponents : 1);
+  return true;
+}
+
+template<uint32 Lanes>
+bool WideVM<Lanes>::Setup() {
+  if (!decoded) {
+    std::cout << "The scalar VM has to be set up first." << std::endl;
+    return false;
+  }
+  return InitializeTypes() && InitializeSlots();
+}
+
+template<uint32 Lanes>
+float* WideVM<Lanes>::GetLanes(const std::string& name) {
+  for (auto& nameOp : prog.Names) {
+    if (nameOp.second.Name == name) {
+      WideSlot& slot = slots[nameOp.second.TargetId];
+      if (slot.Kind != WSVaryingRef) {
+        return nullptr;
+      }
+      return (float*)slot.Lanes;
+    }
+  }
+  return nullptr;
+}
+
+template<uint32 Lanes>
+void WideVM<Lanes>::SetSampleFootprint(float x, float y, float z) {
+  laneVM->SetSampleFootprint(x, y, z);
+}
+
+template<uint32 Lanes>
+void WideVM<Lanes>::SetMathPrecision(MathPrecision precision) {
+  laneVM->SetMathPrecision(precision);
+}
+
+template<uint32 Lanes>
+void WideVM<Lanes>::WriteMasked(WideSlot& dst, const uint32* src, const uint32* mask, bool fullMask) {
+  if (fullMask) {
+    if (dst.Lanes != src) {
+      std::memcpy(dst.Lanes, src, sizeof(uint32) * dst.Components * Lanes);
+    }
+  } else {
+    blend(dst.Lanes, src, mask, Lanes, dst.Components);
+  }
+}
+
+template<uint32 Lanes>
+Value WideVM<Lanes>::GatherLane(const WideSlot& slot, uint32 lane, byte* buffer) const {
+  if (slot.Kind == WSUniformRef) {
+    return Value{ slot.TypeId, slot.Memory };
+  }
+
+  const WideType& wide = GetWideType(slot.TypeId);
+  uint32 compSize = componentByteSize(wide.Kind);
+  for (uint32 c = 0; c < slot.Components; c++) {
+    uint32 word = slot.Lanes[c * Lanes + lane];
+    if (wide.Kind == WCBool) {
+      *(bool*)(buffer + c * compSize) = word != 0;
+    } else {
+      std::memcpy(buffer + c * compSize, &word, compSize);
+    }
+  }
+  return Value{ slot.TypeId, buffer };
+}
+
+template<uint32 Lanes>
+void WideVM<Lanes>::ScatterLane(WideSlot& dst, Value val, uint32 lane) {
+  const WideType& wide = GetWideType(dst.TypeId);
+  uint32 compSize = componentByteSize(wide.Kind);
+  for (uint32 c = 0; c < dst.Components; c++) {
+    uint32 word = 0;
+    if (wide.Kind == WCBool) {
+      word = *(bool*)(val.Memory + c * compSize) ? ~0u : 0u;
+    } else {
+      std::memcpy(&word, val.Memory + c * compSize, compSize);
+    }
+    dst.Lanes[c * Lanes + lane] = word;
+  }
+}
+
+// Hands the lanes of all operands to the batched function, false if there is
+// none or an operand isn't a value held per lane (pointers, composites).
+template<uint32 Lanes>
+bool WideVM<Lanes>::ExecuteBatchedExtInst(const DecodedOp& op, const uint32* mask, bool fullMask) {
+  auto extInst = (SExtInst*)op.Memory;
+  ExtBatchInstFunc* batchFunc = op.ExtBatch;
+  if (!batchFunc && !op.Ext) {
+    const ExtBatchTable& table = laneVM->env.BatchExtensions[extInst->SetId];
+    batchFunc = table.Functions && extInst->Instruction < table.Count ? table.Functions[extInst->Instruction] : nullptr;
+  }
+  if (!batchFunc) {
+    return false;
+  }
+
+  ExtLanes values[8];
+  for (uint32 i = 0; i < extInst->OperandIdsCount; i++) {
+    const WideSlot& slot = Operand(extInst->OperandIds[i]);
+    if (slot.Kind != WSVarying) {
+      return false;
+    }
+    values[i] = ExtLanes{ slot.TypeId, slot.Components, slot.Lanes };
+  }
+
+  WideSlot& dst = slots[extInst->ResultId];
+  ExtLanes result = { dst.TypeId, dst.Components, fullMask ? dst.Lanes : scratch };
+  if (!batchFunc(laneVM.get(), extInst->ResultTypeId, Lanes, mask, extInst->OperandIdsCount, values, &result)) {
+    return false;
+  }
+  WriteMasked(dst, result.Lanes, mask, fullMask);
+  return true;
+}
+
+template<uint32 Lanes>
+bool WideVM<Lanes>::ExecuteFunction(const DecodedFunction* func, uint32 activeMask, WideSlot* returnSlot) {
+  const uint32 allLanes = (uint32)((1ull << Lanes) - 1);
+  uint32 pcs[Lanes];
+  uint32 mask[Lanes];
+
+  for (uint32 l = 0; l < Lanes; l++) {
+    pcs[l] = (activeMask >> l) & 1 ? 0 : DONE;
+  }
+
+  for (;;) {
+    uint32 pc = DONE;
+    for (uint32 l = 0; l < Lanes; l++) {
+      pc = pcs[l] < pc ? pcs[l] : pc;
+    }
+    if (pc == DONE) {
+      return true;
+    }
+
+    uint32 active = 0;
+    for (uint32 l = 0; l < Lanes; l++) {
+      bool on = pcs[l] == pc;
+      active |= (on ? 1u : 0u) << l;
+      mask[l] = on ? ~0u : 0u;
+    }
+    bool fullMask = active == allLanes;
+
+    // Run the block starting at pc for the active lanes up to its terminator.
+    for (bool inBlock = true; inBlock;) {
+      const DecodedOp& op = func->Ops[pc];
+      uint32* words = (uint32*)op.Memory;
+
+      switch (op.Op) {
+      case Op::OpBranch:
+        for (uint32 l = 0; l < Lanes; l++) {
+          if (mask[l]) pcs[l] = op.Targets[0];
+        }
+        inBlock = false;
+        break;
+      case Op::OpBranchConditional: {
+        auto branch = (SBranchConditional*)op.Memory;
+        const uint32* cond = Operand(branch->ConditionId).Lanes;
+        for (uint32 l = 0; l < Lanes; l++) {
+          if (mask[l]) pcs[l] = cond[l] ? op.Targets[0] : op.Targets[1];
+        }
+        inBlock = false;
+        break;
+      }
+      case Op::OpReturnValue: {
+        auto ret = (SReturnValue*)op.Memory;
+        if (returnSlot) {
+          WriteMasked(*returnSlot, Operand(ret->ValueId).Lanes, mask, fullMask);
+        }
+        // fall through
+      }
+      case Op::OpReturn:
+        for (uint32 l = 0; l < Lanes; l++) {
+          if (mask[l]) pcs[l] = DONE;
+        }
+        inBlock = false;
+        break;
+      case Op::OpCopyObject: {
+        WideSlot& dst = slots[op.Targets[0]];
+        if (op.Bind != IBParameter && dst.Kind == WSVarying) {
+          WriteMasked(dst, Operand(op.Targets[1]).Lanes, mask, fullMask);
+        } else {
+          dst = slots[op.Targets[1]];
+        }
+        break;
+      }
+      case Op::OpFunctionCall: {
+        auto call = (SFunctionCall*)op.Memory;
+        const DecodedFunction* toCall = &decoded->Functions[op.Targets[0]];
+        for (uint32 i = 0; i < call->ArgumentIdsCount; i++) {
+          slots[toCall->Source->Parameters[i].ResultId] = slots[call->ArgumentIds[i]];
+        }
+        WideSlot* result = slots[call->ResultId].Kind == WSVarying ? &slots[call->ResultId] : nullptr;
+        if (!ExecuteFunction(toCall, active, result)) {
+          return false;
+        }
+        break;
+      }
+      case Op::OpExtInst: {
+        if (ExecuteBatchedExtInst(op, mask, fullMask)) {
+          break;
+        }
+        auto extInst = (SExtInst*)op.Memory;
+        ExtInstFunc* extFunc = op.Ext ? op.Ext : laneVM->env.Extensions[extInst->SetId][extInst->Instruction];
+        Value values[8];
+        byte buffers[8][64];
+        WideSlot& result = slots[extInst->ResultId];
+        for (uint32 l = 0; l < Lanes; l++) {
+          if (!mask[l]) {
+            continue;
+          }
+          for (uint32 i = 0; i < extInst->OperandIdsCount; i++) {
+            values[i] = GatherLane(Operand(extInst->OperandIds[i]), l, buffers[i]);
+          }
+          ScatterLane(result, extFunc(laneVM.get(), extInst->ResultTypeId, extInst->OperandIdsCount, values), l);
+        }
+        break;
+      }
+      case Op::OpImageSampleImplicitLod: {
+        auto sample = (SImageSampleImplicitLod*)op.Memory;
+        const WideSlot& sampler = Operand(sample->SampledImageId);
+        const WideSlot& coord = Operand(sample->CoordinateId);
+        WideSlot& result = slots[sample->ResultId];
+        const WideSlot* bias = nullptr;
+        if (sample->ImageOperandsIdsCount > 1 && (sample->ImageOperandsIds[0] & (uint32)spv::ImageOperandsMask::Bias)) {
+          bias = &Operand(sample->ImageOperandsIds[1]);
+        }
+        byte buffer[64];
+        byte biasBuffer[4];
+        for (uint32 l = 0; l < Lanes; l++) {
+          if (!mask[l]) {
+            continue;
+          }
+          Value samplerVal = { sampler.TypeId, sampler.Memory };
+          Value coordVal = GatherLane(coord, l, buffer);
+          Value biasVal = bias ? GatherLane(*bias, l, biasBuffer) : Value{ 0, 0 };
+          ScatterLane(result, laneVM->TextureSample(samplerVal, coordVal, biasVal, sample->ResultTypeId), l);
+        }
+        break;
+      }
+      case Op::OpConvertSToF: {
+        auto convert = (SConvertSToF*)op.Memory;
+        WideSlot& dst = slots[convert->ResultId];
+        uint32* target = fullMask ? dst.Lanes : scratch;
+        convertSToF(target, Operand(convert->SignedValueId).Lanes, dst.Components * Lanes);
+        WriteMasked(dst, target, mask, fullMask);
+        break;
+      }
+
+#define WIDE_BINARY_OP(opName, kernel) \
+      case Op::opName: { \
+        WideSlot& dst = slots[words[1]]; \
+        uint32* target = fullMask ? dst.Lanes : scratch; \
+        kernel(target, Operand(words[2]).Lanes, Operand(words[3]).Lanes, dst.Components * Lanes); \
+        WriteMasked(dst, target, mask, fullMask); \
+        break; \
+      }
+
+      WIDE_BINARY_OP(OpFAdd, binaryF<FAddOp>)
+      WIDE_BINARY_OP(OpFSub, binaryF<FSubOp>)
+      WIDE_BINARY_OP(OpFMul, binaryF<FMulOp>)
+      WIDE_BINARY_OP(OpFDiv, binaryF<FDivOp>)
+      WIDE_BINARY_OP(OpIAdd, binaryI<IAddOp>)
+      WIDE_BINARY_OP(OpISub, binaryI<ISubOp>)
+      WIDE_BINARY_OP(OpIMul, binaryI<IMulOp>)
+      WIDE_BINARY_OP(OpSLessThan, binaryI<SLessThanOp>)
+      WIDE_BINARY_OP(OpSGreaterThan, binaryI<SGreaterThanOp>)
+
+#undef WIDE_BINARY_OP
+
+      case Op::OpVectorTimesScalar: {
+        auto vts = (SVectorTimesScalar*)op.Memory;
+        WideSlot& dst = slots[vts->ResultId];
+        uint32* target = fullMask ? dst.Lanes : scratch;
+        const uint32* vector = Operand(vts->VectorId).Lanes;
+        const uint32* scalar = Operand(vts->ScalarId).Lanes;
+        for (uint32 c = 0; c < dst.Components; c++) {
+          binaryF<FMulOp>(target + c * Lanes, vector + c * Lanes, scalar, Lanes);
+        }
+        WriteMasked(dst, target, mask, fullMask);
+        break;
+      }
+      case Op::OpLoad: {
+        auto load = (SLoad*)op.Memory;
+        const WideSlot& ptr = Operand(load->PointerId);
+        WideSlot& dst = slots[load->ResultId];
+        if (dst.Kind != WSVarying) {
+          dst = ptr;
+          dst.TypeId = load->ResultTypeId;
+        } else if (ptr.Kind == WSUniformRef) {
+          for (uint32 l = 0; l < Lanes; l++) {
+            if (mask[l]) ScatterLane(dst, Value{ ptr.TypeId, ptr.Memory }, l);
+          }
+        } else {
+          WriteMasked(dst, ptr.Lanes, mask, fullMask);
+        }
+        break;
+      }
+      case Op::OpStore: {
+        auto store = (SStore*)op.Memory;
+        WideSlot& ptr = Operand(store->PointerId);
+        if (ptr.Kind != WSVaryingRef) {
+          std::cout << "Store to uniform memory is not supported in lockstep execution." << std::endl;
+          return false;
+        }
+        WriteMasked(ptr, Operand(store->ObjectId).Lanes, mask, fullMask);
+        break;
+      }
+      case Op::OpAccessChain: {
+        auto access = (SAccessChain*)op.Memory;
+        const WideSlot& base = Operand(access->BaseId);
+        WideSlot& dst = slots[access->ResultId];
+        uint32 indices[16];
+        if (access->IndexesIdsCount > 16) {
+          return false;
+        }
+        for (uint32 i = 0; i < access->IndexesIdsCount; i++) {
+          indices[i] = *(uint32*)laneVM->Dereference(laneVM->env.Values[access->IndexesIds[i]]).Memory;
+        }
+
+        uint32 resultTypeId = ((STypePointer*)laneVM->GetType(access->ResultTypeId).Memory)->TypeId;
+        if (base.Kind == WSUniformRef) {
+          dst.Kind = WSUniformRef;
+          dst.TypeId = resultTypeId;
+          dst.Memory = laneVM->GetPointerInComposite(base.TypeId, base.Memory, access->IndexesIdsCount, indices, 0);
+        } else if (access->IndexesIdsCount == 1) {
+          dst.Kind = WSVaryingRef;
+          dst.TypeId = resultTypeId;
+          dst.Components = GetWideType(resultTypeId).Components;
+          dst.Lanes = base.Lanes + indices[0] * Lanes;
+        } else {
+          std::cout << "Only single level access chains into per-lane variables are supported." << std::endl;
+          return false;
+        }
+        break;
+      }
+      case Op::OpVectorShuffle: {
+        auto shuffle = (SVectorShuffle*)op.Memory;
+        const WideSlot& vec1 = Operand(shuffle->Vector1Id);
+        const WideSlot& vec2 = Operand(shuffle->Vector2Id);
+        WideSlot& dst = slots[shuffle->ResultId];
+        uint32* target = scratch;
+        for (uint32 i = 0; i < shuffle->ComponentsCount; i++) {
+          uint32 index = shuffle->Components[i];
+          const uint32* src = index < vec1.Components ? vec1.Lanes + index * Lanes : vec2.Lanes + (index - vec1.Components) * Lanes;
+          std::memcpy(target + i * Lanes, src, sizeof(uint32) * Lanes);
+        }
+        WriteMasked(dst, target, mask, fullMask);
+        break;
+      }
+      case Op::OpCompositeExtract: {
+        auto extract = (SCompositeExtract*)op.Memory;
+        WideSlot& dst = slots[extract->ResultId];
+        WriteMasked(dst, Operand(extract->CompositeId).Lanes + extract->Indexes[0] * Lanes, mask, fullMask);
+        break;
+      }
+      case Op::OpCompositeInsert: {
+        auto insert = (SCompositeInsert*)op.Memory;
+        WideSlot& dst = slots[insert->ResultId];
+        const WideSlot& object = Operand(insert->ObjectId);
+        std::memcpy(scratch, Operand(insert->CompositeId).Lanes, sizeof(uint32) * dst.Components * Lanes);
+        std::memcpy(scratch + insert->Indexes[0] * Lanes, object.Lanes, sizeof(uint32) * object.Components * Lanes);
+        WriteMasked(dst, scratch, mask, fullMask);
+        break;
+      }
+      case Op::OpCompositeConstruct: {
+        auto construct = (SCompositeConstruct*)op.Memory;
+        WideSlot& dst = slots[construct->ResultId];
+        uint32* target = scratch;
+        for (uint32 i = 0; i < construct->ConstituentsIdsCount; i++) {
+          const WideSlot& part = Operand(construct->ConstituentsIds[i]);
+          std::memcpy(target, part.Lanes, sizeof(uint32) * part.Components * Lanes);
+          target += part.Components * Lanes;
+        }
+        WriteMasked(dst, scratch, mask, fullMask);
+        break;
+      }
+      case Op::OpVariable: {
+        auto var = (SVariable*)op.Memory;
+        WideSlot& dst = slots[var->ResultId];
+        if (var->InitializerId) {
+          WriteMasked(dst, Operand(var->InitializerId).Lanes, mask, fullMask);
+        } else {
+          std::memset(scratch, 0, sizeof(uint32) * dst.Components * Lanes);
+          WriteMasked(dst, scratch, mask, fullMask);
+        }
+        break;
+      }
+      default:
+        std::cout << "Unimplemented operation: " << writeOp(SOp{ op.Op, op.Memory });
+        return false;
+      }
+
+      pc++;
+    }
+  }
+}
+
+template<uint32 Lanes>
+bool WideVM<Lanes>::Run(uint32 activeMask) {
+  laneVM->InvocationMemory.Reset();
+  laneVM->currentMemory = &laneVM->InvocationMemory;
+
+  bool success = true;
+  for (uint32 ep : decoded->EntryPoints) {
+    if (!ExecuteFunction(&decoded->Functions[ep], activeMask, nullptr)) {
+      success = false;
+      break;
+    }
+  }
+
+  laneVM->currentMemory = &laneVM->ConstantMemory;
+  return success;
+}
+
+template class WideVM<4>;
+template class WideVM<8>;
+template class WideVM<16>;
@@ -0,0 +1,107 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include <string>
+#include "interpreted_vm.h"
+#include "arena.h"
+
+enum WideSlotKind {
+  WSEmpty,
+  // Lanes holds one block of Lanes words per component (structure of arrays).
+  WSVarying,
+  // Points at the lanes of a variable, loads and stores go through it.
+  WSVaryingRef,
+  // Points at memory shared by all lanes, laid out like in InterpretedVM.
+  WSUniformRef
+};
+
+enum WideComponentKind {
+  WCFloat,
+  WCInt,
+  WCBool
+};
+
+struct WideType {
+  bool Vectorizable;
+  uint32 Components;
+  WideComponentKind Kind;
+};
+
+struct WideSlot {
+  WideSlotKind Kind;
+  uint32 TypeId;
+  uint32 Components;
+  uint32* Lanes;
+  byte* Memory;
+};
+
+// Executes Lanes invocations of a program in lockstep. Scalars and vectors of
+// 32 bit floats, ints and bools are kept in structure of arrays form, so
+// arithmetic on them is a handful of SSE/AVX instructions for all lanes.
+// Divergent branches are handled with per-lane program counters: the block
+// with the lowest index among the active lanes runs next under an execution
+// mask, which reconverges lanes at the merge blocks of structured control flow.
+//
+// Uniform variables keep the bindings of the InterpretedVM the wide VM was
+// created from, as does its specialization if it has one: folded results are
+// shared by all lanes. So are the results of the prologue if the VM was
+// hoisted, Setup() runs it unless it is current. Input and Output variables are per-lane and accessed through
+// GetLanes(). Extension instructions run through the batched table of their
+// set when it has one and takes the operands, otherwise they fall back to the
+// scalar function per active lane like texture sampling.
+template<uint32 Lanes>
+class WideVM {
+private:
+  Program& prog;
+  std::unique_ptr<InterpretedVM> laneVM;
+  std::shared_ptr<const DecodedProgram> decoded;
+  std::shared_ptr<const Specialization> specialization;
+  std::shared_ptr<const InvocationPartition> partition;
+
+  std::vector<WideType> types;
+  std::vector<WideSlot> slots;
+  // Ids with one value for all lanes: constants and folded or hoisted results.
+  std::vector<bool> uniformIds;
+  Arena memory;
+  uint32* scratch;
+  uint32 scratchComponents;
+
+  const WideType& GetWideType(uint32 typeId) const;
+  uint32* AllocLanes(uint32 components);
+  bool InitializeTypes();
+  bool InitializeSlots();
+  void InitializeUniformSlot(uint32 id, Value val);
+  void InitializeSharedResults(const std::vector<FoldedResult>& results);
+  bool InitializeResult(uint32 typeId, uint32 resultId, bool isReference);
+
+  WideSlot& Operand(uint32 id) { return slots[id]; }
+  void WriteMasked(WideSlot& dst, const uint32* src, const uint32* mask, bool fullMask);
+  Value GatherLane(const WideSlot& slot, uint32 lane, byte* buffer) const;
+  void ScatterLane(WideSlot& dst, Value val, uint32 lane);
+
+  bool ExecuteBatchedExtInst(const DecodedOp& op, const uint32* mask, bool fullMask);
+  bool ExecuteFunction(const DecodedFunction* func, uint32 activeMask, WideSlot* returnSlot);
+
+public:
+  WideVM(const InterpretedVM& vm);
+
+  // Fails if the program uses types or instructions that cannot be executed
+  // in lockstep, callers should fall back to InterpretedVM in that case.
+  bool Setup();
+
+  // Per-lane storage of an Input or Output variable: component c of lane l
+  // is at index c * Lanes + l.
+  float* GetLanes(const std::string& name);
+
+  // See InterpretedVM::SetSampleFootprint(), applies to all lanes.
+  void SetSampleFootprint(float x, float y, float z = 0);
+
+  // See InterpretedVM::SetMathPrecision().
+  void SetMathPrecision(MathPrecision precision);
+
+  bool Run(uint32 activeMask = (uint32)((1ull << Lanes) - 1));
+};
+
+extern template class WideVM<4>;
+extern template class WideVM<8>;
+extern template class WideVM<16>;
@@ -0,0 +1,95 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <utility>
+
+Arena::Arena(size_t blockSize) : blockSize(blockSize), currentBlock(0), offset(0), used(0) {
+}
+
+Arena::~Arena() {
+  FreeBlocks();
+}
+
+Arena::Arena(Arena&& other) :
+  blocks(std::move(other.blocks)), blockSize(other.blockSize),
+  currentBlock(other.currentBlock), offset(other.offset), used(other.used) {
+  other.blocks.clear();
+  other.currentBlock = 0;
+  other.offset = 0;
+  other.used = 0;
+}
+
+Arena& Arena::operator=(Arena&& other) {
+  if (this != &other) {
+    FreeBlocks();
+    blocks = std::move(other.blocks);
+    blockSize = other.blockSize;
+    currentBlock = other.currentBlock;
+    offset = other.offset;
+    used = other.used;
+    other.blocks.clear();
+    other.currentBlock = 0;
+    other.offset = 0;
+    other.used = 0;
+  }
+  return *this;
+}
+
+void Arena::FreeBlocks() {
+  for (auto& block : blocks) {
+    free(block.Memory);
+  }
+  blocks.clear();
+}
+
+void Arena::AddBlock(size_t minSize) {
+  size_t size = minSize > blockSize ? minSize : blockSize;
+  Block block = { (byte*)malloc(size), size };
+  assert(block.Memory);
+  blocks.push_back(block);
+}
+
+byte* Arena::Alloc(size_t size, size_t alignment) {
+  assert(alignment && (alignment & (alignment - 1)) == 0);
+
+  for (;;) {
+    if (currentBlock < blocks.size()) {
+      Block& block = blocks[currentBlock];
+      size_t base = (size_t)block.Memory;
+      size_t aligned = ((base + offset + alignment - 1) & ~(alignment - 1)) - base;
+      if (aligned + size <= block.Size) {
+        offset = aligned + size;
+        used += size;
+        return block.Memory + aligned;
+      }
+      if (currentBlock + 1 < blocks.size()) {
+        currentBlock++;
+        offset = 0;
+        continue;
+      }
+    }
+
+    AddBlock(size + alignment);
+    currentBlock = blocks.size() - 1;
+    offset = 0;
+  }
+}
+
+void Arena::Reset() {
+  if (blocks.size() > 1) {
+    size_t total = BytesReserved();
+    FreeBlocks();
+    AddBlock(total);
+  }
+  currentBlock = 0;
+  offset = 0;
+  used = 0;
+}
+
+size_t Arena::BytesReserved() const {
+  size_t total = 0;
+  for (auto& block : blocks) {
+    total += block.Size;
+  }
+  return total;
+}
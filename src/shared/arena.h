@@ -0,0 +1,40 @@
+#pragma once
+#include <stddef.h>
+#include <vector>
+#include "types.h"
+
+// Bump allocator handing out memory from a list of large blocks. Individual
+// allocations are never freed, Reset() makes all of the memory available again
+// at once. After a reset the blocks are coalesced so that a steady workload is
+// served from a single block without touching the system allocator.
+class Arena {
+private:
+  struct Block {
+    byte* Memory;
+    size_t Size;
+  };
+
+  std::vector<Block> blocks;
+  size_t blockSize;
+  size_t currentBlock;
+  size_t offset;
+  size_t used;
+
+  void AddBlock(size_t minSize);
+  void FreeBlocks();
+
+public:
+  explicit Arena(size_t blockSize = 64 * 1024);
+  ~Arena();
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+  Arena(Arena&& other);
+  Arena& operator=(Arena&& other);
+
+  byte* Alloc(size_t size, size_t alignment = 16);
+  void Reset();
+
+  size_t BytesUsed() const { return used; }
+  size_t BytesReserved() const;
+};
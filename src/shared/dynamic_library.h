@@ -0,0 +1,28 @@
+#pragma once
+
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)  // note the underscore: without it, it's not msdn official!
+  #include <Windows.h>
+  #define LOAD_LIBRARY(path) LoadLibrary(path)
+  #define UNLOAD_LIBRARY(handle) FreeLibrary(handle)
+  #define LOAD_SYMBOL GetProcAddress
+  #define LIBRARY_EXT ".dll"
+
+  #ifdef __CYGWIN__
+    #define LIB_NAME(name) ("cyg" + name)
+  #else
+    #define LIB_NAME(name) name
+  #endif
+
+  #define LIB_ERROR ""
+  #define HANDLE_TYPE HINSTANCE
+#elif defined(__unix__) || defined(__linux__) || defined(__APPLE__) // all unices, not all compilers
+  #include <dlfcn.h>
+  #define LOAD_LIBRARY(path) dlopen(path, RTLD_LAZY)
+  #define UNLOAD_LIBRARY(handle) dlclose(handle)
+  #define LOAD_SYMBOL dlsym
+  #define LIBRARY_EXT ".so"
+  #define LIB_NAME(name) ("lib" + name)
+  #define LIB_ERROR dlerror()
+  #define HANDLE_TYPE void*
+  #define TEXT(txt) txt
+#endif
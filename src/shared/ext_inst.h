@@ -0,0 +1,35 @@
+#pragma once
+#include "types.h"
+
+struct Value;
+class VM;
+
+// Signature of the functions in an extended instruction set table, indexed by
+// the instruction number of OpExtInst.
+#define EXT_INST_FUNC(x) Value x(VM* vm, uint32 resultTypeId, int valueCount, Value* values)
+typedef EXT_INST_FUNC(ExtInstFunc);
+typedef ExtInstFunc** GetExtTableFunc(void);
+
+// Operand or result of a batched extended instruction in structure of arrays
+// form: component c of invocation l is the 32 bit word Lanes[c * count + l].
+// Bools are stored as 0 or ~0u.
+struct ExtLanes {
+  uint32 TypeId;
+  uint32 Components;
+  uint32* Lanes;
+};
+
+// Optional second table of an instruction set, evaluating an instruction for
+// count invocations at once. mask[l] is ~0u for the invocations that execute
+// it and 0 for the others, whose result lanes are ignored. A function returns
+// false without writing the result if it doesn't support the operands, the VM
+// then calls the scalar function once per invocation. So do nullptr entries
+// and instructions past the end of the table.
+#define EXT_BATCH_INST_FUNC(x) bool x(VM* vm, uint32 resultTypeId, uint32 count, const uint32* mask, int valueCount, const ExtLanes* values, ExtLanes* result)
+typedef EXT_BATCH_INST_FUNC(ExtBatchInstFunc);
+typedef ExtBatchInstFunc** GetExtBatchTableFunc(uint32* outCount);
+
+struct ExtBatchTable {
+  ExtBatchInstFunc** Functions;
+  uint32 Count;
+};
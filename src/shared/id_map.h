@@ -0,0 +1,85 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <stdexcept>
+#include "types.h"
+
+// Associative container for SPIR-V result ids. Entries are stored contiguously
+// in insertion order (which is module order for everything the parser adds)
+// and found through a table indexed by id, so lookups are a single array
+// access. Reserve() with the module's id bound sizes the table up front,
+// otherwise it grows as ids are inserted. Mirrors the subset of std::map the
+// code base uses.
+template<typename T>
+class IdMap {
+public:
+  typedef std::pair<uint32, T> value_type;
+  typedef typename std::vector<value_type>::iterator iterator;
+  typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+private:
+  // Index of the entry for an id plus one, zero if the id isn't present.
+  std::vector<uint32> index;
+  std::vector<value_type> entries;
+
+  uint32 slot(uint32 id) const {
+    return id < index.size() ? index[id] : 0;
+  }
+
+public:
+  void Reserve(uint32 idBound) {
+    if (index.size() < idBound) {
+      index.resize(idBound, 0);
+    }
+  }
+
+  std::pair<iterator, bool> insert(const value_type& value) {
+    uint32 existing = slot(value.first);
+    if (existing) {
+      return std::make_pair(entries.begin() + (existing - 1), false);
+    }
+    Reserve(value.first + 1);
+    entries.push_back(value);
+    index[value.first] = (uint32)entries.size();
+    return std::make_pair(entries.end() - 1, true);
+  }
+
+  T& operator[](uint32 id) {
+    return insert(value_type(id, T())).first->second;
+  }
+
+  iterator find(uint32 id) {
+    uint32 existing = slot(id);
+    return existing ? entries.begin() + (existing - 1) : entries.end();
+  }
+
+  const_iterator find(uint32 id) const {
+    uint32 existing = slot(id);
+    return existing ? entries.begin() + (existing - 1) : entries.end();
+  }
+
+  T& at(uint32 id) {
+    uint32 existing = slot(id);
+    if (!existing) {
+      throw std::out_of_range("IdMap::at");
+    }
+    return entries[existing - 1].second;
+  }
+
+  const T& at(uint32 id) const {
+    uint32 existing = slot(id);
+    if (!existing) {
+      throw std::out_of_range("IdMap::at");
+    }
+    return entries[existing - 1].second;
+  }
+
+  size_t count(uint32 id) const { return slot(id) ? 1 : 0; }
+  size_t size() const { return entries.size(); }
+  bool empty() const { return entries.empty(); }
+
+  iterator begin() { return entries.begin(); }
+  iterator end() { return entries.end(); }
+  const_iterator begin() const { return entries.begin(); }
+  const_iterator end() const { return entries.end(); }
+};
@@ -0,0 +1,102 @@
+#include "mapped_file.h"
+
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+#include <Windows.h>
+
+MappedFile::MappedFile() : data(nullptr), size(0), file(INVALID_HANDLE_VALUE), mapping(nullptr) {
+}
+
+bool MappedFile::Open(const char* path) {
+  Close();
+
+  file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+    Close();
+    return false;
+  }
+
+  mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapping) {
+    Close();
+    return false;
+  }
+
+  data = (const byte*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!data) {
+    Close();
+    return false;
+  }
+
+  size = (size_t)fileSize.QuadPart;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data) {
+    UnmapViewOfFile(data);
+  }
+  if (mapping) {
+    CloseHandle(mapping);
+  }
+  if (file != INVALID_HANDLE_VALUE) {
+    CloseHandle(file);
+  }
+  data = nullptr;
+  size = 0;
+  mapping = nullptr;
+  file = INVALID_HANDLE_VALUE;
+}
+
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+MappedFile::MappedFile() : data(nullptr), size(0) {
+}
+
+bool MappedFile::Open(const char* path) {
+  Close();
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  // The mapping stays valid after the descriptor is closed.
+  void* mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return false;
+  }
+
+  data = (const byte*)mapped;
+  size = (size_t)info.st_size;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data) {
+    munmap((void*)data, size);
+  }
+  data = nullptr;
+  size = 0;
+}
+
+#endif
+
+MappedFile::~MappedFile() {
+  Close();
+}
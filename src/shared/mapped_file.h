@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include "types.h"
+
+// A file mapped read-only into memory. The mapping is released when the
+// object is destroyed, pointers into Data() must not outlive it.
+class MappedFile {
+private:
+  const byte* data;
+  size_t size;
+#if defined(_WIN32) || defined(_WIN64) || defined(__CYGWIN__)
+  void* file;
+  void* mapping;
+#endif
+
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+
+  void Close();
+
+public:
+  MappedFile();
+  ~MappedFile();
+
+  bool Open(const char* path);
+
+  const byte* Data() const { return data; }
+  size_t Size() const { return size; }
+};
@@ -0,0 +1,637 @@
+#include "math_kernels.h"
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <algorithm>
+#include "simd.h"
+
+#if OTHERSIDE_SSE2
+
+// MPPrecise runs the kernels below on __m128d, MPFast on __m128. The helpers
+// are overloaded for both so every function is written once and the
+// polynomial degree is picked by the core functions of each type.
+
+static inline __m128d vadd(__m128d a, __m128d b) { return _mm_add_pd(a, b); }
+static inline __m128 vadd(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+static inline __m128d vsub(__m128d a, __m128d b) { return _mm_sub_pd(a, b); }
+static inline __m128 vsub(__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+static inline __m128d vmul(__m128d a, __m128d b) { return _mm_mul_pd(a, b); }
+static inline __m128 vmul(__m128 a, __m128 b) { return _mm_mul_ps(a, b); }
+static inline __m128d vdiv(__m128d a, __m128d b) { return _mm_div_pd(a, b); }
+static inline __m128 vdiv(__m128 a, __m128 b) { return _mm_div_ps(a, b); }
+static inline __m128d vsqrt(__m128d a) { return _mm_sqrt_pd(a); }
+static inline __m128 vsqrt(__m128 a) { return _mm_sqrt_ps(a); }
+static inline __m128d vmin(__m128d a, __m128d b) { return _mm_min_pd(a, b); }
+static inline __m128 vmin(__m128 a, __m128 b) { return _mm_min_ps(a, b); }
+static inline __m128d vmax(__m128d a, __m128d b) { return _mm_max_pd(a, b); }
+static inline __m128 vmax(__m128 a, __m128 b) { return _mm_max_ps(a, b); }
+static inline __m128d vand(__m128d a, __m128d b) { return _mm_and_pd(a, b); }
+static inline __m128 vand(__m128 a, __m128 b) { return _mm_and_ps(a, b); }
+static inline __m128d vor(__m128d a, __m128d b) { return _mm_or_pd(a, b); }
+static inline __m128 vor(__m128 a, __m128 b) { return _mm_or_ps(a, b); }
+static inline __m128d vxor(__m128d a, __m128d b) { return _mm_xor_pd(a, b); }
+static inline __m128 vxor(__m128 a, __m128 b) { return _mm_xor_ps(a, b); }
+static inline __m128d vlt(__m128d a, __m128d b) { return _mm_cmplt_pd(a, b); }
+static inline __m128 vlt(__m128 a, __m128 b) { return _mm_cmplt_ps(a, b); }
+static inline __m128d vgt(__m128d a, __m128d b) { return _mm_cmpgt_pd(a, b); }
+static inline __m128 vgt(__m128 a, __m128 b) { return _mm_cmpgt_ps(a, b); }
+static inline __m128d vselect(__m128d mask, __m128d a, __m128d b) { return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b)); }
+static inline __m128 vselect(__m128 mask, __m128 a, __m128 b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+
+template<typename V> V vsplat(double v);
+template<> inline __m128d vsplat<__m128d>(double v) { return _mm_set1_pd(v); }
+template<> inline __m128 vsplat<__m128>(double v) { return _mm_set1_ps((float)v); }
+
+template<typename V>
+static inline V vsignbit(V a) {
+  return vand(a, vsplat<V>(-0.0));
+}
+
+template<typename V>
+static inline V vabs(V a) {
+  return vxor(a, vsignbit(a));
+}
+
+// Horner evaluation of c[0] + c[1] x + ... + c[N - 1] x^(N - 1).
+template<typename V, int N>
+static inline V polynomial(V x, const double (&c)[N]) {
+  V p = vsplat<V>(c[N - 1]);
+  for (int i = N - 2; i >= 0; i--) {
+    p = vadd(vmul(p, x), vsplat<V>(c[i]));
+  }
+  return p;
+}
+
+static const double LN2 = 0.69314718055994530942;
+static const double LOG2E = 1.44269504088896340736;
+static const double PI = 3.14159265358979323846;
+static const double PI_2 = 1.57079632679489661923;
+static const double TWO_OVER_PI = 0.63661977236758134308;
+
+// Taylor coefficients of e^z for |z| <= ln(2) / 2.
+static const double EXP_PRECISE[] = { 1.0, 1.0, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040,
+  1.0 / 40320, 1.0 / 362880, 1.0 / 3628800, 1.0 / 39916800 };
+static const double EXP_FAST[] = { 1.0, 1.0, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720 };
+
+// ln(m) = 2 atanh(t) with t = (m - 1) / (m + 1), |t| <= 0.172 for m in
+// [sqrt(1/2), sqrt(2)). Series in t^2, multiplied by t afterwards.
+static const double LOG_PRECISE[] = { 1.0, 1.0 / 3, 1.0 / 5, 1.0 / 7, 1.0 / 9, 1.0 / 11, 1.0 / 13, 1.0 / 15 };
+static const double LOG_FAST[] = { 1.0, 1.0 / 3, 1.0 / 5, 1.0 / 7 };
+
+// sin(r) / r and cos(r) in r^2 for |r| <= pi / 4.
+static const double SIN_PRECISE[] = { 1.0, -1.0 / 6, 1.0 / 120, -1.0 / 5040, 1.0 / 362880, -1.0 / 39916800,
+  1.0 / 6227020800.0, -1.0 / 1307674368000.0 };
+static const double COS_PRECISE[] = { 1.0, -1.0 / 2, 1.0 / 24, -1.0 / 720, 1.0 / 40320, -1.0 / 3628800,
+  1.0 / 479001600, -1.0 / 87178291200.0, 1.0 / 20922789888000.0 };
+static const double SIN_FAST[] = { 1.0, -1.0 / 6, 1.0 / 120, -1.0 / 5040, 1.0 / 362880 };
+static const double COS_FAST[] = { 1.0, -1.0 / 2, 1.0 / 24, -1.0 / 720, 1.0 / 40320, -1.0 / 3628800 };
+
+// atan(a) / a in a^2 for |a| <= tan(pi / 16).
+static const double ATAN_PRECISE[] = { 1.0, -1.0 / 3, 1.0 / 5, -1.0 / 7, 1.0 / 9, -1.0 / 11, 1.0 / 13, -1.0 / 15,
+  1.0 / 17, -1.0 / 19, 1.0 / 21, -1.0 / 23 };
+static const double ATAN_FAST[] = { 1.0, -1.0 / 3, 1.0 / 5, -1.0 / 7, 1.0 / 9, -1.0 / 11 };
+
+static inline __m128d exp2Core(__m128d y) {
+  y = vmin(vmax(y, vsplat<__m128d>(-200)), vsplat<__m128d>(200));
+  __m128i n = _mm_cvtpd_epi32(y);
+  __m128d z = vmul(vsub(y, _mm_cvtepi32_pd(n)), vsplat<__m128d>(LN2));
+  __m128i exponent = _mm_unpacklo_epi32(_mm_add_epi32(n, _mm_set1_epi32(1023)), _mm_setzero_si128());
+  return vmul(polynomial(z, EXP_PRECISE), _mm_castsi128_pd(_mm_slli_epi64(exponent, 52)));
+}
+
+static inline __m128 exp2Core(__m128 y) {
+  y = vmin(vmax(y, vsplat<__m128>(-160)), vsplat<__m128>(160));
+  __m128i n = _mm_cvtps_epi32(y);
+  __m128 z = vmul(vsub(y, _mm_cvtepi32_ps(n)), vsplat<__m128>(LN2));
+  // 2^n is applied in two steps so that results close to the float range
+  // limits don't overflow or flush the scale factor.
+  __m128i half = _mm_srai_epi32(n, 1);
+  __m128 scale1 = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(half, _mm_set1_epi32(127)), 23));
+  __m128 scale2 = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_sub_epi32(n, half), _mm_set1_epi32(127)), 23));
+  return vmul(vmul(polynomial(z, EXP_FAST), scale1), scale2);
+}
+
+// Positive finite x only.
+static inline __m128d log2Core(__m128d x) {
+  __m128i bits = _mm_castpd_si128(x);
+  __m128i biased = _mm_shuffle_epi32(_mm_srli_epi64(bits, 52), _MM_SHUFFLE(3, 3, 2, 0));
+  __m128d e = _mm_cvtepi32_pd(_mm_sub_epi32(biased, _mm_set1_epi32(1023)));
+  __m128d m = vor(_mm_and_pd(x, _mm_castsi128_pd(_mm_set1_epi64x(0x000FFFFFFFFFFFFFll))), vsplat<__m128d>(1.0));
+  __m128d big = vgt(m, vsplat<__m128d>(1.41421356237309504880));
+  m = vselect(big, vmul(m, vsplat<__m128d>(0.5)), m);
+  e = vadd(e, vand(big, vsplat<__m128d>(1.0)));
+  __m128d t = vdiv(vsub(m, vsplat<__m128d>(1.0)), vadd(m, vsplat<__m128d>(1.0)));
+  __m128d lnM = vmul(vmul(t, polynomial(vmul(t, t), LOG_PRECISE)), vsplat<__m128d>(2.0));
+  return vadd(e, vmul(lnM, vsplat<__m128d>(LOG2E)));
+}
+
+// Positive finite normal x only.
+static inline __m128 log2Core(__m128 x) {
+  __m128i bits = _mm_castps_si128(x);
+  __m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+  __m128 m = vor(_mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(0x007FFFFF))), vsplat<__m128>(1.0));
+  __m128 big = vgt(m, vsplat<__m128>(1.41421356237309504880));
+  m = vselect(big, vmul(m, vsplat<__m128>(0.5)), m);
+  e = vadd(e, vand(big, vsplat<__m128>(1.0)));
+  __m128 t = vdiv(vsub(m, vsplat<__m128>(1.0)), vadd(m, vsplat<__m128>(1.0)));
+  __m128 lnM = vmul(vmul(t, polynomial(vmul(t, t), LOG_FAST)), vsplat<__m128>(2.0));
+  return vadd(e, vmul(lnM, vsplat<__m128>(LOG2E)));
+}
+
+// Reduces x by multiples k of pi / 2 and evaluates sin and cos of the rest.
+// The quadrant k mod 4 picks which one and which sign ends up in sinOut and
+// cosOut. Callers hand |x| beyond SINCOS_LIMIT to libm.
+static const float SINCOS_LIMIT = 8192.0f;
+
+static inline __m128i laneMaskFromInt(__m128i n, __m128d) {
+  return _mm_shuffle_epi32(n, _MM_SHUFFLE(1, 1, 0, 0));
+}
+
+static inline __m128i laneMaskFromInt(__m128i n, __m128) {
+  return n;
+}
+
+static inline __m128i roundToInt(__m128d x) { return _mm_cvtpd_epi32(x); }
+static inline __m128i roundToInt(__m128 x) { return _mm_cvtps_epi32(x); }
+static inline __m128d intToReal(__m128i n, __m128d) { return _mm_cvtepi32_pd(n); }
+static inline __m128 intToReal(__m128i n, __m128) { return _mm_cvtepi32_ps(n); }
+static inline __m128d asReal(__m128i n, __m128d) { return _mm_castsi128_pd(n); }
+static inline __m128 asReal(__m128i n, __m128) { return _mm_castsi128_ps(n); }
+
+// Cody-Waite splits of pi / 2. The double one is exact for |k| < 2^20, the
+// float one keeps k * PIO2_1 and k * PIO2_2 exact below SINCOS_LIMIT.
+static inline __m128d reduceQuadrant(__m128d x, __m128d k) {
+  x = vsub(x, vmul(k, vsplat<__m128d>(1.57079632673412561417e+00)));
+  return vsub(x, vmul(k, vsplat<__m128d>(6.07710050650619224932e-11)));
+}
+
+static inline __m128 reduceQuadrant(__m128 x, __m128 k) {
+  x = vsub(x, vmul(k, vsplat<__m128>(1.5703125f)));
+  x = vsub(x, vmul(k, vsplat<__m128>(4.837512969970703125e-4f)));
+  return vsub(x, vmul(k, vsplat<__m128>(7.54978995489188216e-8f)));
+}
+
+static inline void sinCosPolynomials(__m128d r, __m128d* s, __m128d* c) {
+  __m128d r2 = vmul(r, r);
+  *s = vmul(r, polynomial(r2, SIN_PRECISE));
+  *c = polynomial(r2, COS_PRECISE);
+}
+
+static inline void sinCosPolynomials(__m128 r, __m128* s, __m128* c) {
+  __m128 r2 = vmul(r, r);
+  *s = vmul(r, polynomial(r2, SIN_FAST));
+  *c = polynomial(r2, COS_FAST);
+}
+
+template<typename V>
+static inline void sinCosCore(V x, V* sinOut, V* cosOut) {
+  __m128i n = roundToInt(vmul(x, vsplat<V>(TWO_OVER_PI)));
+  V r = reduceQuadrant(x, intToReal(n, x));
+  V s, c;
+  sinCosPolynomials(r, &s, &c);
+
+  const __m128i one = _mm_set1_epi32(1);
+  const __m128i two = _mm_set1_epi32(2);
+  V swap = asReal(laneMaskFromInt(_mm_cmpeq_epi32(_mm_and_si128(n, one), one), x), x);
+  V sinNegative = asReal(laneMaskFromInt(_mm_cmpeq_epi32(_mm_and_si128(n, two), two), x), x);
+  V cosNegative = asReal(laneMaskFromInt(_mm_cmpeq_epi32(_mm_and_si128(_mm_add_epi32(n, one), two), two), x), x);
+  V signBit = vsplat<V>(-0.0);
+  if (sinOut) {
+    *sinOut = vxor(vselect(swap, c, s), vand(sinNegative, signBit));
+  }
+  if (cosOut) {
+    *cosOut = vxor(vselect(swap, s, c), vand(cosNegative, signBit));
+  }
+}
+
+static inline __m128d atanPolynomial(__m128d a) { return vmul(a, polynomial(vmul(a, a), ATAN_PRECISE)); }
+static inline __m128 atanPolynomial(__m128 a) { return vmul(a, polynomial(vmul(a, a), ATAN_FAST)); }
+
+// Any x but NaN.
+template<typename V>
+static inline V atanCore(V x) {
+  const V one = vsplat<V>(1.0);
+  V a = vabs(x);
+  V inverted = vgt(a, one);
+  a = vselect(inverted, vdiv(one, a), a);
+  // atan(a) = 2 atan(a / (1 + sqrt(1 + a^2))), twice to get below tan(pi / 16).
+  a = vdiv(a, vadd(one, vsqrt(vadd(one, vmul(a, a)))));
+  a = vdiv(a, vadd(one, vsqrt(vadd(one, vmul(a, a)))));
+  V r = vmul(atanPolynomial(a), vsplat<V>(4.0));
+  r = vselect(inverted, vsub(vsplat<V>(PI_2), r), r);
+  return vor(r, vsignbit(x));
+}
+
+// Odd series around zero for the hyperbolic functions, where the formulas
+// based on exp and log lose precision to cancellation.
+static const float SMALL_ARGUMENT = 0.25f;
+static const double SINH_SERIES[] = { 1.0, 1.0 / 6, 1.0 / 120, 1.0 / 5040, 1.0 / 362880 };
+static const double TANH_SERIES[] = { 1.0, -1.0 / 3, 2.0 / 15, -17.0 / 315, 62.0 / 2835 };
+static const double ASINH_SERIES[] = { 1.0, -1.0 / 6, 3.0 / 40, -15.0 / 336, 105.0 / 3456 };
+static const double ATANH_SERIES[] = { 1.0, 1.0 / 3, 1.0 / 5, 1.0 / 7, 1.0 / 9, 1.0 / 11 };
+
+template<typename V, int N>
+static inline V oddSeries(V x, const double (&c)[N]) {
+  return vmul(x, polynomial(vmul(x, x), c));
+}
+
+static inline __m128 notFinite(__m128 x) {
+  return _mm_cmpneq_ps(_mm_sub_ps(x, x), _mm_setzero_ps());
+}
+
+static inline __m128 absGreater(__m128 x, float limit) {
+  return _mm_cmpgt_ps(vabs(x), _mm_set1_ps(limit));
+}
+
+// A kernel provides Eval() for both vector types, Scalar() for the lanes
+// Special() flags and for targets without SSE2.
+struct ExpKernel {
+  template<typename V> static V Eval(V x) { return exp2Core(vmul(x, vsplat<V>(LOG2E))); }
+  static __m128 Special(__m128 x) { return notFinite(x); }
+  static float Scalar(float x) { return std::exp(x); }
+};
+
+struct Exp2Kernel {
+  template<typename V> static V Eval(V x) { return exp2Core(x); }
+  static __m128 Special(__m128 x) { return notFinite(x); }
+  static float Scalar(float x) { return std::exp2(x); }
+};
+
+struct LogKernel {
+  template<typename V> static V Eval(V x) { return vmul(log2Core(x), vsplat<V>(LN2)); }
+  static __m128 Special(__m128 x) { return _mm_or_ps(notFinite(x), _mm_cmplt_ps(x, _mm_set1_ps(FLT_MIN))); }
+  static float Scalar(float x) { return std::log(x); }
+};
+
+struct Log2Kernel {
+  template<typename V> static V Eval(V x) { return log2Core(x); }
+  static __m128 Special(__m128 x) { return LogKernel::Special(x); }
+  static float Scalar(float x) { return std::log2(x); }
+};
+
+struct PowKernel {
+  template<typename V> static V Eval(V x, V y) { return exp2Core(vmul(y, log2Core(x))); }
+  static __m128 Special(__m128 x, __m128 y) { return _mm_or_ps(LogKernel::Special(x), notFinite(y)); }
+  static float Scalar(float x, float y) { return std::pow(x, y); }
+};
+
+struct SinKernel {
+  template<typename V> static V Eval(V x) { V s; sinCosCore(x, &s, (V*)nullptr); return s; }
+  static __m128 Special(__m128 x) { return _mm_or_ps(notFinite(x), absGreater(x, SINCOS_LIMIT)); }
+  static float Scalar(float x) { return std::sin(x); }
+};
+
+struct CosKernel {
+  template<typename V> static V Eval(V x) { V c; sinCosCore(x, (V*)nullptr, &c); return c; }
+  static __m128 Special(__m128 x) { return SinKernel::Special(x); }
+  static float Scalar(float x) { return std::cos(x); }
+};
+
+struct TanKernel {
+  template<typename V> static V Eval(V x) { V s, c; sinCosCore(x, &s, &c); return vdiv(s, c); }
+  static __m128 Special(__m128 x) { return SinKernel::Special(x); }
+  static float Scalar(float x) { return std::tan(x); }
+};
+
+struct AsinKernel {
+  template<typename V> static V Eval(V x) {
+    const V one = vsplat<V>(1.0);
+    return atanCore(vdiv(x, vsqrt(vmul(vsub(one, x), vadd(one, x)))));
+  }
+  static __m128 Special(__m128 x) { return _mm_or_ps(notFinite(x), absGreater(x, 1.0f)); }
+  static float Scalar(float x) { return std::asin(x); }
+};
+
+struct AcosKernel {
+  template<typename V> static V Eval(V x) {
+    const V one = vsplat<V>(1.0);
+    return vmul(atanCore(vsqrt(vdiv(vsub(one, x), vadd(one, x)))), vsplat<V>(2.0));
+  }
+  static __m128 Special(__m128 x) { return AsinKernel::Special(x); }
+  static float Scalar(float x) { return std::acos(x); }
+};
+
+struct AtanKernel {
+  template<typename V> static V Eval(V x) { return atanCore(x); }
+  static __m128 Special(__m128 x) { return _mm_cmpunord_ps(x, x); }
+  static float Scalar(float x) { return std::atan(x); }
+};
+
+struct Atan2Kernel {
+  template<typename V> static V Eval(V y, V x) {
+    V r = atanCore(vdiv(y, x));
+    V halfTurn = vor(vsplat<V>(PI), vsignbit(y));
+    return vadd(r, vand(vlt(x, vsplat<V>(0.0)), halfTurn));
+  }
+  // x == 0 leaves the quadrant to the sign of zero, which libm handles.
+  static __m128 Special(__m128 y, __m128 x) {
+    return _mm_or_ps(_mm_or_ps(notFinite(x), notFinite(y)), _mm_cmpeq_ps(x, _mm_setzero_ps()));
+  }
+  static float Scalar(float y, float x) { return std::atan2(y, x); }
+};
+
+struct SinhKernel {
+  template<typename V> static V Eval(V x) {
+    V e = ExpKernel::Eval(x);
+    V r = vmul(vsub(e, vdiv(vsplat<V>(1.0), e)), vsplat<V>(0.5));
+    return vselect(vlt(vabs(x), vsplat<V>(SMALL_ARGUMENT)), oddSeries(x, SINH_SERIES), r);
+  }
+  static __m128 Special(__m128 x) { return _mm_or_ps(notFinite(x), absGreater(x, 88.0f)); }
+  static float Scalar(float x) { return std::sinh(x); }
+};
+
+struct CoshKernel {
+  template<typename V> static V Eval(V x) {
+    V e = ExpKernel::Eval(x);
+    return vmul(vadd(e, vdiv(vsplat<V>(1.0), e)), vsplat<V>(0.5));
+  }
+  static __m128 Special(__m128 x) { return SinhKernel::Special(x); }
+  static float Scalar(float x) { return std::cosh(x); }
+};
+
+struct TanhKernel {
+  template<typename V> static V Eval(V x) {
+    const V one = vsplat<V>(1.0);
+    V e = ExpKernel::Eval(vmul(vabs(x), vsplat<V>(2.0)));
+    V r = vor(vsub(one, vdiv(vsplat<V>(2.0), vadd(e, one))), vsignbit(x));
+    return vselect(vlt(vabs(x), vsplat<V>(SMALL_ARGUMENT)), oddSeries(x, TANH_SERIES), r);
+  }
+  static __m128 Special(__m128 x) { return notFinite(x); }
+  static float Scalar(float x) { return std::tanh(x); }
+};
+
+struct AsinhKernel {
+  template<typename V> static V Eval(V x) {
+    V a = vabs(x);
+    V r = LogKernel::Eval(vadd(a, vsqrt(vadd(vmul(a, a), vsplat<V>(1.0)))));
+    r = vor(r, vsignbit(x));
+    return vselect(vlt(a, vsplat<V>(SMALL_ARGUMENT)), oddSeries(x, ASINH_SERIES), r);
+  }
+  static __m128 Special(__m128 x) { return _mm_or_ps(notFinite(x), absGreater(x, 1e18f)); }
+  static float Scalar(float x) { return std::asinh(x); }
+};
+
+struct AcoshKernel {
+  template<typename V> static V Eval(V x) {
+    const V one = vsplat<V>(1.0);
+    return LogKernel::Eval(vadd(x, vsqrt(vmul(vsub(x, one), vadd(x, one)))));
+  }
+  static __m128 Special(__m128 x) {
+    return _mm_or_ps(_mm_or_ps(notFinite(x), _mm_cmplt_ps(x, _mm_set1_ps(1.0f))), absGreater(x, 1e18f));
+  }
+  static float Scalar(float x) { return std::acosh(x); }
+};
+
+struct AtanhKernel {
+  template<typename V> static V Eval(V x) {
+    const V one = vsplat<V>(1.0);
+    V a = vabs(x);
+    V r = vmul(LogKernel::Eval(vdiv(vadd(one, a), vsub(one, a))), vsplat<V>(0.5));
+    r = vor(r, vsignbit(x));
+    return vselect(vlt(a, vsplat<V>(SMALL_ARGUMENT)), oddSeries(x, ATANH_SERIES), r);
+  }
+  static __m128 Special(__m128 x) { return _mm_or_ps(notFinite(x), _mm_cmpge_ps(vabs(x), _mm_set1_ps(1.0f))); }
+  static float Scalar(float x) { return std::atanh(x); }
+};
+
+struct InverseSqrtKernel {
+  static __m128d Eval(__m128d x) { return vdiv(vsplat<__m128d>(1.0), vsqrt(x)); }
+  // One Newton-Raphson step on the 12 bit estimate.
+  static __m128 Eval(__m128 x) {
+    __m128 y = _mm_rsqrt_ps(x);
+    __m128 yyx = vmul(vmul(y, y), x);
+    return vmul(y, vsub(vsplat<__m128>(1.5), vmul(yyx, vsplat<__m128>(0.5))));
+  }
+  static __m128 Special(__m128 x) { return LogKernel::Special(x); }
+  static float Scalar(float x) { return 1.0f / std::sqrt(x); }
+};
+
+static inline __m128 evalBlock(MathPrecision precision, __m128 x, __m128 (*fast)(__m128), __m128d (*precise)(__m128d)) {
+  if (precision == MPFast) {
+    return fast(x);
+  }
+  __m128d low = precise(_mm_cvtps_pd(x));
+  __m128d high = precise(_mm_cvtps_pd(_mm_movehl_ps(x, x)));
+  return _mm_movelh_ps(_mm_cvtpd_ps(low), _mm_cvtpd_ps(high));
+}
+
+static inline __m128 evalBlock(MathPrecision precision, __m128 x, __m128 y, __m128 (*fast)(__m128, __m128), __m128d (*precise)(__m128d, __m128d)) {
+  if (precision == MPFast) {
+    return fast(x, y);
+  }
+  __m128d low = precise(_mm_cvtps_pd(x), _mm_cvtps_pd(y));
+  __m128d high = precise(_mm_cvtps_pd(_mm_movehl_ps(x, x)), _mm_cvtps_pd(_mm_movehl_ps(y, y)));
+  return _mm_movelh_ps(_mm_cvtpd_ps(low), _mm_cvtpd_ps(high));
+}
+
+// Blocks of four loaded straight from the inputs, the last partial block is
+// padded with ones. Every block is loaded before anything is written so out
+// may alias the inputs, lanes flagged by Special() get the libm result.
+template<typename Kernel>
+static void applyBlock(MathPrecision precision, const float* x, float* out, uint32 n) {
+  __m128 vx = _mm_loadu_ps(x);
+  __m128 result = evalBlock(precision, vx, Kernel::Eval, Kernel::Eval);
+  int special = _mm_movemask_ps(Kernel::Special(vx));
+  if (n == 4 && !special) {
+    _mm_storeu_ps(out, result);
+    return;
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, result);
+  for (uint32 j = 0; j < n; j++) {
+    out[j] = (special >> j) & 1 ? Kernel::Scalar(x[j]) : lanes[j];
+  }
+}
+
+template<typename Kernel>
+static void applyBlock(MathPrecision precision, const float* x, const float* y, float* out, uint32 n) {
+  __m128 vx = _mm_loadu_ps(x);
+  __m128 vy = _mm_loadu_ps(y);
+  __m128 result = evalBlock(precision, vx, vy, Kernel::Eval, Kernel::Eval);
+  int special = _mm_movemask_ps(Kernel::Special(vx, vy));
+  if (n == 4 && !special) {
+    _mm_storeu_ps(out, result);
+    return;
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, result);
+  for (uint32 j = 0; j < n; j++) {
+    out[j] = (special >> j) & 1 ? Kernel::Scalar(x[j], y[j]) : lanes[j];
+  }
+}
+
+template<typename Kernel>
+static void apply(MathPrecision precision, const float* x, float* out, uint32 count) {
+  uint32 i = 0;
+  for (; i + 4 <= count; i += 4) {
+    applyBlock<Kernel>(precision, x + i, out + i, 4);
+  }
+  if (i < count) {
+    float in[4] = { 1, 1, 1, 1 };
+    std::memcpy(in, x + i, (count - i) * sizeof(float));
+    applyBlock<Kernel>(precision, in, out + i, count - i);
+  }
+}
+
+template<typename Kernel>
+static void apply(MathPrecision precision, const float* x, const float* y, float* out, uint32 count) {
+  uint32 i = 0;
+  for (; i + 4 <= count; i += 4) {
+    applyBlock<Kernel>(precision, x + i, y + i, out + i, 4);
+  }
+  if (i < count) {
+    float inX[4] = { 1, 1, 1, 1 };
+    float inY[4] = { 1, 1, 1, 1 };
+    std::memcpy(inX, x + i, (count - i) * sizeof(float));
+    std::memcpy(inY, y + i, (count - i) * sizeof(float));
+    applyBlock<Kernel>(precision, inX, inY, out + i, count - i);
+  }
+}
+
+static inline __m128 fastSqrt(__m128 x) {
+  __m128 r = vmul(x, InverseSqrtKernel::Eval(x));
+  return _mm_and_ps(r, _mm_cmpgt_ps(x, _mm_setzero_ps()));
+}
+
+#else
+
+#define DEFINE_SCALAR_KERNEL(name, func) \
+  struct name { static float Scalar(float x) { return func(x); } };
+
+DEFINE_SCALAR_KERNEL(ExpKernel, std::exp)
+DEFINE_SCALAR_KERNEL(Exp2Kernel, std::exp2)
+DEFINE_SCALAR_KERNEL(LogKernel, std::log)
+DEFINE_SCALAR_KERNEL(Log2Kernel, std::log2)
+DEFINE_SCALAR_KERNEL(SinKernel, std::sin)
+DEFINE_SCALAR_KERNEL(CosKernel, std::cos)
+DEFINE_SCALAR_KERNEL(TanKernel, std::tan)
+DEFINE_SCALAR_KERNEL(AsinKernel, std::asin)
+DEFINE_SCALAR_KERNEL(AcosKernel, std::acos)
+DEFINE_SCALAR_KERNEL(AtanKernel, std::atan)
+DEFINE_SCALAR_KERNEL(SinhKernel, std::sinh)
+DEFINE_SCALAR_KERNEL(CoshKernel, std::cosh)
+DEFINE_SCALAR_KERNEL(TanhKernel, std::tanh)
+DEFINE_SCALAR_KERNEL(AsinhKernel, std::asinh)
+DEFINE_SCALAR_KERNEL(AcoshKernel, std::acosh)
+DEFINE_SCALAR_KERNEL(AtanhKernel, std::atanh)
+
+struct InverseSqrtKernel { static float Scalar(float x) { return 1.0f / std::sqrt(x); } };
+struct PowKernel { static float Scalar(float x, float y) { return std::pow(x, y); } };
+struct Atan2Kernel { static float Scalar(float y, float x) { return std::atan2(y, x); } };
+
+template<typename Kernel>
+static void apply(MathPrecision, const float* x, float* out, uint32 count) {
+  for (uint32 i = 0; i < count; i++) {
+    out[i] = Kernel::Scalar(x[i]);
+  }
+}
+
+template<typename Kernel>
+static void apply(MathPrecision, const float* x, const float* y, float* out, uint32 count) {
+  for (uint32 i = 0; i < count; i++) {
+    out[i] = Kernel::Scalar(x[i], y[i]);
+  }
+}
+
+#endif
+
+void mathExp(MathPrecision precision, const float* x, float* out, uint32 count) { apply<ExpKernel>(precision, x, out, count); }
+void mathExp2(MathPrecision precision, const float* x, float* out, uint32 count) { apply<Exp2Kernel>(precision, x, out, count); }
+void mathLog(MathPrecision precision, const float* x, float* out, uint32 count) { apply<LogKernel>(precision, x, out, count); }
+void mathLog2(MathPrecision precision, const float* x, float* out, uint32 count) { apply<Log2Kernel>(precision, x, out, count); }
+void mathPow(MathPrecision precision, const float* x, const float* y, float* out, uint32 count) { apply<PowKernel>(precision, x, y, out, count); }
+
+void mathSin(MathPrecision precision, const float* x, float* out, uint32 count) { apply<SinKernel>(precision, x, out, count); }
+void mathCos(MathPrecision precision, const float* x, float* out, uint32 count) { apply<CosKernel>(precision, x, out, count); }
+void mathTan(MathPrecision precision, const float* x, float* out, uint32 count) { apply<TanKernel>(precision, x, out, count); }
+void mathAsin(MathPrecision precision, const float* x, float* out, uint32 count) { apply<AsinKernel>(precision, x, out, count); }
+void mathAcos(MathPrecision precision, const float* x, float* out, uint32 count) { apply<AcosKernel>(precision, x, out, count); }
+void mathAtan(MathPrecision precision, const float* x, float* out, uint32 count) { apply<AtanKernel>(precision, x, out, count); }
+void mathAtan2(MathPrecision precision, const float* y, const float* x, float* out, uint32 count) { apply<Atan2Kernel>(precision, y, x, out, count); }
+
+void mathSinh(MathPrecision precision, const float* x, float* out, uint32 count) { apply<SinhKernel>(precision, x, out, count); }
+void mathCosh(MathPrecision precision, const float* x, float* out, uint32 count) { apply<CoshKernel>(precision, x, out, count); }
+void mathTanh(MathPrecision precision, const float* x, float* out, uint32 count) { apply<TanhKernel>(precision, x, out, count); }
+void mathAsinh(MathPrecision precision, const float* x, float* out, uint32 count) { apply<AsinhKernel>(precision, x, out, count); }
+void mathAcosh(MathPrecision precision, const float* x, float* out, uint32 count) { apply<AcoshKernel>(precision, x, out, count); }
+void mathAtanh(MathPrecision precision, const float* x, float* out, uint32 count) { apply<AtanhKernel>(precision, x, out, count); }
+
+void mathSqrt(const float* x, float* out, uint32 count) {
+  uint32 i = 0;
+#if OTHERSIDE_SSE2
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_ps(out + i, _mm_sqrt_ps(_mm_loadu_ps(x + i)));
+  }
+#endif
+  for (; i < count; i++) {
+    out[i] = std::sqrt(x[i]);
+  }
+}
+
+void mathInverseSqrt(MathPrecision precision, const float* x, float* out, uint32 count) {
+  apply<InverseSqrtKernel>(precision, x, out, count);
+}
+
+// Component d of vector i, Lanes selects the structure of arrays layout.
+template<bool Lanes>
+static inline uint32 componentIndex(uint32 i, uint32 d, uint32 dim, uint32 count) {
+  return Lanes ? d * count + i : i * dim + d;
+}
+
+template<bool Difference, bool Lanes>
+static void lengths(MathPrecision precision, const float* a, const float* b, uint32 dim, float* out, uint32 count) {
+  uint32 i = 0;
+#if OTHERSIDE_SSE2
+  // Four vectors at a time, one component of each per step.
+  for (; i + 4 <= count; i += 4) {
+    __m128 sum = _mm_setzero_ps();
+    for (uint32 d = 0; d < dim; d++) {
+      __m128 c;
+      if (Lanes) {
+        c = _mm_loadu_ps(a + componentIndex<Lanes>(i, d, dim, count));
+        if (Difference) {
+          c = _mm_sub_ps(c, _mm_loadu_ps(b + componentIndex<Lanes>(i, d, dim, count)));
+        }
+      } else {
+        const float* v = a + i * dim;
+        c = _mm_setr_ps(v[d], v[dim + d], v[2 * dim + d], v[3 * dim + d]);
+        if (Difference) {
+          const float* w = b + i * dim;
+          c = _mm_sub_ps(c, _mm_setr_ps(w[d], w[dim + d], w[2 * dim + d], w[3 * dim + d]));
+        }
+      }
+      sum = _mm_add_ps(sum, _mm_mul_ps(c, c));
+    }
+    _mm_storeu_ps(out + i, precision == MPFast ? fastSqrt(sum) : _mm_sqrt_ps(sum));
+  }
+#endif
+  for (; i < count; i++) {
+    float sum = 0;
+    for (uint32 d = 0; d < dim; d++) {
+      uint32 index = componentIndex<Lanes>(i, d, dim, count);
+      float c = Difference ? a[index] - b[index] : a[index];
+      sum += c * c;
+    }
+#if OTHERSIDE_SSE2
+    out[i] = precision == MPFast ? _mm_cvtss_f32(fastSqrt(_mm_set_ss(sum))) : std::sqrt(sum);
+#else
+    out[i] = std::sqrt(sum);
+#endif
+  }
+}
+
+void mathLength(MathPrecision precision, const float* v, uint32 dim, float* out, uint32 count) {
+  lengths<false, false>(precision, v, nullptr, dim, out, count);
+}
+
+void mathDistance(MathPrecision precision, const float* a, const float* b, uint32 dim, float* out, uint32 count) {
+  lengths<true, false>(precision, a, b, dim, out, count);
+}
+
+void mathLengthLanes(MathPrecision precision, const float* v, uint32 dim, float* out, uint32 count) {
+  lengths<false, true>(precision, v, nullptr, dim, out, count);
+}
+
+void mathDistanceLanes(MathPrecision precision, const float* a, const float* b, uint32 dim, float* out, uint32 count) {
+  lengths<true, true>(precision, a, b, dim, out, count);
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "types.h"
+#include "vm.h"
+
+// Vectorized transcendental functions of GLSL.std.450. Every kernel evaluates
+// count floats (vector components or a batch of invocations), out may alias
+// the inputs.
+//
+// MPPrecise evaluates the polynomials in double precision, so results are
+// the correctly rounded float in all but a few cases and match libm. MPFast
+// stays in single precision with a relative error below 1e-5 for normal
+// results (absolute for sin and cos). Inputs the polynomials don't cover
+// (negative pow bases, huge trigonometric arguments, infinities and NaNs) are
+// passed to libm in both modes.
+
+void mathExp(MathPrecision precision, const float* x, float* out, uint32 count);
+void mathExp2(MathPrecision precision, const float* x, float* out, uint32 count);
+void mathLog(MathPrecision precision, const float* x, float* out, uint32 count);
+void mathLog2(MathPrecision precision, const float* x, float* out, uint32 count);
+void mathPow(MathPrecision precision, const float* x, const float* y, float* out, uint32 count);
+
+void mathSin(MathPrecision precision, const float* x, float* out, uint32 count);
+void mathCos(MathPrecision precision, const float* x, float* out, uint32 count);
+void mathTan(MathPrecision precision, const float* x, float* out, uint32 count);
+void mathAsin(MathPrecision precision, const float* x, float* out, uint32 count);
+void mathAcos(MathPrecision precision, const float* x, float* out, uint32 count);
+void mathAtan(MathPrecision precision, const float* x, float* out, uint32 count);
+void mathAtan2(MathPrecision precision, const float* y, const float* x, float* out, uint32 count);
+
+void mathSinh(MathPrecision precision, const float* x, float* out, uint32 count);
+void mathCosh(MathPrecision precision, const float* x, float* out, uint32 count);
+void mathTanh(MathPrecision precision, const float* x, float* out, uint32 count);
+void mathAsinh(MathPrecision precision, const float* x, float* out, uint32 count);
+void mathAcosh(MathPrecision precision, const float* x, float* out, uint32 count);
+void mathAtanh(MathPrecision precision, const float* x, float* out, uint32 count);
+
+void mathSqrt(const float* x, float* out, uint32 count);
+void mathInverseSqrt(MathPrecision precision, const float* x, float* out, uint32 count);
+
+// Euclidean length of count vectors with dim components each, stored back to
+// back. Squares are summed in component order in both modes, MPFast replaces
+// the square root with a refined reciprocal estimate.
+void mathLength(MathPrecision precision, const float* v, uint32 dim, float* out, uint32 count);
+void mathDistance(MathPrecision precision, const float* a, const float* b, uint32 dim, float* out, uint32 count);
+
+// Same for vectors in structure of arrays form, component d of vector i is
+// v[d * count + i]. Results are identical to the functions above.
+void mathLengthLanes(MathPrecision precision, const float* v, uint32 dim, float* out, uint32 count);
+void mathDistanceLanes(MathPrecision precision, const float* a, const float* b, uint32 dim, float* out, uint32 count);
@@ -0,0 +1,83 @@
+#include "mipmap.h"
+#include <algorithm>
+#include "thread_pool.h"
+#include "sampling.h"
+#include "simd.h"
+
+// Rows per task, small levels are done by a single one.
+static const uint32 ROWS_PER_TASK = 16;
+
+static void downsampleRow(const Texture& src, Texture* dst, int y) {
+  const Color* row0 = src.data + std::min(2 * y, src.height - 1) * src.width;
+  const Color* row1 = src.data + std::min(2 * y + 1, src.height - 1) * src.width;
+  Color* out = dst->data + y * dst->width;
+
+  for (int x = 0; x < dst->width; x++) {
+    int x0 = std::min(2 * x, src.width - 1);
+    int x1 = std::min(2 * x + 1, src.width - 1);
+#if OTHERSIDE_SSE2
+    __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps((const float*)&row0[x0]), _mm_loadu_ps((const float*)&row0[x1])),
+                            _mm_add_ps(_mm_loadu_ps((const float*)&row1[x0]), _mm_loadu_ps((const float*)&row1[x1])));
+    _mm_storeu_ps((float*)&out[x], _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+    out[x].r = (row0[x0].r + row0[x1].r + row1[x0].r + row1[x1].r) * 0.25f;
+    out[x].g = (row0[x0].g + row0[x1].g + row1[x0].g + row1[x1].g) * 0.25f;
+    out[x].b = (row0[x0].b + row0[x1].b + row1[x0].b + row1[x1].b) * 0.25f;
+    out[x].a = (row0[x0].a + row0[x1].a + row1[x0].a + row1[x1].a) * 0.25f;
+#endif
+  }
+}
+
+bool MipChain::Generate(const Texture& base, ThreadPool& pool, TextureLayout layout, TextureFormat format) {
+  levels.clear();
+  mips.clear();
+  if (!base.data || base.width <= 0 || base.height <= 0) {
+    return false;
+  }
+
+  // The levels are generated as float row-major textures first. Reserved up
+  // front since src points into the vector.
+  std::vector<Texture> generated;
+  uint32 count = 0;
+  for (int size = std::max(base.width, base.height); size > 1; size /= 2) {
+    count++;
+  }
+  generated.reserve(count);
+
+  const Texture* src = &base;
+  while (src->width > 1 || src->height > 1) {
+    int width = std::max(src->width / 2, 1);
+    int height = std::max(src->height / 2, 1);
+    generated.push_back(Texture{ width, height, new Color[width * height] });
+    Texture* dst = &generated.back();
+
+    uint32 tasks = (height + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+    pool.ParallelFor(tasks, [&](uint32 task, uint32 worker) {
+      int end = std::min((int)((task + 1) * ROWS_PER_TASK), height);
+      for (int y = task * ROWS_PER_TASK; y < end; y++) {
+        downsampleRow(*src, dst, y);
+      }
+    });
+    src = dst;
+  }
+
+  levels.resize(generated.size());
+  pool.ParallelFor((uint32)generated.size(), [&](uint32 index, uint32 worker) {
+    StoredLevel& level = levels[index];
+    level.Dims[0] = generated[index].width;
+    level.Dims[1] = generated[index].height;
+    level.Texels.reset(new byte[getLayoutTexelCount(layout, 2, level.Dims) * getTexelSize(format)]);
+    convertToLayout(layout, format, 2, level.Dims, generated[index].data, level.Texels.get());
+    delete[] generated[index].data;
+  });
+
+  for (auto& level : levels) {
+    mips.push_back(MipLevel{ level.Dims, level.Texels.get() });
+  }
+  return true;
+}
+
+void MipChain::Bind(Sampler* sampler) const {
+  sampler->MipCount = (uint32)mips.size();
+  sampler->Mips = mips.empty() ? nullptr : mips.data();
+}
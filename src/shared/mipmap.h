@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include "types.h"
+#include "vm.h"
+#include "utils.h"
+
+class ThreadPool;
+
+// Mip levels of a 2D texture, from half its size down to a single texel. Each
+// level averages 2x2 texels of the previous one, odd sizes round down and
+// repeat the last row or column. The base texture is not copied and has to
+// outlive the chain if it is bound to a sampler.
+class MipChain {
+private:
+  struct StoredLevel {
+    uint32 Dims[2];
+    std::unique_ptr<byte[]> Texels;
+  };
+
+  std::vector<StoredLevel> levels;
+  std::vector<MipLevel> mips;
+
+public:
+  MipChain() { }
+
+  MipChain(const MipChain&) = delete;
+  MipChain& operator=(const MipChain&) = delete;
+
+  // Replaces the current levels with the ones of base, which is row-major.
+  // The rows of every level are generated by the threads of pool, afterwards
+  // the levels are stored in layout and format.
+  bool Generate(const Texture& base, ThreadPool& pool, TextureLayout layout = TLRowMajor, TextureFormat format = TFRGBA32F);
+
+  uint32 LevelCount() const { return (uint32)mips.size(); }
+  const MipLevel& Level(uint32 index) const { return mips[index]; }
+
+  // Sets the mip chain of a sampler of the base texture.
+  void Bind(Sampler* sampler) const;
+};
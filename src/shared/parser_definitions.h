@@ -3,9 +3,12 @@
 #include <map>
 #include <stack>
 #include <string>
+#include <memory>
 #include <assert.h>
 
 #include "types.h"
+#include "arena.h"
+#include "id_map.h"
 #include "lookups.h"
 #include "lookups_gen.h"
 
@@ -28,8 +31,8 @@ struct Function {
   std::vector<SFunctionParameter> Parameters;
   std::vector<SOp> Ops;
   std::map<uint32, Block> Blocks;
-  std::map<uint32, SVariable> Variables;
-  std::map<uint32, uint32> Labels;
+  IdMap<SVariable> Variables;
+  IdMap<uint32> Labels;
 };
 
 struct ParseFunction : public Function {
@@ -41,6 +44,9 @@ struct ParseFunction : public Function {
 };
 
 
+// A parsed module. Instructions point into Memory, which holds the decoded
+// operands, and into the WordCount module words kept alive by Words. Programs
+// can't be copied, destroying one releases everything it references at once.
 struct Program {
   uint32 Version;
   uint32 GeneratorMagic;
@@ -51,29 +57,57 @@ struct Program {
   std::vector<std::string> SourceExtensions;
   std::vector<std::string> SPIRVExtensions;
 
-  std::map<uint32, SString> Strings;
-  std::map<uint32, SName> Names;
+  IdMap<SString> Strings;
+  IdMap<SName> Names;
   std::map<uint32, SMemberName> MemberNames;
-  std::map<uint32, SLine> Lines;
+  IdMap<SLine> Lines;
 
-  std::map<uint32, SEntryPoint> EntryPoints;
-  std::map<uint32, SExecutionMode> ExecutionModes;
-  std::map<uint32, SExtInstImport> ExtensionImports;
-  std::map<uint32, SOp> DefinedTypes;
-  std::map<uint32, SOp> Constants;
-  std::map<uint32, SVariable> Variables;
+  IdMap<SEntryPoint> EntryPoints;
+  IdMap<SExecutionMode> ExecutionModes;
+  IdMap<SExtInstImport> ExtensionImports;
+  IdMap<SOp> DefinedTypes;
+  IdMap<SOp> Constants;
+  IdMap<SVariable> Variables;
 
-  std::map<uint32, Function> FunctionDeclarations;
-  std::map<uint32, Function> FunctionDefinitions;
+  IdMap<Function> FunctionDeclarations;
+  IdMap<Function> FunctionDefinitions;
   std::vector<SOp> Ops;
+
+  Arena Memory;
+  std::shared_ptr<const uint32> Words;
+  uint32 WordCount = 0;
+
+  Program() { }
+  Program(const Program&) = delete;
+  Program& operator=(const Program&) = delete;
+  Program(Program&&) = default;
+  Program& operator=(Program&&) = default;
 };
 
 struct ParseProgram : public Program {
   SOp NextOp;
-  ParseFunction* CurrentFunction;
+  ParseFunction* CurrentFunction = nullptr;
   bool InFunction = false;
+
+  ~ParseProgram() {
+    delete CurrentFunction;
+  }
 };
 
+inline void reserveIds(ParseProgram* prog, uint32 idBound) {
+  prog->Strings.Reserve(idBound);
+  prog->Names.Reserve(idBound);
+  prog->Lines.Reserve(idBound);
+  prog->EntryPoints.Reserve(idBound);
+  prog->ExecutionModes.Reserve(idBound);
+  prog->ExtensionImports.Reserve(idBound);
+  prog->DefinedTypes.Reserve(idBound);
+  prog->Constants.Reserve(idBound);
+  prog->Variables.Reserve(idBound);
+  prog->FunctionDeclarations.Reserve(idBound);
+  prog->FunctionDefinitions.Reserve(idBound);
+}
+
 static void addVariable(ParseProgram* prog, SVariable var) {
   if (prog->InFunction) {
     prog->CurrentFunction->Variables.insert({var.ResultId, var });
@@ -163,11 +197,13 @@ static void endFunction(ParseProgram* prog) {
   prog->CurrentFunction->BlockStack.pop();
   assert(prog->CurrentFunction->BlockStack.size() == 0);
 
-  if (prog->CurrentFunction->Blocks.size() == 1) {
-    prog->FunctionDeclarations.insert({prog->CurrentFunction->Info.ResultId, (Function)*prog->CurrentFunction});
-  } else {
-    prog->FunctionDefinitions.insert({prog->CurrentFunction->Info.ResultId, (Function)*prog->CurrentFunction});
+  auto& functions = prog->CurrentFunction->Blocks.size() == 1 ? prog->FunctionDeclarations : prog->FunctionDefinitions;
+  auto inserted = functions.insert({prog->CurrentFunction->Info.ResultId, Function()});
+  if (inserted.second) {
+    inserted.first->second = std::move((Function&)*prog->CurrentFunction);
   }
+  delete prog->CurrentFunction;
+  prog->CurrentFunction = nullptr;
   prog->InFunction = false;
 }
 
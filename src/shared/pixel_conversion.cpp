@@ -0,0 +1,230 @@
+#include "pixel_conversion.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "thread_pool.h"
+#include "simd.h"
+
+// Rows per task, small images are converted by the calling thread.
+static const uint32 ROWS_PER_TASK = 16;
+
+SrgbTables::SrgbTables() {
+  for (int i = 0; i < 256; i++) {
+    float c = i / 255.0f;
+    ToLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+  }
+  for (uint32 i = 0; i <= SRGB_ENCODE_STEPS; i++) {
+    float c = (float)i / SRGB_ENCODE_STEPS;
+    c = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1 / 2.4f) - 0.055f;
+    FromLinear[i] = (byte)(c * 255 + 0.5f);
+  }
+}
+
+const SrgbTables SRGB_TABLES;
+
+float halfToFloat(uint16 h) {
+  uint32 sign = (uint32)(h & 0x8000) << 16;
+  uint32 exponent = (h >> 10) & 0x1F;
+  uint32 mantissa = h & 0x3FF;
+  uint32 bits;
+  if (exponent == 0x1F) {
+    bits = sign | 0x7F800000 | (mantissa << 13);
+  } else if (exponent != 0) {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  } else if (mantissa == 0) {
+    bits = sign;
+  } else {
+    // Subnormal, normalized by shifting the mantissa up to the implicit bit.
+    exponent = 113;
+    while (!(mantissa & 0x400)) {
+      mantissa <<= 1;
+      exponent--;
+    }
+    bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+  }
+
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+uint16 floatToHalf(float f) {
+  uint32 bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+  uint32 sign = (bits >> 16) & 0x8000;
+  int32 exponent = (int32)((bits >> 23) & 0xFF) - 127 + 15;
+  uint32 mantissa = bits & 0x7FFFFF;
+
+  if (((bits >> 23) & 0xFF) == 0xFF) {
+    return (uint16)(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+  }
+  if (exponent >= 0x1F) {
+    return (uint16)(sign | 0x7C00);
+  }
+
+  uint32 half;
+  uint32 shift;
+  if (exponent <= 0) {
+    if (exponent < -10) {
+      return (uint16)sign;
+    }
+    mantissa |= 0x800000;
+    shift = 14 - exponent;
+    half = mantissa >> shift;
+  } else {
+    shift = 13;
+    half = ((uint32)exponent << 10) | (mantissa >> shift);
+  }
+
+  // A carry out of the mantissa correctly moves on to the next exponent.
+  uint32 rest = mantissa & ((1u << shift) - 1);
+  uint32 halfway = 1u << (shift - 1);
+  if (rest > halfway || (rest == halfway && (half & 1))) {
+    half++;
+  }
+  return (uint16)(sign | half);
+}
+
+template<typename Func>
+static void forEachRow(uint32 height, ThreadPool* pool, Func func) {
+  if (!pool || pool->ThreadCount() == 1 || height <= ROWS_PER_TASK) {
+    for (uint32 y = 0; y < height; y++) {
+      func(y);
+    }
+    return;
+  }
+
+  uint32 tasks = (height + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+  pool->ParallelFor(tasks, [&](uint32 task, uint32 worker) {
+    uint32 end = std::min((task + 1) * ROWS_PER_TASK, height);
+    for (uint32 y = task * ROWS_PER_TASK; y < end; y++) {
+      func(y);
+    }
+  });
+}
+
+static inline byte unormToByte(float c) {
+  return (byte)(int32)(c * 255);
+}
+
+static void unormToFloatRow(const BColor* src, Color* dst, uint32 count) {
+  uint32 x = 0;
+#if OTHERSIDE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128 scale = _mm_set1_ps(255.0f);
+  for (; x + 4 <= count; x += 4) {
+    __m128i bytes = _mm_loadu_si128((const __m128i*)(src + x));
+    __m128i low = _mm_unpacklo_epi8(bytes, zero);
+    __m128i high = _mm_unpackhi_epi8(bytes, zero);
+    // Divided like the scalar conversion, multiplying by 1 / 255 would round
+    // differently.
+    _mm_storeu_ps((float*)(dst + x), _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)), scale));
+    _mm_storeu_ps((float*)(dst + x + 1), _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)), scale));
+    _mm_storeu_ps((float*)(dst + x + 2), _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)), scale));
+    _mm_storeu_ps((float*)(dst + x + 3), _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)), scale));
+  }
+#endif
+  for (; x < count; x++) {
+    BColor p = src[x];
+    dst[x] = Color{ float(p.r) / 255, float(p.g) / 255, float(p.b) / 255, float(p.a) / 255 };
+  }
+}
+
+static void floatToUnormRow(const Color* src, BColor* dst, uint32 count) {
+  uint32 x = 0;
+#if OTHERSIDE_SSE2
+  const __m128 scale = _mm_set1_ps(255.0f);
+  const __m128i lowByte = _mm_set1_epi32(0xFF);
+  for (; x + 4 <= count; x += 4) {
+    __m128i p0 = _mm_and_si128(_mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps((const float*)(src + x)), scale)), lowByte);
+    __m128i p1 = _mm_and_si128(_mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps((const float*)(src + x + 1)), scale)), lowByte);
+    __m128i p2 = _mm_and_si128(_mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps((const float*)(src + x + 2)), scale)), lowByte);
+    __m128i p3 = _mm_and_si128(_mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps((const float*)(src + x + 3)), scale)), lowByte);
+    __m128i packed = _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+    _mm_storeu_si128((__m128i*)(dst + x), packed);
+  }
+#endif
+  for (; x < count; x++) {
+    Color p = src[x];
+    dst[x] = BColor{ unormToByte(p.r), unormToByte(p.g), unormToByte(p.b), unormToByte(p.a) };
+  }
+}
+
+static void srgbToLinearRow(const BColor* src, Color* dst, uint32 count) {
+  for (uint32 x = 0; x < count; x++) {
+    BColor p = src[x];
+    dst[x] = Color{ srgbToLinear(p.r), srgbToLinear(p.g), srgbToLinear(p.b), float(p.a) / 255 };
+  }
+}
+
+static void linearToSrgbRow(const Color* src, BColor* dst, uint32 count) {
+#if OTHERSIDE_SSE2
+  // Table indices of the color channels, alpha is rounded to a byte.
+  const __m128 scale = _mm_setr_ps((float)SRGB_ENCODE_STEPS, (float)SRGB_ENCODE_STEPS, (float)SRGB_ENCODE_STEPS, 255.0f);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 one = _mm_set1_ps(1.0f);
+  for (uint32 x = 0; x < count; x++) {
+    __m128 c = _mm_min_ps(_mm_max_ps(_mm_loadu_ps((const float*)(src + x)), _mm_setzero_ps()), one);
+    int32 indices[4];
+    _mm_storeu_si128((__m128i*)indices, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, scale), half)));
+    dst[x] = BColor{ SRGB_TABLES.FromLinear[indices[0]], SRGB_TABLES.FromLinear[indices[1]], SRGB_TABLES.FromLinear[indices[2]], (byte)indices[3] };
+  }
+#else
+  for (uint32 x = 0; x < count; x++) {
+    Color p = src[x];
+    float a = p.a > 0 ? std::min(p.a, 1.0f) : 0;
+    dst[x] = BColor{ linearToSrgb(p.r), linearToSrgb(p.g), linearToSrgb(p.b), (byte)(a * 255 + 0.5f) };
+  }
+#endif
+}
+
+void convertUnormToFloat(const BColor* src, Color* dst, uint32 width, uint32 height, ThreadPool* pool) {
+  forEachRow(height, pool, [&](uint32 y) { unormToFloatRow(src + y * width, dst + y * width, width); });
+}
+
+void convertFloatToUnorm(const Color* src, BColor* dst, uint32 width, uint32 height, ThreadPool* pool) {
+  forEachRow(height, pool, [&](uint32 y) { floatToUnormRow(src + y * width, dst + y * width, width); });
+}
+
+void convertSrgbToLinear(const BColor* src, Color* dst, uint32 width, uint32 height, ThreadPool* pool) {
+  forEachRow(height, pool, [&](uint32 y) { srgbToLinearRow(src + y * width, dst + y * width, width); });
+}
+
+void convertLinearToSrgb(const Color* src, BColor* dst, uint32 width, uint32 height, ThreadPool* pool) {
+  forEachRow(height, pool, [&](uint32 y) { linearToSrgbRow(src + y * width, dst + y * width, width); });
+}
+
+void fillPixels(Color* dst, Color value, uint32 width, uint32 height, ThreadPool* pool) {
+  forEachRow(height, pool, [&](uint32 y) { std::fill(dst + y * width, dst + (y + 1) * width, value); });
+}
+
+void fillGradient(Color* dst, uint32 width, uint32 height, ThreadPool* pool) {
+  forEachRow(height, pool, [&](uint32 y) {
+    float g = float(y) / (height - 1);
+    Color* row = dst + y * width;
+    uint32 x = 0;
+#if OTHERSIDE_SSE2
+    // Four pixels per iteration, transposed from channel vectors.
+    __m128 gs = _mm_set1_ps(g);
+    __m128 as = _mm_set1_ps(1.0f);
+    __m128 divisor = _mm_set1_ps(float(width - 1));
+    for (; x + 4 <= width; x += 4) {
+      __m128 rs = _mm_div_ps(_mm_setr_ps(float(x), float(x + 1), float(x + 2), float(x + 3)), divisor);
+      __m128 bs = _mm_mul_ps(rs, gs);
+      __m128 p0 = rs;
+      __m128 p1 = gs;
+      __m128 p2 = bs;
+      __m128 p3 = as;
+      _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+      _mm_storeu_ps((float*)(row + x), p0);
+      _mm_storeu_ps((float*)(row + x + 1), p1);
+      _mm_storeu_ps((float*)(row + x + 2), p2);
+      _mm_storeu_ps((float*)(row + x + 3), p3);
+    }
+#endif
+    for (; x < width; x++) {
+      float r = float(x) / (width - 1);
+      row[x] = Color{ r, g, r * g, 1 };
+    }
+  });
+}
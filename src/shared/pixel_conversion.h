@@ -0,0 +1,49 @@
+#pragma once
+#include "types.h"
+#include "utils.h"
+
+class ThreadPool;
+
+// Steps of the linear to sRGB table, enough for the encoded values to be
+// within one of the exactly rounded ones.
+const uint32 SRGB_ENCODE_STEPS = 1 << 14;
+
+struct SrgbTables {
+  float ToLinear[256];
+  byte FromLinear[SRGB_ENCODE_STEPS + 1];
+
+  SrgbTables();
+};
+
+extern const SrgbTables SRGB_TABLES;
+
+inline float srgbToLinear(byte c) {
+  return SRGB_TABLES.ToLinear[c];
+}
+
+// Clamps c to [0, 1], NaN encodes to 0.
+inline byte linearToSrgb(float c) {
+  c = c > 0 ? (c < 1 ? c : 1) : 0;
+  return SRGB_TABLES.FromLinear[(uint32)(c * SRGB_ENCODE_STEPS + 0.5f)];
+}
+
+// IEEE half floats, the float is rounded to the nearest half, ties to even.
+float halfToFloat(uint16 h);
+uint16 floatToHalf(float f);
+
+// Conversions of row-major width x height images. Each row is converted with
+// vectorized kernels, the rows are split over the threads of pool if one is
+// given.
+//
+// Unorm bytes convert to float as byte / 255. Float converts back to bytes
+// truncated, without clamping, which is what save_bmp() has always written.
+void convertUnormToFloat(const BColor* src, Color* dst, uint32 width, uint32 height, ThreadPool* pool = nullptr);
+void convertFloatToUnorm(const Color* src, BColor* dst, uint32 width, uint32 height, ThreadPool* pool = nullptr);
+// sRGB encoded color, alpha is stored linearly as in the unorm conversions
+// but rounded and clamped when encoding.
+void convertSrgbToLinear(const BColor* src, Color* dst, uint32 width, uint32 height, ThreadPool* pool = nullptr);
+void convertLinearToSrgb(const Color* src, BColor* dst, uint32 width, uint32 height, ThreadPool* pool = nullptr);
+
+void fillPixels(Color* dst, Color value, uint32 width, uint32 height, ThreadPool* pool = nullptr);
+// Red increases from 0 to 1 along x, green along y and blue is their product.
+void fillGradient(Color* dst, uint32 width, uint32 height, ThreadPool* pool = nullptr);
@@ -0,0 +1,440 @@
+#include "sampling.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "pixel_conversion.h"
+#include "simd.h"
+
+// Edge length of the TLTiled tiles.
+static const int32 TILE_SIZE = 4;
+
+static int32 roundUpToPowerOfTwo(int32 v) {
+  int32 result = 1;
+  while (result < v) {
+    result *= 2;
+  }
+  return result;
+}
+
+// Moves bit n of the lower 16 bits of v to bit 2n.
+static inline uint32 spreadBits(uint32 v) {
+  v = (v | (v << 8)) & 0x00FF00FF;
+  v = (v | (v << 4)) & 0x0F0F0F0F;
+  v = (v | (v << 2)) & 0x33333333;
+  v = (v | (v << 1)) & 0x55555555;
+  return v;
+}
+
+static constexpr uint32 texelSize(TextureFormat format) {
+  return format == TFRGBA32F ? 16 : format == TFRGBA16F ? 8 : 4;
+}
+
+uint32 getTexelSize(TextureFormat format) {
+  return texelSize(format);
+}
+
+static byte floatToUnorm(float c) {
+  c = c > 0 ? std::min(c, 1.0f) : 0;
+  return (byte)(c * 255 + 0.5f);
+}
+
+template<TextureFormat Format>
+static inline void loadTexel(const byte* texel, Color* result) {
+  switch (Format) {
+  case TFRGBA8: {
+#if OTHERSIDE_SSE2
+    int32 packed;
+    std::memcpy(&packed, texel, sizeof(packed));
+    __m128i zero = _mm_setzero_si128();
+    __m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+    // Divided rather than multiplied by the reciprocal, so that bytes
+    // converted by ConvertToFloat() sample to the same floats.
+    _mm_storeu_ps((float*)result, _mm_div_ps(_mm_cvtepi32_ps(wide), _mm_set1_ps(255.0f)));
+#else
+    *result = Color{ texel[0] / 255.0f, texel[1] / 255.0f, texel[2] / 255.0f, texel[3] / 255.0f };
+#endif
+    break;
+  }
+  case TFRGBA8SRGB:
+    *result = Color{ srgbToLinear(texel[0]), srgbToLinear(texel[1]), srgbToLinear(texel[2]), texel[3] / 255.0f };
+    break;
+  case TFRGBA16F: {
+#if OTHERSIDE_F16C
+    _mm_storeu_ps((float*)result, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)texel)));
+#else
+    uint16 halfs[4];
+    std::memcpy(halfs, texel, sizeof(halfs));
+    *result = Color{ halfToFloat(halfs[0]), halfToFloat(halfs[1]), halfToFloat(halfs[2]), halfToFloat(halfs[3]) };
+#endif
+    break;
+  }
+  default:
+#if OTHERSIDE_SSE2
+    _mm_storeu_ps((float*)result, _mm_loadu_ps((const float*)texel));
+#else
+    std::memcpy(result, texel, sizeof(Color));
+#endif
+    break;
+  }
+}
+
+static void storeTexel(TextureFormat format, const Color& color, byte* texel) {
+  switch (format) {
+  case TFRGBA8:
+    texel[0] = floatToUnorm(color.r);
+    texel[1] = floatToUnorm(color.g);
+    texel[2] = floatToUnorm(color.b);
+    texel[3] = floatToUnorm(color.a);
+    break;
+  case TFRGBA8SRGB:
+    texel[0] = linearToSrgb(color.r);
+    texel[1] = linearToSrgb(color.g);
+    texel[2] = linearToSrgb(color.b);
+    texel[3] = floatToUnorm(color.a);
+    break;
+  case TFRGBA16F: {
+    uint16 halfs[4] = { floatToHalf(color.r), floatToHalf(color.g), floatToHalf(color.b), floatToHalf(color.a) };
+    std::memcpy(texel, halfs, sizeof(halfs));
+    break;
+  }
+  default:
+    std::memcpy(texel, &color, sizeof(Color));
+    break;
+  }
+}
+
+// Texels are stored in blocks of BlockMasks + 1 texels along each dimension,
+// which are laid out in row-major order. Within a block they are row-major
+// for TLTiled and in Z-order for TLMorton, row-major textures have blocks of a
+// single texel. Only the first two dimensions are split into blocks.
+template<TextureLayout Layout>
+static inline int32 texelOffset(const SamplerLevel& level, uint32 d, int32 i) {
+  int32 block = (i >> level.BlockShifts[d]) * level.BlockStrides[d];
+  switch (Layout) {
+  case TLTiled:
+    return block + (i & level.BlockMasks[d]) * level.Strides[d];
+  case TLMorton:
+    return block + (int32)(spreadBits(i & level.BlockMasks[d]) << d);
+  default:
+    return block;
+  }
+}
+
+static int32 texelOffset(const SamplerLevel& level, TextureLayout layout, uint32 d, int32 i) {
+  switch (layout) {
+  case TLTiled:
+    return texelOffset<TLTiled>(level, d, i);
+  case TLMorton:
+    return texelOffset<TLMorton>(level, d, i);
+  default:
+    return texelOffset<TLRowMajor>(level, d, i);
+  }
+}
+
+static bool prepareLevel(TextureLayout layout, uint32 dimCount, const uint32* dims, const void* data, SamplerLevel* outLevel) {
+  if (!dims || dimCount == 0 || dimCount > SAMPLER_MAX_DIMS) {
+    return false;
+  }
+
+  outLevel->Texels = (const byte*)data;
+  outLevel->PowerOfTwo = true;
+
+  int32 blockSize = 1;
+  if (dimCount >= 2 && layout == TLTiled) {
+    blockSize = TILE_SIZE;
+  } else if (dimCount >= 2 && layout == TLMorton) {
+    // The largest square that fits into the texture once it is padded to
+    // powers of two, so non-square textures are a row of squares.
+    blockSize = std::min(roundUpToPowerOfTwo((int32)dims[0]), roundUpToPowerOfTwo((int32)dims[1]));
+    blockSize = std::min(blockSize, 1 << 16);
+  }
+
+  // Unused dimensions have a single texel, so they always address index 0.
+  int32 stride = blockSize * blockSize;
+  for (uint32 d = 0; d < 4; d++) {
+    int32 size = d < dimCount ? (int32)dims[d] : 1;
+    if (size <= 0) {
+      return false;
+    }
+    int32 block = d < 2 ? blockSize : 1;
+    int32 shift = 0;
+    while ((1 << shift) < block) {
+      shift++;
+    }
+
+    outLevel->Dims[d] = size;
+    outLevel->Masks[d] = size - 1;
+    outLevel->Scales[d] = (float)(size - 1);
+    outLevel->InvDims[d] = 1.0f / size;
+    outLevel->PowerOfTwo &= (size & (size - 1)) == 0;
+    outLevel->BlockShifts[d] = shift;
+    outLevel->BlockMasks[d] = block - 1;
+    outLevel->Strides[d] = d == 0 ? 1 : d == 1 ? blockSize : 0;
+    outLevel->BlockStrides[d] = stride;
+    stride *= (size + block - 1) / block;
+  }
+  outLevel->TexelCount = (uint32)stride;
+  return true;
+}
+
+bool prepareSampler(const Sampler& sampler, SamplerState* outState) {
+  if (!sampler.Data || (uint32)sampler.Layout > TLMorton || (uint32)sampler.Format > TFRGBA16F) {
+    return false;
+  }
+
+  outState->DimCount = sampler.DimCount;
+  outState->Filter = sampler.Filter;
+  outState->Wrap = sampler.Wrap;
+  outState->Layout = sampler.Layout;
+  outState->Format = sampler.Format;
+  outState->LevelCount = 1;
+  if (!prepareLevel(sampler.Layout, sampler.DimCount, sampler.Dims, sampler.Data, &outState->Levels[0])) {
+    return false;
+  }
+
+  // Levels past SAMPLER_MAX_LEVELS would be smaller than a texel.
+  for (uint32 i = 0; sampler.Mips && i < sampler.MipCount && outState->LevelCount < SAMPLER_MAX_LEVELS; i++) {
+    const MipLevel& mip = sampler.Mips[i];
+    if (!mip.Data || !prepareLevel(sampler.Layout, sampler.DimCount, mip.Dims, mip.Data, &outState->Levels[outState->LevelCount++])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint32 getLayoutTexelCount(TextureLayout layout, uint32 dimCount, const uint32* dims) {
+  SamplerLevel level;
+  return prepareLevel(layout, dimCount, dims, nullptr, &level) ? level.TexelCount : 0;
+}
+
+void convertToLayout(TextureLayout layout, TextureFormat format, uint32 dimCount, const uint32* dims, const Color* src, void* dst) {
+  SamplerLevel level;
+  if (!src || !prepareLevel(layout, dimCount, dims, dst, &level)) {
+    return;
+  }
+
+  for (int32 z = 0; z < level.Dims[2]; z++) {
+    int32 slice = texelOffset(level, layout, 2, z);
+    for (int32 y = 0; y < level.Dims[1]; y++) {
+      int32 row = slice + texelOffset(level, layout, 1, y);
+      for (int32 x = 0; x < level.Dims[0]; x++) {
+        storeTexel(format, *src++, (byte*)dst + (row + texelOffset(level, layout, 0, x)) * texelSize(format));
+      }
+    }
+  }
+}
+
+float computeLod(const SamplerState& state, const float* footprint) {
+  float texels = 0;
+  for (uint32 d = 0; d < state.DimCount; d++) {
+    texels = std::max(texels, std::abs(footprint[d]) * state.Levels[0].Scales[d]);
+  }
+  return std::log2(texels);
+}
+
+#if OTHERSIDE_SSE2
+static inline __m128 floor4(__m128 x) {
+#if OTHERSIDE_SSE41
+  return _mm_floor_ps(x);
+#else
+  __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+  return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.0f)));
+#endif
+}
+
+// Wraps integral texel coordinates into the texture and converts them to the
+// offsets of the texels along each dimension.
+template<TextureLayout Layout>
+static inline void wrapOffsets(const SamplerState& state, const SamplerLevel& level, __m128 i, int32* offsets) {
+  __m128 dims = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)level.Dims));
+  __m128i wrapped;
+
+  if (state.Wrap == WrapMode::WMClamp) {
+    __m128 last = _mm_sub_ps(dims, _mm_set1_ps(1.0f));
+    wrapped = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(i, _mm_setzero_ps()), last));
+  } else if (level.PowerOfTwo) {
+    wrapped = _mm_and_si128(_mm_cvttps_epi32(i), _mm_loadu_si128((const __m128i*)level.Masks));
+  } else {
+    __m128 q = floor4(_mm_mul_ps(i, _mm_loadu_ps(level.InvDims)));
+    __m128 r = _mm_sub_ps(i, _mm_mul_ps(q, dims));
+    // The reciprocal is inexact, correct results that are off by one period.
+    r = _mm_add_ps(r, _mm_and_ps(_mm_cmplt_ps(r, _mm_setzero_ps()), dims));
+    r = _mm_sub_ps(r, _mm_and_ps(_mm_cmpge_ps(r, dims), dims));
+    // max() returns its second operand for NaN coordinates.
+    wrapped = _mm_cvttps_epi32(_mm_max_ps(r, _mm_setzero_ps()));
+  }
+
+  int32 w[4];
+  _mm_storeu_si128((__m128i*)w, wrapped);
+  for (uint32 d = 0; d < 4; d++) {
+    offsets[d] = texelOffset<Layout>(level, d, w[d]);
+  }
+}
+#else
+template<TextureLayout Layout>
+static inline void wrapOffsets(const SamplerState& state, const SamplerLevel& level, const float* i, int32* offsets) {
+  for (uint32 d = 0; d < 4; d++) {
+    int32 size = level.Dims[d];
+    float v = i[d] == i[d] ? i[d] : 0;
+    int32 w;
+    if (state.Wrap == WrapMode::WMClamp) {
+      w = v < 0 ? 0 : v > size - 1 ? size - 1 : (int32)v;
+    } else if (level.PowerOfTwo) {
+      w = (int32)v & level.Masks[d];
+    } else {
+      w = (int32)(v - std::floor(v * level.InvDims[d]) * size);
+      w += w < 0 ? size : 0;
+      w -= w >= size ? size : 0;
+    }
+    offsets[d] = texelOffset<Layout>(level, d, w);
+  }
+}
+#endif
+
+template<TextureLayout Layout, TextureFormat Format>
+static void samplePoint(const SamplerState& state, const SamplerLevel& level, const float* coord, Color* result) {
+  int32 offsets[4];
+#if OTHERSIDE_SSE2
+  __m128 x = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(coord), _mm_loadu_ps(level.Scales)), _mm_set1_ps(0.5f));
+  wrapOffsets<Layout>(state, level, floor4(x), offsets);
+#else
+  float i[4];
+  for (uint32 d = 0; d < 4; d++) {
+    i[d] = std::floor(coord[d] * level.Scales[d] + 0.5f);
+  }
+  wrapOffsets<Layout>(state, level, i, offsets);
+#endif
+
+  loadTexel<Format>(level.Texels + (offsets[0] + offsets[1] + offsets[2] + offsets[3]) * texelSize(Format), result);
+}
+
+// Blends the 2^DimCount texels around the coordinate, weighting each corner
+// with the product of its distances to the opposite texels.
+template<TextureLayout Layout, TextureFormat Format>
+static void sampleLinear(const SamplerState& state, const SamplerLevel& level, const float* coord, Color* result) {
+  int32 low[4];
+  int32 high[4];
+  float fraction[4];
+#if OTHERSIDE_SSE2
+  __m128 x = _mm_mul_ps(_mm_loadu_ps(coord), _mm_loadu_ps(level.Scales));
+  __m128 i = floor4(x);
+  _mm_storeu_ps(fraction, _mm_sub_ps(x, i));
+  wrapOffsets<Layout>(state, level, i, low);
+  wrapOffsets<Layout>(state, level, _mm_add_ps(i, _mm_set1_ps(1.0f)), high);
+#else
+  float i[4];
+  float next[4];
+  for (uint32 d = 0; d < 4; d++) {
+    float x = coord[d] * level.Scales[d];
+    i[d] = std::floor(x);
+    next[d] = i[d] + 1.0f;
+    fraction[d] = x - i[d];
+  }
+  wrapOffsets<Layout>(state, level, i, low);
+  wrapOffsets<Layout>(state, level, next, high);
+#endif
+
+  uint32 corners = 1u << state.DimCount;
+  float weights[1 << SAMPLER_MAX_DIMS];
+  const float* texels[1 << SAMPLER_MAX_DIMS];
+  Color converted[1 << SAMPLER_MAX_DIMS];
+  for (uint32 c = 0; c < corners; c++) {
+    float weight = 1.0f;
+    int32 offset = 0;
+    for (uint32 d = 0; d < state.DimCount; d++) {
+      bool upper = (c >> d) & 1;
+      weight *= upper ? fraction[d] : 1.0f - fraction[d];
+      offset += upper ? high[d] : low[d];
+    }
+    weights[c] = weight;
+    // Float texels are read in place, the others converted first.
+    const byte* texel = level.Texels + offset * texelSize(Format);
+    if (Format == TFRGBA32F) {
+      texels[c] = (const float*)texel;
+    } else {
+      loadTexel<Format>(texel, &converted[c]);
+      texels[c] = (const float*)&converted[c];
+    }
+  }
+
+#if OTHERSIDE_AVX
+  // Two corners per iteration, the halves are added up at the end.
+  __m256 acc = _mm256_setzero_ps();
+  for (uint32 c = 0; c < corners; c += 2) {
+    __m256 pair = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(texels[c])), _mm_loadu_ps(texels[c + 1]), 1);
+    __m256 w = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(weights[c])), _mm_set1_ps(weights[c + 1]), 1);
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(pair, w));
+  }
+  _mm_storeu_ps((float*)result, _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1)));
+#elif OTHERSIDE_SSE2
+  __m128 acc = _mm_setzero_ps();
+  for (uint32 c = 0; c < corners; c++) {
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(texels[c]), _mm_set1_ps(weights[c])));
+  }
+  _mm_storeu_ps((float*)result, acc);
+#else
+  Color acc = { 0, 0, 0, 0 };
+  for (uint32 c = 0; c < corners; c++) {
+    acc.r += texels[c][0] * weights[c];
+    acc.g += texels[c][1] * weights[c];
+    acc.b += texels[c][2] * weights[c];
+    acc.a += texels[c][3] * weights[c];
+  }
+  *result = acc;
+#endif
+}
+
+template<TextureLayout Layout, TextureFormat Format>
+static void sampleLevels(const SamplerState& state, const float* coord, float lod, Color* result) {
+  // Also maps NaN to the first level.
+  float maxLod = (float)(state.LevelCount - 1);
+  lod = lod > 0 ? std::min(lod, maxLod) : 0;
+
+  if (state.Filter == FMBilinear) {
+    uint32 base = (uint32)lod;
+    float blend = lod - base;
+    sampleLinear<Layout, Format>(state, state.Levels[base], coord, result);
+    if (blend > 0) {
+      Color next;
+      sampleLinear<Layout, Format>(state, state.Levels[base + 1], coord, &next);
+      result->r += (next.r - result->r) * blend;
+      result->g += (next.g - result->g) * blend;
+      result->b += (next.b - result->b) * blend;
+      result->a += (next.a - result->a) * blend;
+    }
+  } else {
+    samplePoint<Layout, Format>(state, state.Levels[(uint32)(lod + 0.5f)], coord, result);
+  }
+}
+
+template<TextureLayout Layout>
+static void sampleLayout(const SamplerState& state, const float* coord, float lod, Color* result) {
+  switch (state.Format) {
+  case TFRGBA8:
+    sampleLevels<Layout, TFRGBA8>(state, coord, lod, result);
+    break;
+  case TFRGBA8SRGB:
+    sampleLevels<Layout, TFRGBA8SRGB>(state, coord, lod, result);
+    break;
+  case TFRGBA16F:
+    sampleLevels<Layout, TFRGBA16F>(state, coord, lod, result);
+    break;
+  default:
+    sampleLevels<Layout, TFRGBA32F>(state, coord, lod, result);
+    break;
+  }
+}
+
+void sampleTexture(const SamplerState& state, const float* coord, float lod, Color* result) {
+  switch (state.Layout) {
+  case TLTiled:
+    sampleLayout<TLTiled>(state, coord, lod, result);
+    break;
+  case TLMorton:
+    sampleLayout<TLMorton>(state, coord, lod, result);
+    break;
+  default:
+    sampleLayout<TLRowMajor>(state, coord, lod, result);
+    break;
+  }
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "types.h"
+#include "vm.h"
+#include "utils.h"
+
+const uint32 SAMPLER_MAX_DIMS = 3;
+// Enough for a 32768 texel wide texture.
+const uint32 SAMPLER_MAX_LEVELS = 16;
+
+// Addressing of one mip level. Arrays have an entry per dimension, padded to
+// four for the vectorized kernels.
+//
+// A normalized coordinate u maps to texel space as u * (size - 1), so 0 and 1
+// hit the centers of the first and last texel.
+struct SamplerLevel {
+  const byte* Texels;
+  uint32 TexelCount;
+  // Repeat wrapping masks with Dims - 1 if every size is a power of two and
+  // falls back to the reciprocals otherwise.
+  bool PowerOfTwo;
+  int32 Dims[4];
+  int32 Masks[4];
+  float Scales[4];
+  float InvDims[4];
+  // Addressing of the texture layout, see texelOffset() in sampling.cpp.
+  int32 BlockShifts[4];
+  int32 BlockMasks[4];
+  int32 BlockStrides[4];
+  int32 Strides[4];
+};
+
+// Addressing of a sampler that only depends on its textures, computed once by
+// prepareSampler() and used for every sample taken from it.
+struct SamplerState {
+  uint32 DimCount;
+  FilterMode Filter;
+  WrapMode Wrap;
+  TextureLayout Layout;
+  TextureFormat Format;
+  uint32 LevelCount;
+  SamplerLevel Levels[SAMPLER_MAX_LEVELS];
+};
+
+bool prepareSampler(const Sampler& sampler, SamplerState* outState);
+
+// Number of texels a level with the given dimensions takes up in layout,
+// including the padding of the tiled layouts. 0 if the dimensions are invalid.
+uint32 getLayoutTexelCount(TextureLayout layout, uint32 dimCount, const uint32* dims);
+
+uint32 getTexelSize(TextureFormat format);
+
+// Stores the row-major texels of src into dst in layout and format, dst has
+// to hold getLayoutTexelCount() * getTexelSize() bytes. Padding texels are
+// left untouched.
+void convertToLayout(TextureLayout layout, TextureFormat format, uint32 dimCount, const uint32* dims, const Color* src, void* dst);
+
+// Level of detail for a pixel that covers footprint (DimCount normalized
+// coordinate extents) of the texture, before it is biased and clamped.
+float computeLod(const SamplerState& state, const float* footprint);
+
+// Samples at coord, which holds DimCount normalized coordinates followed by
+// zeros up to four floats. FMPoint reads the level nearest to lod, FMBilinear
+// blends the two levels around it.
+void sampleTexture(const SamplerState& state, const float* coord, float lod, Color* result);
@@ -0,0 +1,32 @@
+#pragma once
+
+// Instruction set selection for the vectorized kernels. SSE2 is part of every
+// x86-64 target, AVX and SSE4.1 are only used when the compiler targets them
+// (see the OTHERSIDE_NATIVE_ARCH build option). Every kernel keeps a scalar
+// path so other architectures still build.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define OTHERSIDE_SSE2 1
+  #include <emmintrin.h>
+#endif
+
+#if defined(__SSE4_1__) || defined(__AVX__)
+  #define OTHERSIDE_SSE41 1
+  #include <smmintrin.h>
+#endif
+
+#if defined(__AVX__)
+  #define OTHERSIDE_AVX 1
+  #include <immintrin.h>
+#endif
+
+#if defined(__AVX2__)
+  #define OTHERSIDE_AVX2 1
+#endif
+
+#if defined(__F16C__)
+  #define OTHERSIDE_F16C 1
+  #include <immintrin.h>
+#endif
+
+#define SIMD_ALIGNMENT 32
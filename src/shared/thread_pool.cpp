@@ -0,0 +1,126 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(uint32 threadCount) : currentTask(nullptr), jobGeneration(0), busyWorkers(0), remaining(0), stopping(false) {
+  if (threadCount == 0) {
+    threadCount = std::thread::hardware_concurrency();
+  }
+  if (threadCount == 0) {
+    threadCount = 1;
+  }
+
+  for (uint32 i = 0; i < threadCount; i++) {
+    queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+  }
+
+  for (uint32 i = 1; i < threadCount; i++) {
+    threads.push_back(std::thread(&ThreadPool::WorkerMain, this, i));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(jobLock);
+    stopping = true;
+  }
+  jobStarted.notify_all();
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+bool ThreadPool::Pop(uint32 worker, uint32* index) {
+  {
+    WorkQueue& own = *queues[worker];
+    std::lock_guard<std::mutex> lock(own.Lock);
+    if (!own.Indices.empty()) {
+      *index = own.Indices.front();
+      own.Indices.pop_front();
+      return true;
+    }
+  }
+
+  for (uint32 i = 1; i < queues.size(); i++) {
+    WorkQueue& victim = *queues[(worker + i) % queues.size()];
+    std::lock_guard<std::mutex> lock(victim.Lock);
+    if (!victim.Indices.empty()) {
+      *index = victim.Indices.back();
+      victim.Indices.pop_back();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void ThreadPool::Work(uint32 worker, const Task* task) {
+  uint32 index;
+  while (task && Pop(worker, &index)) {
+    (*task)(index, worker);
+    remaining--;
+  }
+}
+
+void ThreadPool::WorkerMain(uint32 worker) {
+  uint64 seenGeneration = 0;
+
+  for (;;) {
+    const Task* task;
+    {
+      std::unique_lock<std::mutex> lock(jobLock);
+      jobStarted.wait(lock, [&]() { return stopping || jobGeneration != seenGeneration; });
+      if (stopping) {
+        return;
+      }
+      seenGeneration = jobGeneration;
+      task = currentTask;
+      busyWorkers++;
+    }
+
+    Work(worker, task);
+
+    {
+      std::lock_guard<std::mutex> lock(jobLock);
+      busyWorkers--;
+    }
+    jobFinished.notify_all();
+  }
+}
+
+void ThreadPool::ParallelFor(uint32 count, const Task& task) {
+  if (count == 0) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(jobLock);
+    currentTask = &task;
+    remaining = count;
+  }
+
+  // Hand out contiguous ranges so neighbouring indices stay on one worker
+  // until somebody runs dry and starts stealing.
+  uint32 workerCount = ThreadCount();
+  for (uint32 w = 0; w < workerCount; w++) {
+    uint32 begin = (uint32)((uint64)count * w / workerCount);
+    uint32 end = (uint32)((uint64)count * (w + 1) / workerCount);
+    std::lock_guard<std::mutex> lock(queues[w]->Lock);
+    for (uint32 i = begin; i < end; i++) {
+      queues[w]->Indices.push_back(i);
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(jobLock);
+    jobGeneration++;
+  }
+  jobStarted.notify_all();
+
+  Work(0, &task);
+
+  // Workers that woke up late may still be searching the queues, so wait for
+  // them as well before the task goes out of scope.
+  std::unique_lock<std::mutex> lock(jobLock);
+  jobFinished.wait(lock, [&]() { return remaining == 0 && busyWorkers == 0; });
+  currentTask = nullptr;
+}
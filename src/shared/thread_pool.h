@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include "types.h"
+
+// Fixed size pool of worker threads executing index ranges. Every worker owns
+// a queue of indices it drains from the front, idle workers steal from the back
+// of the other queues. The calling thread takes part as worker 0.
+class ThreadPool {
+public:
+  typedef std::function<void(uint32 index, uint32 worker)> Task;
+
+private:
+  struct WorkQueue {
+    std::mutex Lock;
+    std::deque<uint32> Indices;
+  };
+
+  std::vector<std::thread> threads;
+  std::vector<std::unique_ptr<WorkQueue>> queues;
+
+  std::mutex jobLock;
+  std::condition_variable jobStarted;
+  std::condition_variable jobFinished;
+  const Task* currentTask;
+  uint64 jobGeneration;
+  uint32 busyWorkers;
+  std::atomic<uint32> remaining;
+  bool stopping;
+
+  bool Pop(uint32 worker, uint32* index);
+  void Work(uint32 worker, const Task* task);
+  void WorkerMain(uint32 worker);
+
+public:
+  explicit ThreadPool(uint32 threadCount = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  uint32 ThreadCount() const { return (uint32)queues.size(); }
+
+  // Runs task for every index in [0, count) and returns once all are done.
+  void ParallelFor(uint32 count, const Task& task);
+};
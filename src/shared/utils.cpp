@@ -1,55 +1,36 @@
 #include "utils.h"
+#include "pixel_conversion.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb/stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb/stb_image_write.h"
 
-Texture MakeFlatTexture(int w, int h, Color col) {
+Texture MakeFlatTexture(int w, int h, Color col, ThreadPool* pool) {
   Color* data = new Color[w * h];
-  for (int i = 0; i < w * h; i++) {
-    data[i] = col;
-  }
+  fillPixels(data, col, w, h, pool);
   return Texture{ w, h, data };
 }
 
-Texture MakeGradientTexture(int w, int h) {
+Texture MakeGradientTexture(int w, int h, ThreadPool* pool) {
   Color* data = new Color[w * h];
-  float a = 1;
-  for (int x = 0; x < w; x++) {
-    float r = float(x) / (w - 1);
-    for (int y = 0; y < h; y++) {
-      float g = float(y) / (h - 1);
-      float b = r*g;
-      data[x + y * w] = { r, g, b, a };
-    }
-  }
+  fillGradient(data, w, h, pool);
   return Texture{ w, h, data };
 }
 
-BColor* ConvertToByte(uint32 w, uint32 h, Color* in) {
-  BColor* data = new BColor[w *h];
-  for (int x = 0; x < w; x++) {
-    for (int y = 0; y < h; y++) {
-      auto p = in[x + y * w];
-      data[x + y * w] = BColor { byte(p.r * 255), byte(p.g * 255), byte(p.b * 255), byte(p.a * 255) };
-    }
-  }
+BColor* ConvertToByte(uint32 w, uint32 h, Color* in, ThreadPool* pool) {
+  BColor* data = new BColor[w * h];
+  convertFloatToUnorm(in, data, w, h, pool);
   return data;
 }
 
-Color* ConvertToFloat(uint32 w, uint32 h, BColor* in) {
-  Color* data = new Color[w *h];
-  for (int x = 0; x < w; x++) {
-    for (int y = 0; y < h; y++) {
-      auto p = in[x + y * w];
-      data[x + y * w] = { float(p.r) / 255, float(p.g) / 255, float(p.b) / 255, float(p.a) / 255 };
-    }
-  }
+Color* ConvertToFloat(uint32 w, uint32 h, BColor* in, ThreadPool* pool) {
+  Color* data = new Color[w * h];
+  convertUnormToFloat(in, data, w, h, pool);
   return data;
 }
 
-Texture load_tex(const char* filename) {
+Texture load_tex(const char* filename, ThreadPool* pool) {
   Texture result;
   int comps;
   BColor* inputData = (BColor*)stbi_load(filename, &result.width, &result.height, &comps, 4);
@@ -60,13 +41,47 @@ Texture load_tex(const char* filename) {
     return result;
   }
 
-  result.data = ConvertToFloat(result.width, result.height, inputData);
+  result.data = ConvertToFloat(result.width, result.height, inputData, pool);
   free(inputData);
   return result;
 }
 
-void save_bmp(const char* filename, const Texture& texture) {
-  BColor* outData = ConvertToByte(texture.width, texture.height, texture.data);
+void save_bmp(const char* filename, const Texture& texture, ThreadPool* pool) {
+  BColor* outData = ConvertToByte(texture.width, texture.height, texture.data, pool);
   stbi_write_bmp(filename, texture.width, texture.height, 4, outData);
-  delete outData;
+  delete[] outData;
+}
+
+bool compare_tex(const char* filename, const Texture& texture, int tolerance, uint32* mismatches, int* maxError, ThreadPool* pool) {
+  int width, height, comps;
+  BColor* refData = (BColor*)stbi_load(filename, &width, &height, &comps, 4);
+  if (!refData) {
+    return false;
+  }
+  if (width != texture.width || height != texture.height) {
+    free(refData);
+    return false;
+  }
+
+  BColor* outData = ConvertToByte(texture.width, texture.height, texture.data, pool);
+  *mismatches = 0;
+  *maxError = 0;
+  for (int i = 0; i < width * height; i++) {
+    const byte* out = (const byte*)&outData[i];
+    const byte* ref = (const byte*)&refData[i];
+    int pixelError = 0;
+    // save_bmp drops alpha, so only the color channels are compared.
+    for (int c = 0; c < 3; c++) {
+      int error = abs((int)out[c] - (int)ref[c]);
+      pixelError = error > pixelError ? error : pixelError;
+    }
+    *maxError = pixelError > *maxError ? pixelError : *maxError;
+    if (pixelError > tolerance) {
+      (*mismatches)++;
+    }
+  }
+
+  delete[] outData;
+  free(refData);
+  return true;
 }
@@ -28,7 +28,16 @@ struct Light {
   Vec2 pos;
 };
 
-Texture MakeFlatTexture(int w, int h, Color col);
-Texture MakeGradientTexture(int w, int h);
-Texture load_tex(const char* filename);
-void save_bmp(const char* filename, const Texture& texture);
\ No newline at end of file
+class ThreadPool;
+
+// The conversions split the rows over the threads of pool if one is given.
+Texture MakeFlatTexture(int w, int h, Color col, ThreadPool* pool = nullptr);
+Texture MakeGradientTexture(int w, int h, ThreadPool* pool = nullptr);
+BColor* ConvertToByte(uint32 w, uint32 h, Color* in, ThreadPool* pool = nullptr);
+Color* ConvertToFloat(uint32 w, uint32 h, BColor* in, ThreadPool* pool = nullptr);
+Texture load_tex(const char* filename, ThreadPool* pool = nullptr);
+void save_bmp(const char* filename, const Texture& texture, ThreadPool* pool = nullptr);
+// Compares texture at 8 bits per channel with the image in filename. Fails if
+// the image can't be loaded or differs in size, otherwise counts the pixels
+// with a channel more than tolerance off the reference.
+bool compare_tex(const char* filename, const Texture& texture, int tolerance, uint32* mismatches, int* maxError, ThreadPool* pool = nullptr);
\ No newline at end of file
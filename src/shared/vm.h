@@ -1,6 +1,9 @@
 #pragma once
 #include <map>
+#include <string>
+#include <vector>
 #include "types.h"
+#include "ext_inst.h"
 #include <cstring>
 
 struct Program;
@@ -21,12 +24,49 @@ enum WrapMode {
   WMRepeat
 };
 
+// Order of the texels in Sampler::Data and the mip levels. TLTiled stores 4x4
+// tiles and TLMorton Z-order curves over the first two dimensions, both padded
+// to whole tiles (see getLayoutTexelCount() in sampling.h).
+enum TextureLayout {
+  TLRowMajor,
+  TLTiled,
+  TLMorton
+};
+
+// Storage of a texel in Sampler::Data and the mip levels, every format is
+// converted to float RGBA when sampled. TFRGBA8 stores unorm bytes,
+// TFRGBA8SRGB sRGB encoded color bytes that are converted to linear before
+// filtering (alpha stays linear) and TFRGBA16F half floats.
+enum TextureFormat {
+  TFRGBA32F,
+  TFRGBA8,
+  TFRGBA8SRGB,
+  TFRGBA16F
+};
+
+// Accuracy of the GLSL.std.450 math functions, see math_kernels.h.
+enum MathPrecision {
+  MPPrecise,
+  MPFast
+};
+
+struct MipLevel {
+  uint32* Dims;
+  void* Data;
+};
+
 struct Sampler {
   uint32 DimCount;
   uint32* Dims;
   void* Data;
   FilterMode Filter;
   WrapMode Wrap;
+  // Optional mip chain below Data, Mips[i] is level i + 1 and halves the
+  // previous level in every dimension. Samplers without one always read Data.
+  uint32 MipCount;
+  const MipLevel* Mips;
+  TextureLayout Layout;
+  TextureFormat Format;
 };
 
 
@@ -53,6 +93,7 @@ public:
   virtual SOp GetType(uint32 typeId) const abstract;
   virtual bool IsVectorType(uint32 typeId) const abstract;
   virtual uint32 ElementCount(uint32 typeId) const abstract;
+  virtual MathPrecision GetMathPrecision() const abstract;
 };
 
 #define BUILDING_DLL
@@ -81,18 +122,20 @@ public:
   #endif
 #endif
 
-#define EXT_INST_FUNC(x) Value x(VM* vm, uint32 resultTypeId, int valueCount, Value* values)
-typedef EXT_INST_FUNC(ExtInstFunc);
-typedef ExtInstFunc** GetExtTableFunc(void);
-
 #define xstr(s) str(s)
 #define str(s) #s
 #define EXT_EXPORT_TABLE_FUNC_NAME GetExtTable
 #define EXT_EXPORT_TABLE_FUNC(x) DLL_PUBLIC ExtInstFunc** EXT_EXPORT_TABLE_FUNC_NAME(void) { return x; }
+// Exported next to EXT_EXPORT_TABLE_FUNC by libraries that have a batched
+// table, indexed like the scalar one. It may be shorter than the scalar table.
+#define EXT_EXPORT_BATCH_TABLE_FUNC_NAME GetExtBatchTable
+#define EXT_EXPORT_BATCH_TABLE_FUNC(x) DLL_PUBLIC ExtBatchInstFunc** EXT_EXPORT_BATCH_TABLE_FUNC_NAME(uint32* outCount) { *outCount = sizeof(x) / sizeof(x[0]); return x; }
 
 struct Environment {
-  std::map<int, Value> Values;
+  std::vector<Value> Values;
   std::map<int, ExtInstFunc**> Extensions;
+  // Functions is nullptr for sets without a batched table.
+  std::map<int, ExtBatchTable> BatchExtensions;
 };
 
 template <typename Func, typename Arg, typename ...Args>
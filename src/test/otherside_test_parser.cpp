@@ -1,5 +1,8 @@
 #include "parser_definitions.h"
 #include "parser.h"
+#include "module_cache.h"
+#include <cstring>
+#include <string>
 
 int main(int argc, char** argv) {
     Parser parser(argv[1]);
@@ -9,5 +12,57 @@ int main(int argc, char** argv) {
         return -1;
     }
 
+    // Parsing a mapped module has to give the same program, which keeps the
+    // mapping alive after the parser is gone.
+    if (argc > 2 && strcmp(argv[2], "--map") == 0) {
+        Program mappedProg;
+        {
+            Parser mappedParser(argv[1], LMMap);
+            if(!mappedParser.Parse(&mappedProg)) {
+                return -1;
+            }
+        }
+
+        if (writeProgram(prog) != writeProgram(mappedProg)) {
+            std::cout << "Mapped module parsed differently." << std::endl;
+            return -1;
+        }
+    }
+
+    // A program read back from the module cache has to match the parsed one.
+    if (argc > 3 && strcmp(argv[2], "--cache") == 0) {
+        std::string cachePath;
+        uint64 moduleHash;
+        if (!getModuleCachePath(argv[3], argv[1], &cachePath, &moduleHash)) {
+            return -1;
+        }
+
+        PreparedModule prepared;
+        if (!prepareModule(prog, &prepared, std::cout) ||
+            !writeModuleCache(cachePath.c_str(), moduleHash, prog, prepared, std::cout)) {
+            return -1;
+        }
+
+        Program cachedProg;
+        PreparedModule cachedPrepared;
+        if (!readModuleCache(cachePath.c_str(), moduleHash, &cachedProg, &cachedPrepared, std::cout)) {
+            std::cout << "Could not read module cache." << std::endl;
+            return -1;
+        }
+
+        if (writeProgram(prog) != writeProgram(cachedProg) ||
+            prepared.Decoded->Functions.size() != cachedPrepared.Decoded->Functions.size() ||
+            prepared.Layouts->Types.size() != cachedPrepared.Layouts->Types.size()) {
+            std::cout << "Cached module differs from the parsed one." << std::endl;
+            return -1;
+        }
+
+        // Entries for other modules must be rejected.
+        if (readModuleCache(cachePath.c_str(), moduleHash + 1, &cachedProg, &cachedPrepared, std::cout)) {
+            std::cout << "Module cache accepted the wrong module." << std::endl;
+            return -1;
+        }
+    }
+
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,165 @@
+#include "sampling.h"
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+// Samples small textures in every layout and format and compares the results
+// with a straightforward filter over the row-major source texels.
+
+static const char* LAYOUT_NAMES[] = { "row", "tiled", "morton" };
+static const char* FORMAT_NAMES[] = { "rgba32f", "rgba8", "srgb8", "rgba16f" };
+static const char* FILTER_NAMES[] = { "point", "bilinear" };
+static const char* WRAP_NAMES[] = { "clamp", "repeat" };
+
+// Every channel is a multiple of 1/255, which rgba8 stores exactly.
+static Color sourceTexel(int32 x, int32 y, int32 width) {
+    return Color{ x * 30 / 255.0f, y * 60 / 255.0f, (x + y * width) * 7 / 255.0f, (255 - x * 30) / 255.0f };
+}
+
+static int32 wrap(WrapMode mode, int32 i, int32 size) {
+    if (mode == WMClamp) {
+        return i < 0 ? 0 : i >= size ? size - 1 : i;
+    }
+    return ((i % size) + size) % size;
+}
+
+static Color expectedSample(FilterMode filter, WrapMode mode, int32 width, int32 height, float u, float v) {
+    float x = u * (float)(width - 1);
+    float y = v * (float)(height - 1);
+    if (filter == FMPoint) {
+        return sourceTexel(wrap(mode, (int32)std::floor(x + 0.5f), width), wrap(mode, (int32)std::floor(y + 0.5f), height), width);
+    }
+
+    float x0 = std::floor(x);
+    float y0 = std::floor(y);
+    float fx = x - x0;
+    float fy = y - y0;
+    Color result = { 0, 0, 0, 0 };
+    for (int32 c = 0; c < 4; c++) {
+        int32 dx = c & 1;
+        int32 dy = c >> 1;
+        float weight = (dx ? fx : 1 - fx) * (dy ? fy : 1 - fy);
+        Color texel = sourceTexel(wrap(mode, (int32)x0 + dx, width), wrap(mode, (int32)y0 + dy, height), width);
+        result.r += texel.r * weight;
+        result.g += texel.g * weight;
+        result.b += texel.b * weight;
+        result.a += texel.a * weight;
+    }
+    return result;
+}
+
+static float channelError(const Color& a, const Color& b) {
+    return std::max(std::max(std::abs(a.r - b.r), std::abs(a.g - b.g)), std::max(std::abs(a.b - b.b), std::abs(a.a - b.a)));
+}
+
+// sRGB and half floats round the stored texels, the other formats are exact.
+static float formatTolerance(TextureFormat format) {
+    switch (format) {
+    case TFRGBA8SRGB:
+        return 1e-2f;
+    case TFRGBA16F:
+        return 1e-3f;
+    default:
+        return 1e-5f;
+    }
+}
+
+static bool testTexture(uint32 width, uint32 height) {
+    std::vector<Color> source;
+    for (uint32 y = 0; y < height; y++) {
+        for (uint32 x = 0; x < width; x++) {
+            source.push_back(sourceTexel(x, y, width));
+        }
+    }
+
+    // Covers texel centers, halfway blends and coordinates outside [0, 1]
+    // where the wrap modes differ.
+    const float coords[] = { -0.6f, -0.25f, 0.0f, 0.3f, 0.5f, 0.75f, 1.0f, 1.2f, 1.7f };
+    uint32 dims[2] = { width, height };
+    bool passed = true;
+
+    for (uint32 layout = TLRowMajor; layout <= TLMorton; layout++) {
+        for (uint32 format = TFRGBA32F; format <= TFRGBA16F; format++) {
+            uint32 count = getLayoutTexelCount((TextureLayout)layout, 2, dims);
+            std::vector<byte> texels(count * getTexelSize((TextureFormat)format));
+            convertToLayout((TextureLayout)layout, (TextureFormat)format, 2, dims, source.data(), texels.data());
+
+            for (uint32 filter = FMPoint; filter <= FMBilinear; filter++) {
+                for (uint32 mode = WMClamp; mode <= WMRepeat; mode++) {
+                    Sampler sampler = { 2, dims, texels.data(), (FilterMode)filter, (WrapMode)mode, 0, nullptr, (TextureLayout)layout, (TextureFormat)format };
+                    SamplerState state;
+                    if (!prepareSampler(sampler, &state)) {
+                        std::cout << "Could not prepare a " << width << "x" << height << " sampler." << std::endl;
+                        return false;
+                    }
+
+                    for (float u : coords) {
+                        for (float v : coords) {
+                            float coord[4] = { u, v, 0, 0 };
+                            Color result;
+                            sampleTexture(state, coord, 0, &result);
+                            Color expected = expectedSample((FilterMode)filter, (WrapMode)mode, width, height, u, v);
+                            if (channelError(result, expected) > formatTolerance((TextureFormat)format)) {
+                                std::cout << width << "x" << height << " " << LAYOUT_NAMES[layout] << " " << FORMAT_NAMES[format]
+                                          << " " << FILTER_NAMES[filter] << " " << WRAP_NAMES[mode] << " at (" << u << ", " << v << "): got ("
+                                          << result.r << ", " << result.g << ", " << result.b << ", " << result.a << "), expected ("
+                                          << expected.r << ", " << expected.g << ", " << expected.b << ", " << expected.a << ")" << std::endl;
+                                passed = false;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return passed;
+}
+
+// A few blends worked out by hand, in case the reference above shares a
+// mistake with the sampler.
+static bool testKnownBlends() {
+    uint32 dims[2] = { 2, 2 };
+    Color texels[4] = { { 0, 0, 0, 1 }, { 1, 0, 0, 1 }, { 0, 1, 0, 1 }, { 0, 0, 1, 1 } };
+    struct Case {
+        WrapMode Wrap;
+        float U;
+        float V;
+        Color Expected;
+    };
+    const Case cases[] = {
+        { WMClamp, 0.5f, 0.0f, { 0.5f, 0, 0, 1 } },
+        { WMClamp, 0.5f, 0.5f, { 0.25f, 0.25f, 0.25f, 1 } },
+        { WMClamp, 0.25f, 1.0f, { 0, 0.75f, 0.25f, 1 } },
+        // One texel past the edge: clamp stays on the last texel, repeat
+        // blends back towards the first.
+        { WMClamp, 1.25f, 0.0f, { 1, 0, 0, 1 } },
+        { WMRepeat, 1.25f, 0.0f, { 0.75f, 0, 0, 1 } },
+        { WMRepeat, -0.5f, 1.0f, { 0, 0.5f, 0.5f, 1 } },
+    };
+
+    bool passed = true;
+    for (const Case& test : cases) {
+        Sampler sampler = { 2, dims, texels, FMBilinear, test.Wrap, 0, nullptr, TLRowMajor, TFRGBA32F };
+        SamplerState state;
+        prepareSampler(sampler, &state);
+        float coord[4] = { test.U, test.V, 0, 0 };
+        Color result;
+        sampleTexture(state, coord, 0, &result);
+        if (channelError(result, test.Expected) > 1e-6f) {
+            std::cout << WRAP_NAMES[test.Wrap] << " blend at (" << test.U << ", " << test.V << "): got ("
+                      << result.r << ", " << result.g << ", " << result.b << ", " << result.a << ")" << std::endl;
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+int main(int argc, char** argv) {
+    bool passed = testKnownBlends();
+    // Power of two and not, within one tile and across tiles and Morton blocks.
+    passed &= testTexture(2, 2);
+    passed &= testTexture(3, 3);
+    passed &= testTexture(5, 3);
+    passed &= testTexture(8, 4);
+    return passed ? 0 : -1;
+}